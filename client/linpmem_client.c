@@ -0,0 +1,512 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "../userspace_interface/linpmem_shared.h"
+#include "linpmem_client.h"
+
+#define CLIENT_PAGE_SHIFT (12)
+#define CLIENT_PAGE_SIZE (1ULL << CLIENT_PAGE_SHIFT)
+
+#define DEFAULT_DEVICE "/dev/" LINPMEM_DEVICE_NAME
+#define DEFAULT_CACHE_PAGES (4096)
+#define DEFAULT_READAHEAD_PAGES (64)
+#define DEFAULT_TLB_ENTRIES (4096)
+
+// End of a slot list.
+#define NIL (UINT32_MAX)
+
+/* A page of the page cache. Unused slots are on the free list (lru_next). */
+struct CACHE_SLOT {
+    uint64_t pfn;
+    uint32_t hash_next;
+    uint32_t lru_prev;
+    uint32_t lru_next;
+};
+
+/* A cached translation, virt_page is stored + 1 so that zero marks an empty
+ * entry.
+ */
+struct TLB_ENTRY {
+    uint64_t cr3;
+    uint64_t virt_page_1;
+    uint64_t phys_page;
+};
+
+struct LINPMEM_CLIENT {
+    int dev;
+    LINPMEM_CLIENT_CONFIG config;
+
+    // The page cache: slots[i] caches pages + i * CLIENT_PAGE_SIZE.
+    struct CACHE_SLOT *slots;
+    uint8_t *pages;
+    uint32_t *buckets;
+    uint32_t bucket_mask;
+    // Most recently used first.
+    uint32_t lru_head;
+    uint32_t lru_tail;
+    uint32_t free_head;
+
+    // Read ahead: where a sequential reader misses next, and how far to
+    // read then.
+    uint8_t *staging;
+    uint64_t next_pfn;
+    uint32_t window;
+
+    struct TLB_ENTRY *tlb;
+    uint32_t tlb_mask;
+
+    LINPMEM_CLIENT_STATS stats;
+};
+
+static uint32_t round_up_pow2(uint32_t value)
+{
+    uint32_t pow2 = 1;
+
+    while (pow2 < value)
+        pow2 <<= 1;
+
+    return pow2;
+}
+
+static uint64_t hash64(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+
+    return value;
+}
+
+PLINPMEM_CLIENT linpmem_client_open(const char *device,
+                                    const LINPMEM_CLIENT_CONFIG *config)
+{
+    PLINPMEM_CLIENT client;
+    int err;
+
+    client = calloc(1, sizeof(*client));
+    if (!client)
+        return NULL;
+
+    if (config)
+        client->config = *config;
+    if (!client->config.cache_pages)
+        client->config.cache_pages = DEFAULT_CACHE_PAGES;
+    if (!client->config.readahead_pages)
+        client->config.readahead_pages = DEFAULT_READAHEAD_PAGES;
+    if (!client->config.tlb_entries)
+        client->config.tlb_entries = DEFAULT_TLB_ENTRIES;
+
+    // Read ahead must not evict what it just read.
+    if (client->config.readahead_pages > client->config.cache_pages / 2)
+        client->config.readahead_pages = client->config.cache_pages / 2;
+    if (!client->config.readahead_pages)
+        client->config.readahead_pages = 1;
+    if (client->config.readahead_pages >
+        LINPMEM_MAX_TRANSFER_SIZE / CLIENT_PAGE_SIZE)
+        client->config.readahead_pages =
+            LINPMEM_MAX_TRANSFER_SIZE / CLIENT_PAGE_SIZE;
+
+    client->config.tlb_entries = round_up_pow2(client->config.tlb_entries);
+    client->tlb_mask = client->config.tlb_entries - 1;
+    client->bucket_mask = round_up_pow2(client->config.cache_pages * 2) - 1;
+
+    client->slots =
+        calloc(client->config.cache_pages, sizeof(struct CACHE_SLOT));
+    client->buckets = malloc((client->bucket_mask + 1) * sizeof(uint32_t));
+    client->tlb = calloc(client->config.tlb_entries, sizeof(struct TLB_ENTRY));
+    client->pages = malloc((size_t)client->config.cache_pages *
+                           CLIENT_PAGE_SIZE);
+    client->staging = malloc((size_t)client->config.readahead_pages *
+                             CLIENT_PAGE_SIZE);
+    if (!client->slots || !client->buckets || !client->tlb ||
+        !client->pages || !client->staging) {
+        err = ENOMEM;
+        goto error;
+    }
+
+    client->dev = open(device ? device : DEFAULT_DEVICE, O_RDONLY);
+    if (client->dev < 0) {
+        err = errno;
+        goto error;
+    }
+
+    linpmem_client_invalidate_phys(client, 0, 0);
+
+    return client;
+
+error:
+    free(client->slots);
+    free(client->buckets);
+    free(client->tlb);
+    free(client->pages);
+    free(client->staging);
+    free(client);
+    errno = err;
+
+    return NULL;
+}
+
+void linpmem_client_close(PLINPMEM_CLIENT client)
+{
+    if (!client)
+        return;
+
+    close(client->dev);
+    free(client->slots);
+    free(client->buckets);
+    free(client->tlb);
+    free(client->pages);
+    free(client->staging);
+    free(client);
+}
+
+int linpmem_client_fd(PLINPMEM_CLIENT client)
+{
+    return client->dev;
+}
+
+void linpmem_client_get_stats(PLINPMEM_CLIENT client,
+                              PLINPMEM_CLIENT_STATS stats)
+{
+    *stats = client->stats;
+}
+
+/* driver_read - one IOCTL_LINPMEM_READ_PHYSADDR buffer read
+ * @flags: LINPMEM_TRANSFER_* flags
+ *
+ * Returns number of bytes read, or negative errno
+ */
+static int64_t driver_read(PLINPMEM_CLIENT client, uint64_t phys_address,
+                           void *buf, uint64_t size, uint8_t flags)
+{
+    LINPMEM_DATA_TRANSFER data_transfer = { 0 };
+
+    data_transfer.phys_address = phys_address;
+    data_transfer.access_type = PHYS_BUFFER_READ;
+    data_transfer.readbuffer = buf;
+    data_transfer.readbuffer_size = size;
+    data_transfer.flags = flags;
+
+    client->stats.driver_reads++;
+
+    if (ioctl(client->dev, IOCTL_LINPMEM_READ_PHYSADDR, &data_transfer))
+        return -errno;
+
+    return data_transfer.readbuffer_size;
+}
+
+static inline uint8_t *slot_page(PLINPMEM_CLIENT client, uint32_t slot)
+{
+    return client->pages + (size_t)slot * CLIENT_PAGE_SIZE;
+}
+
+static inline uint32_t *cache_bucket(PLINPMEM_CLIENT client, uint64_t pfn)
+{
+    return &client->buckets[hash64(pfn) & client->bucket_mask];
+}
+
+static void lru_unlink(PLINPMEM_CLIENT client, uint32_t slot)
+{
+    struct CACHE_SLOT *entry = &client->slots[slot];
+
+    if (entry->lru_prev != NIL)
+        client->slots[entry->lru_prev].lru_next = entry->lru_next;
+    else
+        client->lru_head = entry->lru_next;
+
+    if (entry->lru_next != NIL)
+        client->slots[entry->lru_next].lru_prev = entry->lru_prev;
+    else
+        client->lru_tail = entry->lru_prev;
+}
+
+static void lru_push_front(PLINPMEM_CLIENT client, uint32_t slot)
+{
+    struct CACHE_SLOT *entry = &client->slots[slot];
+
+    entry->lru_prev = NIL;
+    entry->lru_next = client->lru_head;
+    if (client->lru_head != NIL)
+        client->slots[client->lru_head].lru_prev = slot;
+    else
+        client->lru_tail = slot;
+    client->lru_head = slot;
+}
+
+static uint32_t cache_find(PLINPMEM_CLIENT client, uint64_t pfn)
+{
+    uint32_t slot = *cache_bucket(client, pfn);
+
+    while (slot != NIL && client->slots[slot].pfn != pfn)
+        slot = client->slots[slot].hash_next;
+
+    return slot;
+}
+
+static void cache_remove(PLINPMEM_CLIENT client, uint32_t slot)
+{
+    uint32_t *link = cache_bucket(client, client->slots[slot].pfn);
+
+    while (*link != slot)
+        link = &client->slots[*link].hash_next;
+    *link = client->slots[slot].hash_next;
+
+    lru_unlink(client, slot);
+
+    client->slots[slot].lru_next = client->free_head;
+    client->free_head = slot;
+}
+
+/* cache_insert - put a page into the cache, as most recently used
+ *
+ * Returns the slot
+ */
+static uint32_t cache_insert(PLINPMEM_CLIENT client, uint64_t pfn,
+                             const void *page)
+{
+    uint32_t *bucket;
+    uint32_t slot;
+
+    slot = cache_find(client, pfn);
+    if (slot != NIL) {
+        lru_unlink(client, slot);
+    } else {
+        if (client->free_head == NIL) {
+            cache_remove(client, client->lru_tail);
+            client->stats.evictions++;
+        }
+
+        slot = client->free_head;
+        client->free_head = client->slots[slot].lru_next;
+
+        bucket = cache_bucket(client, pfn);
+        client->slots[slot].pfn = pfn;
+        client->slots[slot].hash_next = *bucket;
+        *bucket = slot;
+    }
+
+    memcpy(slot_page(client, slot), page, CLIENT_PAGE_SIZE);
+    lru_push_front(client, slot);
+
+    return slot;
+}
+
+/* cache_fill - read a missing page, and maybe the pages after it
+ * @pfn: the page
+ *
+ * A miss right where the last fill ended is a sequential reader: the read
+ * ahead doubles, up to readahead_pages. Any other miss starts over with one
+ * page. The driver stops early at the first page it can not read.
+ *
+ * Returns the slot of pfn, or NIL if the driver can not read pfn through the
+ * rogue page (not RAM, or not readable)
+ */
+static uint32_t cache_fill(PLINPMEM_CLIENT client, uint64_t pfn)
+{
+    uint64_t pages;
+    int64_t bytes_read;
+    uint32_t slot = NIL;
+    uint64_t i;
+
+    if (pfn == client->next_pfn && client->window)
+        client->window = client->window * 2 < client->config.readahead_pages
+                             ? client->window * 2
+                             : client->config.readahead_pages;
+    else
+        client->window = 1;
+
+    bytes_read = driver_read(client, pfn << CLIENT_PAGE_SHIFT, client->staging,
+                             client->window * CLIENT_PAGE_SIZE,
+                             LINPMEM_TRANSFER_IGNORE_PAGE_BOUNDARY);
+    pages = bytes_read > 0 ? bytes_read / CLIENT_PAGE_SIZE : 0;
+    if (!pages) {
+        client->window = 0;
+        return NIL;
+    }
+
+    client->next_pfn = pfn + pages;
+    client->stats.readahead_pages += pages - 1;
+
+    // Backwards, so that pfn ends up most recently used.
+    for (i = pages; i-- > 0;)
+        slot = cache_insert(client, pfn + i,
+                            client->staging + i * CLIENT_PAGE_SIZE);
+
+    return slot;
+}
+
+int linpmem_client_read_phys(PLINPMEM_CLIENT client, uint64_t phys_address,
+                             void *buf, size_t size)
+{
+    uint8_t *out = buf;
+    uint64_t offset;
+    uint64_t chunk;
+    int64_t bytes_read;
+    uint64_t pfn;
+    uint32_t slot;
+
+    while (size) {
+        pfn = phys_address >> CLIENT_PAGE_SHIFT;
+        offset = phys_address & (CLIENT_PAGE_SIZE - 1);
+        chunk = CLIENT_PAGE_SIZE - offset;
+        if (chunk > size)
+            chunk = size;
+
+        slot = cache_find(client, pfn);
+        if (slot != NIL) {
+            client->stats.page_hits++;
+            lru_unlink(client, slot);
+            lru_push_front(client, slot);
+        } else {
+            client->stats.page_misses++;
+            slot = cache_fill(client, pfn);
+        }
+
+        if (slot != NIL) {
+            memcpy(out, slot_page(client, slot) + offset, chunk);
+        } else {
+            // Not for the cache: straight from the driver, every time.
+            client->stats.uncached_reads++;
+            bytes_read = driver_read(client, phys_address, out, chunk, 0);
+            if (bytes_read < 0)
+                return bytes_read;
+            if ((uint64_t)bytes_read != chunk)
+                return -EIO;
+        }
+
+        phys_address += chunk;
+        out += chunk;
+        size -= chunk;
+    }
+
+    return 0;
+}
+
+int linpmem_client_read_qword(PLINPMEM_CLIENT client, uint64_t phys_address,
+                              uint64_t *value)
+{
+    return linpmem_client_read_phys(client, phys_address, value,
+                                    sizeof(*value));
+}
+
+static inline struct TLB_ENTRY *tlb_entry(PLINPMEM_CLIENT client, uint64_t cr3,
+                                          uint64_t virt_page)
+{
+    return &client->tlb[hash64(cr3 ^ hash64(virt_page)) & client->tlb_mask];
+}
+
+int linpmem_client_vtop(PLINPMEM_CLIENT client, uint64_t cr3,
+                        uint64_t virt_address, uint64_t *phys_address)
+{
+    LINPMEM_VTOP_INFO vtop_info = { 0 };
+    uint64_t virt_page = virt_address >> CLIENT_PAGE_SHIFT;
+    uint64_t offset = virt_address & (CLIENT_PAGE_SIZE - 1);
+    struct TLB_ENTRY *entry = tlb_entry(client, cr3, virt_page);
+
+    if (entry->virt_page_1 == virt_page + 1 && entry->cr3 == cr3) {
+        client->stats.vtop_hits++;
+        *phys_address = (entry->phys_page << CLIENT_PAGE_SHIFT) + offset;
+        return 0;
+    }
+
+    client->stats.vtop_misses++;
+
+    vtop_info.virt_address = virt_address;
+    vtop_info.associated_cr3 = cr3;
+
+    if (ioctl(client->dev, IOCTL_LINPMEM_VTOP_TRANSLATION_SERVICE, &vtop_info))
+        return -errno;
+
+    // Not present.
+    if (!vtop_info.phys_address)
+        return -ENOENT;
+
+    entry->cr3 = cr3;
+    entry->virt_page_1 = virt_page + 1;
+    entry->phys_page = vtop_info.phys_address >> CLIENT_PAGE_SHIFT;
+
+    *phys_address = vtop_info.phys_address;
+
+    return 0;
+}
+
+int linpmem_client_read_virt(PLINPMEM_CLIENT client, uint64_t cr3,
+                             uint64_t virt_address, void *buf, size_t size)
+{
+    uint8_t *out = buf;
+    uint64_t phys_address;
+    uint64_t chunk;
+    int ret;
+
+    while (size) {
+        chunk = CLIENT_PAGE_SIZE - (virt_address & (CLIENT_PAGE_SIZE - 1));
+        if (chunk > size)
+            chunk = size;
+
+        ret = linpmem_client_vtop(client, cr3, virt_address, &phys_address);
+        if (ret)
+            return ret;
+
+        ret = linpmem_client_read_phys(client, phys_address, out, chunk);
+        if (ret)
+            return ret;
+
+        virt_address += chunk;
+        out += chunk;
+        size -= chunk;
+    }
+
+    return 0;
+}
+
+void linpmem_client_invalidate_phys(PLINPMEM_CLIENT client,
+                                    uint64_t phys_address, uint64_t size)
+{
+    uint64_t first = phys_address >> CLIENT_PAGE_SHIFT;
+    uint64_t last;
+    uint32_t slot;
+    uint32_t next;
+    uint32_t i;
+
+    if (!size) {
+        memset(client->buckets, 0xff,
+               (client->bucket_mask + 1) * sizeof(uint32_t));
+        client->lru_head = NIL;
+        client->lru_tail = NIL;
+        client->free_head = NIL;
+        for (i = client->config.cache_pages; i-- > 0;) {
+            client->slots[i].lru_next = client->free_head;
+            client->free_head = i;
+        }
+        client->window = 0;
+        return;
+    }
+
+    last = (phys_address + size - 1) >> CLIENT_PAGE_SHIFT;
+
+    for (slot = client->lru_head; slot != NIL; slot = next) {
+        next = client->slots[slot].lru_next;
+        if (client->slots[slot].pfn >= first &&
+            client->slots[slot].pfn <= last)
+            cache_remove(client, slot);
+    }
+}
+
+void linpmem_client_invalidate_cr3(PLINPMEM_CLIENT client, uint64_t cr3)
+{
+    uint32_t i;
+
+    for (i = 0; i <= client->tlb_mask; i++) {
+        if (cr3 == LINPMEM_CLIENT_ALL_CR3 || client->tlb[i].cr3 == cr3)
+            client->tlb[i].virt_page_1 = 0;
+    }
+}
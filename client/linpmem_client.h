@@ -0,0 +1,116 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _LINPMEM_CLIENT_H_
+#define _LINPMEM_CLIENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ### linpmem_client: cached access to the driver, for analysis tools.
+//
+// Tools that walk kernel structures make many small, overlapping reads.
+// The client keeps the physical pages it read in an LRU cache, and reads
+// ahead in batches (LINPMEM_TRANSFER_IGNORE_PAGE_BOUNDARY) when it sees
+// sequential misses. Translations are cached per CR3.
+//
+// Memory is not frozen while it is cached: invalidate what you expect to
+// have changed, or everything, between passes. Memory that is not RAM (no
+// struct page in the kernel, e.g., MMIO) is never cached, reads of it always
+// go to the driver.
+//
+// A client is not thread safe, use one per thread.
+
+typedef struct LINPMEM_CLIENT LINPMEM_CLIENT, *PLINPMEM_CLIENT;
+
+/* Sizes of the caches, zero for the default. */
+typedef struct {
+    // Pages in the page cache.
+    uint32_t cache_pages;
+    // Largest read ahead, in pages.
+    uint32_t readahead_pages;
+    // Translations in the translation cache (all CR3s together).
+    uint32_t tlb_entries;
+} LINPMEM_CLIENT_CONFIG, *PLINPMEM_CLIENT_CONFIG;
+
+typedef struct {
+    // Pages found in, or read into, the page cache.
+    uint64_t page_hits;
+    uint64_t page_misses;
+    // Pages read ahead, before anyone asked for them.
+    uint64_t readahead_pages;
+    // Pages dropped to make room.
+    uint64_t evictions;
+    // Reads that bypassed the cache (not RAM).
+    uint64_t uncached_reads;
+    // IOCTL_LINPMEM_READ_PHYSADDR calls.
+    uint64_t driver_reads;
+    // Translations found in the translation cache, or asked from the driver.
+    uint64_t vtop_hits;
+    uint64_t vtop_misses;
+} LINPMEM_CLIENT_STATS, *PLINPMEM_CLIENT_STATS;
+
+/* linpmem_client_open - open the driver
+ * @device: the device, NULL for /dev/linpmem
+ * @config: cache sizes, NULL for the defaults
+ *
+ * Returns the client, or NULL with errno set
+ */
+PLINPMEM_CLIENT linpmem_client_open(const char *device,
+                                    const LINPMEM_CLIENT_CONFIG *config);
+
+void linpmem_client_close(PLINPMEM_CLIENT client);
+
+/* linpmem_client_read_phys - read physical memory, through the page cache
+ * @phys_address: where to read, may cross pages
+ * @buf: the buffer
+ * @size: bytes to read
+ *
+ * Returns 0, or -EIO if a page is not readable (the rest of buf is then
+ * undefined), or negative errno
+ */
+int linpmem_client_read_phys(PLINPMEM_CLIENT client, uint64_t phys_address,
+                             void *buf, size_t size);
+
+int linpmem_client_read_qword(PLINPMEM_CLIENT client, uint64_t phys_address,
+                              uint64_t *value);
+
+/* linpmem_client_vtop - translate a virtual address
+ * @cr3: the address space, zero for the driver's default (the caller, or
+ *	 the session binding of the device)
+ * @virt_address: the virtual address
+ * @phys_address: out, the physical address
+ *
+ * Returns 0, -ENOENT if the page is not present, or negative errno
+ */
+int linpmem_client_vtop(PLINPMEM_CLIENT client, uint64_t cr3,
+                        uint64_t virt_address, uint64_t *phys_address);
+
+/* linpmem_client_read_virt - read virtual memory, through both caches
+ *
+ * Returns 0, -ENOENT if a page is not present, or negative errno
+ */
+int linpmem_client_read_virt(PLINPMEM_CLIENT client, uint64_t cr3,
+                             uint64_t virt_address, void *buf, size_t size);
+
+/* linpmem_client_invalidate_phys - forget cached pages
+ * @phys_address, @size: the range, size zero for all of memory
+ */
+void linpmem_client_invalidate_phys(PLINPMEM_CLIENT client,
+                                    uint64_t phys_address, uint64_t size);
+
+/* linpmem_client_invalidate_cr3 - forget cached translations
+ * @cr3: the address space, or LINPMEM_CLIENT_ALL_CR3
+ */
+#define LINPMEM_CLIENT_ALL_CR3 (~0ULL)
+
+void linpmem_client_invalidate_cr3(PLINPMEM_CLIENT client, uint64_t cr3);
+
+void linpmem_client_get_stats(PLINPMEM_CLIENT client,
+                              PLINPMEM_CLIENT_STATS stats);
+
+/* The file descriptor of the driver, for ioctls the client does not wrap. */
+int linpmem_client_fd(PLINPMEM_CLIENT client);
+
+#endif
@@ -5,9 +5,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <elf.h>
 
 #include <linux/types.h>
 
@@ -21,7 +26,27 @@
 // * reading from a physical address
 //      * qword read
 //      * buffer read
+//      * buffer read across page boundaries
 // * using the VTOP translation service
+// * bulk reading through the page ring
+// * per NUMA node ring statistics
+// * searching physical memory for patterns inside the driver
+// * VA -> PA runs of a whole process
+// * all processes with their CR3 in one call
+// * VA -> PA runs of all processes, walked in parallel
+// * following a linked list inside the driver
+// * kernel layout (KASLR) query
+// * who owns a physical page
+// * reading into a registered buffer
+// * which page frames are readable (PFN map)
+// * which page frames are free (buddy allocator)
+// * digests of physical memory, compared inside the driver
+// * reading physical memory compressed (LZ4)
+// * ioremap window statistics (reading memory that is not RAM)
+// * binding the file descriptor to a process (sessions)
+// * watching physical memory for changes (eventfd)
+// * pages of a process written since the last time (soft-dirty)
+// * the ELF core view (/dev/linpmem_core, not an ioctl)
 //
 // All tests are void functions and already inserted in main().
 // Recommended: only try one at a time.
@@ -121,6 +146,35 @@ void do_physread_test_bufferread(int dev)
 
 }
 
+// Buffer read of the first megabyte of physical memory, ignoring page boundaries.
+void do_physread_test_contiguous(int dev)
+{
+    LINPMEM_DATA_TRANSFER dataTransfer = {0};
+
+    dataTransfer.phys_address = 0;
+    dataTransfer.access_type = PHYS_BUFFER_READ;
+    dataTransfer.flags = LINPMEM_TRANSFER_IGNORE_PAGE_BOUNDARY;
+    dataTransfer.readbuffer = malloc(0x100000);
+    if (!dataTransfer.readbuffer)
+    {
+        printf("Malloc didn't not allocate buffer.\n");
+        return;
+    }
+    dataTransfer.readbuffer_size = 0x100000;
+
+    if (ioctl(dev, IOCTL_LINPMEM_READ_PHYSADDR, &dataTransfer))
+    {
+        printf("The contiguous buffer read has failed!\n");
+    }
+    else
+    {
+        // Less than requested if some page on the way was not readable.
+        printf("Read 0x%llx bytes in one go.\n", dataTransfer.readbuffer_size);
+    }
+
+    free(dataTransfer.readbuffer);
+}
+
 void do_vtop_query(int dev)
 {
     unsigned char * hello = "Hello World!\n";
@@ -195,12 +249,859 @@ void do_vtop_query_with_proof_read(int dev)
 
 }
 
+// ### Page ring: read pages in place, one syscall per batch.
+// Reads the page of our hello world string through a tiny ring of 4 slots.
+void do_ring_test(int dev)
+{
+    unsigned char * hello = "Hello World!\n";
+    LINPMEM_VTOP_INFO vtop_info = {0};
+    LINPMEM_RING_SETUP ring_setup = {0};
+    LINPMEM_RING_SUBMIT ring_submit = {0};
+    PLINPMEM_RING_HEADER header = NULL;
+    PLINPMEM_RING_DESC desc = NULL;
+    unsigned char * mapping = NULL;
+    unsigned char * slot = NULL;
+
+    vtop_info.virt_address = (uint64_t) hello;
+
+    ioctl(dev, IOCTL_LINPMEM_VTOP_TRANSLATION_SERVICE, &vtop_info);
+
+    if (!vtop_info.phys_address)
+    {
+        printf("vtop failed.\n");
+        return;
+    }
+
+    ring_setup.slot_count = 4;
+
+    if (ioctl(dev, IOCTL_LINPMEM_RING_SETUP, &ring_setup))
+    {
+        printf("Ring setup failed.\n");
+        return;
+    }
+
+    mapping = mmap(NULL, ring_setup.mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, dev, 0);
+    if (mapping == MAP_FAILED)
+    {
+        printf("Mapping the ring failed.\n");
+        return;
+    }
+
+    header = (PLINPMEM_RING_HEADER) mapping;
+    desc = (PLINPMEM_RING_DESC) (header + 1); // <= first descriptor, belongs to slot 0.
+
+    desc->phys_address = vtop_info.phys_address;
+    __atomic_store_n(&desc->state, LINPMEM_SLOT_SUBMITTED, __ATOMIC_RELEASE);
+
+    // Just one page here, but this is the same single call for thousands.
+    ring_submit.flags = LINPMEM_RING_SUBMIT_WAIT;
+    ioctl(dev, IOCTL_LINPMEM_RING_SUBMIT, &ring_submit);
+
+    if (__atomic_load_n(&desc->state, __ATOMIC_ACQUIRE) == LINPMEM_SLOT_DONE)
+    {
+        // The slot holds the whole page. Our string is at its page offset.
+        slot = mapping + header->slots_offset;
+        printf("Ring slot 0 says: %s", slot + (vtop_info.phys_address & 0xfff));
+    }
+    else
+    {
+        printf("The ring read has failed!\n");
+    }
+
+    desc->state = LINPMEM_SLOT_FREE;
+
+    munmap(mapping, ring_setup.mmap_size);
+}
+
+// ### Per NUMA node throughput of the ring workers.
+// Only NUMA-local rings (LINPMEM_RING_NUMA_LOCAL) are counted here.
+void do_numa_stats_test(int dev)
+{
+    LINPMEM_NUMA_STATS numa_stats = {0};
+    uint32_t i = 0;
+
+    if (ioctl(dev, IOCTL_LINPMEM_QUERY_NUMA_STATS, &numa_stats))
+    {
+        printf("NUMA stats query failed.\n");
+        return;
+    }
+
+    for (i=0;i<numa_stats.node_count;i++)
+    {
+        if (!numa_stats.nodes[i].online) continue;
+
+        printf("Node %u: %llu pages, %llu failed, %llu MB/s\n",
+                numa_stats.nodes[i].node,
+                numa_stats.nodes[i].pages_read,
+                numa_stats.nodes[i].pages_failed,
+                numa_stats.nodes[i].busy_ns ?
+                    numa_stats.nodes[i].bytes_read * 1000 / numa_stats.nodes[i].busy_ns : 0);
+    }
+}
+
+
+// ### Search the BIOS area (below 1 MiB) for the SMBIOS and ACPI anchors.
+void do_scan_test(int dev)
+{
+    LINPMEM_SCAN scan = {0};
+    LINPMEM_SCAN_RANGE range = {0};
+    LINPMEM_SCAN_MATCH matches[16] = {0};
+    const char patterns[] = "_SM_" "_SM3_" "RSD PTR ";
+    uint32_t pattern_sizes[] = {4, 5, 8};
+    uint32_t i = 0;
+
+    range.start = 0;
+    range.size = 0x100000;
+
+    scan.patterns = (const uint8_t *)patterns;
+    scan.pattern_sizes = pattern_sizes;
+    scan.pattern_count = 3;
+    scan.ranges = &range;
+    scan.range_count = 1;
+    scan.matches = matches;
+    scan.max_matches = 16;
+
+    if (ioctl(dev, IOCTL_LINPMEM_SCAN, &scan))
+    {
+        printf("Scan failed.\n");
+        return;
+    }
+
+    printf("Scanned %llu bytes (%llu pages skipped), %u matches.\n",
+            scan.bytes_scanned, scan.pages_skipped, scan.match_count);
+
+    for (i=0;i<scan.match_count;i++)
+    {
+        printf("Pattern %u at %llx\n", matches[i].pattern_index, matches[i].phys_address);
+    }
+}
+
+
+// ### All present pages of our own process, as virtually and physically contiguous runs.
+void do_process_runs_test(int dev)
+{
+    LINPMEM_PROCESS_RUNS process_runs = {0};
+    static LINPMEM_VIRT_RUN runs[4096];
+    uint32_t i = 0;
+
+    process_runs.target_process = 0; // that's us.
+    process_runs.virt_end = 0xffffffffffffffff;
+    process_runs.runs = runs;
+    process_runs.max_runs = 4096;
+
+    if (ioctl(dev, IOCTL_LINPMEM_QUERY_PROCESS_RUNS, &process_runs))
+    {
+        printf("Process runs query failed.\n");
+        return;
+    }
+
+    printf("CR3 %llx: %llu pages mapped in %u runs%s.\n",
+            process_runs.result_cr3, process_runs.mapped_pages, process_runs.run_count,
+            process_runs.resume_address ? " (and more)" : "");
+
+    for (i=0;i<process_runs.run_count && i<10;i++)
+    {
+        printf("VA %llx -> PA %llx, %llx bytes\n",
+                runs[i].virt_address, runs[i].phys_address, runs[i].size);
+    }
+}
+
+
+// ### Clear our soft-dirty bits, write one page, and see what is dirty now.
+void do_dirty_runs_test(int dev)
+{
+    LINPMEM_DIRTY_RUNS dirty_runs = {0};
+    static LINPMEM_VIRT_RUN runs[4096];
+    static volatile char page[0x1000] __attribute__((aligned(0x1000)));
+    int i = 0;
+
+    for (i=0;i<2;i++)
+    {
+        page[0] = i; // dirty it (again).
+
+        dirty_runs.runs.target_process = 0; // that's us.
+        dirty_runs.runs.virt_start = 0;
+        dirty_runs.runs.virt_end = 0xffffffffffffffff;
+        dirty_runs.runs.runs = runs;
+        dirty_runs.runs.max_runs = 4096;
+        dirty_runs.flags = LINPMEM_DIRTY_CLEAR;
+
+        if (ioctl(dev, IOCTL_LINPMEM_QUERY_DIRTY_RUNS, &dirty_runs))
+        {
+            printf("Dirty runs query failed (kernel without soft-dirty?).\n");
+            return;
+        }
+
+        // The first time, that is everything. The second, our page, the stack, ...
+        printf("Round %d (page[0] = %d): %llu dirty pages in %u runs.\n", i,
+                page[0], dirty_runs.runs.mapped_pages,
+                dirty_runs.runs.run_count);
+    }
+}
+
+
+// ### List all processes and their CR3.
+void do_processes_test(int dev)
+{
+    LINPMEM_PROCESSES processes = {0};
+    static LINPMEM_PROCESS_INFO infos[4096];
+    uint32_t i = 0;
+
+    processes.processes = infos;
+    processes.max_processes = 4096;
+
+    if (ioctl(dev, IOCTL_LINPMEM_QUERY_PROCESSES, &processes))
+    {
+        printf("Process query failed.\n");
+        return;
+    }
+
+    printf("%u processes (%u returned).\n", processes.total_count, processes.process_count);
+
+    for (i=0;i<processes.process_count;i++)
+    {
+        if (infos[i].flags & LINPMEM_PROCESS_KERNEL_THREAD) continue;
+
+        printf("%6u %-16s CR3 %llx\n", infos[i].pid, infos[i].comm, infos[i].cr3);
+    }
+}
+
+
+// ### The VA -> PA runs of all processes in one call, walked by kernel workers in parallel.
+void do_process_maps_test(int dev)
+{
+    LINPMEM_PROCESS_MAPS process_maps = {0};
+    PLINPMEM_PROCESS_MAP map = NULL;
+    uint64_t total_pages = 0;
+    uint32_t total_processes = 0;
+    uint32_t i = 0;
+
+    process_maps.buffer_size = 64 * 1024 * 1024;
+    process_maps.buffer = malloc(process_maps.buffer_size);
+    if (!process_maps.buffer)
+    {
+        printf("Malloc didn't not allocate buffer.\n");
+        return;
+    }
+
+    do
+    {
+        if (ioctl(dev, IOCTL_LINPMEM_QUERY_PROCESS_MAPS, &process_maps))
+        {
+            printf("Process maps query failed.\n");
+            free(process_maps.buffer);
+            return;
+        }
+
+        map = process_maps.buffer;
+        for (i=0;i<process_maps.process_count;i++)
+        {
+            if (total_processes + i < 5)
+            {
+                printf("pid %u, CR3 %llx: %llu pages in %u runs%s.\n", map->pid, map->cr3,
+                        map->mapped_pages, map->run_count,
+                        map->flags & LINPMEM_PROCESS_MAP_TRUNCATED ? " (and more)" : "");
+            }
+            total_pages += map->mapped_pages;
+            map = LINPMEM_NEXT_PROCESS_MAP(map);
+        }
+
+        total_processes += process_maps.process_count;
+        process_maps.start_pid = process_maps.resume_pid;
+    } while (process_maps.resume_pid);
+
+    printf("%u processes, %llu pages mapped, %u workers.\n", total_processes, total_pages,
+            process_maps.workers);
+
+    free(process_maps.buffer);
+}
+
+
+// ### Following a linked list inside the driver.
+// Our own list, so we know what should come back. For a kernel list, take the
+// offsets from the kernel's debug info, and set end_address to the list head.
+typedef struct _DEMO_NODE
+{
+    uint64_t magic;
+    struct _DEMO_NODE *next;
+    uint32_t index;
+    char padding[100];
+} DEMO_NODE;
+
+void do_list_walk_test(int dev)
+{
+    LINPMEM_LIST_WALK walk = {0};
+    DEMO_NODE *nodes[8] = {0};
+    uint8_t buffer[8 * 20];
+    uint8_t *entry = NULL;
+    uint32_t i = 0;
+
+    for (i=0;i<8;i++)
+    {
+        nodes[i] = calloc(1, sizeof(DEMO_NODE)); // <= scattered over the heap, each page present.
+        if (!nodes[i])
+        {
+            printf("Calloc didn't not allocate a node.\n");
+            goto out;
+        }
+        nodes[i]->magic = 0x4c494e504d454d00 + i;
+        nodes[i]->index = i;
+    }
+    for (i=0;i<7;i++)
+    {
+        nodes[i]->next = nodes[i + 1];
+    }
+
+    walk.start_address = (uint64_t)nodes[0];
+    walk.associated_cr3 = 0; // <= our own.
+    walk.record_size = sizeof(DEMO_NODE);
+    walk.next_offset = offsetof(DEMO_NODE, next);
+    walk.next_bias = 0; // <= next points at the node itself, not into it.
+    walk.max_count = 100;
+    walk.field_count = 2;
+    walk.fields[0].offset = offsetof(DEMO_NODE, magic);
+    walk.fields[0].size = sizeof(uint64_t);
+    walk.fields[1].offset = offsetof(DEMO_NODE, index);
+    walk.fields[1].size = sizeof(uint32_t);
+    walk.buffer = buffer;
+    walk.buffer_size = sizeof(buffer);
+
+    if (ioctl(dev, IOCTL_LINPMEM_WALK_LIST, &walk))
+    {
+        printf("List walk failed.\n");
+        goto out;
+    }
+
+    printf("%u records, %llu bytes, stop reason %u.\n", walk.record_count,
+            walk.used_size, walk.stop_reason);
+
+    // Each entry: the address, then the fields. 8 + 8 + 4 bytes, unaligned.
+    entry = buffer;
+    for (i=0;i<walk.record_count;i++)
+    {
+        printf("node at %llx: magic %llx, index %u.\n", *(uint64_t *)entry,
+                *(uint64_t *)(entry + 8), *(uint32_t *)(entry + 16));
+        entry += 20;
+    }
+
+out:
+    for (i=0;i<8;i++)
+    {
+        free(nodes[i]);
+    }
+}
+
+
+// ### Where the kernel is.
+void do_kernel_layout_test(int dev)
+{
+    LINPMEM_KERNEL_LAYOUT layout = {0};
+
+    if (ioctl(dev, IOCTL_LINPMEM_QUERY_KERNEL_LAYOUT, &layout))
+    {
+        printf("Kernel layout query failed.\n");
+        return;
+    }
+
+    printf("Kernel %s, %u-level paging\n", layout.uts_release, layout.paging_levels);
+    printf("page_offset_base: %llx\n", layout.page_offset_base);
+    printf("vmalloc_base:     %llx\n", layout.vmalloc_base);
+    printf("vmemmap_base:     %llx\n", layout.vmemmap_base);
+    printf("phys_base:        %llx\n", layout.phys_base);
+
+    if (!(layout.flags & LINPMEM_LAYOUT_SYMBOLS))
+    {
+        printf("No kernel symbols available.\n");
+        return;
+    }
+
+    printf("_text:            %llx (physical %llx)\n", layout.text_start, layout.text_start_phys);
+    printf("KASLR offset:     %llx\n", layout.kaslr_offset);
+    printf("kernel CR3:       %llx\n", layout.kernel_cr3);
+}
+
+
+// ### Who owns the physical page of our hello world string (it's in our binary: page cache).
+void do_page_owners_test(int dev)
+{
+    unsigned char * hello = "Hello World!\n";
+    LINPMEM_VTOP_INFO vtop_info = {0};
+    LINPMEM_PAGE_OWNERS page_owners = {0};
+    LINPMEM_PAGE_OWNER owner = {0};
+
+    vtop_info.virt_address = (uint64_t) hello;
+
+    if (ioctl(dev, IOCTL_LINPMEM_VTOP_TRANSLATION_SERVICE, &vtop_info) || !vtop_info.phys_address)
+    {
+        printf("Translation of hello buffer failed.\n");
+        return;
+    }
+
+    owner.pfn = vtop_info.phys_address >> 12;
+
+    page_owners.owners = &owner;
+    page_owners.count = 1;
+
+    if (ioctl(dev, IOCTL_LINPMEM_QUERY_PAGE_OWNERS, &page_owners))
+    {
+        printf("Page owner query failed.\n");
+        return;
+    }
+
+    printf("PFN %llx: type %u, mapped %u times\n", owner.pfn, owner.type, owner.map_count);
+
+    if (owner.type == LINPMEM_OWNER_FILE)
+    {
+        printf("File '%s' (inode %llu), offset %llx\n", owner.path, owner.inode, owner.file_offset);
+    }
+
+    if (owner.flags & LINPMEM_OWNER_PROCESS_FOUND)
+    {
+        printf("Mapped by %u (%s) at %llx\n", owner.pid, owner.comm, owner.virt_address);
+    }
+}
+
+
+// ### Register a buffer once, then read into it by handle and offset.
+void do_registered_buffer_test(int dev)
+{
+    LINPMEM_REGISTER_BUFFER register_buffer = {0};
+    LINPMEM_READ_REGISTERED read_registered = {0};
+    uint64_t offset = 0;
+
+    register_buffer.size = 0x100000;
+    register_buffer.buffer = malloc(register_buffer.size);
+    if (!register_buffer.buffer)
+    {
+        printf("Malloc didn't not allocate buffer.\n");
+        return;
+    }
+
+    if (ioctl(dev, IOCTL_LINPMEM_REGISTER_BUFFER, &register_buffer))
+    {
+        printf("Registering the buffer failed.\n");
+        free(register_buffer.buffer);
+        return;
+    }
+
+    // The first megabyte of physical memory, 64k at a time.
+    for (offset=0;offset<register_buffer.size;offset+=0x10000)
+    {
+        read_registered.handle = register_buffer.handle;
+        read_registered.phys_address = offset;
+        read_registered.buffer_offset = offset;
+        read_registered.size = 0x10000;
+
+        if (ioctl(dev, IOCTL_LINPMEM_READ_REGISTERED, &read_registered) || read_registered.bytes_read != 0x10000)
+        {
+            printf("Read at %llx came up short.\n", (uint64_t) offset);
+        }
+    }
+
+    printf("Read into registered buffer %u.\n", register_buffer.handle);
+
+    // Unregister before freeing, the driver holds on to the pages until then.
+    ioctl(dev, IOCTL_LINPMEM_UNREGISTER_BUFFER, &register_buffer);
+
+    free(register_buffer.buffer);
+}
+
+
+// ### Count the page frames of every type.
+void do_pfn_map_test(int dev)
+{
+    LINPMEM_PFN_MAP pfn_map = {0};
+    uint64_t types[4] = {0};
+    uint64_t i = 0;
+
+    // Ask for the size first.
+    pfn_map.pfn_count = 0;
+    if (ioctl(dev, IOCTL_LINPMEM_QUERY_PFN_MAP, &pfn_map))
+    {
+        printf("PFN map query failed.\n");
+        return;
+    }
+
+    pfn_map.pfn_count = pfn_map.total_pfns;
+    pfn_map.buffer = malloc((pfn_map.total_pfns + 3) / 4);
+    if (!pfn_map.buffer)
+    {
+        printf("Malloc didn't not allocate buffer.\n");
+        return;
+    }
+
+    if (ioctl(dev, IOCTL_LINPMEM_QUERY_PFN_MAP, &pfn_map))
+    {
+        printf("PFN map query failed.\n");
+        free(pfn_map.buffer);
+        return;
+    }
+
+    for (i=0;i<pfn_map.pfn_count;i++)
+    {
+        types[LINPMEM_PFN_TYPE(pfn_map.buffer, i)]++;
+    }
+
+    printf("%llu page frames: %llu RAM, %llu reserved, %llu MMIO, %llu holes.\n",
+            pfn_map.pfn_count, types[LINPMEM_PFN_TYPE_RAM], types[LINPMEM_PFN_TYPE_RESERVED],
+            types[LINPMEM_PFN_TYPE_MMIO], types[LINPMEM_PFN_TYPE_HOLE]);
+
+    free(pfn_map.buffer);
+}
+
+
+// ### Count the free page frames below 4 GiB.
+void do_free_runs_test(int dev)
+{
+    LINPMEM_FREE_RUNS free_runs = {0};
+    uint64_t total_runs = 0;
+    uint64_t total_free = 0;
+
+    free_runs.start_pfn = 0;
+    free_runs.end_pfn = 0x100000000 / 4096;
+    free_runs.max_runs = 1024;
+    free_runs.runs = malloc(free_runs.max_runs * sizeof(LINPMEM_FREE_RUN));
+    if (!free_runs.runs)
+    {
+        printf("Malloc didn't not allocate buffer.\n");
+        return;
+    }
+
+    while (free_runs.start_pfn < free_runs.end_pfn)
+    {
+        if (ioctl(dev, IOCTL_LINPMEM_QUERY_FREE_RUNS, &free_runs))
+        {
+            printf("Free runs query failed.\n");
+            free(free_runs.runs);
+            return;
+        }
+
+        if (!total_runs && free_runs.run_count)
+        {
+            printf("First free run: pfn %llx, %llu page frames.\n",
+                    free_runs.runs[0].start_pfn, free_runs.runs[0].pfn_count);
+        }
+
+        total_runs += free_runs.run_count;
+        total_free += free_runs.free_pages;
+        free_runs.start_pfn = free_runs.resume_pfn;
+    }
+
+    printf("%llu free page frames below 4 GiB, in %llu runs.\n", total_free, total_runs);
+
+    free(free_runs.runs);
+}
+
+
+// ### Hash the first 16 MiB in 1 MiB chunks, then ask which of them changed since.
+void do_digest_test(int dev)
+{
+    LINPMEM_CHUNK_DIGEST chunks[16] = {0};
+    LINPMEM_CHUNK_DIGEST results[16] = {0};
+    LINPMEM_DIGEST digest = {0};
+    uint32_t i = 0;
+
+    for (i=0;i<16;i++)
+    {
+        chunks[i].phys_address = (uint64_t)i * 0x100000;
+        chunks[i].page_count = 256;
+    }
+
+    digest.chunks = chunks;
+    digest.chunk_count = 16;
+    digest.results = results;
+    digest.max_results = 16;
+
+    if (ioctl(dev, IOCTL_LINPMEM_DIGEST, &digest))
+    {
+        printf("Digest failed.\n");
+        return;
+    }
+
+    printf("%llu pages hashed, %llu unreadable.\n", digest.pages_hashed, digest.pages_unreadable);
+
+    for (i=0;i<digest.result_count;i++)
+    {
+        chunks[i].digest = results[i].digest; // <= expected from now on.
+    }
+
+    digest.flags = LINPMEM_DIGEST_COMPARE;
+
+    if (ioctl(dev, IOCTL_LINPMEM_DIGEST, &digest))
+    {
+        printf("Digest compare failed.\n");
+        return;
+    }
+
+    printf("%u of 16 chunks changed meanwhile.\n", digest.result_count);
+    for (i=0;i<digest.result_count;i++)
+    {
+        printf("changed: %llx, digest now %llx.\n", results[i].phys_address, results[i].digest);
+    }
+}
+
+
+// ### Read the first 16 MiB compressed, in 64 KiB chunks.
+// The chunks could go to a file or a socket as they are, and be decompressed with LZ4_decompress_safe elsewhere.
+void do_compressed_read_test(int dev)
+{
+    LINPMEM_COMPRESSED_READ read = {0};
+    PLINPMEM_COMPRESSED_CHUNK chunk = NULL;
+    uint64_t compressed = 0;
+    uint32_t stored = 0;
+    uint32_t unreadable = 0;
+    uint32_t i = 0;
+
+    read.phys_address = 0;
+    read.size = 16 * 1024 * 1024;
+    read.chunk_size = 0; // <= LINPMEM_DEFAULT_COMPRESSED_CHUNK_SIZE.
+    read.buffer_size = 4 * 1024 * 1024;
+    read.buffer = malloc(read.buffer_size);
+    if (!read.buffer)
+    {
+        printf("Malloc didn't not allocate buffer.\n");
+        return;
+    }
+
+    while (read.size)
+    {
+        if (ioctl(dev, IOCTL_LINPMEM_READ_COMPRESSED, &read))
+        {
+            printf("Compressed read failed.\n");
+            break;
+        }
+
+        chunk = read.buffer;
+        for (i=0;i<read.chunk_count;i++)
+        {
+            if (chunk->flags & LINPMEM_CHUNK_UNREADABLE)
+                unreadable++;
+            else if (chunk->flags & LINPMEM_CHUNK_STORED)
+                stored++;
+            compressed += chunk->compressed_size;
+            chunk = LINPMEM_NEXT_COMPRESSED_CHUNK(chunk);
+        }
+
+        printf("%llx-%llx: %u chunks, %llu of %llu bytes in the buffer.\n", read.phys_address,
+                read.resume_address, read.chunk_count, read.used_size, read.raw_bytes);
+
+        if (read.resume_address == read.phys_address)
+        {
+            break; // <= interrupted.
+        }
+
+        read.size -= read.resume_address - read.phys_address;
+        read.phys_address = read.resume_address;
+    }
+
+    printf("%llu bytes compressed, %u chunks stored, %u unreadable.\n", compressed, stored,
+            unreadable);
+
+    free(read.buffer);
+}
+
+
+// ### Read the local APIC version register (MMIO, not RAM) twice, then look at the window cache.
+void do_iowin_test(int dev)
+{
+    LINPMEM_DATA_TRANSFER dataTransfer = {0};
+    LINPMEM_IOWIN_STATS iowin_stats = {0};
+    int i = 0;
+
+    for (i=0;i<2;i++)
+    {
+        dataTransfer.phys_address = 0xfee00030; // default APIC base, version register.
+        dataTransfer.access_type = PHYS_DWORD_READ;
+
+        if (ioctl(dev, IOCTL_LINPMEM_READ_PHYSADDR, &dataTransfer))
+        {
+            printf("Reading the APIC failed.\n");
+            return;
+        }
+    }
+
+    printf("APIC version register: %llx\n", dataTransfer.out_value);
+
+    if (ioctl(dev, IOCTL_LINPMEM_QUERY_IOWIN_STATS, &iowin_stats))
+    {
+        printf("ioremap window statistics query failed.\n");
+        return;
+    }
+
+    printf("ioremap windows: %llu hits, %llu misses, %llu evictions, %llu failures, %llu mapped.\n",
+            iowin_stats.hits, iowin_stats.misses, iowin_stats.evictions, iowin_stats.failures,
+            iowin_stats.windows_mapped);
+}
+
+
+// ### Bind to ourselves, then translate and read with the short forms of the calls.
+void do_session_test(int dev)
+{
+    unsigned char * hello = "Hello World!\n";
+    LINPMEM_SESSION_BIND session_bind = {0};
+    LINPMEM_SESSION_INFO session_info = {0};
+    LINPMEM_VTOP_INFO vtop_info = {0};
+    LINPMEM_DATA_TRANSFER dataTransfer = {0};
+    char buffer[16] = {0};
+    int i = 0;
+
+    session_bind.target_process = 0; // ourselves.
+    session_bind.default_access_type = PHYS_BUFFER_READ;
+
+    if (ioctl(dev, IOCTL_LINPMEM_SESSION_BIND, &session_bind))
+    {
+        printf("Session bind failed.\n");
+        return;
+    }
+
+    printf("Bound to CR3 %llx.\n", session_bind.cr3);
+
+    // No CR3 and no access type: the session has them.
+    for (i=0;i<2;i++)
+    {
+        vtop_info.virt_address = (uint64_t) hello;
+        ioctl(dev, IOCTL_LINPMEM_VTOP_TRANSLATION_SERVICE, &vtop_info);
+    }
+
+    dataTransfer.phys_address = vtop_info.phys_address;
+    dataTransfer.readbuffer = buffer;
+    dataTransfer.readbuffer_size = sizeof(buffer) - 1;
+
+    if (vtop_info.phys_address && !ioctl(dev, IOCTL_LINPMEM_READ_PHYSADDR, &dataTransfer))
+    {
+        printf("Read through the session: %s", buffer);
+    }
+
+    if (ioctl(dev, IOCTL_LINPMEM_SESSION_QUERY, &session_info))
+    {
+        printf("Session query failed.\n");
+        return;
+    }
+
+    printf("Session of pid %llu: %llu translations (%llu cached), %llu reads with %llu bytes.\n",
+            session_info.pid, session_info.vtop_count, session_info.tlb_hits,
+            session_info.reads, session_info.bytes_read);
+
+    session_bind.flags = LINPMEM_SESSION_UNBIND;
+    ioctl(dev, IOCTL_LINPMEM_SESSION_BIND, &session_bind);
+}
+
+
+// ### Watch the page of a local variable, change it, and wait for the driver to notice.
+void do_watch_test(int dev)
+{
+    static volatile uint64_t watched = 0x1111;
+    LINPMEM_VTOP_INFO vtop_info = {0};
+    LINPMEM_WATCH_RANGE range = {0};
+    LINPMEM_WATCH_SETUP watch_setup = {0};
+    LINPMEM_WATCH_QUERY watch_query = {0};
+    uint64_t snapshot = 0;
+    uint64_t events = 0;
+    struct pollfd pfd = {0};
+    int efd = 0;
+
+    vtop_info.virt_address = (uint64_t) &watched;
+    ioctl(dev, IOCTL_LINPMEM_VTOP_TRANSLATION_SERVICE, &vtop_info);
+    if (!vtop_info.phys_address)
+    {
+        printf("vtop of the watched variable failed.\n");
+        return;
+    }
+
+    efd = eventfd(0, 0);
+    if (efd == -1)
+    {
+        printf("eventfd failed.\n");
+        return;
+    }
+
+    range.phys_address = vtop_info.phys_address;
+    range.size = sizeof(watched);
+    watch_setup.ranges = &range;
+    watch_setup.range_count = 1;
+    watch_setup.period_ms = 100;
+    watch_setup.eventfd = efd;
+
+    if (ioctl(dev, IOCTL_LINPMEM_WATCH_SETUP, &watch_setup))
+    {
+        printf("Watch setup failed.\n");
+        close(efd);
+        return;
+    }
+
+    watched = 0x2222;
+
+    pfd.fd = efd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 2000) == 1 && read(efd, &events, sizeof(events)) == sizeof(events))
+    {
+        watch_query.ranges = &range;
+        watch_query.range_count = 1;
+        watch_query.data = &snapshot;
+        watch_query.data_size = sizeof(snapshot);
+
+        if (!ioctl(dev, IOCTL_LINPMEM_WATCH_QUERY, &watch_query))
+        {
+            printf("Watch: %u of %u ranges changed, now %llx (hash %llx, %llu changes).\n",
+                    watch_query.changed_count, watch_query.range_count, snapshot,
+                    range.hash, range.change_count);
+        }
+    }
+    else
+    {
+        printf("Watch: no change noticed.\n");
+    }
+
+    watch_setup.range_count = 0;
+    ioctl(dev, IOCTL_LINPMEM_WATCH_SETUP, &watch_setup);
+    close(efd);
+}
+
+
+// ### The ELF core view. Needs: mknod /dev/linpmem_core c 42 1
+void do_elf_core_test()
+{
+    Elf64_Ehdr ehdr = {0};
+    Elf64_Phdr phdr = {0};
+    int core = 0;
+    int i = 0;
+
+    core = open("/dev/linpmem_core", O_RDONLY);
+    if (core == -1)
+    {
+        printf("Opening '/dev/linpmem_core' was not possible!\n");
+        return;
+    }
+
+    if (pread(core, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr))
+    {
+        printf("Reading the ELF header failed.\n");
+        close(core);
+        return;
+    }
+
+    printf("ELF core of %llx bytes with %u program headers.\n",
+            (uint64_t) lseek(core, 0, SEEK_END), ehdr.e_phnum);
+
+    for (i=0;i<ehdr.e_phnum;i++)
+    {
+        pread(core, &phdr, sizeof(phdr), ehdr.e_phoff + i * sizeof(phdr));
+        if (phdr.p_type == PT_LOAD)
+        {
+            printf("RAM %llx - %llx at file offset %llx\n",
+                    phdr.p_paddr, phdr.p_paddr + phdr.p_memsz, phdr.p_offset);
+        }
+    }
+
+    close(core);
+}
+
 
 int main()
 {
     int dev;
 
-    dev = open("/dev/linpmem", O_WRONLY);
+    dev = open("/dev/linpmem", O_RDWR); // read access is needed for mapping the page ring.
 
     if (dev == -1)
     {
@@ -219,11 +1120,51 @@ int main()
 
     // do_physread_test_bufferread(dev);
 
+    do_physread_test_contiguous(dev);
+
     do_vtop_query(dev); // Returns physical address of hello world string buffer.
 
     do_vtop_query_with_proof_read(dev); // physical read from the vtop-returned hello world string buffer.
 
+    do_ring_test(dev); // same page again, this time through the page ring.
+
+    do_numa_stats_test(dev);
+
+    do_scan_test(dev);
+
+    do_process_runs_test(dev);
+
+    do_dirty_runs_test(dev);
+
+    do_processes_test(dev);
+
+    do_process_maps_test(dev);
+
+    do_list_walk_test(dev);
+
+    do_kernel_layout_test(dev);
+
+    do_page_owners_test(dev);
+
+    do_registered_buffer_test(dev);
+
+    do_pfn_map_test(dev);
+
+    do_free_runs_test(dev);
+
+    do_digest_test(dev);
+
+    do_compressed_read_test(dev);
+
+    do_iowin_test(dev);
+
+    do_session_test(dev);
+
+    do_watch_test(dev);
+
     close(dev);
 
+    do_elf_core_test();
+
     return 0;
 }
@@ -0,0 +1,129 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+#include "lpmd_format.h"
+
+#define DEDUP_INITIAL_CAPACITY (1ULL << 16)
+
+// data_index is stored + 1, so that zero marks an empty entry.
+struct DEDUP_ENTRY {
+    uint64_t hash;
+    uint64_t data_index_1;
+};
+
+int dedup_init(PDEDUP_TABLE table, DEDUP_READ_PAGE read_page, void *context)
+{
+    memset(table, 0, sizeof(*table));
+
+    table->entries =
+        calloc(DEDUP_INITIAL_CAPACITY, sizeof(struct DEDUP_ENTRY));
+    if (!table->entries)
+        return -ENOMEM;
+
+    // Aligned, the writer might use O_DIRECT for reading back.
+    if (posix_memalign(&table->scratch_page, LPMD_PAGE_SIZE, LPMD_PAGE_SIZE)) {
+        free(table->entries);
+        return -ENOMEM;
+    }
+
+    table->capacity = DEDUP_INITIAL_CAPACITY;
+    table->read_page = read_page;
+    table->read_context = context;
+
+    return 0;
+}
+
+void dedup_free(PDEDUP_TABLE table)
+{
+    free(table->entries);
+    free(table->scratch_page);
+    memset(table, 0, sizeof(*table));
+}
+
+static void dedup_put(struct DEDUP_ENTRY *entries, uint64_t capacity,
+                      uint64_t hash, uint64_t data_index_1)
+{
+    uint64_t i = hash & (capacity - 1);
+
+    while (entries[i].data_index_1)
+        i = (i + 1) & (capacity - 1);
+
+    entries[i].hash = hash;
+    entries[i].data_index_1 = data_index_1;
+}
+
+static int dedup_grow(PDEDUP_TABLE table)
+{
+    struct DEDUP_ENTRY *entries;
+    uint64_t capacity = table->capacity * 2;
+    uint64_t i;
+
+    entries = calloc(capacity, sizeof(struct DEDUP_ENTRY));
+    if (!entries)
+        return -ENOMEM;
+
+    for (i = 0; i < table->capacity; i++) {
+        if (table->entries[i].data_index_1)
+            dedup_put(entries, capacity, table->entries[i].hash,
+                      table->entries[i].data_index_1);
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+
+    return 0;
+}
+
+bool dedup_lookup(PDEDUP_TABLE table, uint64_t hash, const void *page,
+                  uint64_t *data_index)
+{
+    uint64_t mask = table->capacity - 1;
+    uint64_t i = hash & mask;
+
+    table->lookups++;
+
+    for (; table->entries[i].data_index_1; i = (i + 1) & mask) {
+        if (table->entries[i].hash != hash)
+            continue;
+
+        if (table->read_page(table->read_context,
+                             table->entries[i].data_index_1 - 1,
+                             table->scratch_page))
+            continue;
+
+        if (memcmp(table->scratch_page, page, LPMD_PAGE_SIZE)) {
+            table->collisions++;
+            continue;
+        }
+
+        table->hits++;
+        *data_index = table->entries[i].data_index_1 - 1;
+        return true;
+    }
+
+    return false;
+}
+
+int dedup_insert(PDEDUP_TABLE table, uint64_t hash, uint64_t data_index)
+{
+    int ret;
+
+    // Keep the load below one half, probing stays short.
+    if ((table->used + 1) * 2 > table->capacity) {
+        ret = dedup_grow(table);
+        if (ret)
+            return ret;
+    }
+
+    dedup_put(table->entries, table->capacity, hash, data_index + 1);
+    table->used++;
+
+    return 0;
+}
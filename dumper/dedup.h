@@ -0,0 +1,47 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Reads back the contents of a stored page, for the byte-for-byte check. */
+typedef int (*DEDUP_READ_PAGE)(void *context, uint64_t data_index, void *page);
+
+/* Fingerprints of all stored pages: open addressing on the xxh64 of the page.
+ * Equal fingerprints are only candidates, the page contents decide.
+ */
+typedef struct {
+    struct DEDUP_ENTRY *entries;
+    uint64_t capacity;
+    uint64_t used;
+
+    DEDUP_READ_PAGE read_page;
+    void *read_context;
+    void *scratch_page;
+
+    // Statistics.
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t collisions;
+} DEDUP_TABLE, *PDEDUP_TABLE;
+
+int dedup_init(PDEDUP_TABLE table, DEDUP_READ_PAGE read_page, void *context);
+
+void dedup_free(PDEDUP_TABLE table);
+
+/* dedup_lookup - find a stored page with the same contents
+ * @hash: xxh64 of page
+ *
+ * Returns true and sets *data_index if found.
+ */
+bool dedup_lookup(PDEDUP_TABLE table, uint64_t hash, const void *page,
+                  uint64_t *data_index);
+
+/* dedup_insert - remember a newly stored page */
+int dedup_insert(PDEDUP_TABLE table, uint64_t hash, uint64_t data_index);
+
+#endif
@@ -0,0 +1,136 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "digests.h"
+
+int digests_append(PDIGEST_LIST list, uint64_t phys_address,
+                   uint32_t page_count, uint64_t digest)
+{
+    PLPMD_CHUNK_DIGEST tmp;
+    PLPMD_CHUNK_DIGEST chunk;
+
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        tmp = realloc(list->chunks, list->capacity * sizeof(LPMD_CHUNK_DIGEST));
+        if (!tmp)
+            return -ENOMEM;
+        list->chunks = tmp;
+    }
+
+    chunk = &list->chunks[list->count++];
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->phys_address = phys_address;
+    chunk->page_count = page_count;
+    chunk->digest = digest;
+
+    return 0;
+}
+
+PLPMD_CHUNK_DIGEST digests_find(PDIGEST_LIST list, uint64_t phys_address)
+{
+    uint64_t lo = 0;
+    uint64_t hi = list->count;
+    uint64_t mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (list->chunks[mid].phys_address == phys_address)
+            return &list->chunks[mid];
+        if (list->chunks[mid].phys_address < phys_address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+int digests_save(PDIGEST_LIST list, const char *path)
+{
+    LPMD_DIGEST_HEADER header = { 0 };
+    FILE *file;
+    int ret = 0;
+
+    file = fopen(path, "wb");
+    if (!file)
+        return -errno;
+
+    memcpy(header.magic, LPMD_DIGEST_MAGIC, sizeof(header.magic));
+    header.version = LPMD_DIGEST_VERSION;
+    header.chunk_size = list->chunk_size;
+    header.chunk_count = list->count;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        (list->count && fwrite(list->chunks, sizeof(LPMD_CHUNK_DIGEST),
+                               list->count, file) != list->count))
+        ret = -EIO;
+
+    if (fclose(file) && !ret)
+        ret = -errno;
+
+    return ret;
+}
+
+int digests_load(PDIGEST_LIST list, const char *path)
+{
+    LPMD_DIGEST_HEADER header;
+    FILE *file;
+    int ret = 0;
+
+    memset(list, 0, sizeof(*list));
+
+    file = fopen(path, "rb");
+    if (!file)
+        return -errno;
+
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, LPMD_DIGEST_MAGIC, sizeof(header.magic)) ||
+        header.version != LPMD_DIGEST_VERSION) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    list->chunk_size = header.chunk_size;
+    list->chunks = calloc(header.chunk_count ? header.chunk_count : 1,
+                          sizeof(LPMD_CHUNK_DIGEST));
+    if (!list->chunks) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    list->capacity = header.chunk_count;
+
+    if (fread(list->chunks, sizeof(LPMD_CHUNK_DIGEST), header.chunk_count,
+              file) != header.chunk_count) {
+        ret = -EINVAL;
+        goto out;
+    }
+    list->count = header.chunk_count;
+
+out:
+    fclose(file);
+    return ret;
+}
+
+void digests_free(PDIGEST_LIST list)
+{
+    free(list->chunks);
+    memset(list, 0, sizeof(*list));
+}
+
+char *digests_path(const char *image_path)
+{
+    static const char suffix[] = ".digests";
+    char *path;
+
+    path = malloc(strlen(image_path) + sizeof(suffix));
+    if (path)
+        sprintf(path, "%s%s", image_path, suffix);
+
+    return path;
+}
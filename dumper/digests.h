@@ -0,0 +1,36 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _DIGESTS_H_
+#define _DIGESTS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lpmd_format.h"
+
+/* The chunk digests of one acquisition, see lpmd_format.h. */
+typedef struct {
+    uint64_t chunk_size;
+    PLPMD_CHUNK_DIGEST chunks;
+    uint64_t count;
+    uint64_t capacity;
+} DIGEST_LIST, *PDIGEST_LIST;
+
+int digests_append(PDIGEST_LIST list, uint64_t phys_address,
+                   uint32_t page_count, uint64_t digest);
+
+/* digests_find - the digest of the chunk at phys_address, or NULL */
+PLPMD_CHUNK_DIGEST digests_find(PDIGEST_LIST list, uint64_t phys_address);
+
+int digests_save(PDIGEST_LIST list, const char *path);
+
+int digests_load(PDIGEST_LIST list, const char *path);
+
+void digests_free(PDIGEST_LIST list);
+
+/* digests_path - the sidecar path of an image (caller frees) */
+char *digests_path(const char *image_path);
+
+#endif
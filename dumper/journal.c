@@ -0,0 +1,259 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "xxhash.h"
+
+static int write_full(int fd, const void *buf, size_t size)
+{
+    ssize_t written;
+
+    while (size) {
+        written = write(fd, buf, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        buf = (const char *)buf + written;
+        size -= written;
+    }
+
+    return 0;
+}
+
+/* read_full - read size bytes, -ENODATA at the end of the file */
+static int read_full(int fd, void *buf, size_t size)
+{
+    ssize_t got;
+
+    while (size) {
+        got = read(fd, buf, size);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (got == 0)
+            return -ENODATA;
+
+        buf = (char *)buf + got;
+        size -= got;
+    }
+
+    return 0;
+}
+
+static uint64_t journal_checksum(PLPMD_JOURNAL_CHUNK record,
+                                 const LPMD_RUN *runs)
+{
+    LPMD_JOURNAL_CHUNK copy = *record;
+
+    copy.checksum = 0;
+
+    return xxh64(runs, record->run_count * sizeof(LPMD_RUN),
+                 xxh64(&copy, sizeof(copy), 0));
+}
+
+int journal_create(PJOURNAL journal, const char *path,
+                   PLPMD_JOURNAL_HEADER header, PLPMD_JOURNAL_RANGE ranges)
+{
+    int ret;
+
+    memset(journal, 0, sizeof(*journal));
+
+    journal->header = *header;
+    memcpy(journal->header.magic, LPMD_JOURNAL_MAGIC,
+           sizeof(journal->header.magic));
+    journal->header.version = LPMD_JOURNAL_VERSION;
+
+    journal->ranges = calloc(header->range_count ? header->range_count : 1,
+                             sizeof(LPMD_JOURNAL_RANGE));
+    if (!journal->ranges)
+        return -ENOMEM;
+    memcpy(journal->ranges, ranges,
+           header->range_count * sizeof(LPMD_JOURNAL_RANGE));
+
+    journal->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (journal->fd < 0) {
+        ret = -errno;
+        goto error;
+    }
+
+    ret = write_full(journal->fd, &journal->header, sizeof(journal->header));
+    if (!ret)
+        ret = write_full(journal->fd, journal->ranges,
+                         header->range_count * sizeof(LPMD_JOURNAL_RANGE));
+    if (!ret && fsync(journal->fd))
+        ret = -errno;
+    if (ret)
+        goto error;
+
+    return 0;
+
+error:
+    journal_close(journal);
+    return ret;
+}
+
+int journal_open(PJOURNAL journal, const char *path, bool writable,
+                 JOURNAL_REPLAY replay, void *context)
+{
+    LPMD_JOURNAL_CHUNK record;
+    PLPMD_RUN runs = NULL;
+    uint64_t max_pages;
+    off_t valid;
+    int ret;
+
+    memset(journal, 0, sizeof(*journal));
+
+    journal->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (journal->fd < 0)
+        return -errno;
+
+    ret = read_full(journal->fd, &journal->header, sizeof(journal->header));
+    if (ret || memcmp(journal->header.magic, LPMD_JOURNAL_MAGIC,
+                      sizeof(journal->header.magic)) ||
+        journal->header.version != LPMD_JOURNAL_VERSION ||
+        !journal->header.chunk_size ||
+        journal->header.chunk_size % LPMD_PAGE_SIZE) {
+        ret = -EINVAL;
+        goto error;
+    }
+
+    journal->ranges =
+        calloc(journal->header.range_count ? journal->header.range_count : 1,
+               sizeof(LPMD_JOURNAL_RANGE));
+    if (!journal->ranges) {
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    ret = read_full(journal->fd, journal->ranges,
+                    journal->header.range_count * sizeof(LPMD_JOURNAL_RANGE));
+    if (ret) {
+        ret = -EINVAL;
+        goto error;
+    }
+
+    // A chunk's runs: one per page, and the run it might have extended.
+    max_pages = journal->header.chunk_size / LPMD_PAGE_SIZE;
+    runs = calloc(max_pages + 1, sizeof(LPMD_RUN));
+    if (!runs) {
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    for (;;) {
+        valid = lseek(journal->fd, 0, SEEK_CUR);
+
+        if (read_full(journal->fd, &record, sizeof(record)) ||
+            !record.page_count || record.page_count > max_pages ||
+            record.run_count > max_pages + 1 ||
+            read_full(journal->fd, runs, record.run_count * sizeof(LPMD_RUN)) ||
+            journal_checksum(&record, runs) != record.checksum)
+            break;
+
+        ret = replay(context, &record, runs);
+        if (ret)
+            goto error;
+    }
+
+    if (writable) {
+        if (ftruncate(journal->fd, valid) ||
+            lseek(journal->fd, valid, SEEK_SET) < 0) {
+            ret = -errno;
+            goto error;
+        }
+    }
+
+    free(runs);
+
+    return 0;
+
+error:
+    free(runs);
+    journal_close(journal);
+    return ret;
+}
+
+int journal_append(PJOURNAL journal, PLPMD_JOURNAL_CHUNK record,
+                   const LPMD_RUN *runs)
+{
+    size_t size = sizeof(*record) + record->run_count * sizeof(LPMD_RUN);
+    size_t capacity;
+    uint8_t *tmp;
+
+    if (journal->pending_size + size > journal->pending_capacity) {
+        capacity = journal->pending_capacity * 2 + size;
+        tmp = realloc(journal->pending, capacity);
+        if (!tmp)
+            return -ENOMEM;
+        journal->pending = tmp;
+        journal->pending_capacity = capacity;
+    }
+
+    record->checksum = journal_checksum(record, runs);
+
+    memcpy(journal->pending + journal->pending_size, record, sizeof(*record));
+    memcpy(journal->pending + journal->pending_size + sizeof(*record), runs,
+           record->run_count * sizeof(LPMD_RUN));
+    journal->pending_size += size;
+    journal->pending_chunks++;
+
+    return 0;
+}
+
+int journal_flush(PJOURNAL journal, int data_fd)
+{
+    int ret;
+
+    if (!journal->pending_size)
+        return 0;
+
+    if (fdatasync(data_fd))
+        return -errno;
+
+    ret = write_full(journal->fd, journal->pending, journal->pending_size);
+    if (ret)
+        return ret;
+
+    if (fdatasync(journal->fd))
+        return -errno;
+
+    journal->pending_size = 0;
+    journal->pending_chunks = 0;
+
+    return 0;
+}
+
+void journal_close(PJOURNAL journal)
+{
+    if (journal->fd >= 0)
+        close(journal->fd);
+    free(journal->pending);
+    free(journal->ranges);
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = -1;
+}
+
+char *journal_path(const char *image_path)
+{
+    static const char suffix[] = ".journal";
+    char *path;
+
+    path = malloc(strlen(image_path) + sizeof(suffix));
+    if (path)
+        sprintf(path, "%s%s", image_path, suffix);
+
+    return path;
+}
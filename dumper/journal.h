@@ -0,0 +1,56 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lpmd_format.h"
+
+/* Called for every valid chunk record when a journal is opened. A negative
+ * return stops, and is returned by journal_open.
+ */
+typedef int (*JOURNAL_REPLAY)(void *context, PLPMD_JOURNAL_CHUNK record,
+                              PLPMD_RUN runs);
+
+/* The progress journal of an acquisition, see lpmd_format.h. Records are
+ * collected in pending, and written by journal_flush.
+ */
+typedef struct {
+    int fd;
+    LPMD_JOURNAL_HEADER header;
+    PLPMD_JOURNAL_RANGE ranges;
+
+    uint8_t *pending;
+    size_t pending_size;
+    size_t pending_capacity;
+    uint32_t pending_chunks;
+} JOURNAL, *PJOURNAL;
+
+int journal_create(PJOURNAL journal, const char *path,
+                   PLPMD_JOURNAL_HEADER header, PLPMD_JOURNAL_RANGE ranges);
+
+/* journal_open - read a journal, replaying its chunk records
+ * @writable: drop a torn trailing record, and append to the journal
+ */
+int journal_open(PJOURNAL journal, const char *path, bool writable,
+                 JOURNAL_REPLAY replay, void *context);
+
+int journal_append(PJOURNAL journal, PLPMD_JOURNAL_CHUNK record,
+                   const LPMD_RUN *runs);
+
+/* journal_flush - write the pending records
+ * @data_fd: the image, synced first: records never get ahead of the data
+ */
+int journal_flush(PJOURNAL journal, int data_fd);
+
+void journal_close(PJOURNAL journal);
+
+/* journal_path - the sidecar path of an image (caller frees) */
+char *journal_path(const char *image_path);
+
+#endif
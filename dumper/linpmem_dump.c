@@ -0,0 +1,1456 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+// ### linpmem_dump: acquires all of "System RAM" into an LPMD file.
+//
+// Pages are read in bulk through the page ring of the driver. Every page is
+// fingerprinted with xxh64; pages with the same contents as an earlier page
+// (confirmed byte for byte) are stored only once. See lpmd_format.h.
+//
+// Every acquisition also writes the digests of its chunks next to the image
+// (memory.lpmd.digests). With --base, only chunks whose digest changed since
+// that acquisition are stored, the rest refer to the base image.
+//
+// With --pid, only the physical pages mapped by one process are acquired,
+// together with the VA -> PA runs of its page tables.
+//
+// With --skip-free, pages in the free lists of the page allocator are not
+// read, just described as free. --free-pass reads them after everything
+// else, and stores those that are not zero.
+//
+// With --direct, the image is written with O_DIRECT through io_uring, with
+// up to --queue-depth writes in flight, bypassing the page cache: it would
+// otherwise hold a second copy of the memory being acquired.
+//
+// With --journal, the chunks done are recorded in memory.lpmd.journal as the
+// acquisition goes. An interrupted acquisition goes on with --resume, with
+// the options it was started with. lpmd_journal tells what is left, to hand
+// it to other acquisitions with --range.
+//
+// Usage:
+// sudo ./linpmem_dump -o memory.lpmd
+// sudo ./linpmem_dump -o memory.lpmd --skip-free
+// sudo ./linpmem_dump -o memory-2.lpmd --base memory.lpmd
+// sudo ./linpmem_dump -o process.lpmd --pid 1234
+// sudo ./linpmem_dump -o memory.lpmd --journal
+// sudo ./linpmem_dump -o memory.lpmd --resume
+// sudo ./linpmem_dump -o memory.lpmd --direct --queue-depth 64
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../userspace_interface/linpmem_shared.h"
+#include "dedup.h"
+#include "digests.h"
+#include "journal.h"
+#include "lpmd_format.h"
+#include "writer.h"
+#include "xxhash.h"
+
+#define DEFAULT_DEVICE "/dev/" LINPMEM_DEVICE_NAME
+#define DEFAULT_SLOTS (1024)
+#define DEFAULT_CHUNK_SIZE (1024 * 1024)
+#define DEFAULT_QUEUE_DEPTH (32)
+
+// Journaled chunks are synced to disk in batches of this many.
+#define JOURNAL_FLUSH_CHUNKS (256)
+
+// Hash of a free page in the chunk digests, it is not read. (0 is for
+// unreadable pages.)
+#define FREE_PAGE_HASH (1)
+
+static const uint8_t zero_page[LPMD_PAGE_SIZE];
+
+typedef struct {
+    uint64_t start;
+    uint64_t end; // inclusive, as in /proc/iomem
+} RAM_RANGE, *PRAM_RANGE;
+
+_Static_assert(sizeof(RAM_RANGE) == sizeof(LPMD_JOURNAL_RANGE),
+               "RAM_RANGE must match LPMD_JOURNAL_RANGE");
+
+typedef struct {
+    int dev;
+    uint8_t *mapping;
+    size_t mapping_size;
+    PLINPMEM_RING_HEADER header;
+    PLINPMEM_RING_DESC descs;
+    uint32_t slot_count;
+} RING_READER, *PRING_READER;
+
+typedef struct {
+    WRITER writer;
+    bool use_dedup;
+    DEDUP_TABLE dedup;
+    LPMD_HEADER header;
+    PLPMD_RUN runs;
+    uint64_t run_capacity;
+
+    // Digests of this acquisition, and of the base (delta mode).
+    DIGEST_LIST digests;
+    DIGEST_LIST base_digests;
+
+    // Hashes of the pages of the current chunk.
+    uint64_t *page_hashes;
+    uint64_t zero_hash;
+
+    // Process images: the VA -> PA index (header.vmap_count entries).
+    PLPMD_VMAP vmaps;
+
+    // --skip-free: the free runs of all ranges so far, ascending, and the
+    // first one that might still be ahead of the acquisition.
+    bool skip_free;
+    bool free_pass;
+    PLINPMEM_FREE_RUN free_runs;
+    uint64_t free_run_count;
+    uint64_t free_run_capacity;
+    uint64_t free_run_cursor;
+    uint64_t free_pages_stored;
+
+    // Slot of each page of the current chunk, FREE_SLOT if it is free.
+    uint32_t *page_slots;
+
+    // --journal: the progress journal, and where a resumed acquisition
+    // goes on.
+    bool journaling;
+    JOURNAL journal;
+    uint64_t resume_address;
+} DUMP, *PDUMP;
+
+#define FREE_SLOT UINT32_MAX
+
+_Static_assert(sizeof(LPMD_VMAP) == sizeof(LINPMEM_VIRT_RUN),
+               "LPMD_VMAP must match LINPMEM_VIRT_RUN");
+
+static int read_ram_ranges(PRAM_RANGE *ranges, size_t *count)
+{
+    char line[256];
+    FILE *iomem;
+    PRAM_RANGE tmp;
+    uint64_t start;
+    uint64_t end;
+    size_t capacity = 0;
+
+    *ranges = NULL;
+    *count = 0;
+
+    iomem = fopen("/proc/iomem", "r");
+    if (!iomem)
+        return -errno;
+
+    while (fgets(line, sizeof(line), iomem)) {
+        // Top level entries only, RAM is never nested.
+        if (line[0] == ' ' || !strstr(line, ": System RAM"))
+            continue;
+
+        if (sscanf(line, "%" SCNx64 "-%" SCNx64, &start, &end) != 2)
+            continue;
+
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            tmp = realloc(*ranges, capacity * sizeof(RAM_RANGE));
+            if (!tmp) {
+                fclose(iomem);
+                return -ENOMEM;
+            }
+            *ranges = tmp;
+        }
+
+        (*ranges)[*count].start = start;
+        (*ranges)[*count].end = end;
+        (*count)++;
+    }
+
+    fclose(iomem);
+
+    // Without root, all addresses read as zero.
+    if (*count && !(*ranges)[*count - 1].end)
+        return -EPERM;
+
+    return 0;
+}
+
+/* clip_ranges - keep only what lies within [start, end] */
+static void clip_ranges(PRAM_RANGE ranges, size_t *count, uint64_t start,
+                        uint64_t end)
+{
+    size_t n = 0;
+    size_t i;
+
+    for (i = 0; i < *count; i++) {
+        if (ranges[i].end < start || ranges[i].start > end)
+            continue;
+
+        ranges[n].start = ranges[i].start > start ? ranges[i].start : start;
+        ranges[n].end = ranges[i].end < end ? ranges[i].end : end;
+        n++;
+    }
+
+    *count = n;
+}
+
+/* read_process_runs - get the VA -> PA runs of a process from the driver */
+static int read_process_runs(PDUMP dump, int dev, uint64_t pid)
+{
+    LINPMEM_PROCESS_RUNS process_runs = { 0 };
+    uint64_t capacity = 0;
+    PLPMD_VMAP tmp;
+
+    process_runs.target_process = pid;
+    process_runs.virt_end = UINT64_MAX;
+    process_runs.max_runs = LINPMEM_MAX_VIRT_RUNS;
+
+    do {
+        if (dump->header.vmap_count + LINPMEM_MAX_VIRT_RUNS > capacity) {
+            capacity = capacity * 2 + LINPMEM_MAX_VIRT_RUNS;
+            tmp = realloc(dump->vmaps, capacity * sizeof(LPMD_VMAP));
+            if (!tmp)
+                return -ENOMEM;
+            dump->vmaps = tmp;
+        }
+
+        process_runs.runs =
+            (PLINPMEM_VIRT_RUN)&dump->vmaps[dump->header.vmap_count];
+        if (ioctl(dev, IOCTL_LINPMEM_QUERY_PROCESS_RUNS, &process_runs))
+            return -errno;
+
+        dump->header.vmap_count += process_runs.run_count;
+        process_runs.virt_start = process_runs.resume_address;
+    } while (process_runs.resume_address);
+
+    dump->header.flags |= LPMD_FLAG_PROCESS;
+    dump->header.process_id = pid;
+    dump->header.process_cr3 = process_runs.result_cr3;
+
+    return 0;
+}
+
+static int compare_ranges(const void *a, const void *b)
+{
+    const RAM_RANGE *range_a = a;
+    const RAM_RANGE *range_b = b;
+
+    if (range_a->start != range_b->start)
+        return range_a->start < range_b->start ? -1 : 1;
+    return 0;
+}
+
+/* process_ranges - the physical memory mapped by the process
+ *
+ * Pages can be mapped more than once, so the ranges are sorted and merged:
+ * every physical page is acquired once, in ascending order.
+ */
+static int process_ranges(PDUMP dump, PRAM_RANGE *ranges, size_t *count)
+{
+    PLPMD_VMAP vmap;
+    size_t n = 0;
+    size_t i;
+
+    *count = 0;
+    *ranges = malloc((dump->header.vmap_count ? dump->header.vmap_count : 1) *
+                     sizeof(RAM_RANGE));
+    if (!*ranges)
+        return -ENOMEM;
+
+    for (i = 0; i < dump->header.vmap_count; i++) {
+        vmap = &dump->vmaps[i];
+        (*ranges)[i].start = vmap->phys_address;
+        (*ranges)[i].end = vmap->phys_address + vmap->size - 1;
+    }
+
+    qsort(*ranges, dump->header.vmap_count, sizeof(RAM_RANGE), compare_ranges);
+
+    for (i = 0; i < dump->header.vmap_count; i++) {
+        if (n && (*ranges)[i].start <= (*ranges)[n - 1].end + 1) {
+            if ((*ranges)[i].end > (*ranges)[n - 1].end)
+                (*ranges)[n - 1].end = (*ranges)[i].end;
+        } else {
+            (*ranges)[n++] = (*ranges)[i];
+        }
+    }
+
+    *count = n;
+
+    return 0;
+}
+
+static int ring_reader_open(PRING_READER reader, const char *device,
+                            uint32_t slot_count, uint32_t flags)
+{
+    LINPMEM_RING_SETUP ring_setup = { 0 };
+    int ret;
+
+    reader->dev = open(device, O_RDWR);
+    if (reader->dev < 0)
+        return -errno;
+
+    ring_setup.slot_count = slot_count;
+    ring_setup.flags = flags;
+
+    if (ioctl(reader->dev, IOCTL_LINPMEM_RING_SETUP, &ring_setup))
+        goto error;
+
+    reader->mapping = mmap(NULL, ring_setup.mmap_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, reader->dev, 0);
+    if (reader->mapping == MAP_FAILED)
+        goto error;
+
+    reader->mapping_size = ring_setup.mmap_size;
+    reader->header = (PLINPMEM_RING_HEADER)reader->mapping;
+    reader->descs = (PLINPMEM_RING_DESC)(reader->header + 1);
+    reader->slot_count = slot_count;
+
+    return 0;
+
+error:
+    ret = -errno;
+    close(reader->dev);
+    return ret;
+}
+
+static void ring_reader_close(PRING_READER reader)
+{
+    munmap(reader->mapping, reader->mapping_size);
+    close(reader->dev);
+}
+
+static inline const void *ring_reader_slot(PRING_READER reader, uint32_t index)
+{
+    return reader->mapping + reader->header->slots_offset +
+           (size_t)index * reader->header->slot_size;
+}
+
+/* ring_reader_page - the page in a slot, or NULL if it could not be read */
+static const void *ring_reader_page(PRING_READER reader, uint32_t index)
+{
+    if (__atomic_load_n(&reader->descs[index].state, __ATOMIC_ACQUIRE) !=
+        LINPMEM_SLOT_DONE)
+        return NULL;
+
+    return ring_reader_slot(reader, index);
+}
+
+static inline void ring_reader_add(PRING_READER reader, uint32_t index,
+                                   uint64_t phys_address)
+{
+    reader->descs[index].phys_address = phys_address;
+    __atomic_store_n(&reader->descs[index].state, LINPMEM_SLOT_SUBMITTED,
+                     __ATOMIC_RELEASE);
+}
+
+/* ring_reader_submit - read the pages of all added slots, and wait */
+static int ring_reader_submit(PRING_READER reader)
+{
+    LINPMEM_RING_SUBMIT ring_submit = { 0 };
+
+    ring_submit.flags = LINPMEM_RING_SUBMIT_WAIT;
+    if (ioctl(reader->dev, IOCTL_LINPMEM_RING_SUBMIT, &ring_submit))
+        return -errno;
+
+    return 0;
+}
+
+/* ring_reader_read - read count consecutive pages into slots 0..count-1 */
+static int ring_reader_read(PRING_READER reader, uint64_t phys_address,
+                            uint32_t count)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+        ring_reader_add(reader, i, phys_address + (uint64_t)i * LPMD_PAGE_SIZE);
+
+    return ring_reader_submit(reader);
+}
+
+/* read_free_runs - append the free runs of a range to the list
+ *
+ * The driver looks at the allocator right now: by the time a page is
+ * acquired, it might be in use (or free) again. That is the price.
+ */
+static int read_free_runs(PDUMP dump, int dev, PRAM_RANGE range)
+{
+    LINPMEM_FREE_RUNS free_runs = { 0 };
+    PLINPMEM_FREE_RUN tmp;
+    uint64_t capacity;
+
+    free_runs.start_pfn = range->start / LPMD_PAGE_SIZE;
+    free_runs.end_pfn = range->end / LPMD_PAGE_SIZE + 1;
+    free_runs.max_runs = LINPMEM_MAX_FREE_RUNS;
+
+    while (free_runs.start_pfn < free_runs.end_pfn) {
+        if (dump->free_run_count + LINPMEM_MAX_FREE_RUNS >
+            dump->free_run_capacity) {
+            capacity = dump->free_run_capacity * 2 + LINPMEM_MAX_FREE_RUNS;
+            tmp = realloc(dump->free_runs,
+                          capacity * sizeof(LINPMEM_FREE_RUN));
+            if (!tmp)
+                return -ENOMEM;
+            dump->free_runs = tmp;
+            dump->free_run_capacity = capacity;
+        }
+
+        free_runs.runs = &dump->free_runs[dump->free_run_count];
+        if (ioctl(dev, IOCTL_LINPMEM_QUERY_FREE_RUNS, &free_runs))
+            return -errno;
+
+        dump->free_run_count += free_runs.run_count;
+        free_runs.start_pfn = free_runs.resume_pfn;
+    }
+
+    return 0;
+}
+
+/* dump_page_is_free - whether a page is in the free runs
+ *
+ * Pages are asked for in ascending order, the cursor only moves forward.
+ */
+static bool dump_page_is_free(PDUMP dump, uint64_t phys_address)
+{
+    uint64_t pfn = phys_address / LPMD_PAGE_SIZE;
+    PLINPMEM_FREE_RUN run;
+
+    while (dump->free_run_cursor < dump->free_run_count) {
+        run = &dump->free_runs[dump->free_run_cursor];
+        if (pfn < run->start_pfn)
+            return false;
+        if (pfn < run->start_pfn + run->pfn_count)
+            return true;
+        dump->free_run_cursor++;
+    }
+
+    return false;
+}
+
+static int dump_read_stored_page(void *context, uint64_t data_index,
+                                 void *page)
+{
+    PDUMP dump = context;
+
+    return writer_read(&dump->writer, page, LPMD_PAGE_SIZE,
+                       dump->header.data_offset + data_index * LPMD_PAGE_SIZE);
+}
+
+static bool page_is_zero(const void *page)
+{
+    const uint64_t *p = page;
+    size_t i;
+
+    for (i = 0; i < LPMD_PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (p[i])
+            return false;
+    }
+
+    return true;
+}
+
+/* dump_add_run - describe one more page, extending the last run if possible */
+static int dump_add_run(PDUMP dump, uint64_t phys_address, uint32_t type,
+                        uint64_t data_index)
+{
+    PLPMD_RUN run = NULL;
+    PLPMD_RUN tmp;
+
+    if (dump->header.run_count)
+        run = &dump->runs[dump->header.run_count - 1];
+
+    if (run && run->type == type &&
+        run->phys_address + run->page_count * LPMD_PAGE_SIZE == phys_address &&
+        (type != LPMD_RUN_DATA ||
+         run->data_index + run->page_count == data_index)) {
+        run->page_count++;
+        return 0;
+    }
+
+    if (dump->header.run_count == dump->run_capacity) {
+        dump->run_capacity = dump->run_capacity ? dump->run_capacity * 2 : 1024;
+        tmp = realloc(dump->runs, dump->run_capacity * sizeof(LPMD_RUN));
+        if (!tmp)
+            return -ENOMEM;
+        dump->runs = tmp;
+    }
+
+    run = &dump->runs[dump->header.run_count++];
+    memset(run, 0, sizeof(*run));
+    run->phys_address = phys_address;
+    run->page_count = 1;
+    run->type = type;
+    run->data_index = type == LPMD_RUN_DATA ? data_index : 0;
+
+    return 0;
+}
+
+/* dump_free_page - describe one free page that was not read */
+static int dump_free_page(PDUMP dump, uint64_t phys_address)
+{
+    dump->header.total_pages++;
+    dump->header.free_pages++;
+
+    return dump_add_run(dump, phys_address, LPMD_RUN_FREE, 0);
+}
+
+/* dump_page - store one page
+ * @page: page contents, or NULL if the page could not be read
+ * @hash: xxh64 of the page contents
+ */
+static int dump_page(PDUMP dump, uint64_t phys_address, const void *page,
+                     uint64_t hash)
+{
+    uint64_t data_index;
+    int ret;
+
+    dump->header.total_pages++;
+
+    if (!page) {
+        dump->header.unreadable_pages++;
+        return dump_add_run(dump, phys_address, LPMD_RUN_UNREADABLE, 0);
+    }
+
+    if (hash == dump->zero_hash && page_is_zero(page)) {
+        dump->header.zero_pages++;
+        return dump_add_run(dump, phys_address, LPMD_RUN_ZERO, 0);
+    }
+
+    if (dump->use_dedup) {
+        if (dedup_lookup(&dump->dedup, hash, page, &data_index)) {
+            dump->header.duplicate_pages++;
+            return dump_add_run(dump, phys_address, LPMD_RUN_DATA, data_index);
+        }
+    }
+
+    data_index = dump->header.stored_pages;
+
+    ret = writer_write(&dump->writer, page, LPMD_PAGE_SIZE,
+                       dump->header.data_offset + data_index * LPMD_PAGE_SIZE);
+    if (ret)
+        return ret;
+
+    dump->header.stored_pages++;
+
+    if (dump->use_dedup) {
+        ret = dedup_insert(&dump->dedup, hash, data_index);
+        if (ret)
+            return ret;
+    }
+
+    return dump_add_run(dump, phys_address, LPMD_RUN_DATA, data_index);
+}
+
+/* dump_journal_chunk - record a chunk that is done
+ * @first_run: the last run before the chunk, which it might have extended
+ */
+static int dump_journal_chunk(PDUMP dump, uint64_t phys_address,
+                              uint32_t count, uint64_t digest,
+                              uint64_t first_run)
+{
+    LPMD_JOURNAL_CHUNK record = { 0 };
+    int ret;
+
+    record.phys_address = phys_address;
+    record.page_count = count;
+    record.run_count = dump->header.run_count - first_run;
+    record.digest = digest;
+    record.first_run = first_run;
+    record.stored_pages = dump->header.stored_pages;
+    record.total_pages = dump->header.total_pages;
+    record.zero_pages = dump->header.zero_pages;
+    record.duplicate_pages = dump->header.duplicate_pages;
+    record.unreadable_pages = dump->header.unreadable_pages;
+    record.free_pages = dump->header.free_pages;
+    record.changed_chunks = dump->header.changed_chunks;
+    record.unchanged_chunks = dump->header.unchanged_chunks;
+
+    ret = journal_append(&dump->journal, &record, &dump->runs[first_run]);
+    if (ret)
+        return ret;
+
+    if (dump->journal.pending_chunks < JOURNAL_FLUSH_CHUNKS)
+        return 0;
+
+    ret = writer_flush(&dump->writer);
+    if (ret)
+        return ret;
+
+    return journal_flush(&dump->journal, dump->writer.fd);
+}
+
+/* dump_replay_chunk - take over a chunk from the journal of an earlier run */
+static int dump_replay_chunk(void *context, PLPMD_JOURNAL_CHUNK record,
+                             PLPMD_RUN runs)
+{
+    PDUMP dump = context;
+    uint64_t capacity;
+    PLPMD_RUN tmp;
+    int ret;
+
+    if (record->first_run > dump->header.run_count ||
+        record->phys_address < dump->resume_address)
+        return -EINVAL;
+
+    ret = digests_append(&dump->digests, record->phys_address,
+                         record->page_count, record->digest);
+    if (ret)
+        return ret;
+
+    dump->header.run_count = record->first_run;
+    if (dump->header.run_count + record->run_count > dump->run_capacity) {
+        capacity = dump->run_capacity * 2 + record->run_count;
+        tmp = realloc(dump->runs, capacity * sizeof(LPMD_RUN));
+        if (!tmp)
+            return -ENOMEM;
+        dump->runs = tmp;
+        dump->run_capacity = capacity;
+    }
+    memcpy(&dump->runs[dump->header.run_count], runs,
+           record->run_count * sizeof(LPMD_RUN));
+    dump->header.run_count += record->run_count;
+
+    dump->header.stored_pages = record->stored_pages;
+    dump->header.total_pages = record->total_pages;
+    dump->header.zero_pages = record->zero_pages;
+    dump->header.duplicate_pages = record->duplicate_pages;
+    dump->header.unreadable_pages = record->unreadable_pages;
+    dump->header.free_pages = record->free_pages;
+    dump->header.changed_chunks = record->changed_chunks;
+    dump->header.unchanged_chunks = record->unchanged_chunks;
+
+    dump->resume_address =
+        record->phys_address + (uint64_t)record->page_count * LPMD_PAGE_SIZE;
+
+    return 0;
+}
+
+/* dump_rebuild_dedup - fingerprint the pages stored before the interruption
+ *
+ * This reads back the data area once, so that the pages acquired from now
+ * on are deduplicated against the earlier ones, too.
+ */
+static int dump_rebuild_dedup(PDUMP dump)
+{
+    uint64_t data_index;
+    void *page;
+    int ret = 0;
+
+    page = malloc(LPMD_PAGE_SIZE);
+    if (!page)
+        return -ENOMEM;
+
+    for (data_index = 0; data_index < dump->header.stored_pages && !ret;
+         data_index++) {
+        ret = dump_read_stored_page(dump, data_index, page);
+        if (!ret)
+            ret = dedup_insert(&dump->dedup, xxh64(page, LPMD_PAGE_SIZE, 0),
+                               data_index);
+    }
+
+    free(page);
+
+    return ret;
+}
+
+/* dump_chunk - acquire one chunk (no more pages than the ring has slots)
+ *
+ * All pages are read and hashed to compute the chunk digest. In delta mode,
+ * the pages are only stored if the digest differs from the base.
+ */
+static int dump_chunk(PDUMP dump, PRING_READER reader, uint64_t phys_address,
+                      uint32_t count)
+{
+    PLPMD_CHUNK_DIGEST base_chunk = NULL;
+    uint64_t first_run;
+    const void *page;
+    uint64_t page_address;
+    uint64_t digest;
+    uint32_t slots = 0;
+    uint32_t i;
+    int ret;
+
+    first_run = dump->header.run_count ? dump->header.run_count - 1 : 0;
+
+    for (i = 0; i < count; i++) {
+        page_address = phys_address + (uint64_t)i * LPMD_PAGE_SIZE;
+
+        if (dump->skip_free && dump_page_is_free(dump, page_address)) {
+            dump->page_slots[i] = FREE_SLOT;
+            continue;
+        }
+
+        dump->page_slots[i] = slots;
+        ring_reader_add(reader, slots++, page_address);
+    }
+
+    if (slots) {
+        ret = ring_reader_submit(reader);
+        if (ret)
+            goto out;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (dump->page_slots[i] == FREE_SLOT) {
+            dump->page_hashes[i] = FREE_PAGE_HASH;
+            continue;
+        }
+
+        page = ring_reader_page(reader, dump->page_slots[i]);
+        if (!page)
+            dump->page_hashes[i] = 0;
+        else if (page_is_zero(page))
+            dump->page_hashes[i] = dump->zero_hash;
+        else
+            dump->page_hashes[i] = xxh64(page, LPMD_PAGE_SIZE, 0);
+    }
+
+    digest = xxh64(dump->page_hashes, count * sizeof(uint64_t), 0);
+
+    ret = digests_append(&dump->digests, phys_address, count, digest);
+    if (ret)
+        goto out;
+
+    if (dump->header.flags & LPMD_FLAG_DELTA)
+        base_chunk = digests_find(&dump->base_digests, phys_address);
+
+    if (base_chunk && base_chunk->page_count == count &&
+        base_chunk->digest == digest) {
+        dump->header.unchanged_chunks++;
+        dump->header.total_pages += count;
+        for (i = 0; i < count && !ret; i++)
+            ret = dump_add_run(dump, phys_address + (uint64_t)i * LPMD_PAGE_SIZE,
+                               LPMD_RUN_BASE, 0);
+        goto out_journal;
+    }
+
+    dump->header.changed_chunks++;
+
+    for (i = 0; i < count && !ret; i++) {
+        page_address = phys_address + (uint64_t)i * LPMD_PAGE_SIZE;
+
+        if (dump->page_slots[i] != FREE_SLOT)
+            ret = dump_page(dump, page_address,
+                            ring_reader_page(reader, dump->page_slots[i]),
+                            dump->page_hashes[i]);
+        // With a free page pass, that pass describes the free pages.
+        else if (!dump->free_pass)
+            ret = dump_free_page(dump, page_address);
+    }
+
+out_journal:
+    if (!ret && dump->journaling)
+        ret = dump_journal_chunk(dump, phys_address, count, digest, first_run);
+
+out:
+    for (i = 0; i < slots; i++)
+        reader->descs[i].state = LINPMEM_SLOT_FREE;
+
+    return ret;
+}
+
+static int dump_range(PDUMP dump, PRING_READER reader, PRAM_RANGE range)
+{
+    uint64_t phys_address = range->start & ~(uint64_t)(LPMD_PAGE_SIZE - 1);
+    uint64_t chunk_end;
+    uint32_t count;
+    int ret;
+
+    if (dump->skip_free) {
+        ret = read_free_runs(dump, reader->dev, range);
+        if (ret)
+            return ret;
+    }
+
+    while (phys_address <= range->end) {
+        chunk_end = (phys_address / dump->digests.chunk_size + 1) *
+                        dump->digests.chunk_size - 1;
+        if (chunk_end > range->end)
+            chunk_end = range->end;
+        count = (chunk_end - phys_address) / LPMD_PAGE_SIZE + 1;
+
+        ret = dump_chunk(dump, reader, phys_address, count);
+        if (ret)
+            return ret;
+
+        phys_address += (uint64_t)count * LPMD_PAGE_SIZE;
+    }
+
+    if (dump->journaling) {
+        ret = writer_flush(&dump->writer);
+        if (ret)
+            return ret;
+        return journal_flush(&dump->journal, dump->writer.fd);
+    }
+
+    return 0;
+}
+
+/* dump_free_pass - read the pages skipped as free
+ *
+ * Most free pages still hold whatever they held last, and some of that
+ * might be of interest. They are read after everything else, so that the
+ * memory in use was acquired as close in time as possible. Free pages that
+ * are zero by now stay free pages, the others are stored.
+ */
+static int dump_free_pass(PDUMP dump, PRING_READER reader)
+{
+    PLINPMEM_FREE_RUN run;
+    uint64_t phys_address;
+    uint64_t page_address;
+    uint64_t done;
+    const void *page;
+    uint64_t hash;
+    uint32_t count;
+    uint64_t i;
+    uint32_t j;
+    int ret = 0;
+
+    for (i = 0; i < dump->free_run_count && !ret; i++) {
+        run = &dump->free_runs[i];
+
+        for (done = 0; done < run->pfn_count && !ret; done += count) {
+            count = run->pfn_count - done < reader->slot_count ?
+                        run->pfn_count - done :
+                        reader->slot_count;
+            phys_address = (run->start_pfn + done) * LPMD_PAGE_SIZE;
+
+            ret = ring_reader_read(reader, phys_address, count);
+
+            for (j = 0; j < count && !ret; j++) {
+                page_address = phys_address + (uint64_t)j * LPMD_PAGE_SIZE;
+                page = ring_reader_page(reader, j);
+
+                if (page && page_is_zero(page)) {
+                    ret = dump_free_page(dump, page_address);
+                    continue;
+                }
+
+                hash = page ? xxh64(page, LPMD_PAGE_SIZE, 0) : 0;
+                if (page)
+                    dump->free_pages_stored++;
+                ret = dump_page(dump, page_address, page, hash);
+            }
+
+            for (j = 0; j < count; j++)
+                reader->descs[j].state = LINPMEM_SLOT_FREE;
+        }
+    }
+
+    return ret;
+}
+
+static int compare_runs(const void *a, const void *b)
+{
+    const LPMD_RUN *run_a = a;
+    const LPMD_RUN *run_b = b;
+
+    if (run_a->phys_address != run_b->phys_address)
+        return run_a->phys_address < run_b->phys_address ? -1 : 1;
+    return 0;
+}
+
+/* dump_write_table - write a table at offset, padded to a page
+ *
+ * Returns the padded size, or -errno
+ */
+static int64_t dump_write_table(PDUMP dump, const void *table, uint64_t size,
+                                uint64_t offset)
+{
+    uint64_t padded_size =
+        (size + LPMD_PAGE_SIZE - 1) & ~(uint64_t)(LPMD_PAGE_SIZE - 1);
+    void *buf;
+    int ret;
+
+    if (!padded_size)
+        return 0;
+
+    if (posix_memalign(&buf, LPMD_PAGE_SIZE, padded_size))
+        return -ENOMEM;
+    memset(buf, 0, padded_size);
+    memcpy(buf, table, size);
+
+    ret = writer_write(&dump->writer, buf, padded_size, offset);
+    free(buf);
+
+    return ret ? ret : (int64_t)padded_size;
+}
+
+/* dump_finish - write the run index, the vmaps and the header */
+static int dump_finish(PDUMP dump)
+{
+    int64_t written;
+    void *buf;
+    int ret;
+
+    dump->header.index_offset =
+        dump->header.data_offset +
+        dump->header.stored_pages * LPMD_PAGE_SIZE;
+
+    // Readers search the runs, and a free page pass adds its runs late.
+    qsort(dump->runs, dump->header.run_count, sizeof(LPMD_RUN), compare_runs);
+
+    written = dump_write_table(dump, dump->runs,
+                               dump->header.run_count * sizeof(LPMD_RUN),
+                               dump->header.index_offset);
+    if (written < 0)
+        return written;
+
+    if (dump->header.flags & LPMD_FLAG_PROCESS) {
+        dump->header.vmap_offset = dump->header.index_offset + written;
+
+        written = dump_write_table(dump, dump->vmaps,
+                                   dump->header.vmap_count * sizeof(LPMD_VMAP),
+                                   dump->header.vmap_offset);
+        if (written < 0)
+            return written;
+    }
+
+    if (posix_memalign(&buf, LPMD_PAGE_SIZE, LPMD_PAGE_SIZE))
+        return -ENOMEM;
+    memset(buf, 0, LPMD_PAGE_SIZE);
+    memcpy(buf, &dump->header, sizeof(LPMD_HEADER));
+
+    ret = writer_write(&dump->writer, buf, LPMD_PAGE_SIZE, 0);
+    free(buf);
+
+    return ret;
+}
+
+/* dump_set_base_path - record the base of a delta image
+ *
+ * The path is stored relative to the output if both live in the same
+ * directory, so that the pair can be moved together.
+ */
+static int dump_set_base_path(PDUMP dump, const char *output, const char *base)
+{
+    char *base_real = realpath(base, NULL);
+    char *output_real = realpath(output, NULL);
+    char *base_copy = NULL;
+    const char *path;
+    const char *dir;
+    int ret = 0;
+
+    if (!base_real || !output_real) {
+        ret = -errno;
+        goto out;
+    }
+
+    base_copy = strdup(base_real);
+    if (!base_copy) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    path = base_real;
+    dir = dirname(base_copy);
+    if (!strcmp(dir, dirname(output_real))) {
+        // Only the root directory ends with a slash.
+        path = base_real + strlen(dir) + (dir[1] ? 1 : 0);
+    }
+
+    if (strlen(path) >= LPMD_BASE_PATH_SIZE) {
+        ret = -ENAMETOOLONG;
+        goto out;
+    }
+
+    strcpy(dump->header.base_path, path);
+    dump->header.flags |= LPMD_FLAG_DELTA;
+
+out:
+    free(base_copy);
+    free(output_real);
+    free(base_real);
+    return ret;
+}
+
+static void dump_print_stats(PDUMP dump)
+{
+    PLPMD_HEADER header = &dump->header;
+    PWRITER_STATS stats = &dump->writer.stats;
+    uint64_t nonzero = header->total_pages - header->zero_pages -
+                       header->unreadable_pages - header->free_pages;
+
+    printf("pages:      %" PRIu64 " (%" PRIu64 " MiB)\n", header->total_pages,
+           header->total_pages * LPMD_PAGE_SIZE >> 20);
+    printf("zero:       %" PRIu64 "\n", header->zero_pages);
+    printf("unreadable: %" PRIu64 "\n", header->unreadable_pages);
+    if (dump->skip_free)
+        printf("free:       %" PRIu64 " (%" PRIu64 " MiB not acquired)\n",
+               header->free_pages, header->free_pages * LPMD_PAGE_SIZE >> 20);
+    if (dump->free_pass)
+        printf("free, non-zero: %" PRIu64 " pages read in the free pass\n",
+               dump->free_pages_stored);
+    printf("duplicates: %" PRIu64 " (dedup hit rate %.2f%% of non-zero)\n",
+           header->duplicate_pages,
+           nonzero ? 100.0 * header->duplicate_pages / nonzero : 0.0);
+    printf("stored:     %" PRIu64 " pages in %" PRIu64 " runs\n",
+           header->stored_pages, header->run_count);
+    if (dump->use_dedup)
+        printf("hash collisions: %" PRIu64 "\n", dump->dedup.collisions);
+    if (header->flags & LPMD_FLAG_DELTA)
+        printf("chunks:     %" PRIu64 " changed, %" PRIu64
+               " unchanged since %s\n",
+               header->changed_chunks, header->unchanged_chunks,
+               header->base_path);
+    if (header->flags & LPMD_FLAG_PROCESS)
+        printf("process:    %" PRIu64 ", %" PRIu64 " virtual runs\n",
+               header->process_id, header->vmap_count);
+    printf("written:    %" PRIu64 " MiB\n", dump->writer.bytes_written >> 20);
+    if (stats->writes) {
+        printf("writes:     %" PRIu64 ", latency %" PRIu64 " us average, p99 < %"
+               PRIu64 " us, max %" PRIu64 " us\n",
+               stats->writes, stats->latency_ns / stats->writes / 1000,
+               writer_latency_us(stats, 99), stats->max_latency_ns / 1000);
+        printf("queue:      %.1f writes in flight on average, %u at most, %"
+               PRIu64 " waits for a buffer\n",
+               (double)stats->occupancy / stats->submissions, stats->max_in_flight,
+               stats->stalls);
+    }
+}
+
+/* dump_resume - take over the state of an interrupted acquisition
+ *
+ * The journal also has the options it was started with, they apply again.
+ */
+static int dump_resume(PDUMP dump, const char *output, PRAM_RANGE *ranges,
+                       size_t *range_count)
+{
+    char *path;
+    int ret;
+
+    path = journal_path(output);
+    if (!path)
+        return -ENOMEM;
+
+    ret = journal_open(&dump->journal, path, true, dump_replay_chunk, dump);
+    free(path);
+    if (ret)
+        return ret;
+
+    dump->journaling = true;
+    dump->skip_free = dump->journal.header.flags & LPMD_JOURNAL_SKIP_FREE;
+    dump->use_dedup = !(dump->journal.header.flags & LPMD_JOURNAL_NO_DEDUP);
+
+    *range_count = dump->journal.header.range_count;
+    *ranges = calloc(*range_count ? *range_count : 1, sizeof(RAM_RANGE));
+    if (!*ranges)
+        return -ENOMEM;
+    memcpy(*ranges, dump->journal.ranges, *range_count * sizeof(RAM_RANGE));
+
+    return 0;
+}
+
+/* dump_start_journal - record what this acquisition is going to do */
+static int dump_start_journal(PDUMP dump, const char *output,
+                              const char *base, PRAM_RANGE ranges,
+                              size_t range_count)
+{
+    LPMD_JOURNAL_HEADER header = { 0 };
+    char *base_real;
+    char *path;
+    int ret;
+
+    header.range_count = range_count;
+    header.chunk_size = dump->digests.chunk_size;
+    if (dump->skip_free)
+        header.flags |= LPMD_JOURNAL_SKIP_FREE;
+    if (!dump->use_dedup)
+        header.flags |= LPMD_JOURNAL_NO_DEDUP;
+
+    if (base) {
+        base_real = realpath(base, NULL);
+        if (!base_real)
+            return -errno;
+        if (strlen(base_real) >= LPMD_BASE_PATH_SIZE) {
+            free(base_real);
+            return -ENAMETOOLONG;
+        }
+        strcpy(header.base_path, base_real);
+        free(base_real);
+    }
+
+    path = journal_path(output);
+    if (!path)
+        return -ENOMEM;
+
+    ret = journal_create(&dump->journal, path, &header,
+                         (PLPMD_JOURNAL_RANGE)ranges);
+    free(path);
+
+    return ret;
+}
+
+/* dump_end_journal - the image is complete, the journal can go */
+static int dump_end_journal(PDUMP dump, const char *output)
+{
+    char *path;
+    int ret = 0;
+
+    journal_close(&dump->journal);
+
+    path = journal_path(output);
+    if (!path)
+        return -ENOMEM;
+
+    if (unlink(path))
+        ret = -errno;
+    free(path);
+
+    return ret;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s -o OUTPUT [OPTIONS]\n"
+            "  -o, --output FILE   LPMD file to write\n"
+            "  -d, --device PATH   Linpmem device (default: %s)\n"
+            "  -s, --slots N       Page ring slots (default: %d)\n"
+            "      --numa          Use NUMA-local ring workers\n"
+            "      --no-dedup      Store duplicate pages again\n"
+            "  -c, --chunk-size N  Digest chunk size in bytes (default: %d)\n"
+            "  -b, --base FILE     Only store chunks changed since FILE\n"
+            "  -p, --pid PID       Only acquire the memory of process PID\n"
+            "      --skip-free     Do not read pages the allocator has free\n"
+            "      --free-pass     Read the free pages last, store non-zero "
+            "ones\n"
+            "  -r, --range S-E     Only acquire physical addresses S to E\n"
+            "  -j, --journal       Record progress, to resume if interrupted\n"
+            "  -R, --resume        Go on with an interrupted --journal "
+            "acquisition\n"
+            "                      (with the options it was started with)\n"
+            "      --direct        Write with O_DIRECT and io_uring, not "
+            "through the\n"
+            "                      page cache\n"
+            "  -q, --queue-depth N Direct writes in flight (default: %d, "
+            "implies --direct)\n",
+            name, DEFAULT_DEVICE, DEFAULT_SLOTS, DEFAULT_CHUNK_SIZE,
+            DEFAULT_QUEUE_DEPTH);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "output", required_argument, NULL, 'o' },
+        { "device", required_argument, NULL, 'd' },
+        { "slots", required_argument, NULL, 's' },
+        { "numa", no_argument, NULL, 'n' },
+        { "no-dedup", no_argument, NULL, 'D' },
+        { "chunk-size", required_argument, NULL, 'c' },
+        { "base", required_argument, NULL, 'b' },
+        { "pid", required_argument, NULL, 'p' },
+        { "skip-free", no_argument, NULL, 'f' },
+        { "free-pass", no_argument, NULL, 'F' },
+        { "range", required_argument, NULL, 'r' },
+        { "journal", no_argument, NULL, 'j' },
+        { "resume", no_argument, NULL, 'R' },
+        { "direct", no_argument, NULL, 'O' },
+        { "queue-depth", required_argument, NULL, 'q' },
+        { "help", no_argument, NULL, 'h' },
+        { 0 }
+    };
+    const char *output = NULL;
+    const char *device = DEFAULT_DEVICE;
+    const char *base = NULL;
+    bool process = false;
+    bool resume = false;
+    uint64_t pid = 0;
+    uint64_t range_start = 0;
+    uint64_t range_end = UINT64_MAX;
+    RAM_RANGE range;
+    char *end;
+    char *tail;
+    uint64_t chunk_size = DEFAULT_CHUNK_SIZE;
+    char *path;
+    uint32_t slots = DEFAULT_SLOTS;
+    uint32_t queue_depth = 0;
+    uint32_t ring_flags = 0;
+    RING_READER reader = { 0 };
+    PRAM_RANGE ranges = NULL;
+    size_t range_count = 0;
+    DUMP dump = { 0 };
+    size_t i;
+    int opt;
+    int ret;
+
+    dump.use_dedup = true;
+
+    while ((opt = getopt_long(argc, argv, "o:d:s:c:b:p:r:jRq:h", options,
+                              NULL)) != -1) {
+        switch (opt) {
+        case 'o':
+            output = optarg;
+            break;
+        case 'd':
+            device = optarg;
+            break;
+        case 's':
+            slots = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            ring_flags |= LINPMEM_RING_NUMA_LOCAL;
+            break;
+        case 'D':
+            dump.use_dedup = false;
+            break;
+        case 'c':
+            chunk_size = strtoull(optarg, NULL, 0);
+            break;
+        case 'b':
+            base = optarg;
+            break;
+        case 'p':
+            pid = strtoull(optarg, NULL, 0);
+            process = true;
+            break;
+        case 'f':
+            dump.skip_free = true;
+            break;
+        case 'F':
+            dump.skip_free = true;
+            dump.free_pass = true;
+            break;
+        case 'r':
+            range_start = strtoull(optarg, &end, 0);
+            if (end == optarg || *end != '-') {
+                usage(argv[0]);
+                return 1;
+            }
+            range_end = strtoull(end + 1, &tail, 0);
+            if (tail == end + 1 || *tail || range_start > range_end) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'j':
+            dump.journaling = true;
+            break;
+        case 'R':
+            resume = true;
+            break;
+        case 'O':
+            if (!queue_depth)
+                queue_depth = DEFAULT_QUEUE_DEPTH;
+            break;
+        case 'q':
+            queue_depth = strtoul(optarg, NULL, 0);
+            if (!queue_depth || queue_depth > WRITER_MAX_QUEUE_DEPTH) {
+                fprintf(stderr, "The queue depth is 1 to %d.\n",
+                        WRITER_MAX_QUEUE_DEPTH);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!output || !slots || slots > LINPMEM_RING_MAX_SLOTS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Process memory is in use by definition. A delta would compare the
+    // free pages read by the pass against the base.
+    if (dump.skip_free && (process || (dump.free_pass && base))) {
+        fprintf(stderr, "--skip-free does not go with --pid, --free-pass "
+                        "not with --base.\n");
+        return 1;
+    }
+
+    // Journaled are the chunks of physical memory, not the page tables of a
+    // process or a pass over the free pages.
+    if ((dump.journaling || resume) && (process || dump.free_pass)) {
+        fprintf(stderr, "--journal and --resume do not go with --pid or "
+                        "--free-pass.\n");
+        return 1;
+    }
+
+    if (resume) {
+        ret = dump_resume(&dump, output, &ranges, &range_count);
+        if (ret) {
+            fprintf(stderr, "Resuming from the journal of %s failed: %s\n",
+                    output, strerror(-ret));
+            return 1;
+        }
+        chunk_size = dump.journal.header.chunk_size;
+        base = dump.journal.header.base_path[0] ?
+                   dump.journal.header.base_path :
+                   NULL;
+        printf("Resuming at %#" PRIx64 ", %" PRIu64 " pages done\n",
+               dump.resume_address, dump.header.total_pages);
+    }
+
+    if (base) {
+        // A delta must use the chunking of its base.
+        path = digests_path(base);
+        ret = path ? digests_load(&dump.base_digests, path) : -ENOMEM;
+        if (ret) {
+            fprintf(stderr, "Loading the digests of %s failed: %s\n", base,
+                    strerror(-ret));
+            return 1;
+        }
+        free(path);
+        chunk_size = dump.base_digests.chunk_size;
+    }
+
+    if (!chunk_size || chunk_size % LPMD_PAGE_SIZE) {
+        fprintf(stderr, "The chunk size must be a multiple of %d.\n",
+                LPMD_PAGE_SIZE);
+        return 1;
+    }
+
+    // Chunks are read through the ring in one go.
+    if (slots < chunk_size / LPMD_PAGE_SIZE)
+        slots = chunk_size / LPMD_PAGE_SIZE;
+    if (slots > LINPMEM_RING_MAX_SLOTS) {
+        fprintf(stderr, "The chunk size exceeds the page ring.\n");
+        return 1;
+    }
+
+    dump.digests.chunk_size = chunk_size;
+    dump.zero_hash = xxh64(zero_page, LPMD_PAGE_SIZE, 0);
+    dump.page_hashes = calloc(slots, sizeof(uint64_t));
+    dump.page_slots = calloc(slots, sizeof(uint32_t));
+    if (!dump.page_hashes || !dump.page_slots) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    ret = ring_reader_open(&reader, device, slots, ring_flags);
+    if (ret) {
+        fprintf(stderr, "Setting up the page ring on %s failed: %s\n", device,
+                strerror(-ret));
+        return 1;
+    }
+
+    // A resumed acquisition has the ranges of its journal.
+    if (process) {
+        ret = read_process_runs(&dump, reader.dev, pid);
+        if (!ret)
+            ret = process_ranges(&dump, &ranges, &range_count);
+        if (ret) {
+            fprintf(stderr, "Walking the page tables of %" PRIu64
+                    " failed: %s\n", pid, strerror(-ret));
+            return 1;
+        }
+        printf("Acquiring %zu physical ranges of process %" PRIu64 "\n",
+               range_count, pid);
+    } else if (!resume) {
+        ret = read_ram_ranges(&ranges, &range_count);
+        if (ret) {
+            fprintf(stderr, "Reading /proc/iomem failed: %s\n",
+                    strerror(-ret));
+            return 1;
+        }
+        clip_ranges(ranges, &range_count, range_start, range_end);
+    }
+
+    ret = resume ? writer_reopen(&dump.writer, output, queue_depth) :
+                   writer_open(&dump.writer, output, queue_depth);
+    if (ret) {
+        fprintf(stderr, "Opening %s failed: %s\n", output, strerror(-ret));
+        return 1;
+    }
+
+    if (dump.use_dedup &&
+        dedup_init(&dump.dedup, dump_read_stored_page, &dump)) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    memcpy(dump.header.magic, LPMD_MAGIC, sizeof(dump.header.magic));
+    dump.header.version = LPMD_VERSION;
+    dump.header.page_size = LPMD_PAGE_SIZE;
+    dump.header.data_offset = LPMD_PAGE_SIZE;
+    dump.header.chunk_size = chunk_size;
+
+    if (resume && dump.use_dedup) {
+        ret = dump_rebuild_dedup(&dump);
+        if (ret) {
+            fprintf(stderr, "Reading back %s failed: %s\n", output,
+                    strerror(-ret));
+            return 1;
+        }
+    }
+
+    if (base) {
+        ret = dump_set_base_path(&dump, output, base);
+        if (ret) {
+            fprintf(stderr, "Recording base %s failed: %s\n", base,
+                    strerror(-ret));
+            return 1;
+        }
+    }
+
+    if (dump.journaling && !resume) {
+        ret = dump_start_journal(&dump, output, base, ranges, range_count);
+        if (ret) {
+            fprintf(stderr, "Creating the journal of %s failed: %s\n",
+                    output, strerror(-ret));
+            return 1;
+        }
+    }
+
+    for (i = 0; i < range_count && !ret; i++) {
+        // A resumed acquisition goes on after the last chunk done.
+        range = ranges[i];
+        if (range.end < dump.resume_address)
+            continue;
+        if (range.start < dump.resume_address)
+            range.start = dump.resume_address;
+
+        if (!process)
+            printf("Acquiring %#" PRIx64 "-%#" PRIx64 "\n", range.start,
+                   range.end);
+        ret = dump_range(&dump, &reader, &range);
+    }
+
+    if (!ret && dump.free_pass) {
+        printf("Acquiring %" PRIu64 " free runs\n", dump.free_run_count);
+        ret = dump_free_pass(&dump, &reader);
+    }
+
+    if (!ret)
+        ret = dump_finish(&dump);
+
+    if (!ret)
+        ret = writer_close(&dump.writer);
+
+    if (!ret) {
+        path = digests_path(output);
+        ret = path ? digests_save(&dump.digests, path) : -ENOMEM;
+        free(path);
+    }
+
+    if (!ret && dump.journaling)
+        ret = dump_end_journal(&dump, output);
+
+    if (ret) {
+        fprintf(stderr, "Acquisition failed: %s\n", strerror(-ret));
+        return 1;
+    }
+
+    dump_print_stats(&dump);
+
+    if (dump.use_dedup)
+        dedup_free(&dump.dedup);
+    ring_reader_close(&reader);
+    digests_free(&dump.digests);
+    digests_free(&dump.base_digests);
+    free(dump.page_hashes);
+    free(dump.page_slots);
+    free(dump.free_runs);
+    free(dump.vmaps);
+    free(dump.runs);
+    free(ranges);
+
+    return 0;
+}
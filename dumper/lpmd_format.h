@@ -0,0 +1,242 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+// ############################################################################
+// # LPMD: the Linpmem dump format					      #
+// ############################################################################
+
+/* An LPMD file is laid out in pages (LPMD_PAGE_SIZE):
+ *
+ *   page 0			LPMD_HEADER (rest of the page is zero)
+ *   data_offset		stored_pages unique page contents, one per page
+ *   index_offset		run_count LPMD_RUN entries (padded to a page)
+ *   vmap_offset		vmap_count LPMD_VMAP entries (process images only)
+ *
+ * Physical memory is described by the runs. A run covers page_count
+ * consecutive physical pages of the same kind. For LPMD_RUN_DATA, the
+ * contents of the n-th page of the run are stored page (data_index + n).
+ *
+ * Every page content is stored only once: pages with the same contents as an
+ * earlier page (dedup hits) simply reference the stored page of the earlier
+ * one. Zero pages and unreadable pages are not stored at all.
+ *
+ * Free pages (LPMD_RUN_FREE) were in the free lists of the kernel's page
+ * allocator at the time of acquisition, and were not read: their contents
+ * are unknown, they read as zeros. With a free page pass, only the free
+ * pages that turned out to be zero are described that way, the others are
+ * stored like any page.
+ *
+ * Physical ranges that are not described by any run were not acquired
+ * (e.g., they are no "System RAM").
+ *
+ * Differential acquisition: physical memory is also cut into chunks of
+ * chunk_size bytes, and every acquisition writes the digests of all chunks
+ * into a sidecar file (<image>.digests, see LPMD_DIGEST_HEADER). A delta
+ * image (LPMD_FLAG_DELTA) is taken against such a previous acquisition, its
+ * base: chunks whose digest did not change are not stored again, but
+ * described by LPMD_RUN_BASE runs. Their contents are found in the base
+ * image at the same physical address. Bases can be delta images themselves.
+ *
+ * Process images (LPMD_FLAG_PROCESS) only contain the physical pages mapped
+ * by one process. The LPMD_VMAP entries map its virtual address space onto
+ * them; they are sorted by virtual address.
+ */
+
+#ifndef _LPMD_FORMAT_H_
+#define _LPMD_FORMAT_H_
+
+#include <stdint.h>
+
+#define LPMD_MAGIC "LPMD"
+#define LPMD_VERSION (1)
+#define LPMD_PAGE_SIZE (4096)
+
+typedef enum _LPMD_RUN_TYPE {
+	// Contents are stored in the data area (possibly shared with others).
+	LPMD_RUN_DATA = 1,
+	// All bytes are zero.
+	LPMD_RUN_ZERO = 2,
+	// The driver could not read these pages.
+	LPMD_RUN_UNREADABLE = 3,
+	// Unchanged since the base image, look there (delta images only).
+	LPMD_RUN_BASE = 4,
+	// Free pages, not acquired. Read as zeros.
+	LPMD_RUN_FREE = 5
+} LPMD_RUN_TYPE;
+
+// Header flags.
+// This is a delta image, base_path names its base.
+#define LPMD_FLAG_DELTA (1 << 0)
+// This is the memory of one process, see LPMD_VMAP.
+#define LPMD_FLAG_PROCESS (1 << 1)
+
+#define LPMD_BASE_PATH_SIZE (256)
+
+typedef struct _LPMD_HEADER {
+	char magic[4];
+	uint32_t version;
+	uint32_t page_size;
+	uint32_t flags;
+
+	// Offset of the first stored page.
+	uint64_t data_offset;
+	// Number of stored (unique) pages.
+	uint64_t stored_pages;
+
+	// Offset and number of LPMD_RUN entries.
+	uint64_t index_offset;
+	uint64_t run_count;
+
+	// Statistics. total_pages counts all pages described by the runs.
+	uint64_t total_pages;
+	uint64_t zero_pages;
+	uint64_t duplicate_pages;
+	uint64_t unreadable_pages;
+
+	// Size of the chunks of the digest sidecar.
+	uint64_t chunk_size;
+
+	// Delta images: chunks stored, and chunks unchanged since the base.
+	uint64_t changed_chunks;
+	uint64_t unchanged_chunks;
+
+	// Delta images: path of the base image. Relative paths are relative to
+	// the directory of this image.
+	char base_path[LPMD_BASE_PATH_SIZE];
+
+	// Process images: the process, and its page tables at the time.
+	uint64_t process_id;
+	uint64_t process_cr3;
+
+	// Process images: offset and number of LPMD_VMAP entries.
+	uint64_t vmap_offset;
+	uint64_t vmap_count;
+
+	// Statistics: pages described by LPMD_RUN_FREE runs.
+	uint64_t free_pages;
+} LPMD_HEADER, *PLPMD_HEADER;
+
+typedef struct _LPMD_RUN {
+	// Physical address of the first page of the run.
+	uint64_t phys_address;
+
+	// Number of pages in the run.
+	uint64_t page_count;
+
+	// See LPMD_RUN_TYPE.
+	uint32_t type;
+
+	uint32_t reserved;
+
+	// LPMD_RUN_DATA only: stored page of the first page of the run.
+	uint64_t data_index;
+} LPMD_RUN, *PLPMD_RUN;
+
+/* Virtual memory that is contiguous in physical memory as well. The same
+ * as LINPMEM_VIRT_RUN.
+ */
+typedef struct _LPMD_VMAP {
+	uint64_t virt_address;
+	uint64_t phys_address;
+	uint64_t size;
+
+	// LINPMEM_VIRT_RUN_* flags.
+	uint64_t flags;
+} LPMD_VMAP, *PLPMD_VMAP;
+
+// ############################################################################
+// # Digest sidecar (<image>.digests)					      #
+// ############################################################################
+
+#define LPMD_DIGEST_MAGIC "LPMG"
+#define LPMD_DIGEST_VERSION (1)
+
+/* The file is an LPMD_DIGEST_HEADER, followed by chunk_count
+ * LPMD_CHUNK_DIGEST entries, sorted by physical address.
+ */
+typedef struct _LPMD_DIGEST_HEADER {
+	char magic[4];
+	uint32_t version;
+	uint64_t chunk_size;
+	uint64_t chunk_count;
+} LPMD_DIGEST_HEADER, *PLPMD_DIGEST_HEADER;
+
+/* A chunk starts at a multiple of chunk_size, but can be shorter at the
+ * edges of a RAM range.
+ * digest is the xxh64 over the xxh64s of the chunk's pages (0 for an
+ * unreadable page).
+ */
+typedef struct _LPMD_CHUNK_DIGEST {
+	uint64_t phys_address;
+	uint32_t page_count;
+	uint32_t reserved;
+	uint64_t digest;
+} LPMD_CHUNK_DIGEST, *PLPMD_CHUNK_DIGEST;
+
+// ############################################################################
+// # Journal sidecar (<image>.journal)					      #
+// ############################################################################
+
+#define LPMD_JOURNAL_MAGIC "LPMJ"
+#define LPMD_JOURNAL_VERSION (1)
+
+/* A journaled acquisition keeps <image>.journal while it runs, and removes
+ * it once the image is complete. The file is an LPMD_JOURNAL_HEADER, the
+ * range_count LPMD_JOURNAL_RANGEs to acquire, then one LPMD_JOURNAL_CHUNK
+ * per chunk acquired, in ascending order, each followed by its run_count
+ * LPMD_RUNs.
+ *
+ * A chunk is only journaled once its pages are on disk. Everything below
+ * the end of the last valid chunk record is done: an interrupted dump goes
+ * on from there, overwriting whatever was stored after stored_pages. A
+ * trailing record with a bad checksum was torn, and is dropped.
+ */
+
+// Journal flags: the options of the acquisition.
+#define LPMD_JOURNAL_SKIP_FREE (1 << 0)
+#define LPMD_JOURNAL_NO_DEDUP (1 << 1)
+
+typedef struct _LPMD_JOURNAL_HEADER {
+	char magic[4];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t range_count;
+	uint64_t chunk_size;
+
+	// Delta images: absolute path of the base image, else empty.
+	char base_path[LPMD_BASE_PATH_SIZE];
+} LPMD_JOURNAL_HEADER, *PLPMD_JOURNAL_HEADER;
+
+// A physical range to acquire, end inclusive (as in /proc/iomem).
+typedef struct _LPMD_JOURNAL_RANGE {
+	uint64_t start;
+	uint64_t end;
+} LPMD_JOURNAL_RANGE, *PLPMD_JOURNAL_RANGE;
+
+typedef struct _LPMD_JOURNAL_CHUNK {
+	// The chunk, and its digest (see LPMD_CHUNK_DIGEST).
+	uint64_t phys_address;
+	uint32_t page_count;
+	uint32_t run_count;
+	uint64_t digest;
+
+	// The runs that follow replace all runs from index first_run on: the
+	// first page of a chunk might have extended the last run before.
+	uint64_t first_run;
+
+	// The LPMD_HEADER statistics after this chunk.
+	uint64_t stored_pages;
+	uint64_t total_pages;
+	uint64_t zero_pages;
+	uint64_t duplicate_pages;
+	uint64_t unreadable_pages;
+	uint64_t free_pages;
+	uint64_t changed_chunks;
+	uint64_t unchanged_chunks;
+
+	// xxh64 over this record (with checksum 0) and its runs.
+	uint64_t checksum;
+} LPMD_JOURNAL_CHUNK, *PLPMD_JOURNAL_CHUNK;
+
+#endif
@@ -0,0 +1,168 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+// ### lpmd_journal: what is left of an interrupted acquisition.
+//
+// Reads the journal of a linpmem_dump --journal acquisition, and prints the
+// physical ranges that are still to be acquired. With a number of workers,
+// the rest is split into that many parts of about the same size, cut at
+// chunk boundaries, as --range options: each can go to another acquisition
+// (on the same host), instead of resuming this one.
+//
+// Usage:
+// ./lpmd_journal memory.lpmd
+// ./lpmd_journal memory.lpmd 4
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "journal.h"
+
+typedef struct {
+    uint64_t chunks;
+    uint64_t total_pages;
+    uint64_t stored_pages;
+    uint64_t resume_address;
+} PROGRESS, *PPROGRESS;
+
+static int count_chunk(void *context, PLPMD_JOURNAL_CHUNK record,
+                       PLPMD_RUN runs)
+{
+    PPROGRESS progress = context;
+
+    // Only resuming needs the runs of a chunk.
+    (void)runs;
+
+    progress->chunks++;
+    progress->total_pages = record->total_pages;
+    progress->stored_pages = record->stored_pages;
+    progress->resume_address =
+        record->phys_address + (uint64_t)record->page_count * LPMD_PAGE_SIZE;
+
+    return 0;
+}
+
+/* print_workers - split the rest into parts of about the same size
+ *
+ * Chunks are the unit: a part ends at the end of the chunk that makes it
+ * large enough.
+ */
+static void print_workers(PJOURNAL journal, uint64_t resume_address,
+                          uint64_t pending_pages, uint64_t workers)
+{
+    uint64_t chunk_size = journal->header.chunk_size;
+    uint64_t target = (pending_pages + workers - 1) / workers;
+    uint64_t part_start = UINT64_MAX;
+    uint64_t part_pages = 0;
+    uint64_t address;
+    uint64_t chunk_end;
+    PLPMD_JOURNAL_RANGE range;
+    uint32_t i;
+
+    for (i = 0; i < journal->header.range_count; i++) {
+        range = &journal->ranges[i];
+        if (range->end < resume_address)
+            continue;
+
+        address = range->start > resume_address ? range->start : resume_address;
+        address &= ~(uint64_t)(LPMD_PAGE_SIZE - 1);
+
+        while (address <= range->end) {
+            chunk_end = (address / chunk_size + 1) * chunk_size - 1;
+            if (chunk_end > range->end)
+                chunk_end = range->end;
+
+            if (part_start == UINT64_MAX)
+                part_start = address;
+            part_pages += (chunk_end - address) / LPMD_PAGE_SIZE + 1;
+
+            if (part_pages >= target) {
+                printf("--range %#" PRIx64 "-%#" PRIx64 "\n", part_start,
+                       chunk_end);
+                part_start = UINT64_MAX;
+                part_pages = 0;
+            }
+
+            address = chunk_end + 1;
+        }
+    }
+
+    if (part_start != UINT64_MAX)
+        printf("--range %#" PRIx64 "-%#" PRIx64 "\n", part_start,
+               journal->ranges[journal->header.range_count - 1].end);
+}
+
+int main(int argc, char **argv)
+{
+    PROGRESS progress = { 0 };
+    JOURNAL journal;
+    PLPMD_JOURNAL_RANGE range;
+    uint64_t pending_pages = 0;
+    uint64_t workers = 0;
+    uint64_t start;
+    char *path;
+    uint32_t i;
+    int ret;
+
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s IMAGE.lpmd [WORKERS]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc == 3) {
+        workers = strtoull(argv[2], NULL, 0);
+        if (!workers) {
+            fprintf(stderr, "At least one worker, please.\n");
+            return 1;
+        }
+    }
+
+    path = journal_path(argv[1]);
+    ret = path ? journal_open(&journal, path, false, count_chunk, &progress) :
+                 -ENOMEM;
+    if (ret) {
+        fprintf(stderr, "Reading the journal of %s failed: %s\n", argv[1],
+                strerror(-ret));
+        return 1;
+    }
+    free(path);
+
+    printf("chunk size: %" PRIu64 "\n", journal.header.chunk_size);
+    if (journal.header.base_path[0])
+        printf("base:       %s\n", journal.header.base_path);
+    printf("done:       %" PRIu64 " chunks, %" PRIu64 " pages (%" PRIu64
+           " stored)\n",
+           progress.chunks, progress.total_pages, progress.stored_pages);
+
+    if (!workers)
+        printf("left:\n");
+
+    for (i = 0; i < journal.header.range_count; i++) {
+        range = &journal.ranges[i];
+        if (range->end < progress.resume_address)
+            continue;
+
+        start = range->start > progress.resume_address ?
+                    range->start :
+                    progress.resume_address;
+        pending_pages += (range->end - start) / LPMD_PAGE_SIZE + 1;
+
+        if (!workers)
+            printf("  %#" PRIx64 "-%#" PRIx64 "\n", start, range->end);
+    }
+
+    printf("pending:    %" PRIu64 " pages (%" PRIu64 " MiB)\n", pending_pages,
+           pending_pages * LPMD_PAGE_SIZE >> 20);
+
+    if (workers && pending_pages)
+        print_workers(&journal, progress.resume_address, pending_pages,
+                      workers);
+
+    journal_close(&journal);
+
+    return 0;
+}
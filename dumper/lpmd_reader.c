@@ -0,0 +1,200 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lpmd_reader.h"
+
+// Protects against base chains that loop.
+#define LPMD_MAX_CHAIN_LENGTH (64)
+
+static int pread_full(int fd, void *buf, size_t size, uint64_t offset)
+{
+    ssize_t got;
+
+    while (size) {
+        got = pread(fd, buf, size, offset);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (got == 0)
+            return -EIO;
+
+        buf = (char *)buf + got;
+        size -= got;
+        offset += got;
+    }
+
+    return 0;
+}
+
+/* base_image_path - resolve the base path of a delta image (caller frees) */
+static char *base_image_path(const char *image_path, const char *base_path)
+{
+    char *dir_copy;
+    char *path;
+
+    if (base_path[0] == '/')
+        return strdup(base_path);
+
+    dir_copy = strdup(image_path);
+    if (!dir_copy)
+        return NULL;
+
+    path = malloc(strlen(dir_copy) + strlen(base_path) + 2);
+    if (path)
+        sprintf(path, "%s/%s", dirname(dir_copy), base_path);
+
+    free(dir_copy);
+    return path;
+}
+
+static int lpmd_open_chain(PLPMD_IMAGE image, const char *path, int depth)
+{
+    uint64_t index_size;
+    char *base_path;
+    int ret;
+
+    memset(image, 0, sizeof(*image));
+
+    if (depth > LPMD_MAX_CHAIN_LENGTH)
+        return -ELOOP;
+
+    image->fd = open(path, O_RDONLY);
+    if (image->fd < 0)
+        return -errno;
+
+    ret = pread_full(image->fd, &image->header, sizeof(LPMD_HEADER), 0);
+    if (ret)
+        goto error;
+
+    if (memcmp(image->header.magic, LPMD_MAGIC, sizeof(image->header.magic)) ||
+        image->header.version != LPMD_VERSION ||
+        image->header.page_size != LPMD_PAGE_SIZE) {
+        ret = -EINVAL;
+        goto error;
+    }
+
+    index_size = image->header.run_count * sizeof(LPMD_RUN);
+    image->runs = malloc(index_size ? index_size : 1);
+    if (!image->runs) {
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    ret = pread_full(image->fd, image->runs, index_size,
+                     image->header.index_offset);
+    if (ret)
+        goto error;
+
+    if (!(image->header.flags & LPMD_FLAG_DELTA))
+        return 0;
+
+    image->header.base_path[LPMD_BASE_PATH_SIZE - 1] = '\0';
+    base_path = base_image_path(path, image->header.base_path);
+    image->base = calloc(1, sizeof(LPMD_IMAGE));
+    if (!base_path || !image->base) {
+        free(base_path);
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    ret = lpmd_open_chain(image->base, base_path, depth + 1);
+    if (ret)
+        fprintf(stderr, "Opening base image %s failed: %s\n", base_path,
+                strerror(-ret));
+    free(base_path);
+    if (ret) {
+        free(image->base);
+        image->base = NULL;
+        goto error;
+    }
+
+    return 0;
+
+error:
+    free(image->runs);
+    close(image->fd);
+    memset(image, 0, sizeof(*image));
+    return ret;
+}
+
+int lpmd_open(PLPMD_IMAGE image, const char *path)
+{
+    return lpmd_open_chain(image, path, 0);
+}
+
+void lpmd_close(PLPMD_IMAGE image)
+{
+    if (image->base) {
+        lpmd_close(image->base);
+        free(image->base);
+    }
+
+    free(image->runs);
+    close(image->fd);
+    memset(image, 0, sizeof(*image));
+}
+
+PLPMD_RUN lpmd_find_run(PLPMD_IMAGE image, uint64_t phys_address)
+{
+    uint64_t lo = 0;
+    uint64_t hi = image->header.run_count;
+    uint64_t mid;
+    PLPMD_RUN run;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        run = &image->runs[mid];
+
+        if (phys_address < run->phys_address)
+            hi = mid;
+        else if (phys_address >=
+                 run->phys_address + run->page_count * LPMD_PAGE_SIZE)
+            lo = mid + 1;
+        else
+            return run;
+    }
+
+    return NULL;
+}
+
+int lpmd_read_page(PLPMD_IMAGE image, uint64_t phys_address, void *page)
+{
+    PLPMD_RUN run;
+    uint64_t n;
+
+    phys_address &= ~(uint64_t)(LPMD_PAGE_SIZE - 1);
+
+    run = lpmd_find_run(image, phys_address);
+    if (!run)
+        return -ENOENT;
+
+    switch (run->type) {
+    case LPMD_RUN_DATA:
+        n = (phys_address - run->phys_address) / LPMD_PAGE_SIZE;
+        return pread_full(image->fd, page, LPMD_PAGE_SIZE,
+                          image->header.data_offset +
+                              (run->data_index + n) * LPMD_PAGE_SIZE);
+    case LPMD_RUN_BASE:
+        if (!image->base)
+            return -EINVAL;
+        return lpmd_read_page(image->base, phys_address, page);
+    case LPMD_RUN_ZERO:
+    case LPMD_RUN_UNREADABLE:
+    case LPMD_RUN_FREE:
+        memset(page, 0, LPMD_PAGE_SIZE);
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
@@ -0,0 +1,35 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _LPMD_READER_H_
+#define _LPMD_READER_H_
+
+#include <stdint.h>
+
+#include "lpmd_format.h"
+
+/* An opened LPMD image, together with the chain of its base images. */
+typedef struct _LPMD_IMAGE {
+    int fd;
+    LPMD_HEADER header;
+    PLPMD_RUN runs;
+    struct _LPMD_IMAGE *base;
+} LPMD_IMAGE, *PLPMD_IMAGE;
+
+int lpmd_open(PLPMD_IMAGE image, const char *path);
+
+void lpmd_close(PLPMD_IMAGE image);
+
+/* lpmd_find_run - the run that describes phys_address, or NULL */
+PLPMD_RUN lpmd_find_run(PLPMD_IMAGE image, uint64_t phys_address);
+
+/* lpmd_read_page - read one page, following LPMD_RUN_BASE into the bases
+ *
+ * Zero and unreadable pages read as zeros.
+ *
+ * Returns 0, -ENOENT if the page was not acquired, or another -errno
+ */
+int lpmd_read_page(PLPMD_IMAGE image, uint64_t phys_address, void *page);
+
+#endif
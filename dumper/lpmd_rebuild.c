@@ -0,0 +1,138 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+// ### lpmd_rebuild: turns an LPMD image into a raw physical memory image.
+//
+// Delta images are resolved through their chain of base images, so the
+// result is the full memory of the acquisition the image was taken in.
+// The raw image is sparse: file offset == physical address, pages that are
+// zero (or were not acquired) are holes.
+//
+// Usage:
+// ./lpmd_rebuild memory.lpmd memory.raw
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lpmd_reader.h"
+
+static int pwrite_full(int fd, const void *buf, size_t size, uint64_t offset)
+{
+    ssize_t written;
+
+    while (size) {
+        written = pwrite(fd, buf, size, offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        buf = (const char *)buf + written;
+        size -= written;
+        offset += written;
+    }
+
+    return 0;
+}
+
+static int rebuild_run(PLPMD_IMAGE image, PLPMD_RUN run, int out, void *page,
+                       uint64_t *pages_written)
+{
+    uint64_t phys_address;
+    uint64_t i;
+    int ret;
+
+    // Holes in the raw image read as zeros anyway.
+    if (run->type == LPMD_RUN_ZERO || run->type == LPMD_RUN_UNREADABLE ||
+        run->type == LPMD_RUN_FREE)
+        return 0;
+
+    for (i = 0; i < run->page_count; i++) {
+        phys_address = run->phys_address + i * LPMD_PAGE_SIZE;
+
+        ret = lpmd_read_page(image, phys_address, page);
+        if (ret)
+            return ret;
+
+        ret = pwrite_full(out, page, LPMD_PAGE_SIZE, phys_address);
+        if (ret)
+            return ret;
+
+        (*pages_written)++;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    LPMD_IMAGE image;
+    PLPMD_RUN last;
+    uint64_t pages_written = 0;
+    uint64_t i;
+    void *page;
+    int out;
+    int ret;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s IMAGE.lpmd RAW_OUTPUT\n", argv[0]);
+        return 1;
+    }
+
+    ret = lpmd_open(&image, argv[1]);
+    if (ret) {
+        fprintf(stderr, "Opening %s failed: %s\n", argv[1], strerror(-ret));
+        return 1;
+    }
+
+    out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (out < 0) {
+        fprintf(stderr, "Opening %s failed: %s\n", argv[2], strerror(errno));
+        return 1;
+    }
+
+    page = malloc(LPMD_PAGE_SIZE);
+    if (!page) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    for (i = 0; i < image.header.run_count; i++) {
+        ret = rebuild_run(&image, &image.runs[i], out, page, &pages_written);
+        if (ret) {
+            fprintf(stderr, "Rebuilding run at %#" PRIx64 " failed: %s\n",
+                    image.runs[i].phys_address, strerror(-ret));
+            return 1;
+        }
+    }
+
+    // Trailing zero runs still belong to the image.
+    if (image.header.run_count) {
+        last = &image.runs[image.header.run_count - 1];
+        if (ftruncate(out,
+                      last->phys_address + last->page_count * LPMD_PAGE_SIZE)) {
+            fprintf(stderr, "Extending %s failed: %s\n", argv[2],
+                    strerror(errno));
+            return 1;
+        }
+    }
+
+    if (close(out)) {
+        fprintf(stderr, "Closing %s failed: %s\n", argv[2], strerror(errno));
+        return 1;
+    }
+
+    printf("%" PRIu64 " pages written\n", pages_written);
+
+    free(page);
+    lpmd_close(&image);
+
+    return 0;
+}
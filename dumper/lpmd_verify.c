@@ -0,0 +1,169 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+// ### lpmd_verify: does live memory still match an acquisition?
+//
+// Hands the chunk digests of an acquisition (memory.lpmd.digests) to the
+// driver, which hashes the same chunks of live memory and returns only those
+// that differ. Only the digests cross the ioctl boundary, not the pages.
+//
+// Chunks with free pages skipped by the acquisition (--skip-free) differ,
+// as their pages were not hashed then.
+//
+// Exit status: 0 if all chunks match, 2 if some differ, 1 on error.
+//
+// Usage:
+// sudo ./lpmd_verify memory.lpmd
+// sudo ./lpmd_verify -d /dev/linpmem memory.lpmd
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "../userspace_interface/linpmem_shared.h"
+#include "digests.h"
+
+#define DEFAULT_DEVICE "/dev/" LINPMEM_DEVICE_NAME
+
+// Chunks per ioctl, so progress shows and a signal stops soon.
+#define VERIFY_BATCH (1024)
+
+_Static_assert(sizeof(LPMD_CHUNK_DIGEST) == sizeof(LINPMEM_CHUNK_DIGEST),
+               "LPMD_CHUNK_DIGEST must match LINPMEM_CHUNK_DIGEST");
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-d DEVICE] IMAGE.lpmd\n", name);
+}
+
+/* verify_batch - compare count chunks, printing the ones that differ
+ *
+ * Returns 0, or negative error
+ */
+static int verify_batch(int dev, PLINPMEM_CHUNK_DIGEST chunks, uint32_t count,
+                        PLINPMEM_CHUNK_DIGEST results, uint64_t *mismatches,
+                        uint64_t *unreadable_pages)
+{
+    LINPMEM_DIGEST digest = { 0 };
+    uint32_t done = 0;
+    uint32_t i;
+
+    while (done < count) {
+        digest.chunks = chunks + done;
+        digest.chunk_count = count - done;
+        digest.results = results;
+        digest.max_results = VERIFY_BATCH;
+        digest.flags = LINPMEM_DIGEST_COMPARE;
+
+        if (ioctl(dev, IOCTL_LINPMEM_DIGEST, &digest))
+            return -errno;
+
+        for (i = 0; i < digest.result_count; i++)
+            printf("%#" PRIx64 "-%#" PRIx64 " differs%s\n",
+                   results[i].phys_address,
+                   results[i].phys_address +
+                       (uint64_t)results[i].page_count * LPMD_PAGE_SIZE - 1,
+                   results[i].flags & LINPMEM_DIGEST_UNREADABLE ?
+                       " (unreadable pages)" :
+                       "");
+
+        *mismatches += digest.result_count;
+        *unreadable_pages += digest.pages_unreadable;
+
+        // Neither hashed nor full: a signal.
+        if (!digest.resume_index && !digest.result_count)
+            return -EINTR;
+        done += digest.resume_index;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *device = DEFAULT_DEVICE;
+    PLINPMEM_CHUNK_DIGEST results = NULL;
+    DIGEST_LIST digests;
+    uint64_t unreadable_pages = 0;
+    uint64_t mismatches = 0;
+    uint64_t done;
+    uint32_t count;
+    char *path;
+    int dev = -1;
+    int ret;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+        case 'd':
+            device = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    path = digests_path(argv[optind]);
+    ret = path ? digests_load(&digests, path) : -ENOMEM;
+    free(path);
+    if (ret) {
+        fprintf(stderr, "Loading the digests of %s failed: %s\n", argv[optind],
+                strerror(-ret));
+        return 1;
+    }
+
+    results = calloc(VERIFY_BATCH, sizeof(LINPMEM_CHUNK_DIGEST));
+    if (!results) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    dev = open(device, O_RDONLY);
+    if (dev < 0) {
+        ret = -errno;
+        fprintf(stderr, "Opening %s failed: %s\n", device, strerror(-ret));
+        goto out;
+    }
+
+    for (done = 0; done < digests.count; done += count) {
+        count = digests.count - done > VERIFY_BATCH ? VERIFY_BATCH :
+                                                      digests.count - done;
+
+        ret = verify_batch(dev,
+                           (PLINPMEM_CHUNK_DIGEST)(digests.chunks + done),
+                           count, results, &mismatches, &unreadable_pages);
+        if (ret) {
+            fprintf(stderr, "Hashing at %#" PRIx64 " failed: %s\n",
+                    digests.chunks[done].phys_address, strerror(-ret));
+            goto out;
+        }
+    }
+
+    printf("%" PRIu64 " of %" PRIu64 " chunks differ, %" PRIu64
+           " pages unreadable\n",
+           mismatches, digests.count, unreadable_pages);
+
+out:
+    if (dev >= 0)
+        close(dev);
+    free(results);
+    digests_free(&digests);
+
+    if (ret)
+        return 1;
+
+    return mismatches ? 2 : 0;
+}
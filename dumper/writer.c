@@ -0,0 +1,647 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+// O_DIRECT
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+#include "writer.h"
+
+typedef enum {
+    BUFFER_FREE = 0,
+    BUFFER_FILLING,
+    BUFFER_IN_FLIGHT
+} BUFFER_STATE;
+
+/* A buffer of direct writes.
+ * offset, size	Where its data goes in the file, size grows while filling.
+ * done		Bytes written so far, a short write is submitted again for
+ *		the rest (from the last aligned offset).
+ * submitted_ns	When it was first submitted, for the latency.
+ */
+typedef struct {
+    uint8_t *data;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t done;
+    BUFFER_STATE state;
+    uint64_t submitted_ns;
+} WRITER_BUFFER, *PWRITER_BUFFER;
+
+/* The io_uring of direct writes, set up with raw system calls (no liburing
+ * needed). queue_depth buffers, so the rings never overflow.
+ * filling	The buffer contiguous writes go to, or NULL.
+ * bounce	For reads that are not aligned, WRITER_BUFFER_SIZE bytes.
+ */
+struct _WRITER_DIRECT {
+    int ring_fd;
+    uint32_t queue_depth;
+    PWRITER_BUFFER buffers;
+    PWRITER_BUFFER filling;
+    uint32_t in_flight;
+    uint8_t *bounce;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static bool is_aligned(uint64_t value)
+{
+    return !(value % WRITER_ALIGNMENT);
+}
+
+static int direct_enter(PWRITER_DIRECT direct, uint32_t to_submit,
+                        uint32_t min_complete, uint32_t flags)
+{
+    while (syscall(__NR_io_uring_enter, direct->ring_fd, to_submit,
+                   min_complete, flags, NULL, 0) < 0) {
+        if (errno != EINTR)
+            return -errno;
+    }
+
+    return 0;
+}
+
+static void direct_free(PWRITER_DIRECT direct)
+{
+    uint32_t i;
+
+    if (direct->sqes)
+        munmap(direct->sqes, direct->sqes_size);
+    if (direct->cq_ring && direct->cq_ring != direct->sq_ring)
+        munmap(direct->cq_ring, direct->cq_ring_size);
+    if (direct->sq_ring)
+        munmap(direct->sq_ring, direct->sq_ring_size);
+    if (direct->ring_fd >= 0)
+        close(direct->ring_fd);
+
+    if (direct->buffers) {
+        for (i = 0; i < direct->queue_depth; i++)
+            free(direct->buffers[i].data);
+        free(direct->buffers);
+    }
+    free(direct->bounce);
+    free(direct);
+}
+
+static void *direct_map(int ring_fd, size_t size, off_t offset)
+{
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+
+    return mapping == MAP_FAILED ? NULL : mapping;
+}
+
+static int direct_setup(PWRITER writer, uint32_t queue_depth)
+{
+    struct io_uring_params params = { 0 };
+    PWRITER_DIRECT direct;
+    uint8_t *sq;
+    uint8_t *cq;
+    uint32_t i;
+    int ret;
+
+    if (queue_depth > WRITER_MAX_QUEUE_DEPTH)
+        return -EINVAL;
+
+    direct = calloc(1, sizeof(*direct));
+    if (!direct)
+        return -ENOMEM;
+    direct->ring_fd = -1;
+    direct->queue_depth = queue_depth;
+
+    direct->buffers = calloc(queue_depth, sizeof(WRITER_BUFFER));
+    if (!direct->buffers ||
+        posix_memalign((void **)&direct->bounce, WRITER_ALIGNMENT,
+                       WRITER_BUFFER_SIZE)) {
+        ret = -ENOMEM;
+        goto error;
+    }
+    for (i = 0; i < queue_depth; i++) {
+        if (posix_memalign((void **)&direct->buffers[i].data,
+                           WRITER_ALIGNMENT, WRITER_BUFFER_SIZE)) {
+            ret = -ENOMEM;
+            goto error;
+        }
+    }
+
+    direct->ring_fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+    if (direct->ring_fd < 0) {
+        ret = -errno;
+        goto error;
+    }
+
+    direct->sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    direct->cq_ring_size = params.cq_off.cqes +
+                           params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (direct->cq_ring_size > direct->sq_ring_size)
+            direct->sq_ring_size = direct->cq_ring_size;
+        direct->cq_ring_size = direct->sq_ring_size;
+    }
+
+    direct->sq_ring =
+        direct_map(direct->ring_fd, direct->sq_ring_size, IORING_OFF_SQ_RING);
+    if (!direct->sq_ring) {
+        ret = -errno;
+        goto error;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        direct->cq_ring = direct->sq_ring;
+    else
+        direct->cq_ring = direct_map(direct->ring_fd, direct->cq_ring_size,
+                                     IORING_OFF_CQ_RING);
+    if (!direct->cq_ring) {
+        ret = -errno;
+        goto error;
+    }
+
+    direct->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    direct->sqes =
+        direct_map(direct->ring_fd, direct->sqes_size, IORING_OFF_SQES);
+    if (!direct->sqes) {
+        ret = -errno;
+        goto error;
+    }
+
+    sq = direct->sq_ring;
+    direct->sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+    direct->sq_mask = (uint32_t *)(sq + params.sq_off.ring_mask);
+    direct->sq_array = (uint32_t *)(sq + params.sq_off.array);
+
+    cq = direct->cq_ring;
+    direct->cq_head = (uint32_t *)(cq + params.cq_off.head);
+    direct->cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+    direct->cq_mask = (uint32_t *)(cq + params.cq_off.ring_mask);
+    direct->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    writer->direct = direct;
+
+    return 0;
+
+error:
+    direct_free(direct);
+    return ret;
+}
+
+/* direct_submit - queue the (rest of the) data of a buffer */
+static int direct_submit(PWRITER writer, PWRITER_BUFFER buffer)
+{
+    PWRITER_DIRECT direct = writer->direct;
+    struct io_uring_sqe *sqe;
+    uint32_t tail;
+    uint32_t index;
+
+    tail = *direct->sq_tail;
+    index = tail & *direct->sq_mask;
+    sqe = &direct->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = writer->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(buffer->data + buffer->done);
+    sqe->len = buffer->size - buffer->done;
+    sqe->off = buffer->offset + buffer->done;
+    sqe->user_data = buffer - direct->buffers;
+
+    direct->sq_array[index] = index;
+    __atomic_store_n(direct->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    // Not again for the rest of a short write.
+    if (buffer->state != BUFFER_IN_FLIGHT)
+        buffer->submitted_ns = now_ns();
+    buffer->state = BUFFER_IN_FLIGHT;
+    direct->in_flight++;
+
+    writer->stats.submissions++;
+    writer->stats.occupancy += direct->in_flight;
+    if (direct->in_flight > writer->stats.max_in_flight)
+        writer->stats.max_in_flight = direct->in_flight;
+
+    return direct_enter(direct, 1, 0, 0);
+}
+
+static void direct_account(PWRITER writer, PWRITER_BUFFER buffer)
+{
+    uint64_t latency_ns = now_ns() - buffer->submitted_ns;
+    uint64_t latency_us = latency_ns / 1000;
+    uint32_t bucket = 0;
+
+    while (bucket < WRITER_LATENCY_BUCKETS - 1 && latency_us >> bucket)
+        bucket++;
+
+    writer->stats.writes++;
+    writer->stats.latency_ns += latency_ns;
+    writer->stats.latency_buckets[bucket]++;
+    if (latency_ns > writer->stats.max_latency_ns)
+        writer->stats.max_latency_ns = latency_ns;
+}
+
+/* direct_reap - retire completed writes
+ * @wait: wait for at least one, if none has completed
+ *
+ * Returns 0, or the error of a failed write
+ */
+static int direct_reap(PWRITER writer, bool wait)
+{
+    PWRITER_DIRECT direct = writer->direct;
+    PWRITER_BUFFER buffer;
+    struct io_uring_cqe *cqe;
+    uint32_t head = *direct->cq_head;
+    int error = 0;
+    int ret;
+
+    if (wait && head == __atomic_load_n(direct->cq_tail, __ATOMIC_ACQUIRE)) {
+        ret = direct_enter(direct, 0, 1, IORING_ENTER_GETEVENTS);
+        if (ret)
+            return ret;
+    }
+
+    while (head != __atomic_load_n(direct->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &direct->cqes[head & *direct->cq_mask];
+        buffer = &direct->buffers[cqe->user_data];
+        direct->in_flight--;
+
+        if (cqe->res <= 0) {
+            if (!error)
+                error = cqe->res ? cqe->res : -EIO;
+            buffer->state = BUFFER_FREE;
+        } else {
+            buffer->done += cqe->res;
+            if (buffer->done < buffer->size) {
+                // O_DIRECT: the rest must start aligned, too.
+                buffer->done -= buffer->done % WRITER_ALIGNMENT;
+                ret = direct_submit(writer, buffer);
+                if (ret && !error)
+                    error = ret;
+            } else {
+                direct_account(writer, buffer);
+                buffer->state = BUFFER_FREE;
+            }
+        }
+
+        head++;
+        __atomic_store_n(direct->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return error;
+}
+
+/* direct_overlaps - the first buffer not free with data in a range, or NULL */
+static PWRITER_BUFFER direct_overlaps(PWRITER_DIRECT direct, uint64_t offset,
+                                      uint64_t size)
+{
+    PWRITER_BUFFER buffer;
+    uint32_t i;
+
+    for (i = 0; i < direct->queue_depth; i++) {
+        buffer = &direct->buffers[i];
+        if (buffer->state != BUFFER_FREE &&
+            offset < buffer->offset + buffer->size &&
+            buffer->offset < offset + size)
+            return buffer;
+    }
+
+    return NULL;
+}
+
+/* direct_take - a free buffer for writes at offset
+ *
+ * Earlier writes to the range are waited for first: io_uring does not keep
+ * them in order.
+ */
+static int direct_take(PWRITER writer, uint64_t offset, uint64_t size,
+                       PWRITER_BUFFER *taken)
+{
+    PWRITER_DIRECT direct = writer->direct;
+    PWRITER_BUFFER buffer;
+    uint32_t i;
+    int ret;
+
+    while (direct_overlaps(direct, offset, size)) {
+        ret = direct_reap(writer, true);
+        if (ret)
+            return ret;
+    }
+
+    for (;;) {
+        for (i = 0; i < direct->queue_depth; i++) {
+            buffer = &direct->buffers[i];
+            if (buffer->state == BUFFER_FREE) {
+                buffer->state = BUFFER_FILLING;
+                buffer->offset = offset;
+                buffer->size = 0;
+                buffer->done = 0;
+                *taken = buffer;
+                return 0;
+            }
+        }
+
+        writer->stats.stalls++;
+        ret = direct_reap(writer, true);
+        if (ret)
+            return ret;
+    }
+}
+
+static int direct_write(PWRITER writer, const uint8_t *buf, size_t size,
+                        uint64_t offset)
+{
+    PWRITER_DIRECT direct = writer->direct;
+    PWRITER_BUFFER buffer;
+    size_t chunk;
+    int ret;
+
+    if (!is_aligned(offset) || !is_aligned(size))
+        return -EINVAL;
+
+    ret = direct_reap(writer, false);
+    if (ret)
+        return ret;
+
+    while (size) {
+        buffer = direct->filling;
+        if (buffer && (offset != buffer->offset + buffer->size ||
+                       buffer->size == WRITER_BUFFER_SIZE)) {
+            direct->filling = NULL;
+            ret = direct_submit(writer, buffer);
+            if (ret)
+                return ret;
+            buffer = NULL;
+        }
+
+        if (!buffer) {
+            ret = direct_take(writer, offset, size, &buffer);
+            if (ret)
+                return ret;
+            direct->filling = buffer;
+        }
+
+        chunk = WRITER_BUFFER_SIZE - buffer->size;
+        if (chunk > size)
+            chunk = size;
+
+        memcpy(buffer->data + buffer->size, buf, chunk);
+        buffer->size += chunk;
+        buf += chunk;
+        size -= chunk;
+        offset += chunk;
+        writer->bytes_written += chunk;
+
+        if (buffer->size == WRITER_BUFFER_SIZE) {
+            direct->filling = NULL;
+            ret = direct_submit(writer, buffer);
+            if (ret)
+                return ret;
+        }
+    }
+
+    return 0;
+}
+
+/* pread_full - read size bytes, -EIO at the end of the file */
+static int pread_full(int fd, void *buf, size_t size, uint64_t offset)
+{
+    ssize_t got;
+
+    while (size) {
+        got = pread(fd, buf, size, offset);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (got == 0)
+            return -EIO;
+
+        buf = (char *)buf + got;
+        size -= got;
+        offset += got;
+    }
+
+    return 0;
+}
+
+/* direct_read - read, from the buffers if the data is still there
+ *
+ * O_DIRECT needs aligned reads, the rest goes through the bounce buffer.
+ */
+static int direct_read(PWRITER writer, uint8_t *buf, size_t size,
+                       uint64_t offset)
+{
+    PWRITER_DIRECT direct = writer->direct;
+    PWRITER_BUFFER buffer;
+    uint64_t start;
+    uint64_t length;
+    size_t chunk;
+    int ret;
+
+    buffer = direct_overlaps(direct, offset, size);
+    if (buffer && offset >= buffer->offset &&
+        offset + size <= buffer->offset + buffer->size) {
+        memcpy(buf, buffer->data + (offset - buffer->offset), size);
+        return 0;
+    }
+
+    // Partly in flight: let it land first.
+    if (buffer) {
+        ret = writer_flush(writer);
+        if (ret)
+            return ret;
+    }
+
+    if (is_aligned((uintptr_t)buf) && is_aligned(offset) && is_aligned(size))
+        return pread_full(writer->fd, buf, size, offset);
+
+    while (size) {
+        start = offset - offset % WRITER_ALIGNMENT;
+        length = offset - start + size;
+        length = (length + WRITER_ALIGNMENT - 1) / WRITER_ALIGNMENT *
+                 WRITER_ALIGNMENT;
+        if (length > WRITER_BUFFER_SIZE)
+            length = WRITER_BUFFER_SIZE;
+
+        ret = pread_full(writer->fd, direct->bounce, length, start);
+        if (ret)
+            return ret;
+
+        chunk = length - (offset - start);
+        if (chunk > size)
+            chunk = size;
+        memcpy(buf, direct->bounce + (offset - start), chunk);
+
+        buf += chunk;
+        size -= chunk;
+        offset += chunk;
+    }
+
+    return 0;
+}
+
+static int writer_open_flags(PWRITER writer, const char *path, int flags,
+                             uint32_t queue_depth)
+{
+    int ret;
+
+    memset(writer, 0, sizeof(*writer));
+
+    if (queue_depth)
+        flags |= O_DIRECT;
+
+    writer->fd = open(path, flags, 0600);
+    if (writer->fd < 0)
+        return -errno;
+
+    if (queue_depth) {
+        ret = direct_setup(writer, queue_depth);
+        if (ret) {
+            close(writer->fd);
+            writer->fd = -1;
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int writer_open(PWRITER writer, const char *path, uint32_t queue_depth)
+{
+    return writer_open_flags(writer, path, O_RDWR | O_CREAT | O_TRUNC,
+                             queue_depth);
+}
+
+int writer_reopen(PWRITER writer, const char *path, uint32_t queue_depth)
+{
+    return writer_open_flags(writer, path, O_RDWR, queue_depth);
+}
+
+int writer_write(PWRITER writer, const void *buf, size_t size,
+                 uint64_t offset)
+{
+    ssize_t written;
+
+    if (writer->direct)
+        return direct_write(writer, buf, size, offset);
+
+    while (size) {
+        written = pwrite(writer->fd, buf, size, offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        buf = (const char *)buf + written;
+        size -= written;
+        offset += written;
+        writer->bytes_written += written;
+    }
+
+    return 0;
+}
+
+int writer_read(PWRITER writer, void *buf, size_t size, uint64_t offset)
+{
+    if (writer->direct)
+        return direct_read(writer, buf, size, offset);
+
+    return pread_full(writer->fd, buf, size, offset);
+}
+
+int writer_flush(PWRITER writer)
+{
+    PWRITER_DIRECT direct = writer->direct;
+    PWRITER_BUFFER buffer;
+    int ret;
+
+    if (!direct)
+        return 0;
+
+    buffer = direct->filling;
+    if (buffer) {
+        direct->filling = NULL;
+        ret = direct_submit(writer, buffer);
+        if (ret)
+            return ret;
+    }
+
+    while (direct->in_flight) {
+        ret = direct_reap(writer, true);
+        if (ret)
+            return ret;
+    }
+
+    return 0;
+}
+
+uint64_t writer_latency_us(PWRITER_STATS stats, uint32_t percentile)
+{
+    uint64_t target = (stats->writes * percentile + 99) / 100;
+    uint64_t count = 0;
+    uint32_t i;
+
+    for (i = 0; i < WRITER_LATENCY_BUCKETS; i++) {
+        count += stats->latency_buckets[i];
+        if (count >= target)
+            return 1ULL << i;
+    }
+
+    return 1ULL << (WRITER_LATENCY_BUCKETS - 1);
+}
+
+int writer_close(PWRITER writer)
+{
+    int ret;
+
+    ret = writer_flush(writer);
+
+    if (fsync(writer->fd) && !ret)
+        ret = -errno;
+
+    if (close(writer->fd) && !ret)
+        ret = -errno;
+
+    writer->fd = -1;
+
+    if (writer->direct) {
+        direct_free(writer->direct);
+        writer->direct = NULL;
+    }
+
+    return ret;
+}
@@ -0,0 +1,84 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _WRITER_H_
+#define _WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Direct writes: offsets and sizes must be multiples of this.
+#define WRITER_ALIGNMENT (4096)
+
+// Direct writes: contiguous writes are gathered into buffers of this size,
+// one per write in flight.
+#define WRITER_BUFFER_SIZE (1024 * 1024)
+
+// Upper bound of the queue depth.
+#define WRITER_MAX_QUEUE_DEPTH (256)
+
+// Latency histogram: bucket i counts writes of less than 2^i microseconds.
+#define WRITER_LATENCY_BUCKETS (32)
+
+/* Statistics of direct writes.
+ * writes	Number of buffers written.
+ * submissions	Number of writes submitted, more than writes if some were
+ *		short and submitted again for the rest.
+ * occupancy	Sum of the writes in flight at each submission (counting it).
+ *		Divided by submissions, the average queue depth.
+ * stalls	Number of times all buffers were in flight, and a write had to
+ *		wait for one.
+ */
+typedef struct {
+    uint64_t writes;
+    uint64_t submissions;
+    uint64_t latency_ns;
+    uint64_t max_latency_ns;
+    uint64_t latency_buckets[WRITER_LATENCY_BUCKETS];
+    uint64_t occupancy;
+    uint32_t max_in_flight;
+    uint64_t stalls;
+} WRITER_STATS, *PWRITER_STATS;
+
+typedef struct _WRITER_DIRECT WRITER_DIRECT, *PWRITER_DIRECT;
+
+/* The output stage of the dumper. All writes are positional.
+ *
+ * With a queue depth, the output is opened with O_DIRECT, bypassing the page
+ * cache (which would hold a copy of the memory being acquired), and writes
+ * go through io_uring, up to queue_depth at a time. writer_write returns
+ * once the data is copied. Reads see writes still in flight.
+ */
+typedef struct {
+    int fd;
+    uint64_t bytes_written;
+    PWRITER_DIRECT direct;
+    WRITER_STATS stats;
+} WRITER, *PWRITER;
+
+/* writer_open - create the output
+ * @queue_depth: zero for buffered writes, otherwise direct writes with up to
+ *               that many in flight (at most WRITER_MAX_QUEUE_DEPTH)
+ */
+int writer_open(PWRITER writer, const char *path, uint32_t queue_depth);
+
+/* writer_reopen - open an existing output to go on with it */
+int writer_reopen(PWRITER writer, const char *path, uint32_t queue_depth);
+
+int writer_write(PWRITER writer, const void *buf, size_t size,
+                 uint64_t offset);
+
+int writer_read(PWRITER writer, void *buf, size_t size, uint64_t offset);
+
+/* writer_flush - wait until all writes reached the file (not the disk) */
+int writer_flush(PWRITER writer);
+
+/* writer_latency_us - the latency percentile of direct writes, rounded up to
+ * a power of two
+ */
+uint64_t writer_latency_us(PWRITER_STATS stats, uint32_t percentile);
+
+int writer_close(PWRITER writer);
+
+#endif
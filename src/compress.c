@@ -0,0 +1,195 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/lz4.h>
+#include <linux/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include "compress.h"
+#include "linpmem.h"
+
+/* The buffers of a compressed read.
+ * raw		The pages of the chunk being read, chunk_size bytes.
+ * packed	The chunk compressed, chunk_size bytes: what does not fit is
+ *		stored instead.
+ * lz4_work	LZ4_MEM_COMPRESS bytes of LZ4 state.
+ */
+typedef struct {
+    PPTE_METHOD_DATA pte_data;
+    uint8_t *raw;
+    uint8_t *packed;
+    void *lz4_work;
+} COMPRESS_CONTEXT, *PCOMPRESS_CONTEXT;
+
+static bool compress_read_page(PCOMPRESS_CONTEXT ctx, uint64_t phys_address,
+                               uint8_t *page)
+{
+    uint64_t bytes_read = 0;
+    uint64_t chunk;
+
+    while (bytes_read < PAGE_SIZE) {
+        chunk = pte_mmap_read_kernel(ctx->pte_data, phys_address + bytes_read,
+                                     page + bytes_read, PAGE_SIZE - bytes_read);
+        if (!chunk)
+            return false;
+        bytes_read += chunk;
+    }
+
+    return true;
+}
+
+/* compress_gather - read pages into ctx->raw, up to end
+ * @readable: out, whether the pages were read, or could not be
+ *
+ * Stops at the first page that is not like the first one: readable and
+ * unreadable pages go to different chunks.
+ *
+ * Returns the number of bytes gathered, at least one page
+ */
+static uint64_t compress_gather(PCOMPRESS_CONTEXT ctx, uint64_t address,
+                                uint64_t end, bool *readable)
+{
+    uint64_t size = 0;
+    bool page_read;
+
+    while (address + size < end) {
+        page_read = compress_read_page(ctx, address + size, ctx->raw + size);
+        if (!size)
+            *readable = page_read;
+        else if (page_read != *readable)
+            break;
+        size += PAGE_SIZE;
+    }
+
+    return size;
+}
+
+/* compress_emit - copy a chunk and its data to the user buffer */
+static int compress_emit(PLINPMEM_COMPRESSED_READ read,
+                         PLINPMEM_COMPRESSED_CHUNK chunk, const void *data)
+{
+    static const uint8_t padding[8];
+    uint8_t __user *target = (uint8_t __user *)read->buffer + read->used_size;
+    uint32_t padded = ALIGN(chunk->compressed_size, 8);
+
+    if (copy_to_user(target, chunk, sizeof(LINPMEM_COMPRESSED_CHUNK)))
+        return -EFAULT;
+    target += sizeof(LINPMEM_COMPRESSED_CHUNK);
+
+    if (copy_to_user(target, data, chunk->compressed_size) ||
+        copy_to_user(target + chunk->compressed_size, padding,
+                     padded - chunk->compressed_size))
+        return -EFAULT;
+
+    read->used_size += sizeof(LINPMEM_COMPRESSED_CHUNK) + padded;
+    read->chunk_count++;
+
+    return 0;
+}
+
+static int compress_check(PLINPMEM_COMPRESSED_READ read)
+{
+    if (!read->chunk_size)
+        read->chunk_size = LINPMEM_DEFAULT_COMPRESSED_CHUNK_SIZE;
+
+    if (!read->buffer || !read->size ||
+        !PAGE_ALIGNED(read->phys_address) || !PAGE_ALIGNED(read->size) ||
+        read->phys_address + read->size < read->phys_address ||
+        !PAGE_ALIGNED(read->chunk_size) ||
+        read->chunk_size > LINPMEM_MAX_COMPRESSED_CHUNK_SIZE ||
+        read->buffer_size <
+            sizeof(LINPMEM_COMPRESSED_CHUNK) + read->chunk_size)
+        return -EINVAL;
+
+    return 0;
+}
+
+int compress_read(PLINPMEM_COMPRESSED_READ read)
+{
+    COMPRESS_CONTEXT ctx = {
+        // Spread concurrent readers over the windows, as the scanner does.
+        .pte_data = rogue_window(task_pid_nr(current)),
+    };
+    LINPMEM_COMPRESSED_CHUNK chunk = { 0 };
+    uint64_t end = read->phys_address + read->size;
+    uint64_t address = read->phys_address;
+    uint64_t chunk_end;
+    const void *data;
+    bool readable;
+    int packed;
+    int ret;
+
+    ret = compress_check(read);
+    if (ret)
+        return ret;
+
+    ctx.raw = kvmalloc(read->chunk_size, GFP_KERNEL);
+    ctx.packed = kvmalloc(read->chunk_size, GFP_KERNEL);
+    ctx.lz4_work = kvmalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+    if (!ctx.raw || !ctx.packed || !ctx.lz4_work) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    read->chunk_count = 0;
+    read->used_size = 0;
+    read->raw_bytes = 0;
+
+    while (address < end) {
+        // Room for a chunk that is stored, we do not know before.
+        if (read->buffer_size - read->used_size <
+                sizeof(LINPMEM_COMPRESSED_CHUNK) + read->chunk_size ||
+            signal_pending(current))
+            break;
+
+        chunk_end = address - address % read->chunk_size + read->chunk_size;
+        chunk_end = min(chunk_end, end);
+
+        chunk.phys_address = address;
+        chunk.raw_size = compress_gather(&ctx, address, chunk_end, &readable);
+        chunk.compressed_size = 0;
+        chunk.flags = 0;
+        data = NULL;
+
+        if (!readable) {
+            chunk.flags |= LINPMEM_CHUNK_UNREADABLE;
+        } else {
+            // Only if it gets smaller, otherwise 0.
+            packed = LZ4_compress_default((const char *)ctx.raw,
+                                          (char *)ctx.packed, chunk.raw_size,
+                                          chunk.raw_size - 1, ctx.lz4_work);
+            if (packed > 0) {
+                chunk.compressed_size = packed;
+                data = ctx.packed;
+            } else {
+                chunk.flags |= LINPMEM_CHUNK_STORED;
+                chunk.compressed_size = chunk.raw_size;
+                data = ctx.raw;
+            }
+            read->raw_bytes += chunk.raw_size;
+        }
+
+        ret = compress_emit(read, &chunk, data);
+        if (ret)
+            goto out;
+
+        address += chunk.raw_size;
+
+        cond_resched();
+    }
+
+    read->resume_address = address;
+
+out:
+    kvfree(ctx.lz4_work);
+    kvfree(ctx.packed);
+    kvfree(ctx.raw);
+
+    return ret;
+}
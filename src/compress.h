@@ -0,0 +1,19 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include "../userspace_interface/linpmem_shared.h"
+
+/* compress_read - read a physical range into LZ4 compressed chunks, see
+ * IOCTL_LINPMEM_READ_COMPRESSED
+ * @read: the request, with the user buffer. The _OUT_ fields are set.
+ *
+ * Returns 0, also if the buffer is full or a signal stopped it
+ * (resume_address tells), or negative error
+ */
+int compress_read(PLINPMEM_COMPRESSED_READ read);
+
+#endif
@@ -0,0 +1,140 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/uaccess.h>
+#include <linux/xxhash.h>
+
+#include "digest.h"
+#include "linpmem.h"
+
+/* digest_page - the xxh64 of a page, 0 if it can not be read */
+static uint64_t digest_page(PPTE_METHOD_DATA pte_data, uint64_t phys_address,
+                            uint8_t *page)
+{
+    uint64_t bytes_read = 0;
+    uint64_t chunk;
+
+    while (bytes_read < PAGE_SIZE) {
+        chunk = pte_mmap_read_kernel(pte_data, phys_address + bytes_read,
+                                     page + bytes_read,
+                                     PAGE_SIZE - bytes_read);
+        if (!chunk)
+            return 0;
+        bytes_read += chunk;
+    }
+
+    return xxh64(page, PAGE_SIZE, 0);
+}
+
+/* digest_chunk - the digest of a chunk, as linpmem_dump computes it
+ *
+ * Returns false if a signal came before the chunk was done
+ */
+static bool digest_chunk(PPTE_METHOD_DATA pte_data, PLINPMEM_DIGEST digest,
+                         PLINPMEM_CHUNK_DIGEST chunk, uint8_t *page)
+{
+    struct xxh64_state state;
+    uint64_t page_hash;
+    uint32_t unreadable = 0;
+    uint32_t i;
+
+    chunk->flags = 0;
+    xxh64_reset(&state, 0);
+
+    for (i = 0; i < chunk->page_count; i++) {
+        if (signal_pending(current))
+            return false;
+
+        page_hash = digest_page(pte_data,
+                                chunk->phys_address + PFN_PHYS(i), page);
+        if (!page_hash) {
+            chunk->flags |= LINPMEM_DIGEST_UNREADABLE;
+            unreadable++;
+        }
+        xxh64_update(&state, &page_hash, sizeof(page_hash));
+
+        cond_resched();
+    }
+
+    digest->pages_hashed += chunk->page_count;
+    digest->pages_unreadable += unreadable;
+    chunk->digest = xxh64_digest(&state);
+
+    return true;
+}
+
+int digest_chunks(PLINPMEM_DIGEST digest)
+{
+    // Spread concurrent callers over the windows, as the scanner does.
+    PPTE_METHOD_DATA pte_data = rogue_window(task_pid_nr(current));
+    LINPMEM_CHUNK_DIGEST chunk;
+    uint64_t expected;
+    uint8_t *page;
+    uint32_t i;
+    int ret = 0;
+
+    if (!digest->chunks || !digest->results || !digest->max_results ||
+        !digest->chunk_count ||
+        digest->chunk_count > LINPMEM_MAX_DIGEST_CHUNKS ||
+        (digest->flags & ~LINPMEM_DIGEST_COMPARE))
+        return -EINVAL;
+
+    page = (uint8_t *)__get_free_page(GFP_KERNEL);
+    if (!page)
+        return -ENOMEM;
+
+    digest->result_count = 0;
+    digest->pages_hashed = 0;
+    digest->pages_unreadable = 0;
+
+    for (i = 0; i < digest->chunk_count; i++) {
+        if (digest->result_count == digest->max_results ||
+            signal_pending(current))
+            break;
+
+        if (copy_from_user(&chunk, &digest->chunks[i],
+                           sizeof(LINPMEM_CHUNK_DIGEST))) {
+            ret = -EFAULT;
+            goto out;
+        }
+
+        if (offset_in_page(chunk.phys_address) || !chunk.page_count ||
+            chunk.page_count > LINPMEM_MAX_DIGEST_CHUNK_PAGES ||
+            chunk.phys_address + PFN_PHYS(chunk.page_count) <
+                chunk.phys_address) {
+            ret = -EINVAL;
+            goto out;
+        }
+
+        expected = chunk.digest;
+        if (!digest_chunk(pte_data, digest, &chunk, page))
+            break;
+
+        if (digest->flags & LINPMEM_DIGEST_COMPARE) {
+            if (chunk.digest == expected)
+                continue;
+            chunk.flags |= LINPMEM_DIGEST_MISMATCH;
+        }
+
+        if (copy_to_user(&digest->results[digest->result_count], &chunk,
+                         sizeof(LINPMEM_CHUNK_DIGEST))) {
+            ret = -EFAULT;
+            goto out;
+        }
+        digest->result_count++;
+    }
+
+    digest->resume_index = i;
+
+out:
+    free_page((unsigned long)page);
+
+    return ret;
+}
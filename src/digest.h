@@ -0,0 +1,18 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _DIGEST_H_
+#define _DIGEST_H_
+
+#include "../userspace_interface/linpmem_shared.h"
+
+/* digest_chunks - hash chunks of physical memory, see IOCTL_LINPMEM_DIGEST
+ * @digest: the request, with the user buffers. The _OUT_ fields are set.
+ *
+ * Returns 0, also if results is full or a signal stopped it (resume_index
+ * tells), or negative error
+ */
+int digest_chunks(PLINPMEM_DIGEST digest);
+
+#endif
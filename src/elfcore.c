@@ -0,0 +1,283 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/elf.h>
+#include <linux/err.h>
+#include <linux/ioport.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "elfcore.h"
+#include "layout.h"
+
+#define ELF_CORE_NOTE_ALIGN (4)
+
+/* The System RAM ranges, while collecting them. */
+typedef struct {
+    PELF_CORE core;
+    uint32_t max_count;
+} ELF_CORE_COLLECT, *PELF_CORE_COLLECT;
+
+static int elfcore_count_range(struct resource *res, void *arg)
+{
+    uint32_t *count = arg;
+
+    (*count)++;
+
+    return 0;
+}
+
+static int elfcore_add_range(struct resource *res, void *arg)
+{
+    PELF_CORE_COLLECT collect = arg;
+    PELF_CORE_SEGMENT segment;
+
+    // More RAM meanwhile (hotplug)? Next open.
+    if (collect->core->segment_count == collect->max_count)
+        return 0;
+
+    segment = &collect->core->segments[collect->core->segment_count++];
+    segment->phys_start = res->start;
+    segment->size = resource_size(res);
+
+    return 0;
+}
+
+static size_t elfcore_note_size(const char *name, size_t desc_size)
+{
+    return sizeof(Elf64_Nhdr) + ALIGN(strlen(name) + 1, ELF_CORE_NOTE_ALIGN) +
+           ALIGN(desc_size, ELF_CORE_NOTE_ALIGN);
+}
+
+static void *elfcore_write_note(void *note, const char *name, uint32_t type,
+                                const void *desc, size_t desc_size)
+{
+    Elf64_Nhdr *nhdr = note;
+
+    nhdr->n_namesz = strlen(name) + 1;
+    nhdr->n_descsz = desc_size;
+    nhdr->n_type = type;
+    note += sizeof(Elf64_Nhdr);
+
+    memcpy(note, name, nhdr->n_namesz);
+    note += ALIGN(nhdr->n_namesz, ELF_CORE_NOTE_ALIGN);
+
+    memcpy(note, desc, desc_size);
+    note += ALIGN(desc_size, ELF_CORE_NOTE_ALIGN);
+
+    return note;
+}
+
+/* elfcore_vmcoreinfo - find the kernel's VMCOREINFO
+ * @size: out, its size
+ *
+ * The same text that kdump puts into /proc/vmcore, and that crash and
+ * makedumpfile need to find their way around. Not exported, so it takes the
+ * kernel symbols.
+ *
+ * Returns the text, or NULL
+ */
+static const char *elfcore_vmcoreinfo(size_t *size)
+{
+    unsigned long data = layout_lookup_symbol("vmcoreinfo_data");
+    unsigned long data_size = layout_lookup_symbol("vmcoreinfo_size");
+
+    *size = 0;
+
+    if (!data || !data_size || !*(const char **)data)
+        return NULL;
+
+    *size = *(size_t *)data_size;
+
+    return *(const char **)data;
+}
+
+/* elfcore_create - build the ELF core view of physical memory
+ *
+ * A PT_LOAD per System RAM range (top level, like /proc/iomem shows it),
+ * with the direct mapping address as virtual address, and a PT_NOTE with
+ * the kernel layout (LINPMEM_NOTE_KERNEL_LAYOUT) and VMCOREINFO, if
+ * available. The ranges are those of open time.
+ *
+ * Returns the core view, or ERR_PTR
+ */
+PELF_CORE elfcore_create(void)
+{
+    ELF_CORE_COLLECT collect = { 0 };
+    LINPMEM_KERNEL_LAYOUT layout;
+    PELF_CORE_SEGMENT segment;
+    const char *vmcoreinfo;
+    size_t vmcoreinfo_size;
+    uint64_t notes_offset;
+    uint64_t notes_size;
+    uint64_t offset;
+    Elf64_Ehdr *ehdr;
+    Elf64_Phdr *phdr;
+    void *note;
+    uint32_t max_count = 0;
+    uint32_t i;
+    int ret;
+
+    collect.core = kzalloc(sizeof(ELF_CORE), GFP_KERNEL);
+    if (!collect.core)
+        return ERR_PTR(-ENOMEM);
+
+    walk_iomem_res_desc(IORES_DESC_NONE, IORESOURCE_SYSTEM_RAM, 0, -1,
+                        &max_count, elfcore_count_range);
+    if (!max_count || max_count >= PN_XNUM - 1) {
+        ret = -E2BIG;
+        goto error;
+    }
+
+    collect.max_count = max_count;
+    collect.core->segments =
+        kvcalloc(max_count, sizeof(ELF_CORE_SEGMENT), GFP_KERNEL);
+    if (!collect.core->segments) {
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    walk_iomem_res_desc(IORES_DESC_NONE, IORESOURCE_SYSTEM_RAM, 0, -1,
+                        &collect, elfcore_add_range);
+    if (!collect.core->segment_count) {
+        ret = -ENODATA;
+        goto error;
+    }
+
+    layout_query(&layout);
+    vmcoreinfo = elfcore_vmcoreinfo(&vmcoreinfo_size);
+
+    notes_offset = sizeof(Elf64_Ehdr) +
+                   (1 + collect.core->segment_count) * sizeof(Elf64_Phdr);
+    notes_size = elfcore_note_size(LINPMEM_NOTE_NAME,
+                                   sizeof(LINPMEM_KERNEL_LAYOUT));
+    if (vmcoreinfo)
+        notes_size += elfcore_note_size("VMCOREINFO", vmcoreinfo_size);
+
+    collect.core->header_size = notes_offset + notes_size;
+    collect.core->header = kvzalloc(collect.core->header_size, GFP_KERNEL);
+    if (!collect.core->header) {
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    ehdr = collect.core->header;
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_ident[EI_OSABI] = ELFOSABI_NONE;
+    ehdr->e_type = ET_CORE;
+    ehdr->e_machine = EM_X86_64;
+    ehdr->e_version = EV_CURRENT;
+    ehdr->e_phoff = sizeof(Elf64_Ehdr);
+    ehdr->e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr->e_phentsize = sizeof(Elf64_Phdr);
+    ehdr->e_phnum = 1 + collect.core->segment_count;
+
+    phdr = (Elf64_Phdr *)(ehdr + 1);
+    phdr->p_type = PT_NOTE;
+    phdr->p_offset = notes_offset;
+    phdr->p_filesz = notes_size;
+
+    note = collect.core->header + notes_offset;
+    note = elfcore_write_note(note, LINPMEM_NOTE_NAME,
+                              LINPMEM_NOTE_KERNEL_LAYOUT, &layout,
+                              sizeof(LINPMEM_KERNEL_LAYOUT));
+    if (vmcoreinfo)
+        elfcore_write_note(note, "VMCOREINFO", 0, vmcoreinfo,
+                           vmcoreinfo_size);
+
+    // Memory starts on a page, and stays congruent to the physical address.
+    offset = PAGE_ALIGN(collect.core->header_size);
+
+    for (i = 0; i < collect.core->segment_count; i++) {
+        segment = &collect.core->segments[i];
+        segment->file_offset = offset + offset_in_page(segment->phys_start);
+        offset = PAGE_ALIGN(segment->file_offset + segment->size);
+
+        phdr++;
+        phdr->p_type = PT_LOAD;
+        phdr->p_flags = PF_R | PF_W | PF_X;
+        phdr->p_offset = segment->file_offset;
+        phdr->p_vaddr = (uint64_t)__va(segment->phys_start);
+        phdr->p_paddr = segment->phys_start;
+        phdr->p_filesz = segment->size;
+        phdr->p_memsz = segment->size;
+        phdr->p_align = PAGE_SIZE;
+    }
+
+    segment = &collect.core->segments[collect.core->segment_count - 1];
+    collect.core->size = segment->file_offset + segment->size;
+
+    return collect.core;
+
+error:
+    elfcore_destroy(collect.core);
+
+    return ERR_PTR(ret);
+}
+
+void elfcore_destroy(PELF_CORE core)
+{
+    if (!core)
+        return;
+
+    kvfree(core->header);
+    kvfree(core->segments);
+    kfree(core);
+}
+
+/* elfcore_locate - what is at an offset of the core file
+ * @core: the core view
+ * @offset: file offset, less than core->size
+ * @region: out, header, memory, or padding between the two
+ * @where: out, offset into core->header, or physical address
+ *
+ * Returns number of bytes from offset on that are in the same region
+ */
+uint64_t elfcore_locate(PELF_CORE core, uint64_t offset,
+                        ELF_CORE_REGION *region, uint64_t *where)
+{
+    PELF_CORE_SEGMENT segment;
+    uint32_t low = 0;
+    uint32_t high = core->segment_count;
+    uint32_t middle;
+
+    if (offset < core->header_size) {
+        *region = ELF_CORE_HEADER;
+        *where = offset;
+        return core->header_size - offset;
+    }
+
+    // First segment after offset.
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (core->segments[middle].file_offset <= offset)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if (low) {
+        segment = &core->segments[low - 1];
+        if (offset - segment->file_offset < segment->size) {
+            *region = ELF_CORE_MEMORY;
+            *where = segment->phys_start + (offset - segment->file_offset);
+            return segment->size - (offset - segment->file_offset);
+        }
+    }
+
+    *region = ELF_CORE_PADDING;
+    *where = 0;
+
+    if (low < core->segment_count)
+        return core->segments[low].file_offset - offset;
+
+    return core->size - offset;
+}
@@ -0,0 +1,46 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _ELFCORE_H_
+#define _ELFCORE_H_
+
+#include <linux/types.h>
+
+#include "../userspace_interface/linpmem_shared.h"
+
+/* One PT_LOAD: a System RAM range, and where it is in the file. */
+typedef struct {
+    uint64_t phys_start;
+    uint64_t size;
+    uint64_t file_offset;
+} ELF_CORE_SEGMENT, *PELF_CORE_SEGMENT;
+
+/* The ELF core view of one open file, see LINPMEM_MINOR_CORE.
+ * header	ELF header, program headers and notes, header_size bytes.
+ * segments	The PT_LOAD segments, ascending, segment_count of them.
+ * size		Size of the whole core file.
+ */
+typedef struct {
+    void *header;
+    uint64_t header_size;
+    PELF_CORE_SEGMENT segments;
+    uint32_t segment_count;
+    uint64_t size;
+} ELF_CORE, *PELF_CORE;
+
+/* What is at an offset of the core file. */
+typedef enum {
+    ELF_CORE_HEADER,
+    ELF_CORE_MEMORY,
+    ELF_CORE_PADDING
+} ELF_CORE_REGION;
+
+PELF_CORE elfcore_create(void);
+
+void elfcore_destroy(PELF_CORE core);
+
+uint64_t elfcore_locate(PELF_CORE core, uint64_t offset,
+                        ELF_CORE_REGION *region, uint64_t *where);
+
+#endif
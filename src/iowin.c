@@ -0,0 +1,230 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/io.h>
+#include <linux/ioport.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+
+#include "iowin.h"
+
+/* One ioremap'ed window.
+ * lru		On g_iowin_lru (most recently used first), or g_iowin_free.
+ * base, size	The physical range.
+ * cached	Mapped write-back (firmware tables), otherwise uncached.
+ * va		The mapping.
+ */
+typedef struct {
+    struct list_head lru;
+    uint64_t base;
+    uint64_t size;
+    bool cached;
+    void __iomem *va;
+} IOWIN, *PIOWIN;
+
+/* Protects the windows, the lists and the statistics. */
+static DEFINE_MUTEX(g_iowin_lock);
+static IOWIN g_iowins[IOWIN_COUNT];
+static LIST_HEAD(g_iowin_lru);
+static LIST_HEAD(g_iowin_free);
+static LINPMEM_IOWIN_STATS g_iowin_stats;
+
+void iowin_init(void)
+{
+    int i;
+
+    for (i = 0; i < IOWIN_COUNT; i++)
+        list_add_tail(&g_iowins[i].lru, &g_iowin_free);
+}
+
+void iowin_exit(void)
+{
+    PIOWIN win;
+
+    list_for_each_entry(win, &g_iowin_lru, lru)
+        iounmap(win->va);
+}
+
+/* iowin_is_firmware - is a range in ACPI tables or NVS memory
+ * @phys_addr: physical address
+ * @size: size of the range
+ *
+ * The firmware hands these to the kernel, and the kernel maps them
+ * write-back, too. Everything else that is not RAM might be device
+ * registers: uncached, and read exactly as asked.
+ *
+ * Returns true if the whole range is firmware memory
+ */
+static bool iowin_is_firmware(uint64_t phys_addr, uint64_t size)
+{
+    return region_intersects(phys_addr, size, IORESOURCE_MEM,
+                             IORES_DESC_ACPI_TABLES) == REGION_INTERSECTS ||
+           region_intersects(phys_addr, size, IORESOURCE_MEM,
+                             IORES_DESC_ACPI_NV_STORAGE) == REGION_INTERSECTS;
+}
+
+static void __iomem *iowin_map(uint64_t base, uint64_t size, bool cached)
+{
+    if (cached)
+        return ioremap_cache(base, size);
+
+    return ioremap(base, size);
+}
+
+/* iowin_get - find or map the window for a page, under g_iowin_lock
+ * @phys_addr: physical address
+ * @cached: the cache type wanted for the page
+ *
+ * Windows are IOWIN_SIZE aligned, unless the page's neighbours do not share
+ * its cache type, or the kernel refuses to map them: then it is just the page.
+ * On a miss with all windows in use, the least recently used one goes.
+ *
+ * Returns the window, or NULL if the page can not be mapped
+ */
+static PIOWIN iowin_get(uint64_t phys_addr, bool cached)
+{
+    PIOWIN win;
+    uint64_t base;
+    uint64_t size;
+
+    list_for_each_entry(win, &g_iowin_lru, lru) {
+        if (win->cached == cached && phys_addr >= win->base &&
+            phys_addr - win->base < win->size) {
+            g_iowin_stats.hits++;
+            list_move(&win->lru, &g_iowin_lru);
+            return win;
+        }
+    }
+
+    g_iowin_stats.misses++;
+
+    if (list_empty(&g_iowin_free)) {
+        win = list_last_entry(&g_iowin_lru, IOWIN, lru);
+        iounmap(win->va);
+        win->va = NULL;
+        list_move(&win->lru, &g_iowin_free);
+        g_iowin_stats.evictions++;
+    }
+
+    win = list_first_entry(&g_iowin_free, IOWIN, lru);
+
+    base = ALIGN_DOWN(phys_addr, IOWIN_SIZE);
+    size = IOWIN_SIZE;
+    if (cached && !iowin_is_firmware(base, size))
+        size = 0;
+
+    win->va = size ? iowin_map(base, size, cached) : NULL;
+    if (!win->va) {
+        base = phys_addr & PAGE_MASK;
+        size = PAGE_SIZE;
+        win->va = iowin_map(base, size, cached);
+    }
+
+    if (!win->va) {
+        g_iowin_stats.failures++;
+        return NULL;
+    }
+
+    win->base = base;
+    win->size = size;
+    win->cached = cached;
+    list_move(&win->lru, &g_iowin_lru);
+
+    return win;
+}
+
+/* iowin_read - read up to count bytes from a physical address that is not RAM
+ * @phys_addr: physical address to read from, without a struct page
+ * @buf: the buffer to read data into (user-space pointer in buffer read mode)
+ * @count: requested amount of bytes to read, size of buf
+ * @access_mode: how to access the memory
+ *
+ * The counterpart of pte_mmap_read for reserved memory, holes and MMIO,
+ * through ioremap instead of the rogue page. Integer reads are single
+ * accesses of that width, which matters for device registers.
+ *
+ * note: reads can not cross page boundaries
+ * note: non-buffer-mode accesses must be properly aligned
+ *
+ * Returns number of bytes read into `buf`
+ */
+uint64_t iowin_read(uint64_t phys_addr, void *buf, uint64_t count,
+                    PHYS_ACCESS_MODE access_mode)
+{
+    uint8_t bounce[256];
+    void __iomem *source;
+    uint64_t bytes_read = 0;
+    uint64_t to_read;
+    uint64_t done;
+    uint64_t chunk;
+    PIOWIN win;
+
+    to_read = min(PAGE_SIZE - offset_in_page(phys_addr), count);
+
+    if (access_mode != PHYS_BUFFER_READ && !IS_ALIGNED(phys_addr, count))
+        return 0;
+
+    mutex_lock(&g_iowin_lock);
+
+    win = iowin_get(phys_addr,
+                    iowin_is_firmware(phys_addr & PAGE_MASK, PAGE_SIZE));
+    if (!win)
+        goto out_unlock;
+
+    source = win->va + (phys_addr - win->base);
+
+    switch (access_mode) {
+    case PHYS_BYTE_READ:
+        *((uint8_t *)buf) = readb(source);
+        break;
+    case PHYS_WORD_READ:
+        *((uint16_t *)buf) = readw(source);
+        break;
+    case PHYS_DWORD_READ:
+        *((uint32_t *)buf) = readl(source);
+        break;
+    case PHYS_QWORD_READ:
+        *((uint64_t *)buf) = readq(source);
+        break;
+    case PHYS_BUFFER_READ:
+        // No copy_to_user from io memory, so bounce it.
+        for (done = 0; done < to_read; done += chunk) {
+            chunk = min_t(uint64_t, sizeof(bounce), to_read - done);
+            memcpy_fromio(bounce, source + done, chunk);
+            if (copy_to_user((void __user *)buf + done, bounce, chunk)) {
+                pr_notice_ratelimited("%s: copying to user failed\n",
+                                      __func__);
+                goto out_unlock;
+            }
+        }
+        break;
+    }
+
+    bytes_read = to_read;
+
+out_unlock:
+    mutex_unlock(&g_iowin_lock);
+
+    return bytes_read;
+}
+
+void iowin_query_stats(PLINPMEM_IOWIN_STATS iowin_stats)
+{
+    PIOWIN win;
+
+    mutex_lock(&g_iowin_lock);
+
+    *iowin_stats = g_iowin_stats;
+    list_for_each_entry(win, &g_iowin_lru, lru) {
+        iowin_stats->windows_mapped++;
+        iowin_stats->bytes_mapped += win->size;
+    }
+
+    mutex_unlock(&g_iowin_lock);
+}
@@ -0,0 +1,25 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _IOWIN_H_
+#define _IOWIN_H_
+
+#include <linux/types.h>
+
+#include "../userspace_interface/linpmem_shared.h"
+
+/* Number of cached ioremap windows, and their size. */
+#define IOWIN_COUNT (16)
+#define IOWIN_SIZE (0x10000)
+
+void iowin_init(void);
+
+void iowin_exit(void);
+
+uint64_t iowin_read(uint64_t phys_addr, void *buf, uint64_t count,
+                    PHYS_ACCESS_MODE access_mode);
+
+void iowin_query_stats(PLINPMEM_IOWIN_STATS iowin_stats);
+
+#endif
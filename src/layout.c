@@ -0,0 +1,112 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kprobes.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/utsname.h>
+#include <asm/page.h>
+#include <asm/pgtable.h>
+
+#include "layout.h"
+
+typedef unsigned long (*KALLSYMS_LOOKUP_NAME)(const char *name);
+
+/* kallsyms_lookup_name is not exported to modules (any more), but kprobes
+ * still resolve symbols with it. Set once by layout_init, or NULL.
+ */
+static KALLSYMS_LOOKUP_NAME g_kallsyms_lookup_name;
+
+/* The kallsyms tables, see LINPMEM_KERNEL_LAYOUT. */
+static const char *const g_kallsyms_tables[LINPMEM_KALLSYMS_TABLE_COUNT] = {
+    [LINPMEM_KALLSYMS_ADDRESSES] = "kallsyms_addresses",
+    [LINPMEM_KALLSYMS_OFFSETS] = "kallsyms_offsets",
+    [LINPMEM_KALLSYMS_RELATIVE_BASE] = "kallsyms_relative_base",
+    [LINPMEM_KALLSYMS_NUM_SYMS] = "kallsyms_num_syms",
+    [LINPMEM_KALLSYMS_NAMES] = "kallsyms_names",
+    [LINPMEM_KALLSYMS_MARKERS] = "kallsyms_markers",
+    [LINPMEM_KALLSYMS_TOKEN_TABLE] = "kallsyms_token_table",
+    [LINPMEM_KALLSYMS_TOKEN_INDEX] = "kallsyms_token_index",
+};
+
+void layout_init(void)
+{
+#ifdef CONFIG_KPROBES
+    struct kprobe kp = { .symbol_name = "kallsyms_lookup_name" };
+
+    if (register_kprobe(&kp)) {
+        pr_notice("kallsyms_lookup_name not found, no kernel symbols\n");
+        return;
+    }
+
+    g_kallsyms_lookup_name = (KALLSYMS_LOOKUP_NAME)kp.addr;
+
+    unregister_kprobe(&kp);
+#else
+    pr_notice("no kprobes, no kernel symbols\n");
+#endif
+}
+
+/* layout_lookup_symbol - address of a kernel symbol
+ * @name: the symbol
+ *
+ * Returns the (virtual) address, or 0 if not found or no symbols available
+ */
+unsigned long layout_lookup_symbol(const char *name)
+{
+    if (!g_kallsyms_lookup_name)
+        return 0;
+
+    return g_kallsyms_lookup_name(name);
+}
+
+/* image_phys - physical address of an address in the kernel image mapping */
+static uint64_t image_phys(unsigned long address)
+{
+    if (!address)
+        return 0;
+
+    return address - __START_KERNEL_map + phys_base;
+}
+
+void layout_query(PLINPMEM_KERNEL_LAYOUT layout)
+{
+    int i;
+
+    memset(layout, 0, sizeof(LINPMEM_KERNEL_LAYOUT));
+
+    layout->paging_levels = pgtable_l5_enabled() ? 5 : 4;
+
+    // Exported, these are always there.
+    layout->page_offset_base = PAGE_OFFSET;
+    layout->vmalloc_base = VMALLOC_START;
+    layout->vmemmap_base = VMEMMAP_START;
+    layout->phys_base = phys_base;
+
+    strscpy(layout->uts_release, init_utsname()->release,
+            sizeof(layout->uts_release));
+    strscpy(layout->uts_version, init_utsname()->version,
+            sizeof(layout->uts_version));
+
+    if (!g_kallsyms_lookup_name)
+        return;
+
+    layout->flags |= LINPMEM_LAYOUT_SYMBOLS;
+
+    layout->text_start = layout_lookup_symbol("_text");
+    layout->text_end = layout_lookup_symbol("_etext");
+    layout->image_end = layout_lookup_symbol("_end");
+    layout->text_start_phys = image_phys(layout->text_start);
+    if (layout->text_start)
+        layout->kaslr_offset = layout->text_start - __START_KERNEL;
+
+    // swapper_pg_dir
+    layout->kernel_cr3 = image_phys(layout_lookup_symbol("init_top_pgt"));
+
+    for (i = 0; i < LINPMEM_KALLSYMS_TABLE_COUNT; i++)
+        layout->kallsyms[i] = layout_lookup_symbol(g_kallsyms_tables[i]);
+}
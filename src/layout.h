@@ -0,0 +1,16 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _LAYOUT_H_
+#define _LAYOUT_H_
+
+#include "../userspace_interface/linpmem_shared.h"
+
+void layout_init(void);
+
+void layout_query(PLINPMEM_KERNEL_LAYOUT layout);
+
+unsigned long layout_lookup_symbol(const char *name);
+
+#endif
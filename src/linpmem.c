@@ -18,12 +18,29 @@
 #include <linux/uaccess.h>
 #include <linux/mm.h>
 #include <linux/align.h>
+#include <linux/sizes.h>
 #include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
+#include <linux/rcupdate.h>
+#include <linux/mmap_lock.h>
 #include <asm/io.h>
 
 #include "pte_mmap.h"
 #include "page_table.h"
+#include "layout.h"
+#include "compress.h"
+#include "digest.h"
+#include "iowin.h"
 #include "linpmem.h"
+#include "listwalk.h"
+#include "pfnmap.h"
+#include "procmap.h"
+#include "rmap.h"
+#include "scan.h"
+#include "softdirty.h"
 
 unsigned int major = 42;
 
@@ -31,18 +48,67 @@ DEVICE_EXTENSION g_device_extension = { 0 };
 
 static int pmem_open(struct inode *device_file, struct file *instance)
 {
+    PFILE_CONTEXT file_context;
+
     pr_debug("open\n");
 
+    file_context = kzalloc(sizeof(FILE_CONTEXT), GFP_KERNEL);
+    if (!file_context)
+        return -ENOMEM;
+
+    mutex_init(&file_context->lock);
+
+    if (iminor(device_file) == LINPMEM_MINOR_CORE) {
+        file_context->core = elfcore_create();
+        if (IS_ERR(file_context->core)) {
+            int ret = PTR_ERR(file_context->core);
+
+            kfree(file_context);
+            return ret;
+        }
+    }
+
+    instance->private_data = file_context;
+
     return 0;
 }
 
 static int pmem_close(struct inode *device_file, struct file *instance)
 {
+    PFILE_CONTEXT file_context = instance->private_data;
+    int i;
+
     pr_debug("close\n");
 
+    // Any mapping of the ring holds a file reference, so it is gone by now.
+    ring_destroy(file_context->ring);
+
+    for (i = 0; i < LINPMEM_MAX_REGISTERED_BUFFERS; i++)
+        regbuf_put(file_context->buffers[i]);
+
+    elfcore_destroy(file_context->core);
+    session_put(file_context->binding);
+    watch_put(file_context->watch);
+    kfree(file_context);
+
     return 0;
 }
 
+static int pmem_mmap(struct file *instance, struct vm_area_struct *vma)
+{
+    PFILE_CONTEXT file_context = instance->private_data;
+    PPAGE_RING ring;
+
+    // Called with the mmap lock held: file_context->lock must not be taken
+    // here, the ioctls copy to user space under it. The ring is never
+    // replaced once it is set up.
+    ring = smp_load_acquire(&file_context->ring);
+    if (!ring)
+        return -ENODEV;
+
+    return ring_mmap(ring, vma);
+}
+
 /* pte_mmap_read - read up to count bytes from `phys_addr` using rogue PTE
  * @pte_data: management data
  * @phys_addr: physical address to read from
@@ -131,28 +197,167 @@ static uint64_t pte_mmap_read(PPTE_METHOD_DATA pte_data, uint64_t phys_addr,
     bytes_read = to_read;
 
 out_unlock:
-    mutex_unlock(&g_rogue_page_mutex);
+    mutex_unlock(pte_data->rogue_lock);
 
     return bytes_read;
 }
 
-/* r_cr3_pa_pid - get the physical address of the top-level page tables of task
- * @upid: user space pid
+/* pte_mmap_read_contiguous - read across page boundaries into a user buffer
+ * @phys_addr: physical address to read from
+ * @buf: user-space buffer
+ * @count: requested amount of bytes to read, size of buf
  *
- * Currently, Linpmem will NOT try to probe and lock the process in question.
- * From security perspective, the process might exit at any time. 
- * Make sure that the process still exists while asking for its CR3! 
+ * Uses a pair of rogue windows, so the next page is remapped while the
+ * current one is copied, see pte_mmap_read_pipelined. Readers are spread over
+ * the pairs by pid. Without the windows, it is one page after the other on
+ * the rogue page of the ioctl path.
  *
- * Returns physical address of pgd
+ * Returns number of bytes read into `buf`
  */
-static CR3 r_cr3_pa_pid(pid_t upid)
+static uint64_t pte_mmap_read_contiguous(uint64_t phys_addr, void __user *buf,
+                                         uint64_t count)
 {
-    CR3 cr3_pa;
-    struct pid *pid;
+    unsigned int pair;
+    uint64_t bytes_read = 0;
+    uint64_t chunk;
+
+    if (g_device_extension.rogue_windows_ready) {
+        pair = (task_pid_nr(current) % (ROGUE_WINDOW_COUNT / 2)) * 2;
+        return pte_mmap_read_pipelined(rogue_window(pair),
+                                       rogue_window(pair + 1), phys_addr, buf,
+                                       count);
+    }
+
+    while (bytes_read < count) {
+        chunk = pte_mmap_read(&g_device_extension.pte_data,
+                              phys_addr + bytes_read, buf + bytes_read,
+                              count - bytes_read, PHYS_BUFFER_READ);
+        if (!chunk)
+            break;
+        bytes_read += chunk;
+
+        if (signal_pending(current))
+            break;
+    }
+
+    return bytes_read;
+}
+
+static loff_t pmem_llseek(struct file *instance, loff_t offset, int whence)
+{
+    PFILE_CONTEXT file_context = instance->private_data;
+
+    if (!file_context->core)
+        return -ESPIPE;
+
+    return fixed_size_llseek(instance, offset, whence,
+                             file_context->core->size);
+}
+
+/* pmem_read - read the ELF core view (LINPMEM_MINOR_CORE)
+ * @instance: the file
+ * @buf: user buffer
+ * @count: its size
+ * @ppos: file offset
+ *
+ * Memory is read on demand, pages that can not be read are zeros, as is
+ * the padding between the segments. A signal ends the read early.
+ *
+ * Returns number of bytes read, or negative error
+ */
+static ssize_t pmem_read(struct file *instance, char __user *buf, size_t count,
+                         loff_t *ppos)
+{
+    PFILE_CONTEXT file_context = instance->private_data;
+    PELF_CORE core = file_context->core;
+    ELF_CORE_REGION region;
+    uint64_t offset = *ppos;
+    uint64_t done = 0;
+    uint64_t where;
+    uint64_t chunk;
+    uint64_t got;
+
+    if (!core)
+        return -EINVAL;
+
+    if (*ppos < 0 || offset >= core->size)
+        return 0;
+
+    count = min_t(uint64_t, count, core->size - offset);
+
+    while (done < count) {
+        chunk = elfcore_locate(core, offset + done, &region, &where);
+        chunk = min_t(uint64_t, chunk, count - done);
+        // Look at signals (and let go of the rogue windows) now and then.
+        chunk = min_t(uint64_t, chunk, SZ_2M);
+
+        switch (region) {
+        case ELF_CORE_HEADER:
+            if (copy_to_user(buf + done, core->header + where, chunk))
+                goto fault;
+            break;
+        case ELF_CORE_PADDING:
+            if (clear_user(buf + done, chunk))
+                goto fault;
+            break;
+        case ELF_CORE_MEMORY:
+            got = pte_mmap_read_contiguous(where, buf + done, chunk);
+            if (got < chunk) {
+                done += got;
+                if (signal_pending(current))
+                    goto interrupted;
+                // Stopped at the user buffer, not at the memory?
+                if (pfn_valid(__phys_to_pfn(where + got)))
+                    goto fault;
+                // Stopped at a page that can not be read.
+                chunk = min_t(uint64_t, chunk - got,
+                              PAGE_SIZE - offset_in_page(where + got));
+                if (clear_user(buf + done, chunk))
+                    goto fault;
+            }
+            break;
+        }
+
+        done += chunk;
+
+        if (fatal_signal_pending(current))
+            break;
+    }
+
+    *ppos += done;
+
+    return done;
+
+fault:
+    if (!done)
+        return -EFAULT;
+
+    *ppos += done;
+
+    return done;
+
+interrupted:
+    if (!done)
+        return -EINTR;
+
+    *ppos += done;
+
+    return done;
+}
+
+/* get_pid_mm - get the address space of a task
+ * @upid: user space pid, or zero for the current task
+ *
+ * Returns the mm with a reference held (mmput it), or NULL
+ */
+struct mm_struct *get_pid_mm(pid_t upid)
+{
+    struct mm_struct *mm = NULL;
     struct task_struct *task;
-    struct mm_struct *mm;
+    struct pid *pid;
 
-    cr3_pa.value = 0;
+    if (!upid)
+        return get_task_mm(current);
 
     pid = find_get_pid(upid);
     if (!pid)
@@ -163,23 +368,60 @@ static CR3 r_cr3_pa_pid(pid_t upid)
         goto out_pid;
 
     mm = get_task_mm(task);
-    if (!mm)
-        goto out_task;
+
+    put_task_struct(task);
+out_pid:
+    put_pid(pid);
+out:
+    return mm;
+}
+
+/* mm_cr3_pa - get the physical address of the (kernel) pgd of an mm
+ * @mm: the address space
+ *
+ * Returns physical address of pgd
+ */
+CR3 mm_cr3_pa(struct mm_struct *mm)
+{
+    CR3 cr3_pa;
 
     cr3_pa.value = (uint64_t)virt_to_phys((void *)mm->pgd);
 
-    pr_debug("Task with upid %d has pdg@0x%llx\n", upid, cr3_pa.value);
     if (!is_kernel_pgtable(cr3_pa.value)) {
-        pr_notice("PGD stored in mm is not kernel\n");
+        pr_notice_ratelimited("%s: PGD stored in mm is not kernel\n",
+                              __func__);
         cr3_pa.value &= ~PTI_USER_PGTABLE_MASK;
     }
 
+    return cr3_pa;
+}
+
+/* r_cr3_pa_pid - get the physical address of the top-level page tables of task
+ * @upid: user space pid
+ *
+ * Currently, Linpmem will NOT try to probe and lock the process in question.
+ * From security perspective, the process might exit at any time. 
+ * Make sure that the process still exists while asking for its CR3! 
+ *
+ * Returns physical address of pgd
+ */
+static CR3 r_cr3_pa_pid(pid_t upid)
+{
+    CR3 cr3_pa;
+    struct mm_struct *mm;
+
+    cr3_pa.value = 0;
+
+    mm = get_pid_mm(upid);
+    if (!mm)
+        return cr3_pa;
+
+    cr3_pa = mm_cr3_pa(mm);
+
+    pr_debug("Task with upid %d has pdg@0x%llx\n", upid, cr3_pa.value);
+
     mmput(mm);
-out_task:
-    put_task_struct(task);
-out_pid:
-    put_pid(pid);
-out:
+
     return cr3_pa;
 }
 
@@ -225,9 +467,11 @@ out:
     return ret;
 }
 
-static long do_ioctl_vtop(PLINPMEM_VTOP_INFO __user userbuffer)
+static long do_ioctl_vtop(PFILE_CONTEXT file_context,
+                          PLINPMEM_VTOP_INFO __user userbuffer)
 {
     LINPMEM_VTOP_INFO vtop_info;
+    PSESSION_BINDING binding;
     VIRT_ADDR in_va = { 0 };
     uint64_t page_offset = 0;
     volatile PPTE ppte;
@@ -251,6 +495,30 @@ static long do_ioctl_vtop(PLINPMEM_VTOP_INFO __user userbuffer)
         goto out;
     }
 
+    if (!vtop_info.associated_cr3) {
+        // Not under file_context->lock: translating takes the mmap lock.
+        mutex_lock(&file_context->lock);
+        binding = file_context->binding;
+        if (binding)
+            session_get(binding);
+        mutex_unlock(&file_context->lock);
+
+        if (binding) {
+            atomic64_inc(&file_context->vtop_count);
+            ret = session_translate(binding, vtop_info.virt_address,
+                                    &vtop_info.phys_address, &vtop_info.ppte);
+            session_put(binding);
+            if (ret) {
+                vtop_info.phys_address = 0;
+                vtop_info.ppte = NULL;
+                // Not present is not an error, see below.
+                if (ret == -ENOENT)
+                    ret = 0;
+            }
+            goto out_usercopy;
+        }
+    }
+
     in_va.value = vtop_info.virt_address;
     page_offset = in_va.offset;
     in_va.value -= page_offset;
@@ -305,167 +573,1339 @@ out:
     return ret;
 }
 
-static long do_ioctl_read(PLINPMEM_DATA_TRANSFER __user userbuffer)
+bool collect_virt_run(void *context, uint64_t virt_address,
+                      uint64_t phys_address, uint64_t size, PTE effective,
+                      volatile PPTE leaf)
 {
-    LINPMEM_DATA_TRANSFER data_transfer;
-    uint64_t tmp = 0;
-    void *buf = &tmp;
-    PHYS_ACCESS_MODE access_mode = 0;
-    uint64_t count;
+    PVIRT_RUN_LIST list = context;
+    PLINPMEM_VIRT_RUN run = NULL;
+    uint64_t flags = 0;
+
+    if (effective.rw)
+        flags |= LINPMEM_VIRT_RUN_WRITABLE;
+    if (effective.user)
+        flags |= LINPMEM_VIRT_RUN_USER;
+    if (!effective.xd)
+        flags |= LINPMEM_VIRT_RUN_EXECUTABLE;
+
+    if (list->run_count)
+        run = &list->runs[list->run_count - 1];
+
+    if (run && run->flags == flags &&
+        run->virt_address + run->size == virt_address &&
+        run->phys_address + run->size == phys_address) {
+        run->size += size;
+    } else {
+        if (list->run_count == list->max_runs)
+            return false;
+
+        run = &list->runs[list->run_count++];
+        run->virt_address = virt_address;
+        run->phys_address = phys_address;
+        run->size = size;
+        run->flags = flags;
+    }
+
+    list->mapped_pages += size >> PAGE_SHIFT;
+
+    return true;
+}
+
+static long do_ioctl_query_process_runs(PLINPMEM_PROCESS_RUNS __user userbuffer)
+{
+    LINPMEM_PROCESS_RUNS process_runs;
+    VIRT_RUN_LIST list = { 0 };
+    struct mm_struct *mm;
+    PTE_STATUS pte_status;
+    CR3 cr3_pa;
     long ret = 0;
-    uint64_t bytes_read = 0;
 
-    if (copy_from_user(&data_transfer, userbuffer,
-                       sizeof(LINPMEM_DATA_TRANSFER))) {
-        pr_notice_ratelimited("%s: copying LINPMEM_DATA_TRANSFER from user!\n",
+    if (copy_from_user(&process_runs, userbuffer,
+                       sizeof(LINPMEM_PROCESS_RUNS))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_PROCESS_RUNS from user!\n",
                               __func__);
-        ret = -EFAULT;
-        goto out;
+        return -EFAULT;
     }
 
-    switch (data_transfer.access_type) {
-    case PHYS_BYTE_READ:
-        count = 1;
-        access_mode = PHYS_BYTE_READ;
-        break;
-    case PHYS_WORD_READ:
-        count = 2;
-        access_mode = PHYS_WORD_READ;
-        break;
-    case PHYS_DWORD_READ:
-        count = 4;
-        access_mode = PHYS_DWORD_READ;
-        break;
-    case PHYS_QWORD_READ:
-        count = 8;
-        access_mode = PHYS_QWORD_READ;
-        break;
-    case PHYS_BUFFER_READ:
-        count = data_transfer.readbuffer_size;
-
-        if (count == 0 || count > PAGE_SIZE) {
-            pr_notice_ratelimited(
-                "%s: BUFFER_READ: invalid read size specified\n", __func__);
-            ret = -EINVAL;
-            goto out;
-        }
+    if (!process_runs.max_runs ||
+        process_runs.max_runs > LINPMEM_MAX_VIRT_RUNS) {
+        pr_notice_ratelimited("%s: invalid number of runs\n", __func__);
+        return -EINVAL;
+    }
 
-        if (!data_transfer.readbuffer) {
-            pr_notice_ratelimited(
-                "%s: BUFFER_READ: provided usermode buffer is null\n",
-                __func__);
-            ret = -EINVAL;
-            goto out;
-        }
+    // virt_walk_range knows only 4 levels.
+    if (pgtable_l5_enabled())
+        return -EOPNOTSUPP;
 
-        access_mode = PHYS_BUFFER_READ;
+    process_runs.virt_end = min_t(uint64_t, process_runs.virt_end,
+                                  TASK_SIZE_MAX);
+    if (process_runs.virt_start >= process_runs.virt_end)
+        return -EINVAL;
 
-        buf = data_transfer.readbuffer;
+    list.max_runs = process_runs.max_runs;
+    list.runs =
+        kvcalloc(list.max_runs, sizeof(LINPMEM_VIRT_RUN), GFP_KERNEL);
+    if (!list.runs)
+        return -ENOMEM;
 
-        break;
-    default:
-        pr_notice_ratelimited("%s: unknown access type %08x set!\n", __func__,
-                              data_transfer.access_type);
-        ret = -EINVAL;
+    mm = get_pid_mm((pid_t)process_runs.target_process);
+    if (!mm) {
+        ret = -ESRCH;
         goto out;
-    } // end of switch (data_transfer.access_type)
-
-    pr_debug("%s: Reading up to %llu bytes from %llx.\n", __func__, count,
-             (long long unsigned int)data_transfer.phys_address);
+    }
 
-    bytes_read = pte_mmap_read(&g_device_extension.pte_data,
-                               data_transfer.phys_address, buf, count,
-                               access_mode);
+    cr3_pa = mm_cr3_pa(mm);
 
-    pr_debug("%s: Read %llu bytes from %llx.\n", __func__, bytes_read,
-             (long long unsigned int)data_transfer.phys_address);
+    // Keeps munmap from freeing the page tables under us. Not khugepaged,
+    // see virt_walk_range.
+    mmap_read_lock(mm);
+    pte_status = virt_walk_range(cr3_pa.value, process_runs.virt_start,
+                                 process_runs.virt_end, collect_virt_run,
+                                 &list, &process_runs.resume_address);
+    mmap_read_unlock(mm);
 
-    data_transfer.out_value = bytes_read == count ? tmp : 0;
+    mmput(mm);
 
-    if (access_mode != PHYS_BUFFER_READ && bytes_read != count) {
+    if (pte_status != PTE_SUCCESS) {
         ret = -EIO;
+        goto out;
     }
 
-    if (access_mode == PHYS_BUFFER_READ) {
-        if (bytes_read <= count) {
-            data_transfer.readbuffer_size = bytes_read;
-        } else {
-            data_transfer.readbuffer_size = 0;
-            ret = -EIO;
-        }
-    }
+    process_runs.run_count = list.run_count;
+    process_runs.result_cr3 = cr3_pa.value;
+    process_runs.mapped_pages = list.mapped_pages;
 
-    if (copy_to_user(userbuffer, &data_transfer,
-                     sizeof(LINPMEM_DATA_TRANSFER))) {
-        pr_notice_ratelimited(
-            "%s: copying LINPMEM_DATA_TRANSFER back to user!\n", __func__);
+    if (copy_to_user(process_runs.runs, list.runs,
+                     list.run_count * sizeof(LINPMEM_VIRT_RUN)) ||
+        copy_to_user(userbuffer, &process_runs,
+                     sizeof(LINPMEM_PROCESS_RUNS))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_PROCESS_RUNS to user!\n",
+                              __func__);
         ret = -EFAULT;
-        goto out;
     }
 
 out:
+    kvfree(list.runs);
+
     return ret;
 }
 
-static long int pmem_ioctl(struct file *file, unsigned int ioctl,
-                           unsigned long userbuffer)
+static long do_ioctl_query_dirty_runs(PLINPMEM_DIRTY_RUNS __user userbuffer)
 {
+    LINPMEM_DIRTY_RUNS dirty_runs;
+    PLINPMEM_PROCESS_RUNS process_runs = &dirty_runs.runs;
+    VIRT_RUN_LIST list = { 0 };
+    struct mm_struct *mm;
     long ret = 0;
 
-    switch (ioctl) {
-    case IOCTL_LINPMEM_READ_PHYSADDR:
-        ret = do_ioctl_read((PLINPMEM_DATA_TRANSFER)userbuffer);
-        break;
-    case IOCTL_LINPMEM_VTOP_TRANSLATION_SERVICE:
-        ret = do_ioctl_vtop((PLINPMEM_VTOP_INFO)userbuffer);
-        break;
-    case IOCTL_LINPMEM_QUERY_CR3:
-        ret = do_ioctl_query_cr3((PLINPMEM_CR3_INFO)userbuffer);
-        break;
-    default:
-        pr_err_ratelimited("%s: unknown IOCTL %08x\n", __func__, ioctl);
-        ret = -ENOSYS;
+    if (copy_from_user(&dirty_runs, userbuffer, sizeof(LINPMEM_DIRTY_RUNS))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_DIRTY_RUNS from user!\n",
+                              __func__);
+        return -EFAULT;
     }
 
-    return ret;
-}
+    if (!process_runs->max_runs ||
+        process_runs->max_runs > LINPMEM_MAX_VIRT_RUNS) {
+        pr_notice_ratelimited("%s: invalid number of runs\n", __func__);
+        return -EINVAL;
+    }
 
-const static struct file_operations pmem_fops = { .owner = THIS_MODULE,
-                                                  .open = pmem_open,
-                                                  .release = pmem_close,
-                                                  .unlocked_ioctl =
-                                                      pmem_ioctl };
+    process_runs->virt_end = min_t(uint64_t, process_runs->virt_end,
+                                   TASK_SIZE_MAX);
+    if (process_runs->virt_start >= process_runs->virt_end)
+        return -EINVAL;
 
-/* init_check_compatibility - checks necessary conditions for driver loading
- *
- * This function function checks that some necessary conditions for loading
- * the driver are satisfied. Decides whether to bail out, to adapt strategies,
- * or that some features will not be available.
- *
- * Returns 0 if it is ok to continue loading the driver, or -1 if we must bail
- * out.
- */
-static int init_check_compatibility(void)
-{
-    int ret = 0;
+    list.max_runs = process_runs->max_runs;
+    list.runs =
+        kvcalloc(list.max_runs, sizeof(LINPMEM_VIRT_RUN), GFP_KERNEL);
+    if (!list.runs)
+        return -ENOMEM;
 
-    if (boot_cpu_has(X86_FEATURE_SEV)) {
-        pr_debug("SEV: active. BAIL OUT\n");
-        ret = -1;
+    mm = get_pid_mm((pid_t)process_runs->target_process);
+    if (!mm) {
+        ret = -ESRCH;
         goto out;
-    } else {
-        pr_debug("SEV: not active. OK\n");
     }
 
-    if (boot_cpu_has(X86_FEATURE_SME)) {
-        pr_debug("SME: active. BAIL OUT\n");
-        ret = -1;
+    ret = softdirty_walk(mm, process_runs->virt_start, process_runs->virt_end,
+                         dirty_runs.flags & LINPMEM_DIRTY_CLEAR,
+                         collect_virt_run, &list,
+                         &process_runs->resume_address);
+    process_runs->result_cr3 = mm_cr3_pa(mm).value;
+
+    mmput(mm);
+
+    if (ret)
         goto out;
-    } else {
-        pr_debug("SME: not active. OK\n");
+
+    process_runs->run_count = list.run_count;
+    process_runs->mapped_pages = list.mapped_pages;
+
+    if (copy_to_user(process_runs->runs, list.runs,
+                     list.run_count * sizeof(LINPMEM_VIRT_RUN)) ||
+        copy_to_user(userbuffer, &dirty_runs, sizeof(LINPMEM_DIRTY_RUNS))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_DIRTY_RUNS to user!\n",
+                              __func__);
+        ret = -EFAULT;
     }
 
-    // pgtable_l5_enabled() =- cpu_feature_enabled(X86_FEATURE_LA57)
+out:
+    kvfree(list.runs);
+
+    return ret;
+}
+
+/* fill_process_info - describe one task
+ * @task: the task, under RCU
+ * @info: where to put it
+ *
+ * task_lock keeps task->mm from going away while we look at it.
+ */
+static void fill_process_info(struct task_struct *task,
+                              PLINPMEM_PROCESS_INFO info)
+{
+    struct mm_struct *mm;
+
+    info->pid = task_pid_vnr(task);
+    info->tgid = task_tgid_vnr(task);
+    info->ppid = task_tgid_vnr(rcu_dereference(task->real_parent));
+
+    if (task->flags & PF_KTHREAD)
+        info->flags |= LINPMEM_PROCESS_KERNEL_THREAD;
+    if (task->flags & PF_EXITING)
+        info->flags |= LINPMEM_PROCESS_EXITING;
+
+    task_lock(task);
+
+    strscpy(info->comm, task->comm, sizeof(info->comm));
+
+    mm = task->mm;
+    if (mm) {
+        info->cr3 = mm_cr3_pa(mm).value;
+        info->mm_id = (uint64_t)mm;
+    }
+
+    task_unlock(task);
+}
+
+static long do_ioctl_query_processes(PLINPMEM_PROCESSES __user userbuffer)
+{
+    LINPMEM_PROCESSES processes;
+    PLINPMEM_PROCESS_INFO infos;
+    struct task_struct *process;
+    struct task_struct *task;
+    uint32_t count = 0;
+    uint32_t total = 0;
+    long ret = 0;
+
+    if (copy_from_user(&processes, userbuffer, sizeof(LINPMEM_PROCESSES))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_PROCESSES from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    if (!processes.max_processes ||
+        processes.max_processes > LINPMEM_MAX_PROCESSES ||
+        (processes.flags & ~LINPMEM_PROCESSES_THREADS)) {
+        pr_notice_ratelimited("%s: invalid process query\n", __func__);
+        return -EINVAL;
+    }
+
+    // We can not copy to user space under RCU, so collect first.
+    infos = kvcalloc(processes.max_processes, sizeof(LINPMEM_PROCESS_INFO),
+                     GFP_KERNEL);
+    if (!infos)
+        return -ENOMEM;
+
+    rcu_read_lock();
+
+    for_each_process(process) {
+        if (!(processes.flags & LINPMEM_PROCESSES_THREADS)) {
+            if (count < processes.max_processes)
+                fill_process_info(process, &infos[count++]);
+            total++;
+            continue;
+        }
+
+        for_each_thread(process, task) {
+            if (count < processes.max_processes)
+                fill_process_info(task, &infos[count++]);
+            total++;
+        }
+    }
+
+    rcu_read_unlock();
+
+    processes.process_count = count;
+    processes.total_count = total;
+
+    if (copy_to_user(processes.processes, infos,
+                     count * sizeof(LINPMEM_PROCESS_INFO)) ||
+        copy_to_user(userbuffer, &processes, sizeof(LINPMEM_PROCESSES))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_PROCESSES to user!\n",
+                              __func__);
+        ret = -EFAULT;
+    }
+
+    kvfree(infos);
+
+    return ret;
+}
+
+static long
+do_ioctl_query_process_maps(PLINPMEM_PROCESS_MAPS __user userbuffer)
+{
+    LINPMEM_PROCESS_MAPS process_maps;
+    long ret;
+
+    if (copy_from_user(&process_maps, userbuffer,
+                       sizeof(LINPMEM_PROCESS_MAPS))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_PROCESS_MAPS from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    ret = procmap_query(&process_maps);
+    if (ret)
+        return ret;
+
+    if (copy_to_user(userbuffer, &process_maps,
+                     sizeof(LINPMEM_PROCESS_MAPS))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_PROCESS_MAPS to user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+static long do_ioctl_walk_list(PLINPMEM_LIST_WALK __user userbuffer)
+{
+    LINPMEM_LIST_WALK walk;
+    long ret;
+
+    if (copy_from_user(&walk, userbuffer, sizeof(LINPMEM_LIST_WALK))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_LIST_WALK from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    ret = listwalk_walk(&walk);
+    if (ret)
+        return ret;
+
+    if (copy_to_user(userbuffer, &walk, sizeof(LINPMEM_LIST_WALK))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_LIST_WALK to user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+static long do_ioctl_digest(PLINPMEM_DIGEST __user userbuffer)
+{
+    LINPMEM_DIGEST digest;
+    long ret;
+
+    if (copy_from_user(&digest, userbuffer, sizeof(LINPMEM_DIGEST))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_DIGEST from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    ret = digest_chunks(&digest);
+    if (ret)
+        return ret;
+
+    if (copy_to_user(userbuffer, &digest, sizeof(LINPMEM_DIGEST))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_DIGEST to user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+static long do_ioctl_read_compressed(PFILE_CONTEXT file_context,
+                                     PLINPMEM_COMPRESSED_READ __user userbuffer)
+{
+    LINPMEM_COMPRESSED_READ read;
+    long ret;
+
+    if (copy_from_user(&read, userbuffer, sizeof(LINPMEM_COMPRESSED_READ))) {
+        pr_notice_ratelimited(
+            "%s: copying LINPMEM_COMPRESSED_READ from user!\n", __func__);
+        return -EFAULT;
+    }
+
+    ret = compress_read(&read);
+    if (ret)
+        return ret;
+
+    atomic64_inc(&file_context->reads);
+    atomic64_add(read.raw_bytes, &file_context->bytes_read);
+
+    if (copy_to_user(userbuffer, &read, sizeof(LINPMEM_COMPRESSED_READ))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_COMPRESSED_READ to user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+static long do_ioctl_read(PFILE_CONTEXT file_context,
+                          PLINPMEM_DATA_TRANSFER __user userbuffer)
+{
+    LINPMEM_DATA_TRANSFER data_transfer;
+    uint8_t access_type;
+    uint64_t tmp = 0;
+    void *buf = &tmp;
+    PHYS_ACCESS_MODE access_mode = 0;
+    uint64_t count;
+    uint64_t max_count;
+    long ret = 0;
+    uint64_t bytes_read = 0;
+
+    if (copy_from_user(&data_transfer, userbuffer,
+                       sizeof(LINPMEM_DATA_TRANSFER))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_DATA_TRANSFER from user!\n",
+                              __func__);
+        ret = -EFAULT;
+        goto out;
+    }
+
+    access_type = data_transfer.access_type;
+    if (!access_type)
+        access_type = READ_ONCE(file_context->default_access_type);
+
+    switch (access_type) {
+    case PHYS_BYTE_READ:
+        count = 1;
+        access_mode = PHYS_BYTE_READ;
+        break;
+    case PHYS_WORD_READ:
+        count = 2;
+        access_mode = PHYS_WORD_READ;
+        break;
+    case PHYS_DWORD_READ:
+        count = 4;
+        access_mode = PHYS_DWORD_READ;
+        break;
+    case PHYS_QWORD_READ:
+        count = 8;
+        access_mode = PHYS_QWORD_READ;
+        break;
+    case PHYS_BUFFER_READ:
+        count = data_transfer.readbuffer_size;
+        max_count = PAGE_SIZE;
+        if (data_transfer.flags & LINPMEM_TRANSFER_IGNORE_PAGE_BOUNDARY)
+            max_count = LINPMEM_MAX_TRANSFER_SIZE;
+
+        if (count == 0 || count > max_count) {
+            pr_notice_ratelimited(
+                "%s: BUFFER_READ: invalid read size specified\n", __func__);
+            ret = -EINVAL;
+            goto out;
+        }
+
+        if (!data_transfer.readbuffer) {
+            pr_notice_ratelimited(
+                "%s: BUFFER_READ: provided usermode buffer is null\n",
+                __func__);
+            ret = -EINVAL;
+            goto out;
+        }
+
+        if (!access_ok(data_transfer.readbuffer, count)) {
+            pr_notice_ratelimited(
+                "%s: BUFFER_READ: provided usermode buffer is invalid\n",
+                __func__);
+            ret = -EFAULT;
+            goto out;
+        }
+
+        access_mode = PHYS_BUFFER_READ;
+
+        buf = data_transfer.readbuffer;
+
+        break;
+    default:
+        pr_notice_ratelimited("%s: unknown access type %08x set!\n", __func__,
+                              access_type);
+        ret = -EINVAL;
+        goto out;
+    } // end of switch (data_transfer.access_type)
+
+    pr_debug("%s: Reading up to %llu bytes from %llx.\n", __func__, count,
+             (long long unsigned int)data_transfer.phys_address);
+
+    if (access_mode == PHYS_BUFFER_READ &&
+        (data_transfer.flags & LINPMEM_TRANSFER_IGNORE_PAGE_BOUNDARY))
+        bytes_read = pte_mmap_read_contiguous(data_transfer.phys_address, buf,
+                                              count);
+    else if (!pfn_valid(__phys_to_pfn(data_transfer.phys_address)))
+        // Not RAM: no rogue page, but ioremap.
+        bytes_read = iowin_read(data_transfer.phys_address, buf, count,
+                                access_mode);
+    else
+        bytes_read = pte_mmap_read(&g_device_extension.pte_data,
+                                   data_transfer.phys_address, buf, count,
+                                   access_mode);
+
+    pr_debug("%s: Read %llu bytes from %llx.\n", __func__, bytes_read,
+             (long long unsigned int)data_transfer.phys_address);
+
+    atomic64_inc(&file_context->reads);
+    atomic64_add(bytes_read, &file_context->bytes_read);
+
+    data_transfer.out_value = bytes_read == count ? tmp : 0;
+
+    if (access_mode != PHYS_BUFFER_READ && bytes_read != count) {
+        ret = -EIO;
+    }
+
+    if (access_mode == PHYS_BUFFER_READ) {
+        if (bytes_read <= count) {
+            data_transfer.readbuffer_size = bytes_read;
+        } else {
+            data_transfer.readbuffer_size = 0;
+            ret = -EIO;
+        }
+    }
+
+    if (copy_to_user(userbuffer, &data_transfer,
+                     sizeof(LINPMEM_DATA_TRANSFER))) {
+        pr_notice_ratelimited(
+            "%s: copying LINPMEM_DATA_TRANSFER back to user!\n", __func__);
+        ret = -EFAULT;
+        goto out;
+    }
+
+out:
+    return ret;
+}
+
+static long do_ioctl_ring_setup(PFILE_CONTEXT file_context,
+                               PLINPMEM_RING_SETUP __user userbuffer)
+{
+    LINPMEM_RING_SETUP ring_setup;
+    PPAGE_RING ring;
+    long ret = 0;
+
+    if (copy_from_user(&ring_setup, userbuffer, sizeof(LINPMEM_RING_SETUP))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_RING_SETUP from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    if (!ring_setup.slot_count ||
+        ring_setup.slot_count > LINPMEM_RING_MAX_SLOTS ||
+        (ring_setup.flags & ~LINPMEM_RING_NUMA_LOCAL)) {
+        pr_notice_ratelimited("%s: invalid ring setup requested\n", __func__);
+        return -EINVAL;
+    }
+
+    if (smp_load_acquire(&file_context->ring)) {
+        pr_notice_ratelimited("%s: this file already has a ring\n", __func__);
+        return -EBUSY;
+    }
+
+    ring = ring_create(ring_setup.slot_count, ring_setup.flags);
+    if (!ring)
+        return -ENOMEM;
+
+    ring_setup.mmap_size = ring->size;
+
+    // Not under file_context->lock: a fault here takes the mmap lock.
+    if (copy_to_user(userbuffer, &ring_setup, sizeof(LINPMEM_RING_SETUP))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_RING_SETUP to user!\n",
+                              __func__);
+        ring_destroy(ring);
+        return -EFAULT;
+    }
+
+    mutex_lock(&file_context->lock);
+
+    // Another thread might have been faster.
+    if (file_context->ring) {
+        pr_notice_ratelimited("%s: this file already has a ring\n", __func__);
+        ret = -EBUSY;
+    } else {
+        smp_store_release(&file_context->ring, ring);
+        ring = NULL;
+    }
+
+    mutex_unlock(&file_context->lock);
+
+    if (ring)
+        ring_destroy(ring);
+
+    return ret;
+}
+
+static long do_ioctl_ring_submit(PFILE_CONTEXT file_context,
+                                 PLINPMEM_RING_SUBMIT __user userbuffer)
+{
+    LINPMEM_RING_SUBMIT ring_submit_info;
+    PPAGE_RING ring;
+
+    if (copy_from_user(&ring_submit_info, userbuffer,
+                       sizeof(LINPMEM_RING_SUBMIT))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_RING_SUBMIT from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    if ((ring_submit_info.flags & ~LINPMEM_RING_SUBMIT_WAIT) ||
+        ring_submit_info.reserved) {
+        pr_notice_ratelimited("%s: invalid ring submit requested\n", __func__);
+        return -EINVAL;
+    }
+
+    // The ring is never replaced once it is set up.
+    ring = smp_load_acquire(&file_context->ring);
+    if (!ring)
+        return -ENODEV;
+
+    ring_submit(ring, ring_submit_info.flags);
+
+    return 0;
+}
+
+static long do_ioctl_query_numa_stats(PLINPMEM_NUMA_STATS __user userbuffer)
+{
+    PLINPMEM_NUMA_STATS numa_stats;
+    long ret = 0;
+
+    // Too large for the stack.
+    numa_stats = kzalloc(sizeof(LINPMEM_NUMA_STATS), GFP_KERNEL);
+    if (!numa_stats)
+        return -ENOMEM;
+
+    ring_query_numa_stats(numa_stats);
+
+    if (copy_to_user(userbuffer, numa_stats, sizeof(LINPMEM_NUMA_STATS))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_NUMA_STATS to user!\n",
+                              __func__);
+        ret = -EFAULT;
+    }
+
+    kfree(numa_stats);
+
+    return ret;
+}
+
+static long do_ioctl_scan(PLINPMEM_SCAN __user userbuffer)
+{
+    LINPMEM_SCAN scan;
+    PSCAN_AUTOMATON automaton = NULL;
+    PLINPMEM_SCAN_RANGE ranges = NULL;
+    uint32_t *pattern_sizes = NULL;
+    uint8_t *patterns = NULL;
+    SCAN_RESULT result = { 0 };
+    uint64_t total_size = 0;
+    uint32_t i;
+    long ret = 0;
+
+    if (copy_from_user(&scan, userbuffer, sizeof(LINPMEM_SCAN))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_SCAN from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    if (!scan.pattern_count || scan.pattern_count > LINPMEM_SCAN_MAX_PATTERNS ||
+        !scan.range_count || scan.range_count > LINPMEM_SCAN_MAX_RANGES ||
+        !scan.max_matches || scan.max_matches > LINPMEM_SCAN_MAX_MATCHES) {
+        pr_notice_ratelimited("%s: invalid scan requested\n", __func__);
+        return -EINVAL;
+    }
+
+    pattern_sizes = memdup_user(scan.pattern_sizes,
+                                scan.pattern_count * sizeof(uint32_t));
+    if (IS_ERR(pattern_sizes)) {
+        ret = PTR_ERR(pattern_sizes);
+        pattern_sizes = NULL;
+        goto out;
+    }
+
+    for (i = 0; i < scan.pattern_count; i++) {
+        if (!pattern_sizes[i])
+            break;
+        total_size += pattern_sizes[i];
+    }
+    if (i < scan.pattern_count ||
+        total_size > LINPMEM_SCAN_MAX_PATTERN_BYTES) {
+        pr_notice_ratelimited("%s: invalid scan patterns\n", __func__);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    patterns = memdup_user(scan.patterns, total_size);
+    if (IS_ERR(patterns)) {
+        ret = PTR_ERR(patterns);
+        patterns = NULL;
+        goto out;
+    }
+
+    ranges = vmemdup_user(scan.ranges,
+                          scan.range_count * sizeof(LINPMEM_SCAN_RANGE));
+    if (IS_ERR(ranges)) {
+        ret = PTR_ERR(ranges);
+        ranges = NULL;
+        goto out;
+    }
+
+    for (i = 0; i < scan.range_count; i++) {
+        if (ranges[i].start + ranges[i].size < ranges[i].start) {
+            pr_notice_ratelimited("%s: invalid scan range\n", __func__);
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+    automaton = scan_compile(patterns, pattern_sizes, scan.pattern_count);
+    if (IS_ERR(automaton)) {
+        ret = PTR_ERR(automaton);
+        goto out;
+    }
+
+    result.max_matches = scan.max_matches;
+    result.matches =
+        kvcalloc(scan.max_matches, sizeof(LINPMEM_SCAN_MATCH), GFP_KERNEL);
+    if (!result.matches) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    ret = scan_ranges(automaton, ranges, scan.range_count, &result);
+    if (ret)
+        goto out;
+
+    scan.match_count = result.match_count;
+    scan.bytes_scanned = result.bytes_scanned;
+    scan.pages_skipped = result.pages_skipped;
+    scan.resume_address = result.resume_address;
+    scan.resume_range = result.resume_range;
+
+    if (copy_to_user(scan.matches, result.matches,
+                     result.match_count * sizeof(LINPMEM_SCAN_MATCH)) ||
+        copy_to_user(userbuffer, &scan, sizeof(LINPMEM_SCAN))) {
+        pr_notice_ratelimited("%s: copying scan results to user!\n",
+                              __func__);
+        ret = -EFAULT;
+    }
+
+out:
+    kvfree(result.matches);
+    scan_free(automaton);
+    kvfree(ranges);
+    kfree(patterns);
+    kfree(pattern_sizes);
+
+    return ret;
+}
+
+static long
+do_ioctl_query_kernel_layout(PLINPMEM_KERNEL_LAYOUT __user userbuffer)
+{
+    LINPMEM_KERNEL_LAYOUT layout;
+
+    layout_query(&layout);
+
+    if (copy_to_user(userbuffer, &layout, sizeof(LINPMEM_KERNEL_LAYOUT))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_KERNEL_LAYOUT to user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+static long
+do_ioctl_query_page_owners(PLINPMEM_PAGE_OWNERS __user userbuffer)
+{
+    LINPMEM_PAGE_OWNERS page_owners;
+    PLINPMEM_PAGE_OWNER owners;
+    uint32_t i;
+    long ret;
+
+    if (copy_from_user(&page_owners, userbuffer,
+                       sizeof(LINPMEM_PAGE_OWNERS))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_PAGE_OWNERS from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    if (!page_owners.count || page_owners.count > LINPMEM_MAX_PAGE_OWNERS ||
+        (page_owners.flags & ~LINPMEM_PAGE_OWNERS_NO_PROCESSES)) {
+        pr_notice_ratelimited("%s: invalid page owner query\n", __func__);
+        return -EINVAL;
+    }
+
+    owners = vmemdup_user(page_owners.owners,
+                          page_owners.count * sizeof(LINPMEM_PAGE_OWNER));
+    if (IS_ERR(owners))
+        return PTR_ERR(owners);
+
+    // Only the pfn is input.
+    for (i = 0; i < page_owners.count; i++) {
+        uint64_t pfn = owners[i].pfn;
+
+        memset(&owners[i], 0, sizeof(LINPMEM_PAGE_OWNER));
+        owners[i].pfn = pfn;
+    }
+
+    ret = rmap_query(owners, page_owners.count, page_owners.flags);
+    if (ret)
+        goto out;
+
+    if (copy_to_user(page_owners.owners, owners,
+                     page_owners.count * sizeof(LINPMEM_PAGE_OWNER))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_PAGE_OWNER to user!\n",
+                              __func__);
+        ret = -EFAULT;
+    }
+
+out:
+    kvfree(owners);
+
+    return ret;
+}
+
+static long do_ioctl_register_buffer(PFILE_CONTEXT file_context,
+                                     PLINPMEM_REGISTER_BUFFER __user userbuffer)
+{
+    LINPMEM_REGISTER_BUFFER register_buffer;
+    PREGISTERED_BUFFER regbuf;
+    uint32_t i;
+    long ret = 0;
+
+    if (copy_from_user(&register_buffer, userbuffer,
+                       sizeof(LINPMEM_REGISTER_BUFFER))) {
+        pr_notice_ratelimited(
+            "%s: copying LINPMEM_REGISTER_BUFFER from user!\n", __func__);
+        return -EFAULT;
+    }
+
+    if (!register_buffer.size ||
+        register_buffer.size > LINPMEM_MAX_REGISTERED_SIZE ||
+        !access_ok(register_buffer.buffer, register_buffer.size)) {
+        pr_notice_ratelimited("%s: invalid buffer\n", __func__);
+        return -EINVAL;
+    }
+
+    regbuf = regbuf_register(register_buffer.buffer, register_buffer.size);
+    if (IS_ERR(regbuf))
+        return PTR_ERR(regbuf);
+
+    mutex_lock(&file_context->lock);
+
+    for (i = 0; i < LINPMEM_MAX_REGISTERED_BUFFERS; i++) {
+        if (!file_context->buffers[i])
+            break;
+    }
+
+    if (i == LINPMEM_MAX_REGISTERED_BUFFERS) {
+        mutex_unlock(&file_context->lock);
+        regbuf_put(regbuf);
+        return -EBUSY;
+    }
+
+    // Reserve the slot, and keep a reference for the rollback below.
+    file_context->buffers[i] = regbuf;
+    regbuf_get(regbuf);
+
+    mutex_unlock(&file_context->lock);
+
+    register_buffer.handle = i + 1;
+
+    // Not under file_context->lock: a fault here takes the mmap lock.
+    if (copy_to_user(userbuffer, &register_buffer,
+                     sizeof(LINPMEM_REGISTER_BUFFER))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_REGISTER_BUFFER to user!\n",
+                              __func__);
+        ret = -EFAULT;
+
+        // Release the slot, unless the handle was unregistered meanwhile.
+        mutex_lock(&file_context->lock);
+        if (file_context->buffers[i] == regbuf) {
+            file_context->buffers[i] = NULL;
+            regbuf_put(regbuf);
+        }
+        mutex_unlock(&file_context->lock);
+    }
+
+    regbuf_put(regbuf);
+
+    return ret;
+}
+
+static long
+do_ioctl_unregister_buffer(PFILE_CONTEXT file_context,
+                           PLINPMEM_REGISTER_BUFFER __user userbuffer)
+{
+    LINPMEM_REGISTER_BUFFER register_buffer;
+    PREGISTERED_BUFFER regbuf = NULL;
+
+    if (copy_from_user(&register_buffer, userbuffer,
+                       sizeof(LINPMEM_REGISTER_BUFFER))) {
+        pr_notice_ratelimited(
+            "%s: copying LINPMEM_REGISTER_BUFFER from user!\n", __func__);
+        return -EFAULT;
+    }
+
+    if (!register_buffer.handle ||
+        register_buffer.handle > LINPMEM_MAX_REGISTERED_BUFFERS)
+        return -EINVAL;
+
+    mutex_lock(&file_context->lock);
+    swap(regbuf, file_context->buffers[register_buffer.handle - 1]);
+    mutex_unlock(&file_context->lock);
+
+    if (!regbuf)
+        return -EINVAL;
+
+    // Readers in flight keep their reference, the pages go with the last.
+    regbuf_put(regbuf);
+
+    return 0;
+}
+
+static long do_ioctl_read_registered(PFILE_CONTEXT file_context,
+                                     PLINPMEM_READ_REGISTERED __user userbuffer)
+{
+    LINPMEM_READ_REGISTERED read_registered;
+    PREGISTERED_BUFFER regbuf = NULL;
+    long ret = 0;
+
+    if (copy_from_user(&read_registered, userbuffer,
+                       sizeof(LINPMEM_READ_REGISTERED))) {
+        pr_notice_ratelimited(
+            "%s: copying LINPMEM_READ_REGISTERED from user!\n", __func__);
+        return -EFAULT;
+    }
+
+    if (!read_registered.handle ||
+        read_registered.handle > LINPMEM_MAX_REGISTERED_BUFFERS ||
+        !read_registered.size)
+        return -EINVAL;
+
+    mutex_lock(&file_context->lock);
+    regbuf = file_context->buffers[read_registered.handle - 1];
+    if (regbuf)
+        regbuf_get(regbuf);
+    mutex_unlock(&file_context->lock);
+
+    if (!regbuf)
+        return -EINVAL;
+
+    if (read_registered.buffer_offset > regbuf->size ||
+        read_registered.size > regbuf->size - read_registered.buffer_offset) {
+        pr_notice_ratelimited("%s: read does not fit in the buffer\n",
+                              __func__);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    read_registered.bytes_read =
+        regbuf_read(regbuf, read_registered.buffer_offset,
+                    read_registered.phys_address, read_registered.size);
+
+    if (copy_to_user(userbuffer, &read_registered,
+                     sizeof(LINPMEM_READ_REGISTERED))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_READ_REGISTERED to user!\n",
+                              __func__);
+        ret = -EFAULT;
+    }
+
+out:
+    regbuf_put(regbuf);
+
+    return ret;
+}
+
+static long do_ioctl_query_pfn_map(PLINPMEM_PFN_MAP __user userbuffer)
+{
+    LINPMEM_PFN_MAP pfn_map;
+    long ret;
+
+    if (copy_from_user(&pfn_map, userbuffer, sizeof(LINPMEM_PFN_MAP))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_PFN_MAP from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    ret = pfnmap_query(&pfn_map);
+    if (ret)
+        return ret;
+
+    if (copy_to_user(userbuffer, &pfn_map, sizeof(LINPMEM_PFN_MAP))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_PFN_MAP to user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+static long do_ioctl_query_free_runs(PLINPMEM_FREE_RUNS __user userbuffer)
+{
+    LINPMEM_FREE_RUNS free_runs;
+    long ret;
+
+    if (copy_from_user(&free_runs, userbuffer, sizeof(LINPMEM_FREE_RUNS))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_FREE_RUNS from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    ret = pfnmap_query_free(&free_runs);
+    if (ret)
+        return ret;
+
+    if (copy_to_user(userbuffer, &free_runs, sizeof(LINPMEM_FREE_RUNS))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_FREE_RUNS to user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+static long do_ioctl_query_iowin_stats(PLINPMEM_IOWIN_STATS __user userbuffer)
+{
+    LINPMEM_IOWIN_STATS iowin_stats;
+
+    iowin_query_stats(&iowin_stats);
+
+    if (copy_to_user(userbuffer, &iowin_stats, sizeof(LINPMEM_IOWIN_STATS))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_IOWIN_STATS to user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+static bool is_access_type(uint8_t access_type)
+{
+    switch (access_type) {
+    case PHYS_BYTE_READ:
+    case PHYS_WORD_READ:
+    case PHYS_DWORD_READ:
+    case PHYS_QWORD_READ:
+    case PHYS_BUFFER_READ:
+        return true;
+    }
+
+    return false;
+}
+
+static long do_ioctl_session_bind(PFILE_CONTEXT file_context,
+                                  PLINPMEM_SESSION_BIND __user userbuffer)
+{
+    LINPMEM_SESSION_BIND session_bind;
+    PSESSION_BINDING binding = NULL;
+
+    if (copy_from_user(&session_bind, userbuffer,
+                       sizeof(LINPMEM_SESSION_BIND))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_SESSION_BIND from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    if ((session_bind.flags &
+         ~(LINPMEM_SESSION_BIND_CR3 | LINPMEM_SESSION_UNBIND)) ||
+        memchr_inv(session_bind.reserved, 0, sizeof(session_bind.reserved))) {
+        pr_notice_ratelimited("%s: invalid session bind requested\n",
+                              __func__);
+        return -EINVAL;
+    }
+
+    if (!(session_bind.flags & LINPMEM_SESSION_UNBIND)) {
+        if (session_bind.default_access_type &&
+            !is_access_type(session_bind.default_access_type))
+            return -EINVAL;
+
+        // Resolved here, once, for all later calls.
+        if (session_bind.flags & LINPMEM_SESSION_BIND_CR3)
+            binding = session_bind_cr3(session_bind.cr3);
+        else
+            binding = session_bind_process((pid_t)session_bind.target_process);
+        if (IS_ERR(binding))
+            return PTR_ERR(binding);
+
+        session_bind.cr3 = binding->cr3;
+    }
+
+    mutex_lock(&file_context->lock);
+    swap(binding, file_context->binding);
+    WRITE_ONCE(file_context->default_access_type,
+               session_bind.default_access_type);
+    mutex_unlock(&file_context->lock);
+
+    session_put(binding);
+
+    if (copy_to_user(userbuffer, &session_bind, sizeof(LINPMEM_SESSION_BIND))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_SESSION_BIND to user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+static long do_ioctl_session_query(PFILE_CONTEXT file_context,
+                                   PLINPMEM_SESSION_INFO __user userbuffer)
+{
+    LINPMEM_SESSION_INFO session_info = { 0 };
+    PSESSION_BINDING binding;
+
+    mutex_lock(&file_context->lock);
+
+    binding = file_context->binding;
+    if (binding) {
+        session_info.flags |= LINPMEM_SESSION_BOUND;
+        session_info.cr3 = binding->cr3;
+        if (binding->mm) {
+            session_info.flags |= LINPMEM_SESSION_PROCESS;
+            session_info.pid = binding->pid;
+        }
+
+        spin_lock(&binding->tlb_lock);
+        session_info.tlb_hits = binding->tlb_hits;
+        session_info.tlb_misses = binding->tlb_misses;
+        session_info.tlb_invalidations = binding->tlb_invalidations;
+        spin_unlock(&binding->tlb_lock);
+    }
+
+    session_info.default_access_type = file_context->default_access_type;
+
+    mutex_unlock(&file_context->lock);
+
+    session_info.vtop_count = atomic64_read(&file_context->vtop_count);
+    session_info.reads = atomic64_read(&file_context->reads);
+    session_info.bytes_read = atomic64_read(&file_context->bytes_read);
+
+    if (copy_to_user(userbuffer, &session_info, sizeof(LINPMEM_SESSION_INFO))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_SESSION_INFO to user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+static long do_ioctl_watch_setup(PFILE_CONTEXT file_context,
+                                 PLINPMEM_WATCH_SETUP __user userbuffer)
+{
+    LINPMEM_WATCH_SETUP watch_setup;
+    PWATCH_SET set = NULL;
+
+    if (copy_from_user(&watch_setup, userbuffer, sizeof(LINPMEM_WATCH_SETUP))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_WATCH_SETUP from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    if (watch_setup.range_count) {
+        set = watch_create(&watch_setup);
+        if (IS_ERR(set))
+            return PTR_ERR(set);
+    }
+
+    mutex_lock(&file_context->lock);
+    swap(set, file_context->watch);
+    mutex_unlock(&file_context->lock);
+
+    watch_put(set);
+
+    return 0;
+}
+
+static long do_ioctl_watch_query(PFILE_CONTEXT file_context,
+                                 PLINPMEM_WATCH_QUERY __user userbuffer)
+{
+    LINPMEM_WATCH_QUERY query;
+    PWATCH_SET set;
+    long ret;
+
+    if (copy_from_user(&query, userbuffer, sizeof(LINPMEM_WATCH_QUERY))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_WATCH_QUERY from user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    // Not under file_context->lock: a fault in the user copies takes the
+    // mmap lock.
+    mutex_lock(&file_context->lock);
+    set = file_context->watch;
+    if (set)
+        watch_get(set);
+    mutex_unlock(&file_context->lock);
+
+    if (!set)
+        return -ENOENT;
+
+    ret = watch_query(set, &query);
+    watch_put(set);
+    if (ret)
+        return ret;
+
+    if (copy_to_user(userbuffer, &query, sizeof(LINPMEM_WATCH_QUERY))) {
+        pr_notice_ratelimited("%s: copying LINPMEM_WATCH_QUERY to user!\n",
+                              __func__);
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+static long int pmem_ioctl(struct file *file, unsigned int ioctl,
+                           unsigned long userbuffer)
+{
+    PFILE_CONTEXT file_context = file->private_data;
+    long ret = 0;
+
+    switch (ioctl) {
+    case IOCTL_LINPMEM_READ_PHYSADDR:
+        ret = do_ioctl_read(file_context, (PLINPMEM_DATA_TRANSFER)userbuffer);
+        break;
+    case IOCTL_LINPMEM_VTOP_TRANSLATION_SERVICE:
+        ret = do_ioctl_vtop(file_context, (PLINPMEM_VTOP_INFO)userbuffer);
+        break;
+    case IOCTL_LINPMEM_QUERY_CR3:
+        ret = do_ioctl_query_cr3((PLINPMEM_CR3_INFO)userbuffer);
+        break;
+    case IOCTL_LINPMEM_RING_SETUP:
+        ret = do_ioctl_ring_setup(file_context,
+                                  (PLINPMEM_RING_SETUP)userbuffer);
+        break;
+    case IOCTL_LINPMEM_RING_SUBMIT:
+        ret = do_ioctl_ring_submit(file_context,
+                                   (PLINPMEM_RING_SUBMIT)userbuffer);
+        break;
+    case IOCTL_LINPMEM_QUERY_NUMA_STATS:
+        ret = do_ioctl_query_numa_stats((PLINPMEM_NUMA_STATS)userbuffer);
+        break;
+    case IOCTL_LINPMEM_SCAN:
+        ret = do_ioctl_scan((PLINPMEM_SCAN)userbuffer);
+        break;
+    case IOCTL_LINPMEM_QUERY_PROCESS_RUNS:
+        ret = do_ioctl_query_process_runs((PLINPMEM_PROCESS_RUNS)userbuffer);
+        break;
+    case IOCTL_LINPMEM_QUERY_DIRTY_RUNS:
+        ret = do_ioctl_query_dirty_runs((PLINPMEM_DIRTY_RUNS)userbuffer);
+        break;
+    case IOCTL_LINPMEM_QUERY_PROCESSES:
+        ret = do_ioctl_query_processes((PLINPMEM_PROCESSES)userbuffer);
+        break;
+    case IOCTL_LINPMEM_QUERY_PROCESS_MAPS:
+        ret = do_ioctl_query_process_maps((PLINPMEM_PROCESS_MAPS)userbuffer);
+        break;
+    case IOCTL_LINPMEM_WALK_LIST:
+        ret = do_ioctl_walk_list((PLINPMEM_LIST_WALK)userbuffer);
+        break;
+    case IOCTL_LINPMEM_DIGEST:
+        ret = do_ioctl_digest((PLINPMEM_DIGEST)userbuffer);
+        break;
+    case IOCTL_LINPMEM_READ_COMPRESSED:
+        ret = do_ioctl_read_compressed(file_context,
+                                       (PLINPMEM_COMPRESSED_READ)userbuffer);
+        break;
+    case IOCTL_LINPMEM_QUERY_KERNEL_LAYOUT:
+        ret = do_ioctl_query_kernel_layout(
+            (PLINPMEM_KERNEL_LAYOUT)userbuffer);
+        break;
+    case IOCTL_LINPMEM_QUERY_PAGE_OWNERS:
+        ret = do_ioctl_query_page_owners((PLINPMEM_PAGE_OWNERS)userbuffer);
+        break;
+    case IOCTL_LINPMEM_REGISTER_BUFFER:
+        ret = do_ioctl_register_buffer(file_context,
+                                       (PLINPMEM_REGISTER_BUFFER)userbuffer);
+        break;
+    case IOCTL_LINPMEM_UNREGISTER_BUFFER:
+        ret = do_ioctl_unregister_buffer(file_context,
+                                         (PLINPMEM_REGISTER_BUFFER)userbuffer);
+        break;
+    case IOCTL_LINPMEM_READ_REGISTERED:
+        ret = do_ioctl_read_registered(file_context,
+                                       (PLINPMEM_READ_REGISTERED)userbuffer);
+        break;
+    case IOCTL_LINPMEM_QUERY_PFN_MAP:
+        ret = do_ioctl_query_pfn_map((PLINPMEM_PFN_MAP)userbuffer);
+        break;
+    case IOCTL_LINPMEM_QUERY_FREE_RUNS:
+        ret = do_ioctl_query_free_runs((PLINPMEM_FREE_RUNS)userbuffer);
+        break;
+    case IOCTL_LINPMEM_QUERY_IOWIN_STATS:
+        ret = do_ioctl_query_iowin_stats((PLINPMEM_IOWIN_STATS)userbuffer);
+        break;
+    case IOCTL_LINPMEM_SESSION_BIND:
+        ret = do_ioctl_session_bind(file_context,
+                                    (PLINPMEM_SESSION_BIND)userbuffer);
+        break;
+    case IOCTL_LINPMEM_SESSION_QUERY:
+        ret = do_ioctl_session_query(file_context,
+                                     (PLINPMEM_SESSION_INFO)userbuffer);
+        break;
+    case IOCTL_LINPMEM_WATCH_SETUP:
+        ret = do_ioctl_watch_setup(file_context,
+                                   (PLINPMEM_WATCH_SETUP)userbuffer);
+        break;
+    case IOCTL_LINPMEM_WATCH_QUERY:
+        ret = do_ioctl_watch_query(file_context,
+                                   (PLINPMEM_WATCH_QUERY)userbuffer);
+        break;
+    default:
+        pr_err_ratelimited("%s: unknown IOCTL %08x\n", __func__, ioctl);
+        ret = -ENOSYS;
+    }
+
+    return ret;
+}
+
+const static struct file_operations pmem_fops = { .owner = THIS_MODULE,
+                                                  .open = pmem_open,
+                                                  .release = pmem_close,
+                                                  .llseek = pmem_llseek,
+                                                  .read = pmem_read,
+                                                  .mmap = pmem_mmap,
+                                                  .unlocked_ioctl =
+                                                      pmem_ioctl };
+
+/* init_check_compatibility - checks necessary conditions for driver loading
+ *
+ * This function function checks that some necessary conditions for loading
+ * the driver are satisfied. Decides whether to bail out, to adapt strategies,
+ * or that some features will not be available.
+ *
+ * Returns 0 if it is ok to continue loading the driver, or -1 if we must bail
+ * out.
+ */
+static int init_check_compatibility(void)
+{
+    int ret = 0;
+
+    if (boot_cpu_has(X86_FEATURE_SEV)) {
+        pr_debug("SEV: active. BAIL OUT\n");
+        ret = -1;
+        goto out;
+    } else {
+        pr_debug("SEV: not active. OK\n");
+    }
+
+    if (boot_cpu_has(X86_FEATURE_SME)) {
+        pr_debug("SME: active. BAIL OUT\n");
+        ret = -1;
+        goto out;
+    } else {
+        pr_debug("SME: not active. OK\n");
+    }
+
+    // pgtable_l5_enabled() =- cpu_feature_enabled(X86_FEATURE_LA57)
     if (cpu_feature_enabled(X86_FEATURE_LA57)) {
         pr_debug("5-level paging: active. BAIL OUT\n");
         ret = -1;
@@ -490,10 +1930,33 @@ static int __init pmem_init(void)
         return ret;
     }
 
+    // Not fatal, the layout then lacks the symbol based fields.
+    layout_init();
+
+    iowin_init();
+
+    ret = ring_init();
+    if (ret) {
+        pr_err("ring_init->%d\n", ret);
+        return ret;
+    }
+
+    ret = pfnmap_init();
+    if (ret) {
+        pr_err("pfnmap_init->%d\n", ret);
+        goto out_ring;
+    }
+
+    ret = procmap_init();
+    if (ret) {
+        pr_err("procmap_init->%d\n", ret);
+        goto out_pfnmap;
+    }
+
     ret = register_chrdev(major, KBUILD_MODNAME, &pmem_fops);
     if (ret) {
         pr_err("register_chrdev->%d\n", ret);
-        return ret;
+        goto out_procmap;
     } else {
         pr_info("registered chrdev with major %d\n", major);
     }
@@ -504,12 +1967,24 @@ static int __init pmem_init(void)
         goto out_chrdev;
     }
 
+    // Not fatal, the workers will then share the rogue page of the ioctls.
+    if (setup_rogue_windows(g_device_extension.rogue_windows))
+        pr_warn("rogue windows setup failed - kernel workers will be slow\n");
+    else
+        g_device_extension.rogue_windows_ready = true;
+
     pr_info("startup successfull\n");
 
     return 0;
 
 out_chrdev:
     unregister_chrdev(major, KBUILD_MODNAME);
+out_procmap:
+    procmap_exit();
+out_pfnmap:
+    pfnmap_exit();
+out_ring:
+    ring_exit();
 
     return ret;
 }
@@ -517,6 +1992,10 @@ out_chrdev:
 static void __exit pmem_exit(void)
 {
     // Undo the sacrifice.
+    if (g_device_extension.rogue_windows_ready) {
+        restore_rogue_windows(g_device_extension.rogue_windows);
+    }
+
     if (g_device_extension.pte_data.pte_method_is_ready_to_use) {
         restore_pte_method(&g_device_extension.pte_data);
     }
@@ -539,6 +2018,10 @@ static void __exit pmem_exit(void)
 
 out:
     unregister_chrdev(major, KBUILD_MODNAME);
+    iowin_exit();
+    procmap_exit();
+    pfnmap_exit();
+    ring_exit();
 }
 
 module_init(pmem_init);
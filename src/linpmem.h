@@ -5,7 +5,15 @@
 #ifndef _LINPMEM_H_
 #define _LINPMEM_H_
 
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+
+#include "elfcore.h"
 #include "pte_mmap.h"
+#include "regbuf.h"
+#include "ring.h"
+#include "session.h"
+#include "watch.h"
 #include "../userspace_interface/linpmem_shared.h"
 
 /* Our Device Extension Structure.
@@ -14,11 +22,76 @@
  *		READ ONLY after init method!
  *		*pte_data.rogue_pte and *pte_data.rogue_va are protected by
  *		g_rogue_page_lock. Do not read/write eiter without holding it.
+ * rogue_windows	The same, for the additional rogue pages of the kernel
+ *		workers. Each is protected by its own rogue_lock.
+ * rogue_windows_ready	Set if all rogue_windows are set up.
  */
 typedef struct {
     PTE_METHOD_DATA pte_data;
+    PTE_METHOD_DATA rogue_windows[ROGUE_WINDOW_COUNT];
+    bool rogue_windows_ready;
 } DEVICE_EXTENSION, *PDEVICE_EXTENSION;
 
 extern DEVICE_EXTENSION g_device_extension;
 
+/* rogue_window - get a rogue window for a kernel worker
+ * @index: any number, e.g., the NUMA node of the worker
+ *
+ * Workers with the same index share a window (and its lock). Falls back to
+ * the rogue page of the ioctl path if the windows are not available.
+ */
+static inline PPTE_METHOD_DATA rogue_window(unsigned int index)
+{
+    if (!g_device_extension.rogue_windows_ready)
+        return &g_device_extension.pte_data;
+
+    return &g_device_extension.rogue_windows[index % ROGUE_WINDOW_COUNT];
+}
+
+struct mm_struct;
+
+CR3 mm_cr3_pa(struct mm_struct *mm);
+
+struct mm_struct *get_pid_mm(pid_t upid);
+
+/* Collects the runs of IOCTL_LINPMEM_QUERY_PROCESS_RUNS. */
+typedef struct {
+    PLINPMEM_VIRT_RUN runs;
+    uint32_t max_runs;
+    uint32_t run_count;
+    uint64_t mapped_pages;
+} VIRT_RUN_LIST, *PVIRT_RUN_LIST;
+
+/* Called by virt_walk_range, merges the pages into a VIRT_RUN_LIST. Returns
+ * false if the list is full.
+ */
+bool collect_virt_run(void *context, uint64_t virt_address,
+                      uint64_t phys_address, uint64_t size, PTE effective,
+                      volatile PPTE leaf);
+
+/* Our per-open state, stored in file->private_data.
+ * lock		Protects setup and teardown of the members below. Never
+ *		taken in ->mmap, which runs under the mmap lock.
+ * ring		The page ring of this file descriptor, or NULL. Set once,
+ *		read with smp_load_acquire.
+ * buffers	The registered buffers, handle - 1 is the index.
+ * core		The ELF core view, for LINPMEM_MINOR_CORE only. Set on open.
+ * binding	The session binding, or NULL. See IOCTL_LINPMEM_SESSION_BIND.
+ * default_access_type	For reads with access_type zero, or zero.
+ * vtop_count, reads, bytes_read	Session statistics.
+ * watch	The watched ranges, or NULL.
+ */
+typedef struct {
+    struct mutex lock;
+    PPAGE_RING ring;
+    PREGISTERED_BUFFER buffers[LINPMEM_MAX_REGISTERED_BUFFERS];
+    PELF_CORE core;
+    PSESSION_BINDING binding;
+    uint8_t default_access_type;
+    atomic64_t vtop_count;
+    atomic64_t reads;
+    atomic64_t bytes_read;
+    PWATCH_SET watch;
+} FILE_CONTEXT, *PFILE_CONTEXT;
+
 #endif
@@ -0,0 +1,225 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include "linpmem.h"
+#include "listwalk.h"
+
+// Records between checks for signals and rescheduling.
+#define LISTWALK_BATCH (256)
+
+/* The state of a walk.
+ * page_va, page_pa	The last page translated, page_va is 1 if none. Records
+ *		of a list are often in the same page (e.g., of a slab), and the
+ *		next pointer is in the record just read.
+ * entry	The entry being built, for copying to user space.
+ */
+typedef struct {
+    uint64_t cr3;
+    uint64_t page_va;
+    uint64_t page_pa;
+    uint8_t *entry;
+} LIST_WALKER, *PLIST_WALKER;
+
+static bool listwalk_translate(PLIST_WALKER walker, uint64_t virt_address,
+                               uint64_t *phys_address)
+{
+    VIRT_ADDR in_va = { .value = virt_address & PAGE_MASK };
+    volatile PPTE ppte;
+
+    if (in_va.value != walker->page_va) {
+        if (virt_find_pte(in_va, &ppte, walker->cr3) != PTE_SUCCESS ||
+            !ppte->present)
+            return false;
+
+        // As in do_ioctl_vtop.
+        if (ppte->large_page)
+            walker->page_pa = PFN_PHYS(ppte->page_frame + in_va.pt_index);
+        else
+            walker->page_pa = PFN_PHYS(ppte->page_frame);
+        walker->page_va = in_va.value;
+    }
+
+    *phys_address = walker->page_pa + offset_in_page(virt_address);
+
+    return true;
+}
+
+/* listwalk_read - read virtual memory of the walked address space
+ *
+ * Returns false if any of it is not mapped, or not RAM
+ */
+static bool listwalk_read(PLIST_WALKER walker, uint64_t virt_address,
+                          void *buf, uint64_t size)
+{
+    uint64_t phys_address;
+    uint64_t chunk;
+
+    while (size) {
+        if (!listwalk_translate(walker, virt_address, &phys_address))
+            return false;
+
+        chunk = pte_mmap_read_kernel(&g_device_extension.pte_data,
+                                     phys_address, buf, size);
+        if (!chunk)
+            return false;
+
+        virt_address += chunk;
+        buf += chunk;
+        size -= chunk;
+    }
+
+    return true;
+}
+
+static int listwalk_check(PLINPMEM_LIST_WALK walk)
+{
+    uint64_t fields_size = 0;
+    uint32_t i;
+
+    if (!walk->start_address || !walk->buffer ||
+        walk->record_size < sizeof(uint64_t) ||
+        walk->record_size > LINPMEM_MAX_LIST_RECORD_SIZE ||
+        walk->next_offset > walk->record_size - sizeof(uint64_t) ||
+        !walk->max_count ||
+        walk->max_count > LINPMEM_MAX_LIST_COUNT ||
+        walk->field_count > LINPMEM_MAX_LIST_FIELDS)
+        return -EINVAL;
+
+    for (i = 0; i < walk->field_count; i++) {
+        if (!walk->fields[i].size ||
+            walk->fields[i].offset > walk->record_size ||
+            walk->fields[i].size > walk->record_size - walk->fields[i].offset)
+            return -EINVAL;
+        fields_size += walk->fields[i].size;
+    }
+
+    if (fields_size > LINPMEM_MAX_LIST_RECORD_SIZE)
+        return -EINVAL;
+
+    return 0;
+}
+
+int listwalk_walk(PLINPMEM_LIST_WALK walk)
+{
+    LINPMEM_LIST_FIELD whole = { 0 };
+    PLINPMEM_LIST_FIELD fields = walk->fields;
+    uint32_t field_count = walk->field_count;
+    LIST_WALKER walker = { 0 };
+    uint64_t record = walk->start_address;
+    uint64_t tortoise = record;
+    uint32_t power = 1;
+    uint32_t steps = 0;
+    uint64_t entry_size;
+    uint64_t offset;
+    uint64_t next;
+    uint32_t i;
+    int ret;
+
+    ret = listwalk_check(walk);
+    if (ret)
+        return ret;
+
+    // virt_find_pte knows only 4 levels.
+    if (pgtable_l5_enabled())
+        return -EOPNOTSUPP;
+
+    if (!field_count) {
+        whole.size = walk->record_size;
+        fields = &whole;
+        field_count = 1;
+    }
+
+    entry_size = sizeof(uint64_t);
+    for (i = 0; i < field_count; i++)
+        entry_size += fields[i].size;
+
+    walker.cr3 = walk->associated_cr3;
+    walker.page_va = 1;
+    walker.entry = kvmalloc(entry_size, GFP_KERNEL);
+    if (!walker.entry)
+        return -ENOMEM;
+
+    walk->used_size = 0;
+    walk->record_count = 0;
+    walk->resume_address = 0;
+    walk->stop_reason = LINPMEM_LIST_STOP_END;
+
+    for (;;) {
+        if (walk->record_count == walk->max_count) {
+            walk->stop_reason = LINPMEM_LIST_STOP_MAX_COUNT;
+            break;
+        }
+
+        if (entry_size > walk->buffer_size - walk->used_size) {
+            walk->stop_reason = LINPMEM_LIST_STOP_BUFFER_FULL;
+            break;
+        }
+
+        memcpy(walker.entry, &record, sizeof(uint64_t));
+        offset = sizeof(uint64_t);
+        for (i = 0; i < field_count; i++) {
+            if (!listwalk_read(&walker, record + fields[i].offset,
+                               walker.entry + offset, fields[i].size))
+                break;
+            offset += fields[i].size;
+        }
+
+        if (i < field_count ||
+            !listwalk_read(&walker, record + walk->next_offset, &next,
+                           sizeof(next))) {
+            walk->stop_reason = LINPMEM_LIST_STOP_UNREADABLE;
+            break;
+        }
+
+        if (copy_to_user((uint8_t __user *)walk->buffer + walk->used_size,
+                         walker.entry, entry_size)) {
+            ret = -EFAULT;
+            break;
+        }
+
+        walk->used_size += entry_size;
+        walk->record_count++;
+
+        if (!next || next == walk->end_address)
+            break;
+
+        record = next - walk->next_bias;
+
+        // Brent's cycle detection: the tortoise jumps to the hare at every
+        // power of two, a loop is found within twice its length.
+        if (record == tortoise) {
+            walk->stop_reason = LINPMEM_LIST_STOP_LOOP;
+            break;
+        }
+        if (++steps == power) {
+            tortoise = record;
+            power *= 2;
+            steps = 0;
+        }
+
+        if (!(walk->record_count % LISTWALK_BATCH)) {
+            if (fatal_signal_pending(current)) {
+                ret = -EINTR;
+                break;
+            }
+            cond_resched();
+        }
+    }
+
+    if (walk->stop_reason != LINPMEM_LIST_STOP_END &&
+        walk->stop_reason != LINPMEM_LIST_STOP_LOOP)
+        walk->resume_address = record;
+
+    kvfree(walker.entry);
+
+    return ret;
+}
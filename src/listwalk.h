@@ -0,0 +1,17 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _LISTWALK_H_
+#define _LISTWALK_H_
+
+#include "../userspace_interface/linpmem_shared.h"
+
+/* listwalk_walk - follow a linked list, see IOCTL_LINPMEM_WALK_LIST
+ * @walk: the request, with the user buffer. The _OUT_ fields are set.
+ *
+ * Returns 0 however the walk stopped, or negative error
+ */
+int listwalk_walk(PLINPMEM_LIST_WALK walk);
+
+#endif
@@ -0,0 +1,347 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/ioport.h>
+#include <linux/memory.h>
+#include <linux/memory_hotplug.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/pfn.h>
+#include <linux/sched.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+
+#include "pfnmap.h"
+
+/* The current map, see LINPMEM_PFN_MAP. Replaced as a whole on rebuild.
+ * map		LINPMEM_PFN_TYPE_* of every pfn, 2 bits each.
+ * count	Number of pfns in map.
+ * generation	Incremented with every rebuild.
+ */
+static DEFINE_MUTEX(g_pfnmap_lock);
+static uint8_t *g_pfnmap;
+static uint64_t g_pfnmap_count;
+static uint64_t g_pfnmap_generation;
+
+static void pfnmap_rebuild_work(struct work_struct *work);
+
+static DECLARE_WORK(g_pfnmap_rebuild, pfnmap_rebuild_work);
+
+/* A map under construction. */
+typedef struct {
+    uint8_t *map;
+    uint64_t count;
+} PFNMAP_BUILD, *PPFNMAP_BUILD;
+
+static inline uint8_t pfnmap_get(const uint8_t *map, uint64_t pfn)
+{
+    return (map[pfn / 4] >> ((pfn % 4) * 2)) & 3;
+}
+
+static inline void pfnmap_set(uint8_t *map, uint64_t pfn, uint8_t type)
+{
+    unsigned int shift = (pfn % 4) * 2;
+
+    map[pfn / 4] = (map[pfn / 4] & ~(3 << shift)) | (type << shift);
+}
+
+static int pfnmap_find_end(struct resource *res, void *arg)
+{
+    uint64_t *count = arg;
+
+    *count = max_t(uint64_t, *count, PHYS_PFN(res->end) + 1);
+
+    return 0;
+}
+
+/* Called by walk_iomem_res_desc, marks a resource as MMIO or RAM. */
+static int pfnmap_mark_resource(struct resource *res, void *arg)
+{
+    PPFNMAP_BUILD build = arg;
+    uint8_t type = LINPMEM_PFN_TYPE_MMIO;
+    uint64_t end = min_t(uint64_t, PHYS_PFN(res->end) + 1, build->count);
+    uint64_t pfn;
+
+    if ((res->flags & IORESOURCE_SYSTEM_RAM) == IORESOURCE_SYSTEM_RAM)
+        type = LINPMEM_PFN_TYPE_RAM;
+
+    for (pfn = PHYS_PFN(res->start); pfn < end; pfn++)
+        pfnmap_set(build->map, pfn, type);
+
+    return 0;
+}
+
+/* pfnmap_build - classify all pfns
+ * @build: out, the new map
+ *
+ * Everything in iomem is MMIO first, then System RAM (which might also be
+ * nested in other resources, e.g., kmem on persistent memory) is RAM. The
+ * final word has pfn_valid, which is all that the rogue page needs: without
+ * a struct page, we do not read, and with one, we can, be it usable RAM or
+ * not.
+ *
+ * Returns 0, or negative error
+ */
+static int pfnmap_build(PPFNMAP_BUILD build)
+{
+    struct page *page;
+    uint64_t pfn;
+    uint8_t type;
+
+    // Low memory always, for the firmware and devices below 4 GiB.
+    build->count = PHYS_PFN(SZ_4G);
+    walk_iomem_res_desc(IORES_DESC_NONE, IORESOURCE_SYSTEM_RAM, 0, -1,
+                        &build->count, pfnmap_find_end);
+
+    build->map = vzalloc(DIV_ROUND_UP(build->count, 4));
+    if (!build->map)
+        return -ENOMEM;
+
+    walk_iomem_res_desc(IORES_DESC_NONE, IORESOURCE_MEM, 0,
+                        PFN_PHYS(build->count) - 1, build,
+                        pfnmap_mark_resource);
+    walk_iomem_res_desc(IORES_DESC_NONE, IORESOURCE_SYSTEM_RAM, 0,
+                        PFN_PHYS(build->count) - 1, build,
+                        pfnmap_mark_resource);
+
+    for (pfn = 0; pfn < build->count; pfn++) {
+        type = pfnmap_get(build->map, pfn);
+
+        if (pfn_valid(pfn)) {
+            // Offline memory has a struct page, but not a meaningful one.
+            page = pfn_to_online_page(pfn);
+            if (type != LINPMEM_PFN_TYPE_RAM || !page || PageReserved(page))
+                pfnmap_set(build->map, pfn, LINPMEM_PFN_TYPE_RESERVED);
+        } else if (type == LINPMEM_PFN_TYPE_RAM) {
+            // RAM that the kernel does not manage (mem=, ...).
+            pfnmap_set(build->map, pfn, LINPMEM_PFN_TYPE_HOLE);
+        }
+
+        if (!(pfn % (1 << 18)))
+            cond_resched();
+    }
+
+    return 0;
+}
+
+static int pfnmap_rebuild(void)
+{
+    PFNMAP_BUILD build;
+    int ret;
+
+    ret = pfnmap_build(&build);
+    if (ret)
+        return ret;
+
+    mutex_lock(&g_pfnmap_lock);
+    swap(g_pfnmap, build.map);
+    g_pfnmap_count = build.count;
+    g_pfnmap_generation++;
+    mutex_unlock(&g_pfnmap_lock);
+
+    vfree(build.map);
+
+    return 0;
+}
+
+static void pfnmap_rebuild_work(struct work_struct *work)
+{
+    if (pfnmap_rebuild())
+        pr_warn("PFN map rebuild failed, it is outdated now\n");
+}
+
+#ifdef CONFIG_MEMORY_HOTPLUG
+static int pfnmap_memory_callback(struct notifier_block *self,
+                                  unsigned long action, void *arg)
+{
+    if (action == MEM_ONLINE || action == MEM_OFFLINE)
+        schedule_work(&g_pfnmap_rebuild);
+
+    return NOTIFY_OK;
+}
+
+static struct notifier_block g_pfnmap_memory_notifier = {
+    .notifier_call = pfnmap_memory_callback,
+};
+#endif
+
+int pfnmap_init(void)
+{
+    int ret;
+
+    ret = pfnmap_rebuild();
+    if (ret)
+        return ret;
+
+#ifdef CONFIG_MEMORY_HOTPLUG
+    ret = register_memory_notifier(&g_pfnmap_memory_notifier);
+    if (ret) {
+        vfree(g_pfnmap);
+        g_pfnmap = NULL;
+    }
+#endif
+
+    return ret;
+}
+
+void pfnmap_exit(void)
+{
+#ifdef CONFIG_MEMORY_HOTPLUG
+    unregister_memory_notifier(&g_pfnmap_memory_notifier);
+#endif
+    cancel_work_sync(&g_pfnmap_rebuild);
+
+    vfree(g_pfnmap);
+    g_pfnmap = NULL;
+}
+
+/* pfnmap_query - copy a part of the map to user space
+ * @pfn_map: the request, with the user buffer, start_pfn and pfn_count
+ *
+ * Returns 0, or negative error
+ */
+int pfnmap_query(PLINPMEM_PFN_MAP pfn_map)
+{
+    uint64_t count;
+    int ret = 0;
+
+    if (pfn_map->start_pfn % 4)
+        return -EINVAL;
+
+    mutex_lock(&g_pfnmap_lock);
+
+    pfn_map->total_pfns = g_pfnmap_count;
+    pfn_map->generation = g_pfnmap_generation;
+
+    count = 0;
+    if (pfn_map->start_pfn < g_pfnmap_count)
+        count = min(pfn_map->pfn_count, g_pfnmap_count - pfn_map->start_pfn);
+    pfn_map->pfn_count = count;
+
+    if (count && copy_to_user(pfn_map->buffer,
+                              g_pfnmap + pfn_map->start_pfn / 4,
+                              DIV_ROUND_UP(count, 4)))
+        ret = -EFAULT;
+
+    mutex_unlock(&g_pfnmap_lock);
+
+    return ret;
+}
+
+/* The highest order of a free block, for a sanity check: a free page might
+ * be allocated (and its private field reused) while we look at it. Before
+ * 6.4, MAX_ORDER was one above it.
+ */
+#ifdef MAX_PAGE_ORDER
+#define FREE_MAX_ORDER MAX_PAGE_ORDER
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+#define FREE_MAX_ORDER MAX_ORDER
+#else
+#define FREE_MAX_ORDER (MAX_ORDER - 1)
+#endif
+
+/* pfnmap_free_order - the order of the free block starting at pfn
+ * @pfn: the page frame
+ *
+ * The buddy allocator marks the first page of every free block, with the
+ * order in page_private. We hold no zone lock: the order is only trusted if
+ * the page is still marked after reading it.
+ *
+ * Returns the order, or -1 if no free block starts here
+ */
+static int pfnmap_free_order(uint64_t pfn)
+{
+    struct page *page = pfn_to_online_page(pfn);
+    unsigned long order;
+
+    if (!page || !PageBuddy(page))
+        return -1;
+
+    order = READ_ONCE(page_private(page));
+    smp_rmb();
+    if (!PageBuddy(page) || order > FREE_MAX_ORDER)
+        return -1;
+
+    return order;
+}
+
+/* pfnmap_query_free - the free runs of a range of page frames
+ * @free_runs: the request, with the user buffer, start_pfn and end_pfn
+ *
+ * Page frames beyond the map are not RAM, and never free.
+ *
+ * Returns 0, or negative error
+ */
+int pfnmap_query_free(PLINPMEM_FREE_RUNS free_runs)
+{
+    PLINPMEM_FREE_RUN runs;
+    PLINPMEM_FREE_RUN run = NULL;
+    uint64_t end;
+    uint64_t pfn;
+    uint64_t count;
+    uint64_t steps = 0;
+    int order;
+    int ret = 0;
+
+    if (free_runs->start_pfn > free_runs->end_pfn || !free_runs->max_runs ||
+        free_runs->max_runs > LINPMEM_MAX_FREE_RUNS)
+        return -EINVAL;
+
+    runs = kvmalloc_array(free_runs->max_runs, sizeof(LINPMEM_FREE_RUN),
+                          GFP_KERNEL);
+    if (!runs)
+        return -ENOMEM;
+
+    mutex_lock(&g_pfnmap_lock);
+    end = min(free_runs->end_pfn, g_pfnmap_count);
+    mutex_unlock(&g_pfnmap_lock);
+
+    free_runs->run_count = 0;
+    free_runs->free_pages = 0;
+    free_runs->resume_pfn = free_runs->end_pfn;
+
+    pfn = free_runs->start_pfn;
+    while (pfn < end) {
+        if (!(++steps % (1 << 18)))
+            cond_resched();
+
+        order = pfnmap_free_order(pfn);
+        if (order < 0) {
+            pfn++;
+            continue;
+        }
+
+        count = min(1ULL << order, end - pfn);
+
+        if (run && run->start_pfn + run->pfn_count == pfn) {
+            run->pfn_count += count;
+        } else if (free_runs->run_count == free_runs->max_runs) {
+            free_runs->resume_pfn = pfn;
+            break;
+        } else {
+            run = &runs[free_runs->run_count++];
+            run->start_pfn = pfn;
+            run->pfn_count = count;
+        }
+
+        free_runs->free_pages += count;
+        pfn += count;
+    }
+
+    if (free_runs->run_count &&
+        copy_to_user(free_runs->runs, runs,
+                     free_runs->run_count * sizeof(LINPMEM_FREE_RUN)))
+        ret = -EFAULT;
+
+    kvfree(runs);
+
+    return ret;
+}
@@ -0,0 +1,20 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _PFNMAP_H_
+#define _PFNMAP_H_
+
+#include <linux/types.h>
+
+#include "../userspace_interface/linpmem_shared.h"
+
+int pfnmap_init(void);
+
+void pfnmap_exit(void);
+
+int pfnmap_query(PLINPMEM_PFN_MAP pfn_map);
+
+int pfnmap_query_free(PLINPMEM_FREE_RUNS free_runs);
+
+#endif
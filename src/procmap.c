@@ -0,0 +1,377 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/mm.h>
+#include <linux/mmap_lock.h>
+#include <linux/rcupdate.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include "linpmem.h"
+#include "procmap.h"
+
+// Runs of a process to start with, doubled up to LINPMEM_MAX_VIRT_RUNS.
+#define PROCMAP_INITIAL_RUNS (256)
+
+// Processes a worker may be ahead of the copy to user space, per worker.
+#define PROCMAP_WINDOW_PER_WORKER (2)
+
+static struct workqueue_struct *g_procmap_wq;
+
+/* One address space to walk.
+ * mm		With a reference (mmget).
+ * map		What goes to user space in front of the runs.
+ * list		The runs, owned by the worker until done is completed.
+ */
+typedef struct {
+    struct mm_struct *mm;
+    LINPMEM_PROCESS_MAP map;
+    VIRT_RUN_LIST list;
+    struct completion done;
+} PROCMAP_ENTRY, *PPROCMAP_ENTRY;
+
+/* A query in progress.
+ * next		The next entry for a worker to take.
+ * consumed	Entries copied to user space. Workers stay within window
+ *		entries of it, which bounds the memory of the runs.
+ * abort	Set when the query is over: workers complete what they take
+ *		without walking.
+ */
+typedef struct {
+    PPROCMAP_ENTRY entries;
+    uint32_t count;
+    atomic_t next;
+    uint32_t consumed;
+    uint32_t window;
+    bool abort;
+    wait_queue_head_t window_wait;
+} PROCMAP_QUERY, *PPROCMAP_QUERY;
+
+typedef struct {
+    struct work_struct work;
+    PPROCMAP_QUERY query;
+} PROCMAP_WORKER, *PPROCMAP_WORKER;
+
+/* procmap_grow - make room for more runs
+ *
+ * Returns false if the list is at LINPMEM_MAX_VIRT_RUNS, or out of memory
+ */
+static bool procmap_grow(PVIRT_RUN_LIST list)
+{
+    uint32_t max_runs =
+        min_t(uint32_t, list->max_runs * 2, LINPMEM_MAX_VIRT_RUNS);
+    PLINPMEM_VIRT_RUN runs;
+
+    if (max_runs == list->max_runs)
+        return false;
+
+    runs = kvmalloc_array(max_runs, sizeof(LINPMEM_VIRT_RUN), GFP_KERNEL);
+    if (!runs)
+        return false;
+
+    memcpy(runs, list->runs, list->run_count * sizeof(LINPMEM_VIRT_RUN));
+    kvfree(list->runs);
+    list->runs = runs;
+    list->max_runs = max_runs;
+
+    return true;
+}
+
+/* Called by virt_walk_range, collect_virt_run with a growing list. */
+static bool procmap_collect(void *context, uint64_t virt_address,
+                            uint64_t phys_address, uint64_t size,
+                            PTE effective, volatile PPTE leaf)
+{
+    PVIRT_RUN_LIST list = context;
+
+    if (collect_virt_run(list, virt_address, phys_address, size, effective,
+                         leaf))
+        return true;
+
+    return procmap_grow(list) && collect_virt_run(list, virt_address,
+                                                  phys_address, size,
+                                                  effective, leaf);
+}
+
+static void procmap_walk(PPROCMAP_ENTRY entry)
+{
+    PTE_STATUS pte_status;
+
+    entry->list.max_runs = PROCMAP_INITIAL_RUNS;
+    entry->list.runs = kvmalloc_array(entry->list.max_runs,
+                                      sizeof(LINPMEM_VIRT_RUN), GFP_KERNEL);
+    if (!entry->list.runs) {
+        entry->map.flags |= LINPMEM_PROCESS_MAP_FAILED;
+        return;
+    }
+
+    // Keeps munmap from freeing the page tables under us. Not khugepaged,
+    // see virt_walk_range.
+    mmap_read_lock(entry->mm);
+    pte_status = virt_walk_range(entry->map.cr3, 0, TASK_SIZE_MAX,
+                                 procmap_collect, &entry->list,
+                                 &entry->map.resume_address);
+    mmap_read_unlock(entry->mm);
+
+    if (pte_status != PTE_SUCCESS) {
+        entry->map.flags |= LINPMEM_PROCESS_MAP_FAILED;
+        entry->list.run_count = 0;
+        entry->list.mapped_pages = 0;
+        return;
+    }
+
+    if (entry->map.resume_address)
+        entry->map.flags |= LINPMEM_PROCESS_MAP_TRUNCATED;
+    entry->map.run_count = entry->list.run_count;
+    entry->map.mapped_pages = entry->list.mapped_pages;
+}
+
+static void procmap_work(struct work_struct *work)
+{
+    PPROCMAP_WORKER worker = container_of(work, PROCMAP_WORKER, work);
+    PPROCMAP_QUERY query = worker->query;
+    PPROCMAP_ENTRY entry;
+    uint32_t index;
+
+    for (;;) {
+        index = atomic_inc_return(&query->next) - 1;
+        if (index >= query->count)
+            break;
+        entry = &query->entries[index];
+
+        wait_event(query->window_wait,
+                   READ_ONCE(query->abort) ||
+                       index < READ_ONCE(query->consumed) + query->window);
+
+        if (!READ_ONCE(query->abort))
+            procmap_walk(entry);
+
+        complete(&entry->done);
+    }
+}
+
+static int procmap_compare(const void *a, const void *b)
+{
+    const PROCMAP_ENTRY *entry_a = a;
+    const PROCMAP_ENTRY *entry_b = b;
+
+    if (entry_a->map.pid != entry_b->map.pid)
+        return entry_a->map.pid < entry_b->map.pid ? -1 : 1;
+    return 0;
+}
+
+/* procmap_collect_processes - take a reference on every address space
+ * @query: out, entries and count, sorted by pid
+ * @start_pid: the first pid wanted
+ *
+ * Returns 0, or negative error
+ */
+static int procmap_collect_processes(PPROCMAP_QUERY query, uint32_t start_pid)
+{
+    struct task_struct *process;
+    PPROCMAP_ENTRY entry;
+    struct mm_struct *mm;
+    uint32_t capacity = 0;
+    uint32_t pid;
+    uint32_t i;
+
+    rcu_read_lock();
+    for_each_process(process)
+        capacity++;
+    rcu_read_unlock();
+
+    // Some room for processes that start meanwhile, the rest is missed.
+    capacity += 64;
+    query->entries = kvcalloc(capacity, sizeof(PROCMAP_ENTRY), GFP_KERNEL);
+    if (!query->entries)
+        return -ENOMEM;
+
+    rcu_read_lock();
+
+    for_each_process(process) {
+        if (query->count == capacity)
+            break;
+
+        pid = task_tgid_vnr(process);
+        if (!pid || pid < start_pid || (process->flags & PF_KTHREAD))
+            continue;
+
+        task_lock(process);
+        mm = process->mm;
+        if (mm && !mmget_not_zero(mm))
+            mm = NULL;
+        task_unlock(process);
+
+        if (!mm)
+            continue;
+
+        entry = &query->entries[query->count++];
+        entry->mm = mm;
+        entry->map.pid = pid;
+        entry->map.cr3 = mm_cr3_pa(mm).value;
+        entry->map.mm_id = (uint64_t)mm;
+    }
+
+    rcu_read_unlock();
+
+    sort(query->entries, query->count, sizeof(PROCMAP_ENTRY),
+         procmap_compare, NULL);
+
+    // Not before sorting: a completion must not move.
+    for (i = 0; i < query->count; i++)
+        init_completion(&query->entries[i].done);
+
+    return 0;
+}
+
+/* procmap_copy - copy one walked process to user space
+ * @used: in/out, bytes used in the user buffer
+ *
+ * Returns 0, -ENOSPC if it does not fit, or -EFAULT
+ */
+static int procmap_copy(PLINPMEM_PROCESS_MAPS process_maps,
+                        PPROCMAP_ENTRY entry, uint64_t *used)
+{
+    uint64_t runs_size = entry->map.run_count * sizeof(LINPMEM_VIRT_RUN);
+    uint8_t __user *target = (uint8_t __user *)process_maps->buffer + *used;
+
+    if (sizeof(LINPMEM_PROCESS_MAP) + runs_size >
+        process_maps->buffer_size - *used)
+        return -ENOSPC;
+
+    if (copy_to_user(target, &entry->map, sizeof(LINPMEM_PROCESS_MAP)) ||
+        copy_to_user(target + sizeof(LINPMEM_PROCESS_MAP), entry->list.runs,
+                     runs_size))
+        return -EFAULT;
+
+    *used += sizeof(LINPMEM_PROCESS_MAP) + runs_size;
+
+    return 0;
+}
+
+/* procmap_query - walk the page tables of all processes, in parallel
+ * @process_maps: the request, with the user buffer
+ *
+ * The workers walk, this thread copies the results to user space in pid
+ * order, and frees them. Entries are sorted before the workers start, so
+ * the pid order is also the order they take them in.
+ *
+ * Returns 0, or negative error
+ */
+int procmap_query(PLINPMEM_PROCESS_MAPS process_maps)
+{
+    PPROCMAP_WORKER workers = NULL;
+    PROCMAP_QUERY query = { 0 };
+    PPROCMAP_ENTRY entry;
+    uint32_t worker_count;
+    uint64_t used = 0;
+    uint32_t i;
+    int ret = 0;
+
+    if (process_maps->buffer_size < LINPMEM_PROCESS_MAP_MAX_SIZE ||
+        process_maps->max_workers > LINPMEM_MAX_PROCESS_MAP_WORKERS)
+        return -EINVAL;
+
+    // virt_walk_range knows only 4 levels.
+    if (pgtable_l5_enabled())
+        return -EOPNOTSUPP;
+
+    worker_count = process_maps->max_workers ? process_maps->max_workers :
+                                               num_online_cpus();
+    worker_count = clamp_t(uint32_t, worker_count, 1,
+                           LINPMEM_MAX_PROCESS_MAP_WORKERS);
+
+    ret = procmap_collect_processes(&query, process_maps->start_pid);
+    if (ret)
+        return ret;
+
+    worker_count = min(worker_count, max(query.count, 1U));
+    workers = kcalloc(worker_count, sizeof(PROCMAP_WORKER), GFP_KERNEL);
+    if (!workers) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    atomic_set(&query.next, 0);
+    query.window = worker_count * PROCMAP_WINDOW_PER_WORKER;
+    init_waitqueue_head(&query.window_wait);
+
+    for (i = 0; i < worker_count; i++) {
+        INIT_WORK(&workers[i].work, procmap_work);
+        workers[i].query = &query;
+        queue_work(g_procmap_wq, &workers[i].work);
+    }
+
+    process_maps->process_count = 0;
+    process_maps->resume_pid = 0;
+
+    for (i = 0; i < query.count; i++) {
+        entry = &query.entries[i];
+
+        ret = wait_for_completion_killable(&entry->done);
+        if (ret)
+            break;
+
+        ret = procmap_copy(process_maps, entry, &used);
+        if (ret == -ENOSPC) {
+            process_maps->resume_pid = entry->map.pid;
+            ret = 0;
+            break;
+        }
+        if (ret)
+            break;
+
+        process_maps->process_count++;
+
+        kvfree(entry->list.runs);
+        entry->list.runs = NULL;
+
+        WRITE_ONCE(query.consumed, i + 1);
+        wake_up_all(&query.window_wait);
+    }
+
+    WRITE_ONCE(query.abort, true);
+    wake_up_all(&query.window_wait);
+
+    for (i = 0; i < worker_count; i++)
+        flush_work(&workers[i].work);
+
+    process_maps->used_size = used;
+    process_maps->workers = worker_count;
+
+out:
+    for (i = 0; i < query.count; i++) {
+        kvfree(query.entries[i].list.runs);
+        mmput(query.entries[i].mm);
+    }
+    kvfree(query.entries);
+    kfree(workers);
+
+    return ret;
+}
+
+int procmap_init(void)
+{
+    g_procmap_wq = alloc_workqueue("linpmem_procmap", WQ_UNBOUND, 0);
+    if (!g_procmap_wq)
+        return -ENOMEM;
+
+    return 0;
+}
+
+void procmap_exit(void)
+{
+    if (g_procmap_wq)
+        destroy_workqueue(g_procmap_wq);
+}
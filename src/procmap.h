@@ -0,0 +1,18 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _PROCMAP_H_
+#define _PROCMAP_H_
+
+#include <linux/types.h>
+
+#include "../userspace_interface/linpmem_shared.h"
+
+int procmap_init(void);
+
+void procmap_exit(void);
+
+int procmap_query(PLINPMEM_PROCESS_MAPS process_maps);
+
+#endif
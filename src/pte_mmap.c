@@ -22,6 +22,10 @@
 #include <asm/io.h>
 #include <linux/mm.h>
 #include <linux/mutex.h>
+#include <linux/pagemap.h>
+#include <linux/prefetch.h>
+#include <linux/sched.h>
+#include <linux/uaccess.h>
 
 #include "linpmem.h"
 #include "page_table.h"
@@ -32,14 +36,21 @@ DEFINE_MUTEX(g_rogue_page_mutex);
 char g_rogue_page[PAGE_SIZE]
     __attribute__((aligned(PAGE_SIZE))) = { "SacrificePhysicalPage=1;" };
 
+static struct mutex g_rogue_window_mutex[ROGUE_WINDOW_COUNT];
+
+char g_rogue_windows[ROGUE_WINDOW_COUNT][PAGE_SIZE]
+    __attribute__((aligned(PAGE_SIZE))) = {
+        [0 ... ROGUE_WINDOW_COUNT - 1] = "SacrificePhysicalPage=1;"
+    };
+
 // Edit the page tables to relink a virtual address to a specific physical page.
 //
 // Argument 1: a PTE data struct, filled with information about the rogue page to be used.
 // Argument 2: the physical address to re-map to.
 //
 // Returns:
-//  PTE_SUCCESS (with g_rogue_page_lock)
-//  PTE_ERROR (without g_rogue_page_lock)
+//  PTE_SUCCESS (with pte_data->rogue_lock)
+//  PTE_ERROR (without pte_data->rogue_lock)
 //
 PTE_STATUS pte_remap_rogue_page_locked(PPTE_METHOD_DATA pte_data, PTE new_pte)
 {
@@ -50,7 +61,7 @@ PTE_STATUS pte_remap_rogue_page_locked(PPTE_METHOD_DATA pte_data, PTE new_pte)
              (long long unsigned int)pte_data->rogue_va.pointer,
              __pfn_to_phys(new_pte.page_frame));
 
-    mutex_lock(&g_rogue_page_mutex);
+    mutex_lock(pte_data->rogue_lock);
 
     // It is *critical* there is no interruption while doing PTE remapping.
     // Alternatively we could allow interruption and being re-scheduled in the plain middle 
@@ -73,6 +84,208 @@ PTE_STATUS pte_remap_rogue_page_locked(PPTE_METHOD_DATA pte_data, PTE new_pte)
     return PTE_SUCCESS;
 }
 
+// Reads up to one page from a physical address into a *kernel* buffer.
+//
+// Argument 1: a PTE data struct, filled with information about the rogue page to be used.
+// Argument 2: the physical address to read from.
+// Argument 3: the kernel buffer to copy to.
+// Argument 4: the number of bytes wanted. Reads do not cross page boundaries.
+//
+// Returns:
+//  the number of bytes copied, or 0 on error.
+//
+// Remarks: This is the path for the kernel workers, which copy into memory that can not fault.
+//          Preemption is kept disabled while reading, so we can not be moved to a CPU core
+//          with a stale TLB entry for the rogue page after the remap.
+//
+uint64_t pte_mmap_read_kernel(PPTE_METHOD_DATA pte_data, uint64_t phys_addr,
+                              void *buf, uint64_t count)
+{
+    uint64_t page_offset;
+    uint64_t to_read;
+    uint64_t pfn;
+    PTE new_pte;
+
+    if (!pte_data || !buf)
+        return 0;
+
+    page_offset = offset_in_page(phys_addr);
+    to_read = min(PAGE_SIZE - page_offset, count);
+
+    pfn = __phys_to_pfn(phys_addr);
+    if (!pfn_valid(pfn))
+        return 0;
+
+    new_pte = pte_data->original_pte;
+    new_pte.page_frame = pfn;
+
+    if (pte_remap_rogue_page_locked(pte_data, new_pte) != PTE_SUCCESS)
+        return 0;
+
+    preempt_disable();
+
+    // We might have been moved to another core between the sti and here.
+    tlb_flush((uint64_t)pte_data->rogue_va.pointer);
+
+    memcpy(buf, (void *)(pte_data->rogue_va.value + page_offset), to_read);
+
+    preempt_enable();
+
+    mutex_unlock(pte_data->rogue_lock);
+
+    return to_read;
+}
+
+// Points a rogue page, whose lock we hold, at another page frame and flushes it locally.
+static inline void pte_retarget_rogue_page(PPTE_METHOD_DATA pte_data, uint64_t pfn)
+{
+    PTE new_pte = pte_data->original_pte;
+
+    new_pte.page_frame = pfn;
+    WRITE_ONCE((*pte_data->rogue_pte).value, new_pte.value);
+    tlb_flush((uint64_t)pte_data->rogue_va.pointer);
+}
+
+// Reads a physically contiguous range, crossing page boundaries.
+//
+// Argument 1, 2: two rogue pages ("slots"), used in turns. Callers that take more than one
+//                rogue page must take them in ascending order, so pass them that way.
+// Argument 3: the physical address to read from.
+// Argument 4: the buffer to copy to.
+// Argument 5: the number of bytes wanted.
+// Argument 6: whether buf is a user buffer.
+//
+// Returns:
+//  the number of bytes copied. Stops early at the first invalid page frame, or if the user
+//  buffer faults.
+//
+// Remarks: Remapping a rogue page means a serializing INVLPG and a TLB miss on the first
+//          access. With two slots, the next page is remapped and prefetched before the
+//          current one is copied, so the page walk for it overlaps with the copy.
+//          The copies happen with page faults disabled (we hold the rogue page locks and
+//          keep preemption off, see pte_mmap_read_kernel). If the user buffer is not
+//          present, we leave the atomic section, fault it in, and copy the page again.
+//          Kernel buffers must not fault at all.
+//
+static uint64_t pte_mmap_pipeline(PPTE_METHOD_DATA front, PPTE_METHOD_DATA back,
+                                  uint64_t phys_addr, void *buf, uint64_t count,
+                                  bool user_buffer)
+{
+    PPTE_METHOD_DATA slots[2] = { front, back };
+    uint64_t bytes_read = 0;
+    uint64_t page_offset;
+    uint64_t to_read;
+    uint64_t pfn;
+    unsigned int page = 0;
+    unsigned long left;
+    bool next_valid;
+
+    if (!front || !back || front == back || !count)
+        return 0;
+
+    pfn = __phys_to_pfn(phys_addr);
+    if (!pfn_valid(pfn))
+        return 0;
+
+    mutex_lock(front->rogue_lock);
+    mutex_lock(back->rogue_lock);
+
+    preempt_disable();
+    pagefault_disable();
+
+    pte_retarget_rogue_page(slots[0], pfn);
+
+    while (bytes_read < count) {
+        PPTE_METHOD_DATA current_slot = slots[page % 2];
+        PPTE_METHOD_DATA next_slot = slots[(page + 1) % 2];
+        char *source;
+
+        page_offset = offset_in_page(phys_addr + bytes_read);
+        to_read = min(PAGE_SIZE - page_offset, count - bytes_read);
+
+        // Get the next page going while we copy this one.
+        next_valid = false;
+        if (bytes_read + to_read < count) {
+            pfn = __phys_to_pfn(phys_addr + bytes_read + to_read);
+            next_valid = pfn_valid(pfn);
+            if (next_valid) {
+                pte_retarget_rogue_page(next_slot, pfn);
+                prefetch_range(next_slot->rogue_va.pointer, L1_CACHE_BYTES * 8);
+            }
+        }
+
+        source = (char *)current_slot->rogue_va.pointer + page_offset;
+        left = 0;
+        if (user_buffer)
+            left = __copy_to_user_inatomic((void __user *)buf + bytes_read,
+                                           source, to_read);
+        else
+            memcpy(buf + bytes_read, source, to_read);
+
+        if (left) {
+            pagefault_enable();
+            preempt_enable();
+
+            if (fault_in_writeable((void __user *)buf + bytes_read, to_read))
+                goto out_unlock;
+
+            preempt_disable();
+            pagefault_disable();
+
+            // We might run on another core now.
+            tlb_flush((uint64_t)current_slot->rogue_va.pointer);
+            tlb_flush((uint64_t)next_slot->rogue_va.pointer);
+
+            if (__copy_to_user_inatomic((void __user *)buf + bytes_read,
+                                        source, to_read))
+                break;
+        }
+
+        bytes_read += to_read;
+        page++;
+
+        if (!next_valid)
+            break;
+
+        // Be nice every now and then.
+        if (!(page % 64) && need_resched()) {
+            pagefault_enable();
+            preempt_enable();
+            cond_resched();
+            preempt_disable();
+            pagefault_disable();
+            tlb_flush((uint64_t)next_slot->rogue_va.pointer);
+        }
+    }
+
+    pagefault_enable();
+    preempt_enable();
+
+out_unlock:
+    mutex_unlock(back->rogue_lock);
+    mutex_unlock(front->rogue_lock);
+
+    return bytes_read;
+}
+
+// Reads a physically contiguous range into a *user* buffer, see pte_mmap_pipeline.
+// The copies there do not check the buffer, so we do it here.
+uint64_t pte_mmap_read_pipelined(PPTE_METHOD_DATA front, PPTE_METHOD_DATA back,
+                                 uint64_t phys_addr, void __user *buf, uint64_t count)
+{
+    if (!access_ok(buf, count))
+        return 0;
+
+    return pte_mmap_pipeline(front, back, phys_addr, (void __force *)buf, count, true);
+}
+
+// Reads a physically contiguous range into a *kernel* buffer, see pte_mmap_pipeline.
+uint64_t pte_mmap_read_pipelined_kernel(PPTE_METHOD_DATA front, PPTE_METHOD_DATA back,
+                                        uint64_t phys_addr, void *buf, uint64_t count)
+{
+    return pte_mmap_pipeline(front, back, phys_addr, buf, count, false);
+}
+
 // Traverses the page tables to find the pte for a given virtual address.
 //
 // Args:
@@ -253,18 +466,176 @@ error:
     return status;
 }
 
-int setup_pte_method(PPTE_METHOD_DATA pte_data)
+/* walk_table - map a page table that an upper level entry points to
+ * @pfn: the page frame of the table
+ *
+ * Returns NULL if the frame is not RAM: the entry was torn or changed under
+ * us, as nothing keeps the tables of a live process stable.
+ */
+static void *walk_table(uint64_t pfn)
+{
+    if (!pfn_valid(pfn))
+        return NULL;
+
+    return phys_to_virt(PFN_PHYS(pfn));
+}
+
+// Walks the page tables of an address space and reports all present pages.
+//
+// Args:
+//  _In_ uint64_t cr3_pa: Physical address of the PML4 (4-level paging only).
+//  _In_ uint64_t start, end: The virtual range [start, end). Must not cross the non-canonical hole.
+//  _In_ PTE_WALK_CALLBACK callback: Called for every present page (4 KiB, 2 MiB or 1 GiB), in ascending
+//                                   order and clipped to the range. The rw, user and xd bits of the PTE it
+//                                   gets are the effective rights of all levels. Returning false stops the walk.
+//                                   It also gets the entry that maps the page (any level), unless the page is
+//                                   clipped to the range. The entry is live: read it only, never write it.
+//  _In_ void *context: Passed to the callback.
+//  _Out_ uint64_t *stopped_at: The virtual address the callback refused, or zero.
+//
+// Returns:
+//  PTE_SUCCESS or PTE_ERROR
+//
+// Remarks: Like virt_find_pte, this reads the page tables through the direct mapping, without the page table
+//          locks. The mmap lock does NOT keep the tables alive: khugepaged, for one, retracts and frees page
+//          tables without it. Every entry is therefore read once, and tables that are not in valid RAM are
+//          skipped, so the walk never leaves the direct mapping of RAM. What the callback gets is a best-effort
+//          snapshot: pages that are mapped or unmapped concurrently may or may not be reported, and a freed
+//          table that was reused meanwhile may yield bogus pages.
+//          Might sleep.
+//
+PTE_STATUS virt_walk_range(uint64_t cr3_pa, uint64_t start, uint64_t end,
+                           PTE_WALK_CALLBACK callback, void *context,
+                           uint64_t *stopped_at)
+{
+    PPML4E pml4_table;
+    PPDPTE pdpt_table;
+    PPDE pd_table;
+    PPTE pt_table;
+    PML4E pml4e;
+    PDPTE pdpte;
+    PDE pde;
+    PTE pte;
+    PTE effective;
+    volatile PPTE leaf;
+    VIRT_ADDR va;
+    uint64_t phys_address;
+    uint64_t span;
+    uint64_t next;
+    bool rw, user, xd;
+
+    *stopped_at = 0;
+
+    if (!cr3_pa)
+        return PTE_ERROR;
+
+    pml4_table = walk_table(__phys_to_pfn(cr3_pa));
+    if (!pml4_table)
+        return PTE_ERROR;
+
+    va.value = start & PAGE_MASK;
+
+    while (va.value < end) {
+        pml4e.value = READ_ONCE(pml4_table[va.pml4_index].value);
+        span = 1ULL << 39;
+        if (!pml4e.present)
+            goto skip;
+        pdpt_table = walk_table(pml4e.pdpt_p);
+        if (!pdpt_table)
+            goto skip;
+        rw = pml4e.rw;
+        user = pml4e.user;
+        xd = pml4e.xd;
+
+        pdpte.value = READ_ONCE(pdpt_table[va.pdpt_index].value);
+        span = 1ULL << 30;
+        if (!pdpte.present)
+            goto skip;
+        rw &= pdpte.rw;
+        user &= pdpte.user;
+        xd |= pdpte.xd;
+        if (pdpte.large_page) {
+            effective.value = pdpte.value;
+            leaf = (PPTE)&pdpt_table[va.pdpt_index];
+            phys_address = PFN_PHYS(pdpte.pd_p);
+            goto leaf;
+        }
+        pd_table = walk_table(pdpte.pd_p);
+        if (!pd_table)
+            goto skip;
+
+        pde.value = READ_ONCE(pd_table[va.pd_index].value);
+        span = 1ULL << 21;
+        if (!pde.present)
+            goto skip;
+        rw &= pde.rw;
+        user &= pde.user;
+        xd |= pde.xd;
+        if (pde.large_page) {
+            effective.value = pde.value;
+            leaf = (PPTE)&pd_table[va.pd_index];
+            phys_address = PFN_PHYS(pde.pt_p);
+            goto leaf;
+        }
+        pt_table = walk_table(pde.pt_p);
+        if (!pt_table)
+            goto skip;
+
+        pte.value = READ_ONCE(pt_table[va.pt_index].value);
+        span = PAGE_SIZE;
+        if (!pte.present)
+            goto skip;
+        rw &= pte.rw;
+        user &= pte.user;
+        xd |= pte.xd;
+        effective.value = pte.value;
+        leaf = &pt_table[va.pt_index];
+        phys_address = PFN_PHYS(pte.page_frame);
+
+leaf:
+        // Large pages: the lowest frame bit is the PAT bit.
+        phys_address &= ~(span - 1);
+        effective.rw = rw;
+        effective.user = user;
+        effective.xd = xd;
+
+        next = (va.value & ~(span - 1)) + span;
+        if (va.value & (span - 1) || next > end)
+            leaf = NULL;
+        if (!callback(context, va.value,
+                      phys_address + (va.value & (span - 1)),
+                      min(next, end) - va.value, effective, leaf)) {
+            *stopped_at = va.value;
+            return PTE_SUCCESS;
+        }
+
+skip:
+        next = (va.value & ~(span - 1)) + span;
+        if (next < va.value) // wrapped around at the top
+            break;
+        va.value = next;
+
+        if (!(va.value & ((1ULL << 21) - 1)))
+            cond_resched();
+    }
+
+    return PTE_SUCCESS;
+}
+
+static int setup_rogue_page(PPTE_METHOD_DATA pte_data, char *rogue_page,
+                            struct mutex *rogue_lock)
 {
     PTE_STATUS pte_status;
 
     pte_data->pte_method_is_ready_to_use = false;
 
-    if (!PAGE_ALIGNED(g_rogue_page)) {
+    if (!PAGE_ALIGNED(rogue_page)) {
         pr_warn(
             "Setup of PTE method failed: rogue map is not pagesize aligned. This is a programming error!\n");
         return -1;
     }
-    pte_data->rogue_va.pointer = g_rogue_page;
+    pte_data->rogue_va.pointer = rogue_page;
+    pte_data->rogue_lock = rogue_lock;
 
     // We only need one PTE for the rogue page, and just remap the PFN.
     // A part of the driver's body is sacrificed for this.
@@ -293,6 +664,11 @@ int setup_pte_method(PPTE_METHOD_DATA pte_data)
     return 0;
 }
 
+int setup_pte_method(PPTE_METHOD_DATA pte_data)
+{
+    return setup_rogue_page(pte_data, g_rogue_page, &g_rogue_page_mutex);
+}
+
 void restore_pte_method(PPTE_METHOD_DATA pte_data)
 {
     PTE_STATUS pte_status;
@@ -316,12 +692,42 @@ void restore_pte_method(PPTE_METHOD_DATA pte_data)
         return;
     }
 
-    if (g_rogue_page[0] == 'S')
-        pr_info("Sacrifice section successfully restored: %s.\n", g_rogue_page);
+    if (((char *)pte_data->rogue_va.pointer)[0] == 'S')
+        pr_info("Sacrifice section successfully restored: %s.\n",
+                (char *)pte_data->rogue_va.pointer);
     else
         pr_crit("Uh-oh, restoring failed. Consider rebooting. (Right now.)\n");
 
-    mutex_unlock(&g_rogue_page_mutex);
+    mutex_unlock(pte_data->rogue_lock);
 
     return;
 }
+
+// Sets up all rogue windows, or none of them.
+int setup_rogue_windows(PPTE_METHOD_DATA windows)
+{
+    int i;
+
+    for (i = 0; i < ROGUE_WINDOW_COUNT; i++) {
+        mutex_init(&g_rogue_window_mutex[i]);
+        if (setup_rogue_page(&windows[i], g_rogue_windows[i],
+                             &g_rogue_window_mutex[i]))
+            goto error;
+    }
+
+    return 0;
+
+error:
+    while (i--)
+        restore_pte_method(&windows[i]);
+
+    return -1;
+}
+
+void restore_rogue_windows(PPTE_METHOD_DATA windows)
+{
+    int i;
+
+    for (i = 0; i < ROGUE_WINDOW_COUNT; i++)
+        restore_pte_method(&windows[i]);
+}
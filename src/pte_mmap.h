@@ -42,6 +42,13 @@
 extern struct mutex g_rogue_page_mutex;
 extern char g_rogue_page[];
 
+/* More rogue pages ("windows") for the kernel workers, so they do not all
+ * queue up on the one rogue page of the ioctl path. Each window has its own
+ * mutex, see PTE_METHOD_DATA.rogue_lock.
+ */
+#define ROGUE_WINDOW_COUNT (16)
+extern char g_rogue_windows[ROGUE_WINDOW_COUNT][PAGE_SIZE];
+
 #pragma pack(push, 1)
 typedef union {
     uint64_t value;
@@ -162,6 +169,7 @@ typedef struct {
     VIRT_ADDR rogue_va;
     volatile PPTE rogue_pte;
     PTE original_pte;
+    struct mutex *rogue_lock;
 } PTE_METHOD_DATA, *PPTE_METHOD_DATA;
 
 /* Parse a 64 bit page table entry and print it. */
@@ -223,11 +231,36 @@ static inline void pmem_x64sti(void)
 
 PTE_STATUS pte_remap_rogue_page_locked(PPTE_METHOD_DATA pte_data, PTE new_pte);
 
+uint64_t pte_mmap_read_kernel(PPTE_METHOD_DATA pte_data, uint64_t phys_addr,
+                              void *buf, uint64_t count);
+
+uint64_t pte_mmap_read_pipelined(PPTE_METHOD_DATA front, PPTE_METHOD_DATA back,
+                                 uint64_t phys_addr, void __user *buf,
+                                 uint64_t count);
+
+uint64_t pte_mmap_read_pipelined_kernel(PPTE_METHOD_DATA front,
+                                        PPTE_METHOD_DATA back,
+                                        uint64_t phys_addr, void *buf,
+                                        uint64_t count);
+
 PTE_STATUS virt_find_pte(VIRT_ADDR vaddr, volatile PPTE *pPTE,
                          uint64_t foreign_CR3);
 
+/* Called by virt_walk_range for every present page, see there. */
+typedef bool (*PTE_WALK_CALLBACK)(void *context, uint64_t virt_address,
+                                  uint64_t phys_address, uint64_t size,
+                                  PTE effective, volatile PPTE leaf);
+
+PTE_STATUS virt_walk_range(uint64_t cr3_pa, uint64_t start, uint64_t end,
+                           PTE_WALK_CALLBACK callback, void *context,
+                           uint64_t *stopped_at);
+
 int setup_pte_method(PPTE_METHOD_DATA pPtedata);
 
 void restore_pte_method(PPTE_METHOD_DATA pPtedata);
 
+int setup_rogue_windows(PPTE_METHOD_DATA windows);
+
+void restore_rogue_windows(PPTE_METHOD_DATA windows);
+
 #endif
@@ -0,0 +1,141 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/err.h>
+#include <linux/kref.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#include "linpmem.h"
+#include "pte_mmap.h"
+#include "regbuf.h"
+
+/* regbuf_register - pin a user buffer for later reads
+ * @buffer: the user buffer
+ * @size: its size, must be checked by the caller
+ *
+ * The pages are pinned long term (FOLL_LONGTERM), so they are never moved or
+ * reclaimed, and mapped once into the kernel. Reads into the buffer are then
+ * plain memcpys that can not fault.
+ *
+ * Returns the buffer, or ERR_PTR
+ */
+PREGISTERED_BUFFER regbuf_register(void __user *buffer, uint64_t size)
+{
+    PREGISTERED_BUFFER regbuf;
+    unsigned long start = (unsigned long)buffer & PAGE_MASK;
+    long pinned;
+    int ret;
+
+    regbuf = kzalloc(sizeof(REGISTERED_BUFFER), GFP_KERNEL);
+    if (!regbuf)
+        return ERR_PTR(-ENOMEM);
+
+    kref_init(&regbuf->refcount);
+    regbuf->size = size;
+    regbuf->page_count =
+        (PAGE_ALIGN((unsigned long)buffer + size) - start) >> PAGE_SHIFT;
+
+    regbuf->pages =
+        kvcalloc(regbuf->page_count, sizeof(struct page *), GFP_KERNEL);
+    if (!regbuf->pages) {
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    pinned = pin_user_pages_fast(start, regbuf->page_count,
+                                 FOLL_WRITE | FOLL_LONGTERM, regbuf->pages);
+    if (pinned != regbuf->page_count) {
+        ret = pinned < 0 ? pinned : -EFAULT;
+        if (pinned > 0)
+            unpin_user_pages(regbuf->pages, pinned);
+        goto error;
+    }
+
+    regbuf->base = vmap(regbuf->pages, regbuf->page_count, VM_MAP, PAGE_KERNEL);
+    if (!regbuf->base) {
+        unpin_user_pages(regbuf->pages, regbuf->page_count);
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    regbuf->data = regbuf->base + offset_in_page(buffer);
+
+    return regbuf;
+
+error:
+    kvfree(regbuf->pages);
+    kfree(regbuf);
+
+    return ERR_PTR(ret);
+}
+
+static void regbuf_release(struct kref *refcount)
+{
+    PREGISTERED_BUFFER regbuf =
+        container_of(refcount, REGISTERED_BUFFER, refcount);
+
+    vunmap(regbuf->base);
+    // We wrote into them behind the back of the page tables.
+    unpin_user_pages_dirty_lock(regbuf->pages, regbuf->page_count, true);
+    kvfree(regbuf->pages);
+    kfree(regbuf);
+}
+
+void regbuf_get(PREGISTERED_BUFFER regbuf)
+{
+    kref_get(&regbuf->refcount);
+}
+
+void regbuf_put(PREGISTERED_BUFFER regbuf)
+{
+    if (regbuf)
+        kref_put(&regbuf->refcount, regbuf_release);
+}
+
+/* regbuf_read - read physical memory into a registered buffer
+ * @regbuf: the buffer, with a reference held
+ * @buffer_offset: where to put the data in the buffer
+ * @phys_addr: physical address to read from
+ * @size: number of bytes, buffer_offset + size must be checked by the caller
+ *
+ * Reads across page boundaries, like LINPMEM_TRANSFER_IGNORE_PAGE_BOUNDARY.
+ *
+ * Returns number of bytes read, less than size if a page is not readable
+ */
+uint64_t regbuf_read(PREGISTERED_BUFFER regbuf, uint64_t buffer_offset,
+                     uint64_t phys_addr, uint64_t size)
+{
+    char *buf = regbuf->data + buffer_offset;
+    uint64_t bytes_read = 0;
+    uint64_t chunk;
+    unsigned int pair;
+
+    if (g_device_extension.rogue_windows_ready) {
+        pair = (task_pid_nr(current) % (ROGUE_WINDOW_COUNT / 2)) * 2;
+        return pte_mmap_read_pipelined_kernel(rogue_window(pair),
+                                              rogue_window(pair + 1),
+                                              phys_addr, buf, size);
+    }
+
+    while (bytes_read < size) {
+        chunk = pte_mmap_read_kernel(&g_device_extension.pte_data,
+                                     phys_addr + bytes_read, buf + bytes_read,
+                                     size - bytes_read);
+        if (!chunk)
+            break;
+        bytes_read += chunk;
+
+        if (signal_pending(current))
+            break;
+    }
+
+    return bytes_read;
+}
@@ -0,0 +1,40 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _REGBUF_H_
+#define _REGBUF_H_
+
+#include <linux/kref.h>
+#include <linux/mm_types.h>
+
+#include "../userspace_interface/linpmem_shared.h"
+
+/* A user buffer, registered once and pinned until unregistered.
+ * refcount	One reference for the file context, one for each read in
+ *		flight, so unregistering does not pull the pages from under a
+ *		reader.
+ * pages	The pinned pages, page_count of them.
+ * base		vmap of the pages.
+ * data		Start of the user buffer in base (it need not be aligned).
+ * size		Size of the user buffer.
+ */
+typedef struct {
+    struct kref refcount;
+    struct page **pages;
+    unsigned long page_count;
+    void *base;
+    void *data;
+    uint64_t size;
+} REGISTERED_BUFFER, *PREGISTERED_BUFFER;
+
+PREGISTERED_BUFFER regbuf_register(void __user *buffer, uint64_t size);
+
+void regbuf_get(PREGISTERED_BUFFER regbuf);
+
+void regbuf_put(PREGISTERED_BUFFER regbuf);
+
+uint64_t regbuf_read(PREGISTERED_BUFFER regbuf, uint64_t buffer_offset,
+                     uint64_t phys_addr, uint64_t size);
+
+#endif
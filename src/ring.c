@@ -0,0 +1,312 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/nodemask.h>
+#include <linux/pfn.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/topology.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "linpmem.h"
+#include "pte_mmap.h"
+#include "ring.h"
+
+/* What the NUMA-local ring workers of one node did, all rings together. */
+typedef struct {
+    atomic64_t pages_read;
+    atomic64_t pages_failed;
+    atomic64_t busy_ns;
+} RING_NODE_STATS;
+
+static RING_NODE_STATS g_node_stats[LINPMEM_MAX_NUMA_NODES];
+
+static struct workqueue_struct *g_ring_wq;
+
+static inline PLINPMEM_RING_HEADER ring_header(PPAGE_RING ring)
+{
+    return (PLINPMEM_RING_HEADER)ring->base;
+}
+
+static inline PLINPMEM_RING_DESC ring_desc(PPAGE_RING ring, uint32_t index)
+{
+    return (PLINPMEM_RING_DESC)(ring_header(ring) + 1) + index;
+}
+
+static inline void *ring_slot(PPAGE_RING ring, uint32_t index)
+{
+    return ring->base + ring->slots_offset + (size_t)index * PAGE_SIZE;
+}
+
+/* ring_slot_node - NUMA node of the page that a slot wants
+ * @ring: the ring
+ * @index: slot
+ *
+ * Nobody can read an invalid pfn, so these are left to the first node to fail
+ * them.
+ *
+ * Returns node id
+ */
+static int ring_slot_node(PPAGE_RING ring, uint32_t index)
+{
+    uint64_t pfn =
+        __phys_to_pfn(READ_ONCE(ring_desc(ring, index)->phys_address));
+
+    if (!pfn_valid(pfn))
+        return first_memory_node;
+
+    return pfn_to_nid(pfn);
+}
+
+/* ring_fill_slot - read the page of a submitted slot
+ * @ring: the ring
+ * @index: slot to fill
+ * @pte_data: the rogue page to read through
+ *
+ * User space owns the descriptor until we manage to move it from SUBMITTED to
+ * BUSY, and gets it back with the release store of the final state.
+ *
+ * Returns true if the page was read
+ */
+static bool ring_fill_slot(PPAGE_RING ring, uint32_t index,
+                           PPTE_METHOD_DATA pte_data)
+{
+    PLINPMEM_RING_DESC desc = ring_desc(ring, index);
+    uint64_t phys_addr;
+    uint64_t bytes_read;
+
+    if (cmpxchg(&desc->state, LINPMEM_SLOT_SUBMITTED, LINPMEM_SLOT_BUSY) !=
+        LINPMEM_SLOT_SUBMITTED)
+        return false;
+
+    phys_addr = READ_ONCE(desc->phys_address) & PAGE_MASK;
+
+    bytes_read = pte_mmap_read_kernel(pte_data, phys_addr,
+                                      ring_slot(ring, index), PAGE_SIZE);
+
+    WRITE_ONCE(desc->bytes_read, (uint32_t)bytes_read);
+    smp_store_release(&desc->state, bytes_read == PAGE_SIZE ?
+                                        LINPMEM_SLOT_DONE :
+                                        LINPMEM_SLOT_ERROR);
+
+    return bytes_read == PAGE_SIZE;
+}
+
+/* ring_fill_slots - fill the submitted slots
+ * @ring: the ring
+ * @node: only fill slots of pages on this node, NUMA_NO_NODE for all slots
+ * @pte_data: the rogue page to read through
+ */
+static void ring_fill_slots(PPAGE_RING ring, int node,
+                            PPTE_METHOD_DATA pte_data)
+{
+    PLINPMEM_RING_HEADER header = ring_header(ring);
+    uint64_t start_ns = ktime_get_ns();
+    uint64_t done = 0;
+    uint64_t failed = 0;
+    uint32_t i;
+
+    for (i = 0; i < ring->slot_count; i++) {
+        if (READ_ONCE(ring_desc(ring, i)->state) != LINPMEM_SLOT_SUBMITTED)
+            continue;
+
+        if (node != NUMA_NO_NODE && ring_slot_node(ring, i) != node)
+            continue;
+
+        if (ring_fill_slot(ring, i, pte_data))
+            done++;
+        else
+            failed++;
+
+        cond_resched();
+    }
+
+    if (!done && !failed)
+        return;
+
+    // Several node workers may race here, the header is just a snapshot.
+    WRITE_ONCE(header->slots_done,
+               atomic64_add_return(done, &ring->slots_done));
+    WRITE_ONCE(header->slots_failed,
+               atomic64_add_return(failed, &ring->slots_failed));
+
+    if (node >= 0 && node < LINPMEM_MAX_NUMA_NODES) {
+        atomic64_add(done, &g_node_stats[node].pages_read);
+        atomic64_add(failed, &g_node_stats[node].pages_failed);
+        atomic64_add(ktime_get_ns() - start_ns, &g_node_stats[node].busy_ns);
+    }
+
+    pr_debug("%s: node %d filled %llu slots, %llu failed\n", __func__, node,
+             done, failed);
+}
+
+static void ring_work(struct work_struct *work)
+{
+    PPAGE_RING ring = container_of(work, PAGE_RING, work);
+
+    ring_fill_slots(ring, NUMA_NO_NODE, &g_device_extension.pte_data);
+}
+
+static void ring_node_work(struct work_struct *work)
+{
+    PRING_NODE_WORKER worker = container_of(work, RING_NODE_WORKER, work);
+
+    ring_fill_slots(worker->ring, worker->node, rogue_window(worker->node));
+}
+
+/* ring_create - allocate a page ring
+ * @slot_count: number of slots, must be checked by the caller
+ * @flags: LINPMEM_RING_* flags, must be checked by the caller
+ *
+ * Returns the ring, or NULL if out of memory
+ */
+PPAGE_RING ring_create(uint32_t slot_count, uint32_t flags)
+{
+    PPAGE_RING ring;
+    PLINPMEM_RING_HEADER header;
+    int node;
+
+    ring = kzalloc(sizeof(PAGE_RING), GFP_KERNEL);
+    if (!ring)
+        return NULL;
+
+    ring->slot_count = slot_count;
+    ring->flags = flags;
+    ring->slots_offset =
+        PAGE_ALIGN(sizeof(LINPMEM_RING_HEADER) +
+                   (size_t)slot_count * sizeof(LINPMEM_RING_DESC));
+    ring->size = ring->slots_offset + (size_t)slot_count * PAGE_SIZE;
+
+    if (flags & LINPMEM_RING_NUMA_LOCAL) {
+        ring->node_workers =
+            kcalloc(nr_node_ids, sizeof(RING_NODE_WORKER), GFP_KERNEL);
+        if (!ring->node_workers)
+            goto error;
+
+        for (node = 0; node < nr_node_ids; node++) {
+            INIT_WORK(&ring->node_workers[node].work, ring_node_work);
+            ring->node_workers[node].ring = ring;
+            ring->node_workers[node].node = node;
+        }
+    }
+
+    // Zeroed, so all slots start out as LINPMEM_SLOT_FREE.
+    ring->base = vmalloc_user(ring->size);
+    if (!ring->base)
+        goto error;
+
+    header = ring_header(ring);
+    header->slot_count = slot_count;
+    header->slot_size = PAGE_SIZE;
+    header->slots_offset = ring->slots_offset;
+
+    INIT_WORK(&ring->work, ring_work);
+
+    pr_debug("%s: %u slots, %zu bytes, flags %x\n", __func__, slot_count,
+             ring->size, flags);
+
+    return ring;
+
+error:
+    kfree(ring->node_workers);
+    kfree(ring);
+
+    return NULL;
+}
+
+void ring_destroy(PPAGE_RING ring)
+{
+    int node;
+
+    if (!ring)
+        return;
+
+    cancel_work_sync(&ring->work);
+
+    if (ring->node_workers) {
+        for (node = 0; node < nr_node_ids; node++)
+            cancel_work_sync(&ring->node_workers[node].work);
+        kfree(ring->node_workers);
+    }
+
+    vfree(ring->base);
+    kfree(ring);
+}
+
+int ring_mmap(PPAGE_RING ring, struct vm_area_struct *vma)
+{
+    if (vma->vm_pgoff)
+        return -EINVAL;
+
+    if (vma->vm_end - vma->vm_start > ring->size)
+        return -EINVAL;
+
+    return remap_vmalloc_range(vma, ring->base, 0);
+}
+
+void ring_submit(PPAGE_RING ring, uint32_t flags)
+{
+    int node;
+
+    if (!ring->node_workers) {
+        queue_work(g_ring_wq, &ring->work);
+
+        if (flags & LINPMEM_RING_SUBMIT_WAIT)
+            flush_work(&ring->work);
+
+        return;
+    }
+
+    // Wake all node workers, each one picks the slots of its node.
+    for_each_node_state(node, N_MEMORY)
+        queue_work_node(node, g_ring_wq, &ring->node_workers[node].work);
+
+    if (flags & LINPMEM_RING_SUBMIT_WAIT) {
+        for_each_node_state(node, N_MEMORY)
+            flush_work(&ring->node_workers[node].work);
+    }
+}
+
+void ring_query_numa_stats(PLINPMEM_NUMA_STATS numa_stats)
+{
+    PLINPMEM_NUMA_NODE_STATS node_stats;
+    int node;
+
+    numa_stats->node_count =
+        min_t(unsigned int, nr_node_ids, LINPMEM_MAX_NUMA_NODES);
+
+    for (node = 0; node < numa_stats->node_count; node++) {
+        node_stats = &numa_stats->nodes[node];
+        node_stats->node = node;
+        node_stats->online = node_state(node, N_MEMORY);
+        node_stats->pages_read = atomic64_read(&g_node_stats[node].pages_read);
+        node_stats->pages_failed =
+            atomic64_read(&g_node_stats[node].pages_failed);
+        node_stats->bytes_read = node_stats->pages_read * PAGE_SIZE;
+        node_stats->busy_ns = atomic64_read(&g_node_stats[node].busy_ns);
+    }
+}
+
+int ring_init(void)
+{
+    // Unbound, so the node workers can be queued on their own node.
+    g_ring_wq = alloc_workqueue("linpmem_ring", WQ_UNBOUND, 0);
+    if (!g_ring_wq)
+        return -ENOMEM;
+
+    return 0;
+}
+
+void ring_exit(void)
+{
+    if (g_ring_wq)
+        destroy_workqueue(g_ring_wq);
+}
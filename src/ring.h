@@ -0,0 +1,64 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <linux/mm_types.h>
+#include <linux/workqueue.h>
+
+#include "../userspace_interface/linpmem_shared.h"
+
+struct _PAGE_RING;
+
+/* One worker of a NUMA-local ring.
+ * work		Queued on (a CPU of) node.
+ * ring		The ring the worker belongs to.
+ * node		Only slots with pages of this node are filled by this worker.
+ */
+typedef struct {
+    struct work_struct work;
+    struct _PAGE_RING *ring;
+    int node;
+} RING_NODE_WORKER, *PRING_NODE_WORKER;
+
+/* The page ring of one file descriptor.
+ * base		vmalloc_user'd memory: header, descriptors, then the slots.
+ *		Shared with user space, so never trust what is in there.
+ * size		Size of base, a multiple of PAGE_SIZE.
+ * slot_count	Number of descriptors/slots. Copy of the header field that
+ *		user space can not modify.
+ * flags	LINPMEM_RING_* flags from the setup.
+ * work		The kernel worker filling the slots (not NUMA-local).
+ * node_workers	Array of nr_node_ids workers (NUMA-local), otherwise NULL.
+ * slots_done	Statistics, published to the header after each batch.
+ * slots_failed
+ */
+typedef struct _PAGE_RING {
+    void *base;
+    size_t size;
+    uint32_t slot_count;
+    uint64_t slots_offset;
+    uint32_t flags;
+    struct work_struct work;
+    PRING_NODE_WORKER node_workers;
+    atomic64_t slots_done;
+    atomic64_t slots_failed;
+} PAGE_RING, *PPAGE_RING;
+
+int ring_init(void);
+
+void ring_exit(void);
+
+PPAGE_RING ring_create(uint32_t slot_count, uint32_t flags);
+
+void ring_destroy(PPAGE_RING ring);
+
+int ring_mmap(PPAGE_RING ring, struct vm_area_struct *vma);
+
+void ring_submit(PPAGE_RING ring, uint32_t flags);
+
+void ring_query_numa_stats(PLINPMEM_NUMA_STATS numa_stats);
+
+#endif
@@ -0,0 +1,348 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/dcache.h>
+#include <linux/fs.h>
+#include <linux/kdev_t.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/rcupdate.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+
+#include "linpmem.h"
+#include "pte_mmap.h"
+#include "rmap.h"
+
+/* One page frame the sweep looks for.
+ * pfn		The page frame.
+ * index	Its entry in the caller's array.
+ */
+typedef struct {
+    uint64_t pfn;
+    uint32_t index;
+} RMAP_WANTED, *PRMAP_WANTED;
+
+/* State of the sweep over the page tables of all processes.
+ * owners	The caller's array.
+ * wanted	The mapped page frames, sorted by pfn.
+ * wanted_count	Number of entries in wanted.
+ * unresolved	Number of entries in wanted without a process yet.
+ * pid, comm	The process whose page tables are walked.
+ */
+typedef struct {
+    PLINPMEM_PAGE_OWNER owners;
+    PRMAP_WANTED wanted;
+    uint32_t wanted_count;
+    uint32_t unresolved;
+    uint32_t pid;
+    char comm[LINPMEM_COMM_SIZE];
+} RMAP_SWEEP, *PRMAP_SWEEP;
+
+static int compare_wanted(const void *a, const void *b)
+{
+    const RMAP_WANTED *left = a;
+    const RMAP_WANTED *right = b;
+
+    if (left->pfn != right->pfn)
+        return left->pfn < right->pfn ? -1 : 1;
+
+    return 0;
+}
+
+/* describe_file - name the file of a page cache page
+ * @owner: the entry to fill
+ * @folio: the folio of owner->pfn, with a reference held
+ * @mapping: its mapping
+ *
+ * The folio lock keeps the inode from being evicted. If someone else holds
+ * it, we rather leave the file unnamed than wait.
+ */
+static void describe_file(PLINPMEM_PAGE_OWNER owner, struct folio *folio,
+                          struct address_space *mapping)
+{
+    char buffer[LINPMEM_OWNER_PATH_SIZE];
+    struct dentry *dentry;
+    struct inode *inode;
+    char *path;
+
+    if (!folio_trylock(folio))
+        return;
+
+    // Truncated meanwhile?
+    if (folio->mapping != mapping || !mapping->host)
+        goto out;
+
+    inode = mapping->host;
+
+    owner->inode = inode->i_ino;
+    owner->device = new_encode_dev(inode->i_sb->s_dev);
+    owner->file_offset = folio_pos(folio) +
+                         ((owner->pfn - folio_pfn(folio)) << PAGE_SHIFT);
+
+    dentry = d_find_any_alias(inode);
+    if (!dentry)
+        goto out;
+
+    path = dentry_path_raw(dentry, buffer, sizeof(buffer));
+    if (!IS_ERR(path))
+        strscpy(owner->path, path, sizeof(owner->path));
+
+    dput(dentry);
+out:
+    folio_unlock(folio);
+}
+
+/* classify_page - tell who owns a page frame, from its struct page
+ * @owner: the entry to fill, with pfn set
+ *
+ * All of this is racy by nature: the page can be freed and reused while we
+ * look. The folio reference at least keeps it from changing its kind.
+ */
+static void classify_page(PLINPMEM_PAGE_OWNER owner)
+{
+    struct address_space *mapping;
+    struct folio *folio;
+    struct page *page;
+
+    if (!pfn_valid(owner->pfn)) {
+        owner->type = LINPMEM_OWNER_INVALID;
+        return;
+    }
+
+    page = pfn_to_page(owner->pfn);
+
+    if (PageReserved(page)) {
+        owner->type = LINPMEM_OWNER_RESERVED;
+        return;
+    }
+    if (PageBuddy(page)) {
+        owner->type = LINPMEM_OWNER_FREE;
+        return;
+    }
+    if (PageTable(page)) {
+        owner->type = LINPMEM_OWNER_PAGE_TABLE;
+        return;
+    }
+
+    folio = page_folio(page);
+    if (!folio_try_get(folio)) {
+        owner->type = LINPMEM_OWNER_FREE;
+        return;
+    }
+
+    // Split or freed and reallocated before we got the reference?
+    if (folio != page_folio(page)) {
+        owner->type = LINPMEM_OWNER_UNKNOWN;
+        goto out;
+    }
+
+    if (folio_test_large(folio))
+        owner->flags |= LINPMEM_OWNER_COMPOUND;
+    if (folio_test_dirty(folio))
+        owner->flags |= LINPMEM_OWNER_DIRTY;
+
+    if (folio_test_slab(folio)) {
+        owner->type = LINPMEM_OWNER_SLAB;
+    } else if (folio_test_anon(folio)) {
+        owner->type = LINPMEM_OWNER_ANON;
+        owner->map_count = folio_mapcount(folio);
+        if (folio_test_swapcache(folio))
+            owner->flags |= LINPMEM_OWNER_SWAPCACHE;
+    } else if ((mapping = folio_mapping(folio))) {
+        owner->type = LINPMEM_OWNER_FILE;
+        owner->map_count = folio_mapcount(folio);
+        describe_file(owner, folio, mapping);
+    } else {
+        owner->type = LINPMEM_OWNER_KERNEL;
+    }
+
+out:
+    folio_put(folio);
+}
+
+/* Called by virt_walk_range for every present page of a process. */
+static bool sweep_mapping(void *context, uint64_t virt_address,
+                          uint64_t phys_address, uint64_t size, PTE effective,
+                          volatile PPTE leaf)
+{
+    PRMAP_SWEEP sweep = context;
+    PLINPMEM_PAGE_OWNER owner;
+    uint64_t first = PHYS_PFN(phys_address);
+    uint64_t last = PHYS_PFN(phys_address + size);
+    uint32_t low = 0;
+    uint32_t high = sweep->wanted_count;
+    uint32_t middle;
+
+    // Lower bound of first.
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (sweep->wanted[middle].pfn < first)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    for (; low < sweep->wanted_count && sweep->wanted[low].pfn < last;
+         low++) {
+        owner = &sweep->owners[sweep->wanted[low].index];
+        if (owner->flags & LINPMEM_OWNER_PROCESS_FOUND)
+            continue;
+
+        owner->flags |= LINPMEM_OWNER_PROCESS_FOUND;
+        owner->pid = sweep->pid;
+        owner->virt_address =
+            virt_address + ((sweep->wanted[low].pfn - first) << PAGE_SHIFT);
+        memcpy(owner->comm, sweep->comm, sizeof(owner->comm));
+
+        sweep->unresolved--;
+    }
+
+    return sweep->unresolved != 0;
+}
+
+/* collect_processes - get a reference on every user space process
+ * @count: out, number of processes
+ *
+ * Returns a kvmalloc'ed array of tasks (put every one and kvfree it), or NULL
+ */
+static struct task_struct **collect_processes(uint32_t *count)
+{
+    struct task_struct **tasks;
+    struct task_struct *task;
+    uint32_t max_count = 0;
+
+    *count = 0;
+
+    rcu_read_lock();
+    for_each_process(task)
+        max_count++;
+    rcu_read_unlock();
+
+    tasks = kvcalloc(max_count, sizeof(*tasks), GFP_KERNEL);
+    if (!tasks)
+        return NULL;
+
+    // Processes that came meanwhile are not worth a second round.
+    rcu_read_lock();
+    for_each_process(task) {
+        if (*count == max_count)
+            break;
+        if (task->flags & PF_KTHREAD)
+            continue;
+        get_task_struct(task);
+        tasks[(*count)++] = task;
+    }
+    rcu_read_unlock();
+
+    return tasks;
+}
+
+/* sweep_processes - find a process and virtual address for mapped pages
+ * @sweep: with owners, wanted and wanted_count set
+ *
+ * There is no way for a module to walk the reverse mappings of a page
+ * (rmap_walk is not exported), so walk the page tables of all processes
+ * instead, once for the whole batch. Stops as soon as every page is found.
+ *
+ * Returns 0, or negative error
+ */
+static int sweep_processes(PRMAP_SWEEP sweep)
+{
+    struct task_struct **tasks;
+    struct mm_struct *mm;
+    uint64_t stopped_at;
+    uint32_t task_count;
+    uint32_t i;
+    int ret = 0;
+
+    tasks = collect_processes(&task_count);
+    if (!tasks)
+        return -ENOMEM;
+
+    for (i = 0; i < task_count && sweep->unresolved; i++) {
+        if (fatal_signal_pending(current)) {
+            ret = -EINTR;
+            break;
+        }
+
+        mm = get_task_mm(tasks[i]);
+        if (!mm)
+            continue;
+
+        sweep->pid = task_pid_vnr(tasks[i]);
+        task_lock(tasks[i]);
+        strscpy(sweep->comm, tasks[i]->comm, sizeof(sweep->comm));
+        task_unlock(tasks[i]);
+
+        // Keeps munmap from freeing the page tables under us. Not khugepaged,
+        // see virt_walk_range.
+        mmap_read_lock(mm);
+        virt_walk_range(mm_cr3_pa(mm).value, 0, TASK_SIZE_MAX, sweep_mapping,
+                        sweep, &stopped_at);
+        mmap_read_unlock(mm);
+
+        mmput(mm);
+    }
+
+    for (i = 0; i < task_count; i++)
+        put_task_struct(tasks[i]);
+    kvfree(tasks);
+
+    return ret;
+}
+
+/* rmap_query - tell who owns a batch of page frames
+ * @owners: kernel copy of the caller's array, pfn set and the rest zeroed
+ * @count: number of entries
+ * @flags: LINPMEM_PAGE_OWNERS_* flags
+ *
+ * Returns 0, or negative error
+ */
+int rmap_query(PLINPMEM_PAGE_OWNER owners, uint32_t count, uint32_t flags)
+{
+    RMAP_SWEEP sweep = { .owners = owners };
+    uint32_t i;
+    int ret;
+
+    for (i = 0; i < count; i++) {
+        classify_page(&owners[i]);
+
+        if (!(i % 256))
+            cond_resched();
+    }
+
+    // virt_walk_range knows only 4 levels.
+    if ((flags & LINPMEM_PAGE_OWNERS_NO_PROCESSES) || pgtable_l5_enabled())
+        return 0;
+
+    sweep.wanted = kvcalloc(count, sizeof(RMAP_WANTED), GFP_KERNEL);
+    if (!sweep.wanted)
+        return -ENOMEM;
+
+    for (i = 0; i < count; i++) {
+        if (!owners[i].map_count)
+            continue;
+        sweep.wanted[sweep.wanted_count].pfn = owners[i].pfn;
+        sweep.wanted[sweep.wanted_count].index = i;
+        sweep.wanted_count++;
+    }
+
+    sort(sweep.wanted, sweep.wanted_count, sizeof(RMAP_WANTED),
+         compare_wanted, NULL);
+
+    sweep.unresolved = sweep.wanted_count;
+    ret = sweep.unresolved ? sweep_processes(&sweep) : 0;
+
+    kvfree(sweep.wanted);
+
+    return ret;
+}
@@ -0,0 +1,12 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _RMAP_H_
+#define _RMAP_H_
+
+#include "../userspace_interface/linpmem_shared.h"
+
+int rmap_query(PLINPMEM_PAGE_OWNER owners, uint32_t count, uint32_t flags);
+
+#endif
@@ -0,0 +1,403 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/build_bug.h>
+#include <linux/err.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "linpmem.h"
+#include "pte_mmap.h"
+#include "scan.h"
+
+// Marks missing transitions while the trie is built.
+#define SCAN_NO_STATE ((uint16_t)~0)
+
+/* State of one scan.
+ * automaton	The compiled patterns.
+ * pte_data	The rogue page we read through.
+ * result	Where matches and statistics go.
+ * range	The range being scanned, and its end (exclusive).
+ * range_end
+ * page		Copy of the page being scanned.
+ * state	Automaton state after the last byte scanned.
+ */
+typedef struct {
+    PSCAN_AUTOMATON automaton;
+    PPTE_METHOD_DATA pte_data;
+    PSCAN_RESULT result;
+    PLINPMEM_SCAN_RANGE range;
+    uint64_t range_end;
+    uint8_t *page;
+    uint16_t state;
+} SCAN_CONTEXT, *PSCAN_CONTEXT;
+
+void scan_free(PSCAN_AUTOMATON automaton)
+{
+    if (IS_ERR_OR_NULL(automaton))
+        return;
+
+    kvfree(automaton->delta);
+    kvfree(automaton->accepting);
+    kvfree(automaton->state_pattern);
+    kvfree(automaton->dict_link);
+    kvfree(automaton->pattern_next);
+    kvfree(automaton->pattern_sizes);
+    kfree(automaton);
+}
+
+/* scan_build_links - turn the trie into the Aho-Corasick DFA
+ * @automaton: automaton that contains the trie
+ * @fail: scratch, one entry per state
+ * @queue: scratch, one entry per state
+ *
+ * Breadth first, every state gets its failure link, dictionary suffix link,
+ * and the missing transitions are taken over from its failure state (which
+ * is closer to the root, and thus already complete).
+ */
+static void scan_build_links(PSCAN_AUTOMATON automaton, uint16_t *fail,
+                             uint16_t *queue)
+{
+    uint32_t classes = automaton->class_count;
+    uint16_t *delta = automaton->delta;
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    uint16_t state;
+    uint16_t next;
+    uint32_t c;
+
+    for (c = 0; c < classes; c++) {
+        next = delta[c];
+        if (next == SCAN_NO_STATE) {
+            delta[c] = 0;
+        } else {
+            fail[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+
+    while (head < tail) {
+        state = queue[head++];
+
+        automaton->dict_link[state] =
+            automaton->state_pattern[fail[state]] >= 0 ?
+                fail[state] :
+                automaton->dict_link[fail[state]];
+        automaton->accepting[state] = automaton->state_pattern[state] >= 0 ||
+                                      automaton->dict_link[state];
+
+        for (c = 0; c < classes; c++) {
+            next = delta[state * classes + c];
+            if (next == SCAN_NO_STATE) {
+                delta[state * classes + c] = delta[fail[state] * classes + c];
+            } else {
+                fail[next] = delta[fail[state] * classes + c];
+                queue[tail++] = next;
+            }
+        }
+    }
+}
+
+/* scan_compile - build the automaton for a set of patterns
+ * @patterns: all patterns, back to back (kernel memory)
+ * @pattern_sizes: size of each pattern, none of them zero
+ * @pattern_count: number of patterns
+ *
+ * The caller checks the limits of LINPMEM_SCAN.
+ *
+ * Returns the automaton or an ERR_PTR
+ */
+PSCAN_AUTOMATON scan_compile(const uint8_t *patterns,
+                             const uint32_t *pattern_sizes,
+                             uint32_t pattern_count)
+{
+    PSCAN_AUTOMATON automaton;
+    uint64_t total_size = 0;
+    uint32_t max_states;
+    uint16_t *fail = NULL;
+    uint16_t *queue = NULL;
+    uint16_t *next;
+    uint16_t state;
+    uint32_t other;
+    uint32_t i, j;
+
+    // State numbers, including SCAN_NO_STATE, have to fit into 16 bit.
+    BUILD_BUG_ON(LINPMEM_SCAN_MAX_PATTERN_BYTES + 1 >= SCAN_NO_STATE);
+
+    for (i = 0; i < pattern_count; i++) {
+        if (!pattern_sizes[i])
+            return ERR_PTR(-EINVAL);
+        total_size += pattern_sizes[i];
+    }
+    if (!pattern_count || total_size > LINPMEM_SCAN_MAX_PATTERN_BYTES)
+        return ERR_PTR(-EINVAL);
+    max_states = total_size + 1;
+
+    automaton = kzalloc(sizeof(SCAN_AUTOMATON), GFP_KERNEL);
+    if (!automaton)
+        return ERR_PTR(-ENOMEM);
+
+    memset(automaton->byte_class, 0xff, sizeof(automaton->byte_class));
+    for (i = 0; i < total_size; i++) {
+        if (automaton->byte_class[patterns[i]] == SCAN_NO_STATE)
+            automaton->byte_class[patterns[i]] = automaton->class_count++;
+    }
+    other = automaton->class_count;
+    for (i = 0; i < ARRAY_SIZE(automaton->byte_class); i++) {
+        if (automaton->byte_class[i] == SCAN_NO_STATE) {
+            automaton->byte_class[i] = other;
+            automaton->class_count = other + 1;
+        }
+    }
+
+    automaton->delta = kvmalloc_array(max_states * automaton->class_count,
+                                      sizeof(uint16_t), GFP_KERNEL);
+    automaton->accepting = kvzalloc(max_states, GFP_KERNEL);
+    automaton->state_pattern =
+        kvmalloc_array(max_states, sizeof(int32_t), GFP_KERNEL);
+    automaton->dict_link = kvcalloc(max_states, sizeof(uint16_t), GFP_KERNEL);
+    automaton->pattern_next =
+        kvmalloc_array(pattern_count, sizeof(int32_t), GFP_KERNEL);
+    automaton->pattern_sizes =
+        kvmemdup(pattern_sizes, pattern_count * sizeof(uint32_t), GFP_KERNEL);
+    fail = kvcalloc(max_states, sizeof(uint16_t), GFP_KERNEL);
+    queue = kvmalloc_array(max_states, sizeof(uint16_t), GFP_KERNEL);
+    if (!automaton->delta || !automaton->accepting ||
+        !automaton->state_pattern || !automaton->dict_link ||
+        !automaton->pattern_next || !automaton->pattern_sizes || !fail ||
+        !queue) {
+        scan_free(automaton);
+        automaton = ERR_PTR(-ENOMEM);
+        goto out;
+    }
+
+    // All bits set: SCAN_NO_STATE, and -1.
+    memset(automaton->delta, 0xff,
+           max_states * automaton->class_count * sizeof(uint16_t));
+    memset(automaton->state_pattern, 0xff, max_states * sizeof(int32_t));
+
+    // The trie.
+    automaton->state_count = 1;
+    for (i = 0; i < pattern_count; i++) {
+        state = 0;
+        for (j = 0; j < pattern_sizes[i]; j++) {
+            next = &automaton->delta[state * automaton->class_count +
+                                     automaton->byte_class[patterns[j]]];
+            if (*next == SCAN_NO_STATE)
+                *next = automaton->state_count++;
+            state = *next;
+        }
+        automaton->pattern_next[i] = automaton->state_pattern[state];
+        automaton->state_pattern[state] = i;
+        patterns += pattern_sizes[i];
+    }
+
+    scan_build_links(automaton, fail, queue);
+
+out:
+    kvfree(queue);
+    kvfree(fail);
+
+    return automaton;
+}
+
+/* scan_read_context - fill in the context of a match
+ * @ctx: the scan
+ * @match: match with phys_address set
+ *
+ * Context is read again through the rogue page. It is clipped to the range,
+ * and to the readable pages around the match.
+ */
+static void scan_read_context(PSCAN_CONTEXT ctx, PLINPMEM_SCAN_MATCH match)
+{
+    uint64_t start = match->phys_address -
+                     min_t(uint64_t, match->phys_address - ctx->range->start,
+                           LINPMEM_SCAN_CONTEXT_BEFORE);
+    uint64_t end =
+        start + min_t(uint64_t, ctx->range_end - start,
+                      LINPMEM_SCAN_CONTEXT_SIZE);
+    uint64_t address = start;
+    uint64_t filled = 0;
+    uint64_t count;
+
+    while (address < end) {
+        count = pte_mmap_read_kernel(ctx->pte_data, address,
+                                     match->context + filled, end - address);
+        if (!count) {
+            if (address >= match->phys_address)
+                break;
+            // Skip an unreadable page in front of the match.
+            address = (address & PAGE_MASK) + PAGE_SIZE;
+            start = address;
+            filled = 0;
+            continue;
+        }
+        address += count;
+        filled += count;
+    }
+
+    match->context_address = start;
+    match->context_size = filled;
+}
+
+/* scan_report - store all matches that end at a byte
+ * @ctx: the scan
+ * @state: the (accepting) state after the byte
+ * @phys_address: the byte
+ *
+ * Longer patterns come first, so a match that does not fit any more starts
+ * no later than all other unreported matches ending here.
+ *
+ * Returns false if the match buffer is full (resume_address is set then)
+ */
+static bool scan_report(PSCAN_CONTEXT ctx, uint16_t state,
+                        uint64_t phys_address)
+{
+    PSCAN_AUTOMATON automaton = ctx->automaton;
+    PSCAN_RESULT result = ctx->result;
+    PLINPMEM_SCAN_MATCH match;
+    uint64_t start;
+    int32_t pattern;
+
+    if (automaton->state_pattern[state] < 0)
+        state = automaton->dict_link[state];
+
+    for (; state; state = automaton->dict_link[state]) {
+        for (pattern = automaton->state_pattern[state]; pattern >= 0;
+             pattern = automaton->pattern_next[pattern]) {
+            start = phys_address + 1 - automaton->pattern_sizes[pattern];
+
+            if (result->match_count == result->max_matches) {
+                result->resume_address = start;
+                return false;
+            }
+
+            match = &result->matches[result->match_count++];
+            match->phys_address = start;
+            match->pattern_index = pattern;
+            scan_read_context(ctx, match);
+        }
+    }
+
+    return true;
+}
+
+/* scan_buffer - run the automaton over the bytes of one page
+ * @ctx: the scan
+ * @phys_address: physical address of the first byte in ctx->page
+ * @count: number of bytes
+ *
+ * Returns false if the scan has to stop
+ */
+static bool scan_buffer(PSCAN_CONTEXT ctx, uint64_t phys_address,
+                        uint64_t count)
+{
+    const uint16_t *delta = ctx->automaton->delta;
+    const uint16_t *byte_class = ctx->automaton->byte_class;
+    const uint8_t *accepting = ctx->automaton->accepting;
+    uint32_t classes = ctx->automaton->class_count;
+    uint16_t state = ctx->state;
+    uint64_t i;
+
+    for (i = 0; i < count; i++) {
+        state = delta[state * classes + byte_class[ctx->page[i]]];
+
+        if (unlikely(accepting[state]) &&
+            !scan_report(ctx, state, phys_address + i))
+            return false;
+    }
+
+    ctx->state = state;
+
+    return true;
+}
+
+/* scan_range - scan one range
+ * @ctx: the scan, with range set
+ *
+ * Returns false if the scan stopped early (resume_address is set then)
+ */
+static bool scan_range(PSCAN_CONTEXT ctx)
+{
+    PSCAN_RESULT result = ctx->result;
+    uint64_t address = ctx->range->start;
+    uint64_t count;
+
+    ctx->range_end = ctx->range->start + ctx->range->size;
+    ctx->state = 0;
+
+    while (address < ctx->range_end) {
+        if (signal_pending(current)) {
+            result->resume_address = address;
+            return false;
+        }
+
+        count = pte_mmap_read_kernel(ctx->pte_data, address, ctx->page,
+                                     ctx->range_end - address);
+        if (!count) {
+            result->pages_skipped++;
+            ctx->state = 0;
+            address = min(ctx->range_end, (address & PAGE_MASK) + PAGE_SIZE);
+            continue;
+        }
+
+        if (!scan_buffer(ctx, address, count))
+            return false;
+
+        result->bytes_scanned += count;
+        address += count;
+
+        cond_resched();
+    }
+
+    return true;
+}
+
+/* scan_ranges - search physical memory for the patterns of an automaton
+ * @automaton: the compiled patterns
+ * @ranges: ranges to scan, checked by the caller not to wrap around
+ * @range_count: number of ranges
+ * @result: matches and max_matches set, the rest zeroed
+ *
+ * Every page is copied out of the rogue page before it is scanned, so the
+ * window is only held for the copy.
+ *
+ * Returns 0 or -ENOMEM
+ */
+int scan_ranges(PSCAN_AUTOMATON automaton, PLINPMEM_SCAN_RANGE ranges,
+                uint32_t range_count, PSCAN_RESULT result)
+{
+    SCAN_CONTEXT ctx = {
+        .automaton = automaton,
+        .result = result,
+        // Spread concurrent scans over the windows.
+        .pte_data = rogue_window(task_pid_nr(current)),
+    };
+    uint32_t i;
+
+    ctx.page = (uint8_t *)__get_free_page(GFP_KERNEL);
+    if (!ctx.page)
+        return -ENOMEM;
+
+    for (i = 0; i < range_count; i++) {
+        ctx.range = &ranges[i];
+        if (!scan_range(&ctx))
+            break;
+    }
+
+    result->resume_range = i;
+    if (i == range_count)
+        result->resume_address = 0;
+
+    free_page((unsigned long)ctx.page);
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <linux/types.h>
+
+#include "../userspace_interface/linpmem_shared.h"
+
+/* The Aho-Corasick automaton of a pattern set, as a complete DFA.
+ * state_count	Number of states, state 0 is the root.
+ * class_count	Number of byte classes. Bytes that appear in no pattern
+ *		share one class, which keeps the transition table small.
+ * byte_class	Byte class of every byte value.
+ * delta	Transition table, state_count * class_count entries.
+ * accepting	Per state: nonzero if some pattern ends in this state.
+ * state_pattern	Per state: the last pattern that is equal to the path to
+ *		the state, or -1.
+ * dict_link	Per state: the longest proper suffix state with a
+ *		state_pattern, or 0.
+ * pattern_next	Per pattern: the previous pattern with the same bytes, or -1.
+ * pattern_sizes	Per pattern: its size.
+ */
+typedef struct {
+    uint32_t state_count;
+    uint32_t class_count;
+    uint16_t byte_class[256];
+    uint16_t *delta;
+    uint8_t *accepting;
+    int32_t *state_pattern;
+    uint16_t *dict_link;
+    int32_t *pattern_next;
+    uint32_t *pattern_sizes;
+} SCAN_AUTOMATON, *PSCAN_AUTOMATON;
+
+/* Outcome of scan_ranges.
+ * matches	Kernel buffer for max_matches matches.
+ * The rest has the meaning of the fields in LINPMEM_SCAN.
+ */
+typedef struct {
+    PLINPMEM_SCAN_MATCH matches;
+    uint32_t max_matches;
+    uint32_t match_count;
+    uint64_t bytes_scanned;
+    uint64_t pages_skipped;
+    uint64_t resume_address;
+    uint32_t resume_range;
+} SCAN_RESULT, *PSCAN_RESULT;
+
+PSCAN_AUTOMATON scan_compile(const uint8_t *patterns,
+                             const uint32_t *pattern_sizes,
+                             uint32_t pattern_count);
+
+void scan_free(PSCAN_AUTOMATON automaton);
+
+int scan_ranges(PSCAN_AUTOMATON automaton, PLINPMEM_SCAN_RANGE ranges,
+                uint32_t range_count, PSCAN_RESULT result);
+
+#endif
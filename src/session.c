@@ -0,0 +1,261 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/err.h>
+#include <linux/kref.h>
+#include <linux/mm.h>
+#include <linux/mmap_lock.h>
+#include <linux/mmu_notifier.h>
+#include <linux/pfn.h>
+#include <linux/sched/mm.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+#include "linpmem.h"
+#include "pte_mmap.h"
+#include "session.h"
+
+static inline PSESSION_TLB_ENTRY session_tlb_entry(PSESSION_BINDING binding,
+                                                   uint64_t virt_page)
+{
+    return &binding->tlb[virt_page % SESSION_TLB_SIZE];
+}
+
+/* Called before translations in [start, end) of the bound mm change: unmap,
+ * reclaim, migration, mprotect, ... Might not be allowed to sleep.
+ */
+static int
+session_invalidate_range_start(struct mmu_notifier *notifier,
+                               const struct mmu_notifier_range *range)
+{
+    PSESSION_BINDING binding =
+        container_of(notifier, SESSION_BINDING, notifier);
+    uint64_t virt_page;
+    int i;
+
+    spin_lock(&binding->tlb_lock);
+
+    binding->tlb_sequence++;
+    binding->tlb_invalidating++;
+
+    for (i = 0; i < SESSION_TLB_SIZE; i++) {
+        virt_page = binding->tlb[i].virt_page;
+        if (!virt_page)
+            continue;
+        virt_page--;
+        if (PFN_PHYS(virt_page) >= range->start &&
+            PFN_PHYS(virt_page) < range->end) {
+            binding->tlb[i].virt_page = 0;
+            binding->tlb_invalidations++;
+        }
+    }
+
+    spin_unlock(&binding->tlb_lock);
+
+    return 0;
+}
+
+/* Called after translations in [start, end) of the bound mm changed. Entries
+ * were already dropped by session_invalidate_range_start, translations may be
+ * cached again once no invalidation is in progress.
+ */
+static void
+session_invalidate_range_end(struct mmu_notifier *notifier,
+                             const struct mmu_notifier_range *range)
+{
+    PSESSION_BINDING binding =
+        container_of(notifier, SESSION_BINDING, notifier);
+
+    spin_lock(&binding->tlb_lock);
+
+    binding->tlb_sequence++;
+    binding->tlb_invalidating--;
+
+    spin_unlock(&binding->tlb_lock);
+}
+
+static const struct mmu_notifier_ops g_session_notifier_ops = {
+    .invalidate_range_start = session_invalidate_range_start,
+    .invalidate_range_end = session_invalidate_range_end,
+};
+
+/* session_bind_process - bind to the address space of a process
+ * @upid: user space pid, or zero for the current task
+ *
+ * Resolved once: the mm reference keeps the page tables alive even if the
+ * process exits meanwhile (then, they are just not used any more).
+ *
+ * Returns the binding, or ERR_PTR
+ */
+PSESSION_BINDING session_bind_process(pid_t upid)
+{
+    PSESSION_BINDING binding;
+    int ret;
+
+    binding = kzalloc(sizeof(SESSION_BINDING), GFP_KERNEL);
+    if (!binding)
+        return ERR_PTR(-ENOMEM);
+
+    kref_init(&binding->refcount);
+    spin_lock_init(&binding->tlb_lock);
+
+    binding->mm = get_pid_mm(upid);
+    if (!binding->mm) {
+        ret = -ESRCH;
+        goto error;
+    }
+
+    binding->pid = upid ? upid : task_tgid_vnr(current);
+    binding->cr3 = mm_cr3_pa(binding->mm).value;
+
+    binding->notifier.ops = &g_session_notifier_ops;
+    ret = mmu_notifier_register(&binding->notifier, binding->mm);
+    if (ret)
+        goto error_mm;
+
+    return binding;
+
+error_mm:
+    mmput(binding->mm);
+error:
+    kfree(binding);
+
+    return ERR_PTR(ret);
+}
+
+/* session_bind_cr3 - bind to a raw CR3
+ * @cr3: physical address of the top-level page table
+ *
+ * The caller has to make sure that it stays valid, as with
+ * LINPMEM_VTOP_INFO.associated_cr3.
+ *
+ * Returns the binding, or ERR_PTR
+ */
+PSESSION_BINDING session_bind_cr3(uint64_t cr3)
+{
+    PSESSION_BINDING binding;
+
+    if (!pfn_valid(__phys_to_pfn(cr3)))
+        return ERR_PTR(-EINVAL);
+
+    binding = kzalloc(sizeof(SESSION_BINDING), GFP_KERNEL);
+    if (!binding)
+        return ERR_PTR(-ENOMEM);
+
+    kref_init(&binding->refcount);
+    spin_lock_init(&binding->tlb_lock);
+    binding->cr3 = cr3;
+
+    return binding;
+}
+
+static void session_release(struct kref *refcount)
+{
+    PSESSION_BINDING binding =
+        container_of(refcount, SESSION_BINDING, refcount);
+
+    if (binding->mm) {
+        mmu_notifier_unregister(&binding->notifier, binding->mm);
+        mmput(binding->mm);
+    }
+
+    kfree(binding);
+}
+
+void session_get(PSESSION_BINDING binding)
+{
+    kref_get(&binding->refcount);
+}
+
+/* session_put - drop a reference, the last one unbinds
+ *
+ * Might sleep.
+ */
+void session_put(PSESSION_BINDING binding)
+{
+    if (binding)
+        kref_put(&binding->refcount, session_release);
+}
+
+/* session_translate - virtual to physical, in the bound address space
+ * @binding: the binding
+ * @virt_address: the virtual address
+ * @phys_address: out, the physical address
+ * @ppte: out, the PTE (or PDE, for 2 MiB pages)
+ *
+ * Like IOCTL_LINPMEM_VTOP_TRANSLATION_SERVICE, but with the bound CR3 and the
+ * session's translation cache.
+ *
+ * Returns 0, -EIO if there is no translation, or -ENOENT if not present
+ */
+int session_translate(PSESSION_BINDING binding, uint64_t virt_address,
+                      uint64_t *phys_address, void **ppte)
+{
+    PSESSION_TLB_ENTRY entry;
+    VIRT_ADDR in_va = { .value = virt_address & PAGE_MASK };
+    uint64_t virt_page = virt_address >> PAGE_SHIFT;
+    uint64_t sequence;
+    uint64_t phys_page = 0;
+    PTE_STATUS pte_status;
+    volatile PPTE pte;
+    bool present = false;
+
+    spin_lock(&binding->tlb_lock);
+
+    entry = session_tlb_entry(binding, virt_page);
+    if (binding->mm && entry->virt_page == virt_page + 1) {
+        *phys_address = PFN_PHYS(entry->phys_page) +
+                        offset_in_page(virt_address);
+        *ppte = entry->ppte;
+        binding->tlb_hits++;
+        spin_unlock(&binding->tlb_lock);
+        return 0;
+    }
+
+    binding->tlb_misses++;
+    sequence = binding->tlb_sequence;
+
+    spin_unlock(&binding->tlb_lock);
+
+    // Keeps munmap from freeing the page tables under us. Not khugepaged,
+    // see virt_walk_range.
+    if (binding->mm)
+        mmap_read_lock(binding->mm);
+
+    pte_status = virt_find_pte(in_va, &pte, binding->cr3);
+    if (pte_status == PTE_SUCCESS && pte->present) {
+        present = true;
+        phys_page = pte->page_frame;
+        // 2 MiB page: the PDE maps 512 of them.
+        if (pte->large_page)
+            phys_page += in_va.pt_index;
+    }
+
+    if (binding->mm)
+        mmap_read_unlock(binding->mm);
+
+    if (pte_status != PTE_SUCCESS)
+        return -EIO;
+    if (!present)
+        return -ENOENT;
+
+    *phys_address = PFN_PHYS(phys_page) + offset_in_page(virt_address);
+    *ppte = (void *)pte;
+
+    if (!binding->mm)
+        return 0;
+
+    spin_lock(&binding->tlb_lock);
+    if (binding->tlb_sequence == sequence && !binding->tlb_invalidating) {
+        entry->virt_page = virt_page + 1;
+        entry->phys_page = phys_page;
+        entry->ppte = (void *)pte;
+    }
+    spin_unlock(&binding->tlb_lock);
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include <linux/kref.h>
+#include <linux/mmu_notifier.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "../userspace_interface/linpmem_shared.h"
+
+/* Number of translations a session keeps, direct mapped by virtual page. */
+#define SESSION_TLB_SIZE (64)
+
+/* One cached translation.
+ * virt_page	Virtual page number + 1, zero if the entry is empty.
+ * phys_page	Physical page number.
+ * ppte		The PTE (or PDE, for 2 MiB pages) that maps it.
+ */
+typedef struct {
+    uint64_t virt_page;
+    uint64_t phys_page;
+    void *ppte;
+} SESSION_TLB_ENTRY, *PSESSION_TLB_ENTRY;
+
+/* What a file descriptor is bound to, see IOCTL_LINPMEM_SESSION_BIND.
+ * refcount	One reference for the file context, one for each translation
+ *		in flight, so rebinding does not pull the binding from under
+ *		a translation.
+ * notifier	Tells us when translations of mm change. Registered only if
+ *		mm is set.
+ * mm		The address space of the bound process, with mm_users held
+ *		so the page tables stay around. NULL if bound to a raw CR3.
+ * pid		The bound process, as seen by the binder.
+ * cr3		The physical address of the top-level page table.
+ * tlb_lock	Protects tlb, tlb_sequence, tlb_invalidating and the
+ *		statistics.
+ * tlb		The translation cache. Only used if mm is set, as nobody
+ *		tells us when a raw CR3 changes.
+ * tlb_sequence	Incremented at the start and at the end of every
+ *		invalidation, so a translation that raced with one is not
+ *		cached.
+ * tlb_invalidating	The number of invalidations in progress. The page
+ *		tables may still change until it drops to zero, so nothing
+ *		is cached meanwhile.
+ */
+typedef struct {
+    struct kref refcount;
+    struct mmu_notifier notifier;
+    struct mm_struct *mm;
+    pid_t pid;
+    uint64_t cr3;
+    spinlock_t tlb_lock;
+    SESSION_TLB_ENTRY tlb[SESSION_TLB_SIZE];
+    uint64_t tlb_sequence;
+    unsigned int tlb_invalidating;
+    uint64_t tlb_hits;
+    uint64_t tlb_misses;
+    uint64_t tlb_invalidations;
+} SESSION_BINDING, *PSESSION_BINDING;
+
+PSESSION_BINDING session_bind_process(pid_t upid);
+
+PSESSION_BINDING session_bind_cr3(uint64_t cr3);
+
+void session_get(PSESSION_BINDING binding);
+
+void session_put(PSESSION_BINDING binding);
+
+int session_translate(PSESSION_BINDING binding, uint64_t virt_address,
+                      uint64_t *phys_address, void **ppte);
+
+#endif
@@ -0,0 +1,377 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/atomic.h>
+#include <linux/huge_mm.h>
+#include <linux/mm.h>
+#include <linux/mmap_lock.h>
+#include <linux/mmu_notifier.h>
+#include <linux/pagewalk.h>
+#include <linux/pgtable.h>
+#include <linux/sizes.h>
+#include <linux/version.h>
+#include <asm/tlbflush.h>
+
+#include "layout.h"
+#include "linpmem.h"
+#include "softdirty.h"
+
+/* Not exported, see softdirty_walk. */
+typedef void (*FLUSH_TLB_MM_RANGE)(struct mm_struct *mm, unsigned long start,
+                                   unsigned long end,
+                                   unsigned int stride_shift,
+                                   bool freed_tables);
+typedef int (*WALK_PAGE_RANGE)(struct mm_struct *mm, unsigned long start,
+                               unsigned long end,
+                               const struct mm_walk_ops *ops, void *private);
+typedef void (*VMA_SET_PAGE_PROT)(struct vm_area_struct *vma);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+typedef pte_t *(*PTE_OFFSET_MAP_LOCK)(struct mm_struct *mm, pmd_t *pmd,
+                                      unsigned long addr, spinlock_t **ptlp);
+#endif
+
+/* The walk in progress.
+ * callback, context	Who gets the soft-dirty pages.
+ * clear	Clear the soft-dirty bits of the pages the callback took.
+ * cleared	Number of entries cleared, to skip the TLB flush if zero.
+ * stopped_at	The virtual address the callback refused, or zero.
+ * start, end	The range of the walk.
+ * vma_dirty	VM_SOFTDIRTY is set on the VMA being walked: all its pages
+ *		count as soft-dirty, as in /proc/pid/pagemap.
+ * vma_kept	A page of the VMA being walked was reported, but not cleared.
+ * vma_set_page_prot_fn	To clear VM_SOFTDIRTY, see softdirty_post_vma.
+ * pte_offset_map_lock_fn	__pte_offset_map_lock, 6.5 and later.
+ */
+typedef struct {
+    PTE_WALK_CALLBACK callback;
+    void *context;
+    bool clear;
+    uint64_t cleared;
+    uint64_t *stopped_at;
+    uint64_t start;
+    uint64_t end;
+    bool vma_dirty;
+    bool vma_kept;
+    VMA_SET_PAGE_PROT vma_set_page_prot_fn;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    PTE_OFFSET_MAP_LOCK pte_offset_map_lock_fn;
+#endif
+} SOFTDIRTY_WALK, *PSOFTDIRTY_WALK;
+
+/* softdirty_clear_leaf - clear the soft-dirty bit of a present entry
+ * @leaf: the entry, a PTE or a 2 MiB PMD
+ * @size: the size it maps
+ *
+ * Like the kernel does for clear_refs: the entry is also write protected,
+ * so the next write faults and sets the bit again. This is done even if the
+ * bit is not set, for pages that are soft-dirty by their VMA only (see
+ * softdirty_post_vma). The caller holds the page
+ * table lock of the entry, so only the CPU might set accessed or dirty
+ * meanwhile: the update is a cmpxchg.
+ *
+ * Pages that might be pinned for DMA and hugetlb pages stay as they are:
+ * they are just reported again next time.
+ *
+ * Returns true if the entry was cleared
+ */
+static bool softdirty_clear_leaf(volatile PPTE leaf, uint64_t size)
+{
+    uint64_t *entry = (uint64_t *)&leaf->value;
+    uint64_t old = READ_ONCE(*entry);
+    struct folio *folio;
+    uint64_t new;
+
+    if (!pfn_valid(PHYS_PFN(old & PTE_PFN_MASK)))
+        return false;
+
+    folio = page_folio(pfn_to_page(PHYS_PFN(old & PTE_PFN_MASK)));
+    if (folio_test_hugetlb(folio) || folio_maybe_dma_pinned(folio))
+        return false;
+
+    do {
+        if (!(old & _PAGE_PRESENT))
+            return false;
+
+        if (size == PAGE_SIZE)
+            new = pte_val(pte_clear_soft_dirty(pte_wrprotect(__pte(old))));
+        else
+            new = pmd_val(pmd_clear_soft_dirty(pmd_wrprotect(__pmd(old))));
+    } while (!try_cmpxchg64(entry, &old, new));
+
+    return true;
+}
+
+/* softdirty_page - pass on a page if it is soft-dirty
+ * @walk: the walk
+ * @virt_address, @end: the part of the page in the range, [virt_address, end)
+ * @size: the size of the page
+ * @entry: the entry that maps it, read under its page table lock
+ * @leaf: the entry itself, to clear it. NULL if it must not be cleared.
+ *
+ * Returns 0, or 1 if the callback refused the page (stops the walk)
+ */
+static int softdirty_page(PSOFTDIRTY_WALK walk, uint64_t virt_address,
+                          uint64_t end, uint64_t size, PTE entry,
+                          volatile PPTE leaf)
+{
+    uint64_t base = virt_address & ~(size - 1);
+    uint64_t phys_address;
+
+    if (!entry.present ||
+        (!walk->vma_dirty && !(entry.value & _PAGE_SOFT_DIRTY)))
+        return 0;
+
+    // Large pages: the lowest frame bit is the PAT bit.
+    phys_address = (entry.value & PTE_PFN_MASK & ~(size - 1)) +
+                   (virt_address - base);
+
+    // A clipped large page is only partly reported: keep it.
+    if (virt_address != base || end != base + size)
+        leaf = NULL;
+
+    // User mappings: the upper levels grant everything, the leaf decides.
+    if (!walk->callback(walk->context, virt_address, phys_address,
+                        end - virt_address, entry, leaf)) {
+        *walk->stopped_at = virt_address;
+        return 1;
+    }
+
+    if (!walk->clear)
+        return 0;
+
+    if (leaf && softdirty_clear_leaf(leaf, size))
+        walk->cleared++;
+    else
+        walk->vma_kept = true;
+
+    return 0;
+}
+
+/* A huge page, or the migration or swap entry of one: no page table. */
+static bool softdirty_pmd_is_leaf(pmd_t pmd)
+{
+    return pmd_leaf(pmd) || (!pmd_none(pmd) && !pmd_present(pmd));
+}
+
+/* Called by walk_page_range for every PMD, like clear_refs_pte_range: huge
+ * pages under the PMD lock, page tables under the PTE lock.
+ */
+static int softdirty_pmd_entry(pmd_t *pmd, unsigned long addr,
+                               unsigned long end, struct mm_walk *mm_walk)
+{
+    PSOFTDIRTY_WALK walk = mm_walk->private;
+    struct mm_struct *mm = mm_walk->vma->vm_mm;
+    spinlock_t *ptl;
+    pte_t *start_pte;
+    pte_t *pte;
+    pmd_t pmdval;
+    PTE entry;
+    int ret = 0;
+
+    if (softdirty_pmd_is_leaf(READ_ONCE(*pmd))) {
+        ptl = pmd_lock(mm, pmd);
+        pmdval = *pmd;
+        if (softdirty_pmd_is_leaf(pmdval)) {
+            entry.value = pmd_val(pmdval);
+            ret = softdirty_page(walk, addr, end, SZ_2M, entry,
+                                 (volatile PPTE)pmd);
+            spin_unlock(ptl);
+            return ret;
+        }
+        // Split meanwhile.
+        spin_unlock(ptl);
+    }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    // Checks the PMD again, under RCU: page tables can be freed without the
+    // mmap lock (khugepaged).
+    start_pte = walk->pte_offset_map_lock_fn(mm, pmd, addr, &ptl);
+    if (!start_pte) {
+        mm_walk->action = ACTION_AGAIN;
+        return 0;
+    }
+#else
+    pmdval = READ_ONCE(*pmd);
+    if (pmd_none(pmdval) || softdirty_pmd_is_leaf(pmdval) || pmd_bad(pmdval))
+        return 0;
+    start_pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+#endif
+
+    for (pte = start_pte; addr != end; pte++, addr += PAGE_SIZE) {
+        entry.value = pte_val(READ_ONCE(*pte));
+        ret = softdirty_page(walk, addr, addr + PAGE_SIZE, PAGE_SIZE, entry,
+                             (volatile PPTE)pte);
+        if (ret)
+            break;
+    }
+
+    pte_unmap_unlock(start_pte, ptl);
+    cond_resched();
+
+    return ret;
+}
+
+/* Called by walk_page_range for hugetlb pages. Reports them only, clear_refs
+ * does not clear them either.
+ */
+static int softdirty_hugetlb_entry(pte_t *pte, unsigned long hmask,
+                                   unsigned long addr, unsigned long end,
+                                   struct mm_walk *mm_walk)
+{
+    PTE entry = { .value = pte_val(READ_ONCE(*pte)) };
+
+    return softdirty_page(mm_walk->private, addr, end, ~hmask + 1, entry,
+                          NULL);
+}
+
+/* Called by walk_page_range before walking a VMA. */
+static int softdirty_pre_vma(unsigned long start, unsigned long end,
+                             struct mm_walk *mm_walk)
+{
+    PSOFTDIRTY_WALK walk = mm_walk->private;
+
+    walk->vma_dirty = mm_walk->vma->vm_flags & VM_SOFTDIRTY;
+    walk->vma_kept = false;
+
+    return 0;
+}
+
+/* Called by walk_page_range after walking a VMA. When clearing, this clears
+ * VM_SOFTDIRTY, as clear_refs does: as long as it is set, the kernel does not
+ * track writes through the soft-dirty bits (mprotect, for one, may make a
+ * clean PTE writable again). It stays set if the VMA was not walked as a
+ * whole, or if some of its pages could not be cleared: then, all its pages
+ * are reported again next time, which is safe.
+ */
+static void softdirty_post_vma(struct mm_walk *mm_walk)
+{
+    PSOFTDIRTY_WALK walk = mm_walk->private;
+    struct vm_area_struct *vma = mm_walk->vma;
+
+    if (!walk->clear || !walk->vma_dirty || walk->vma_kept ||
+        *walk->stopped_at || vma->vm_start < walk->start ||
+        vma->vm_end > walk->end)
+        return;
+
+    // We hold the mmap lock for writing.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_SOFTDIRTY);
+#else
+    vma->vm_flags &= ~VM_SOFTDIRTY;
+#endif
+    walk->vma_set_page_prot_fn(vma);
+}
+
+static const struct mm_walk_ops g_softdirty_walk_ops = {
+    .pmd_entry = softdirty_pmd_entry,
+    .hugetlb_entry = softdirty_hugetlb_entry,
+    .pre_vma = softdirty_pre_vma,
+    .post_vma = softdirty_post_vma,
+};
+
+/* softdirty_walk - the pages of a process written since the last clear
+ * @mm: the address space, with a reference held
+ * @start, @end: the virtual range [start, end)
+ * @clear: clear the soft-dirty bits of the pages reported
+ * @callback, @context: see virt_walk_range, gets the soft-dirty pages only.
+ *                      The leaf entry is only valid during the call.
+ * @stopped_at: see virt_walk_range
+ *
+ * The soft-dirty bit is what /proc/pid/pagemap reports (CONFIG_MEM_SOFT_DIRTY).
+ * Unlike virt_walk_range, this goes through the VMAs with walk_page_range and
+ * holds the page table locks, as clear_refs does: reading and clearing happen
+ * per entry under its lock, so a write is either reported now, or the next
+ * time. Pages of VMAs with VM_SOFTDIRTY set count as soft-dirty; clearing
+ * takes the mmap lock for writing to clear that flag (see softdirty_post_vma).
+ * walk_page_range is not exported, and neither are flush_tlb_mm_range and
+ * vma_set_page_prot, which clearing needs: without them in kallsyms, there is
+ * no walk.
+ *
+ * Returns 0, or negative error
+ */
+int softdirty_walk(struct mm_struct *mm, uint64_t start, uint64_t end,
+                   bool clear, PTE_WALK_CALLBACK callback, void *context,
+                   uint64_t *stopped_at)
+{
+    SOFTDIRTY_WALK walk = { .callback = callback,
+                            .context = context,
+                            .clear = clear,
+                            .stopped_at = stopped_at };
+    FLUSH_TLB_MM_RANGE flush_tlb_mm_range_fn = NULL;
+    WALK_PAGE_RANGE walk_page_range_fn;
+    struct mmu_notifier_range range;
+    int ret;
+
+    *stopped_at = 0;
+
+    if (!IS_ENABLED(CONFIG_MEM_SOFT_DIRTY))
+        return -EOPNOTSUPP;
+
+    // walk_page_range works on whole pages.
+    start &= PAGE_MASK;
+    end = PAGE_ALIGN(end);
+    walk.start = start;
+    walk.end = end;
+
+    walk_page_range_fn =
+        (WALK_PAGE_RANGE)layout_lookup_symbol("walk_page_range");
+    if (!walk_page_range_fn)
+        return -EOPNOTSUPP;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    walk.pte_offset_map_lock_fn =
+        (PTE_OFFSET_MAP_LOCK)layout_lookup_symbol("__pte_offset_map_lock");
+    if (!walk.pte_offset_map_lock_fn)
+        return -EOPNOTSUPP;
+#endif
+
+    if (clear) {
+        flush_tlb_mm_range_fn = (FLUSH_TLB_MM_RANGE)layout_lookup_symbol(
+            "flush_tlb_mm_range");
+        if (!flush_tlb_mm_range_fn)
+            return -EOPNOTSUPP;
+
+        walk.vma_set_page_prot_fn =
+            (VMA_SET_PAGE_PROT)layout_lookup_symbol("vma_set_page_prot");
+        if (!walk.vma_set_page_prot_fn)
+            return -EOPNOTSUPP;
+
+        // To clear VM_SOFTDIRTY.
+        if (mmap_write_lock_killable(mm))
+            return -EINTR;
+    } else {
+        mmap_read_lock(mm);
+    }
+
+    if (clear) {
+        // Others that change page tables meanwhile flush, too.
+        inc_tlb_flush_pending(mm);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+        mmu_notifier_range_init(&range, MMU_NOTIFY_SOFT_DIRTY, 0, mm, start,
+                                end);
+#else
+        mmu_notifier_range_init(&range, MMU_NOTIFY_SOFT_DIRTY, 0, NULL, mm,
+                                start, end);
+#endif
+        mmu_notifier_invalidate_range_start(&range);
+    }
+
+    ret = walk_page_range_fn(mm, start, end, &g_softdirty_walk_ops, &walk);
+
+    if (clear) {
+        mmu_notifier_invalidate_range_end(&range);
+        if (walk.cleared)
+            flush_tlb_mm_range_fn(mm, start, end, PAGE_SHIFT, false);
+        dec_tlb_flush_pending(mm);
+        mmap_write_unlock(mm);
+    } else {
+        mmap_read_unlock(mm);
+    }
+
+    // Positive: the callback stopped the walk.
+    return ret < 0 ? ret : 0;
+}
@@ -0,0 +1,17 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _SOFTDIRTY_H_
+#define _SOFTDIRTY_H_
+
+#include <linux/mm_types.h>
+#include <linux/types.h>
+
+#include "pte_mmap.h"
+
+int softdirty_walk(struct mm_struct *mm, uint64_t start, uint64_t end,
+                   bool clear, PTE_WALK_CALLBACK callback, void *context,
+                   uint64_t *stopped_at);
+
+#endif
@@ -0,0 +1,280 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include "precompiler.h"
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/err.h>
+#include <linux/eventfd.h>
+#include <linux/jiffies.h>
+#include <linux/kref.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/timekeeping.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+#include <linux/xxhash.h>
+
+#include "linpmem.h"
+#include "pte_mmap.h"
+#include "watch.h"
+
+static void watch_signal(struct eventfd_ctx *eventfd)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+    eventfd_signal(eventfd);
+#else
+    eventfd_signal(eventfd, 1);
+#endif
+}
+
+/* watch_sample_range - read a range and compare it with the last sample
+ * @set: the watch set
+ * @range: the range
+ * @snapshot: where its snapshot is
+ * @baseline: first sample, nothing to compare with
+ *
+ * A range that becomes unreadable (or readable again) has changed, too.
+ *
+ * Returns true if the range changed
+ */
+static bool watch_sample_range(PWATCH_SET set, PLINPMEM_WATCH_RANGE range,
+                               uint8_t *snapshot, bool baseline)
+{
+    uint64_t bytes_read = 0;
+    uint64_t chunk;
+    uint32_t flags = 0;
+    uint64_t hash = 0;
+
+    while (bytes_read < range->size) {
+        chunk = pte_mmap_read_kernel(rogue_window(raw_smp_processor_id()),
+                                     range->phys_address + bytes_read,
+                                     set->scratch + bytes_read,
+                                     range->size - bytes_read);
+        if (!chunk)
+            break;
+        bytes_read += chunk;
+    }
+
+    if (bytes_read == range->size)
+        hash = xxh64(set->scratch, range->size, 0);
+    else
+        flags |= LINPMEM_WATCH_UNREADABLE;
+
+    if (!baseline && hash == range->hash &&
+        (range->flags & LINPMEM_WATCH_UNREADABLE) == flags)
+        return false;
+
+    mutex_lock(&set->lock);
+
+    range->hash = hash;
+    range->flags = (range->flags & ~LINPMEM_WATCH_UNREADABLE) | flags;
+    if (!baseline) {
+        range->flags |= LINPMEM_WATCH_CHANGED;
+        range->change_count++;
+        range->last_change = ktime_get_real_ns();
+    }
+    // Unreadable keeps the last contents that were readable.
+    if (!flags)
+        memcpy(snapshot, set->scratch, range->size);
+
+    mutex_unlock(&set->lock);
+
+    return !baseline;
+}
+
+static bool watch_sample(PWATCH_SET set, bool baseline)
+{
+    uint8_t *snapshot = set->snapshots;
+    bool changed = false;
+    uint32_t i;
+
+    for (i = 0; i < set->range_count; i++) {
+        if (watch_sample_range(set, &set->ranges[i], snapshot, baseline))
+            changed = true;
+        snapshot += set->ranges[i].size;
+
+        cond_resched();
+    }
+
+    mutex_lock(&set->lock);
+    set->samples++;
+    mutex_unlock(&set->lock);
+
+    return changed;
+}
+
+static void watch_work(struct work_struct *work)
+{
+    PWATCH_SET set = container_of(to_delayed_work(work), WATCH_SET, work);
+
+    if (watch_sample(set, false))
+        watch_signal(set->eventfd);
+
+    queue_delayed_work(system_unbound_wq, &set->work, set->period);
+}
+
+/* watch_create - start watching a set of physical ranges
+ * @watch_setup: the request, with the user array of ranges
+ *
+ * The first sample is taken right away, as the baseline for the next.
+ *
+ * Returns the watch set, or ERR_PTR
+ */
+PWATCH_SET watch_create(PLINPMEM_WATCH_SETUP watch_setup)
+{
+    PWATCH_SET set;
+    uint64_t max_size = 0;
+    uint32_t i;
+    int ret;
+
+    if (!watch_setup->range_count ||
+        watch_setup->range_count > LINPMEM_MAX_WATCH_RANGES ||
+        watch_setup->period_ms < LINPMEM_MIN_WATCH_PERIOD_MS)
+        return ERR_PTR(-EINVAL);
+
+    set = kzalloc(sizeof(WATCH_SET), GFP_KERNEL);
+    if (!set)
+        return ERR_PTR(-ENOMEM);
+
+    kref_init(&set->refcount);
+    INIT_DELAYED_WORK(&set->work, watch_work);
+    mutex_init(&set->lock);
+    set->period = msecs_to_jiffies(watch_setup->period_ms);
+    set->range_count = watch_setup->range_count;
+
+    set->ranges = kvcalloc(set->range_count, sizeof(LINPMEM_WATCH_RANGE),
+                           GFP_KERNEL);
+    if (!set->ranges) {
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    if (copy_from_user(set->ranges, watch_setup->ranges,
+                       set->range_count * sizeof(LINPMEM_WATCH_RANGE))) {
+        ret = -EFAULT;
+        goto error;
+    }
+
+    for (i = 0; i < set->range_count; i++) {
+        set->ranges[i].hash = 0;
+        set->ranges[i].change_count = 0;
+        set->ranges[i].last_change = 0;
+        set->ranges[i].flags = 0;
+
+        if (!set->ranges[i].size ||
+            set->ranges[i].size > LINPMEM_MAX_WATCH_SIZE -
+                                      set->snapshots_size) {
+            ret = -EINVAL;
+            goto error;
+        }
+
+        set->snapshots_size += set->ranges[i].size;
+        max_size = max(max_size, set->ranges[i].size);
+    }
+
+    set->snapshots = kvzalloc(set->snapshots_size, GFP_KERNEL);
+    set->scratch = kvmalloc(max_size, GFP_KERNEL);
+    if (!set->snapshots || !set->scratch) {
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    set->eventfd = eventfd_ctx_fdget(watch_setup->eventfd);
+    if (IS_ERR(set->eventfd)) {
+        ret = PTR_ERR(set->eventfd);
+        set->eventfd = NULL;
+        goto error;
+    }
+
+    watch_sample(set, true);
+
+    queue_delayed_work(system_unbound_wq, &set->work, set->period);
+
+    return set;
+
+error:
+    watch_put(set);
+
+    return ERR_PTR(ret);
+}
+
+static void watch_release(struct kref *refcount)
+{
+    PWATCH_SET set = container_of(refcount, WATCH_SET, refcount);
+
+    // Also stops the work from requeueing itself.
+    cancel_delayed_work_sync(&set->work);
+
+    if (set->eventfd)
+        eventfd_ctx_put(set->eventfd);
+    kvfree(set->scratch);
+    kvfree(set->snapshots);
+    kvfree(set->ranges);
+    kfree(set);
+}
+
+void watch_get(PWATCH_SET set)
+{
+    kref_get(&set->refcount);
+}
+
+/* watch_put - drop a reference, the last one stops sampling
+ *
+ * Might sleep.
+ */
+void watch_put(PWATCH_SET set)
+{
+    if (set)
+        kref_put(&set->refcount, watch_release);
+}
+
+/* watch_query - copy the state of all ranges to user space
+ * @set: the watch set
+ * @watch_query: the request, with the user buffers
+ *
+ * Clears LINPMEM_WATCH_CHANGED of the ranges returned. Copies to user space
+ * under set->lock, so the caller must not hold file_context->lock.
+ *
+ * Returns 0, or negative error
+ */
+int watch_query(PWATCH_SET set, PLINPMEM_WATCH_QUERY watch_query)
+{
+    uint32_t count = min(watch_query->range_count, set->range_count);
+    uint32_t i;
+    int ret = 0;
+
+    if (watch_query->data && watch_query->data_size < set->snapshots_size)
+        return -EINVAL;
+
+    mutex_lock(&set->lock);
+
+    watch_query->range_count = set->range_count;
+    watch_query->data_size = set->snapshots_size;
+    watch_query->samples = set->samples;
+    watch_query->changed_count = 0;
+    for (i = 0; i < set->range_count; i++) {
+        if (set->ranges[i].flags & LINPMEM_WATCH_CHANGED)
+            watch_query->changed_count++;
+    }
+
+    if (copy_to_user(watch_query->ranges, set->ranges,
+                     count * sizeof(LINPMEM_WATCH_RANGE)) ||
+        (watch_query->data &&
+         copy_to_user(watch_query->data, set->snapshots,
+                      set->snapshots_size))) {
+        ret = -EFAULT;
+        goto out_unlock;
+    }
+
+    for (i = 0; i < count; i++)
+        set->ranges[i].flags &= ~LINPMEM_WATCH_CHANGED;
+
+out_unlock:
+    mutex_unlock(&set->lock);
+
+    return ret;
+}
@@ -0,0 +1,49 @@
+/* SPDX-FileCopyrightText: © 2023 Viviane Zwanger, Valentin Obst <legal@eb9f.de>
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include <linux/eventfd.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+
+#include "../userspace_interface/linpmem_shared.h"
+
+/* The watched ranges of a file descriptor, see IOCTL_LINPMEM_WATCH_SETUP.
+ * refcount	One reference for the file context, one for each query in
+ *		flight: queries copy to user space without file_context->lock.
+ * work		Samples all ranges, then requeues itself after period.
+ * eventfd	Signalled once per sample that found changes.
+ * lock		Protects ranges (the _OUT_ fields), snapshots and samples
+ *		against queries.
+ * ranges	The ranges, with hash, change_count, ... of the last sample.
+ * snapshots	The contents of all ranges as of their last change (or
+ *		setup), concatenated in the order of ranges.
+ * scratch	Where a sample reads a range to, largest range size bytes.
+ */
+typedef struct {
+    struct kref refcount;
+    struct delayed_work work;
+    struct eventfd_ctx *eventfd;
+    unsigned long period;
+    struct mutex lock;
+    PLINPMEM_WATCH_RANGE ranges;
+    uint32_t range_count;
+    uint8_t *snapshots;
+    uint64_t snapshots_size;
+    uint8_t *scratch;
+    uint64_t samples;
+} WATCH_SET, *PWATCH_SET;
+
+PWATCH_SET watch_create(PLINPMEM_WATCH_SETUP watch_setup);
+
+void watch_get(PWATCH_SET set);
+
+void watch_put(PWATCH_SET set);
+
+int watch_query(PWATCH_SET set, PLINPMEM_WATCH_QUERY watch_query);
+
+#endif
@@ -53,6 +53,13 @@ typedef enum _PHYS_ACCESS_MODE {
 	PHYS_BUFFER_READ = 9
 } PHYS_ACCESS_MODE;
 
+// Flags of LINPMEM_DATA_TRANSFER, PHYS_BUFFER_READ only.
+// Read across page boundaries, see readbuffer_size.
+#define LINPMEM_TRANSFER_IGNORE_PAGE_BOUNDARY (1 << 0)
+
+// Largest buffer read with LINPMEM_TRANSFER_IGNORE_PAGE_BOUNDARY.
+#define LINPMEM_MAX_TRANSFER_SIZE (0x200000)
+
 /* LINPMEM_DATA_TRANSFER (for physical reading, the main capability):
  * You must provide a physical address, and then choose whether you want
  * a true integer read (1/2/4/8 byte), or a buffer read.
@@ -93,16 +100,13 @@ typedef struct _LINPMEM_DATA_TRANSFER {
 	//          Maximum the driver will (currently) read:
 	//          	0x1000 - 0xaaa = 0x556 bytes.
 	//
-	// In future there might be an option to force-ignore page boundary.
-	// (In other words, you can provide a buffer as large as you want.)
+	// With LINPMEM_TRANSFER_IGNORE_PAGE_BOUNDARY in flags, the driver
+	// reads up to LINPMEM_MAX_TRANSFER_SIZE bytes of physically contiguous
+	// memory (such as acpi tables, or a whole range for acquisition),
+	// and only stops early at a page that is not readable.
 	// However, reading from a physical address you got from translating a
 	// virtual address and *then* ignoring the page boundary is most
 	// certainly not what you want!
-	// On the other side, being able to force ignore page boundary for
-	// reading from contiguous memory (such as acpi tables, for instance)
-	// might really come in handy.
-	// A reserved field might be used in future for a
-	// "forceIgnorePageBoundary" flag.
 
 	// (_IN_)  access mode types: byte, word, dword, qword, buffer
 	uint8_t access_type;
@@ -116,8 +120,10 @@ typedef struct _LINPMEM_DATA_TRANSFER {
 	// Unused. 
 	uint8_t write_access;
 
+	// (_IN_) LINPMEM_TRANSFER_* flags, or zero.
+	uint8_t flags;
+
 	// Every good struct has minimum one!
-	uint8_t reserved1;
 	uint8_t reserved2;
 } LINPMEM_DATA_TRANSFER, *PLINPMEM_DATA_TRANSFER;
 
@@ -159,6 +165,1378 @@ typedef struct _LINPMEM_CR3_INFO {
 	uint64_t result_cr3;
 } LINPMEM_CR3_INFO, *PLINPMEM_CR3_INFO;
 
+// ############################################################################
+// # Page ring (bulk acquisition)					      #
+// ############################################################################
+
+/* For bulk acquisition, reading page by page with IOCTL_LINPMEM_READ_PHYSADDR
+ * costs one syscall and one copy to your buffer for every single page.
+ * The page ring avoids both: the driver exports a ring of page-sized slots
+ * that you mmap into your process. You post physical addresses into the slot
+ * descriptors, kick the driver once per batch, and kernel workers fill the
+ * slots directly from the rogue page. You then read the page contents in
+ * place. (Think AF_PACKET or io_uring rings.)
+ *
+ * How to use it:
+ * 1. IOCTL_LINPMEM_RING_SETUP with the number of slots you want. One ring per
+ *    open file descriptor.
+ * 2. mmap() mmap_size bytes at offset 0 of the same file descriptor, with
+ *    PROT_READ | PROT_WRITE and MAP_SHARED.
+ * 3. The mapping starts with a LINPMEM_RING_HEADER, directly followed by
+ *    slot_count LINPMEM_RING_DESC descriptors. The page data of slot i is at
+ *    (mapping + slots_offset + i * slot_size).
+ * 4. For every page you want: take a descriptor in state LINPMEM_SLOT_FREE,
+ *    fill in phys_address, then set the state to LINPMEM_SLOT_SUBMITTED.
+ *    Store the state last and with release semantics, e.g.,
+ *    __atomic_store_n(&desc->state, LINPMEM_SLOT_SUBMITTED, __ATOMIC_RELEASE).
+ * 5. IOCTL_LINPMEM_RING_SUBMIT, once per batch (not per page!).
+ * 6. Wait for LINPMEM_SLOT_DONE or LINPMEM_SLOT_ERROR (load the state with
+ *    acquire semantics), consume the slot, and set it back to
+ *    LINPMEM_SLOT_FREE for reuse.
+ *
+ * Slots always hold whole pages: the driver reads the page that contains
+ * phys_address, starting at its first byte. Like all other reads, this only
+ * works for valid page frames.
+ *
+ * NUMA: with LINPMEM_RING_NUMA_LOCAL, the driver runs one kernel worker per
+ * NUMA node instead of a single one. Each worker only reads the pages that
+ * belong to its own node, through its own rogue page, so a dump uses all
+ * memory controllers at once. Per-node throughput can be queried with
+ * IOCTL_LINPMEM_QUERY_NUMA_STATS.
+ */
+
+// The maximum number of slots per ring.
+#define LINPMEM_RING_MAX_SLOTS (65536)
+
+// Flags for LINPMEM_RING_SETUP.
+// Fill the slots with node-local workers, one per NUMA node.
+#define LINPMEM_RING_NUMA_LOCAL (1 << 0)
+
+/* Slot states (LINPMEM_RING_DESC.state). FREE and SUBMITTED are set by you,
+ * BUSY, DONE and ERROR are set by the driver. Never touch a slot that is
+ * SUBMITTED or BUSY.
+ */
+typedef enum _LINPMEM_SLOT_STATE {
+	LINPMEM_SLOT_FREE = 0,
+	LINPMEM_SLOT_SUBMITTED = 1,
+	LINPMEM_SLOT_BUSY = 2,
+	LINPMEM_SLOT_DONE = 3,
+	LINPMEM_SLOT_ERROR = 4
+} LINPMEM_SLOT_STATE;
+
+/* LINPMEM_RING_SETUP: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_RING_SETUP" to the driver.
+ */
+typedef struct _LINPMEM_RING_SETUP {
+	// (_IN_) Number of page slots. 1 to LINPMEM_RING_MAX_SLOTS.
+	uint32_t slot_count;
+
+	// (_IN_) LINPMEM_RING_* flags, or zero.
+	uint32_t flags;
+
+	// (_OUT_) The number of bytes you must mmap (at offset 0).
+	uint64_t mmap_size;
+} LINPMEM_RING_SETUP, *PLINPMEM_RING_SETUP;
+
+/* LINPMEM_RING_HEADER: at the beginning of the mapped ring. Read only. */
+typedef struct _LINPMEM_RING_HEADER {
+	// Number of slots (and descriptors).
+	uint32_t slot_count;
+
+	// Size of one slot. This is the page size.
+	uint32_t slot_size;
+
+	// Offset of the first slot, counted from the beginning of the mapping.
+	uint64_t slots_offset;
+
+	// Statistics: slots that were filled, and slots that failed.
+	uint64_t slots_done;
+	uint64_t slots_failed;
+} LINPMEM_RING_HEADER, *PLINPMEM_RING_HEADER;
+
+/* LINPMEM_RING_DESC: one per slot, directly after the header. */
+typedef struct _LINPMEM_RING_DESC {
+	// (_IN_) Physical address of the page you want in this slot.
+	uint64_t phys_address;
+
+	// (_INOUT_) See LINPMEM_SLOT_STATE.
+	uint32_t state;
+
+	// (_OUT_) Number of bytes in the slot. Equals the slot size on success,
+	// zero on error.
+	uint32_t bytes_read;
+} LINPMEM_RING_DESC, *PLINPMEM_RING_DESC;
+
+// Flags for LINPMEM_RING_SUBMIT.
+// Do not return before all submitted slots are processed.
+#define LINPMEM_RING_SUBMIT_WAIT (1 << 0)
+
+/* LINPMEM_RING_SUBMIT: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_RING_SUBMIT" to the driver.
+ * Without LINPMEM_RING_SUBMIT_WAIT, the call returns immediately and the
+ * kernel workers fill the slots in the background.
+ */
+typedef struct _LINPMEM_RING_SUBMIT {
+	// (_IN_) LINPMEM_RING_SUBMIT_* flags.
+	uint32_t flags;
+
+	// Unused, must be zero.
+	uint32_t reserved;
+} LINPMEM_RING_SUBMIT, *PLINPMEM_RING_SUBMIT;
+
+// Statistics are kept for the first LINPMEM_MAX_NUMA_NODES nodes.
+#define LINPMEM_MAX_NUMA_NODES (64)
+
+/* LINPMEM_NUMA_NODE_STATS: what the ring workers of one node did so far
+ * (since the driver was loaded, all rings together).
+ * Throughput of the node: bytes_read / busy_ns.
+ */
+typedef struct _LINPMEM_NUMA_NODE_STATS {
+	// Node id.
+	uint32_t node;
+
+	// Nonzero if the node is online and has memory.
+	uint32_t online;
+
+	uint64_t pages_read;
+	uint64_t pages_failed;
+	uint64_t bytes_read;
+
+	// Time the workers of this node spent filling slots, in nanoseconds.
+	uint64_t busy_ns;
+} LINPMEM_NUMA_NODE_STATS, *PLINPMEM_NUMA_NODE_STATS;
+
+/* LINPMEM_NUMA_STATS: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_QUERY_NUMA_STATS" to the driver.
+ */
+typedef struct _LINPMEM_NUMA_STATS {
+	// (_OUT_) Number of valid entries in nodes.
+	uint32_t node_count;
+
+	// Unused.
+	uint32_t reserved;
+
+	// (_OUT_) Per node statistics, indexed by node id.
+	LINPMEM_NUMA_NODE_STATS nodes[LINPMEM_MAX_NUMA_NODES];
+} LINPMEM_NUMA_STATS, *PLINPMEM_NUMA_STATS;
+
+// ############################################################################
+// # Pattern scanner							      #
+// ############################################################################
+
+/* Looking for an indicator in memory does not require copying all of it to
+ * user space. With IOCTL_LINPMEM_SCAN, you hand the driver a set of byte
+ * patterns and a list of physical ranges. The driver compiles the patterns
+ * into an automaton (Aho-Corasick, so one pass over memory no matter how many
+ * patterns) and searches the ranges inside the kernel. Only the matches come
+ * back to you, each with some bytes of context around it.
+ *
+ * > Matches crossing a page boundary are found, as long as both pages are
+ *   part of the same range.
+ * > Invalid page frames are skipped (see pages_skipped); matches can not
+ *   cross them.
+ * > If your match buffer is full, or a signal arrives, the scan stops early.
+ *   resume_range and resume_address then tell you where to continue: call
+ *   again with the ranges starting at ranges[resume_range], and that range
+ *   starting at resume_address. Matches that end before the match you
+ *   stopped at, but start after it, may be reported a second time.
+ */
+
+// Limits of one scan.
+#define LINPMEM_SCAN_MAX_PATTERNS (1024)
+#define LINPMEM_SCAN_MAX_PATTERN_BYTES (8192) // all patterns together
+#define LINPMEM_SCAN_MAX_RANGES (4096)
+#define LINPMEM_SCAN_MAX_MATCHES (65536)
+
+// Context of a match: up to LINPMEM_SCAN_CONTEXT_BEFORE bytes before its
+// first byte, LINPMEM_SCAN_CONTEXT_SIZE bytes in total.
+#define LINPMEM_SCAN_CONTEXT_BEFORE (32)
+#define LINPMEM_SCAN_CONTEXT_SIZE (96)
+
+/* LINPMEM_SCAN_RANGE: a range of physical memory to scan. */
+typedef struct _LINPMEM_SCAN_RANGE {
+	uint64_t start;
+	uint64_t size;
+} LINPMEM_SCAN_RANGE, *PLINPMEM_SCAN_RANGE;
+
+/* LINPMEM_SCAN_MATCH: one match, as returned in your match buffer. */
+typedef struct _LINPMEM_SCAN_MATCH {
+	// Physical address of the first byte of the match.
+	uint64_t phys_address;
+
+	// Index of the pattern that matched.
+	uint32_t pattern_index;
+
+	// Number of valid bytes in context. Context never leaves the range
+	// that was scanned.
+	uint32_t context_size;
+
+	// Physical address of context[0].
+	uint64_t context_address;
+
+	uint8_t context[LINPMEM_SCAN_CONTEXT_SIZE];
+} LINPMEM_SCAN_MATCH, *PLINPMEM_SCAN_MATCH;
+
+/* LINPMEM_SCAN: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_SCAN" to the driver.
+ */
+typedef struct _LINPMEM_SCAN {
+	// (_IN_) All patterns, back to back.
+	const uint8_t *patterns;
+
+	// (_IN_) The size of each pattern, pattern_count entries. Patterns
+	// must not be empty.
+	const uint32_t *pattern_sizes;
+
+	// (_IN_) Number of patterns. 1 to LINPMEM_SCAN_MAX_PATTERNS.
+	uint32_t pattern_count;
+
+	// (_IN_) Number of ranges. 1 to LINPMEM_SCAN_MAX_RANGES.
+	uint32_t range_count;
+
+	// (_IN_) The physical ranges to scan, in this order.
+	const LINPMEM_SCAN_RANGE *ranges;
+
+	// (_INOUT_) Your buffer for max_matches matches.
+	LINPMEM_SCAN_MATCH *matches;
+
+	// (_IN_) 1 to LINPMEM_SCAN_MAX_MATCHES.
+	uint32_t max_matches;
+
+	// (_OUT_) Number of matches in your buffer.
+	uint32_t match_count;
+
+	// (_OUT_) Statistics.
+	uint64_t bytes_scanned;
+	uint64_t pages_skipped;
+
+	// (_OUT_) Set if the scan stopped early, see above. resume_range is
+	// range_count if all ranges were scanned.
+	uint64_t resume_address;
+	uint32_t resume_range;
+
+	// Unused.
+	uint32_t reserved;
+} LINPMEM_SCAN, *PLINPMEM_SCAN;
+
+// ############################################################################
+// # Process memory							      #
+// ############################################################################
+
+/* To acquire the memory of a single process, you do not need one VTOP and
+ * one read per page. IOCTL_LINPMEM_QUERY_PROCESS_RUNS walks the page tables
+ * of the process once and returns all of its present pages, merged into
+ * runs that are contiguous both virtually and physically. Read the physical
+ * side of the runs (e.g., through the page ring), and keep the runs as the
+ * VA -> PA index of your dump.
+ *
+ * Only the user half of the address space is walked, and only 4-level paging
+ * is supported. The page tables are walked under the mmap lock of the
+ * process, but without the page table locks, so the result is a best-effort
+ * snapshot: pages that are (re)mapped during the call may be missing or
+ * stale. And of course the process keeps running: pages may be remapped
+ * right after the call.
+ *
+ * If your run buffer is too small, resume_address tells you where to
+ * continue: call again with virt_start set to it.
+ */
+
+// The maximum number of runs per call.
+#define LINPMEM_MAX_VIRT_RUNS (65536)
+
+// Flags of LINPMEM_VIRT_RUN.
+#define LINPMEM_VIRT_RUN_WRITABLE (1 << 0)
+#define LINPMEM_VIRT_RUN_USER (1 << 1)
+#define LINPMEM_VIRT_RUN_EXECUTABLE (1 << 2)
+
+/* LINPMEM_VIRT_RUN: memory that is contiguous virtually and physically, and
+ * has the same access rights.
+ */
+typedef struct _LINPMEM_VIRT_RUN {
+	uint64_t virt_address;
+	uint64_t phys_address;
+	uint64_t size;
+
+	// LINPMEM_VIRT_RUN_* flags.
+	uint64_t flags;
+} LINPMEM_VIRT_RUN, *PLINPMEM_VIRT_RUN;
+
+/* LINPMEM_PROCESS_RUNS: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_QUERY_PROCESS_RUNS" to the driver.
+ */
+typedef struct _LINPMEM_PROCESS_RUNS {
+	// (_IN_) The process (pid_t). Zero for your own process.
+	uint64_t target_process;
+
+	// (_IN_) The virtual range to walk: [virt_start, virt_end). virt_end
+	// is clipped to the end of user space, the range must not be empty.
+	uint64_t virt_start;
+	uint64_t virt_end;
+
+	// (_INOUT_) Your buffer for max_runs runs.
+	LINPMEM_VIRT_RUN *runs;
+
+	// (_IN_) 1 to LINPMEM_MAX_VIRT_RUNS.
+	uint32_t max_runs;
+
+	// (_OUT_) Number of runs in your buffer.
+	uint32_t run_count;
+
+	// (_OUT_) The CR3 that was walked, see IOCTL_LINPMEM_QUERY_CR3.
+	uint64_t result_cr3;
+
+	// (_OUT_) Zero if the range was walked completely, otherwise where
+	// to continue.
+	uint64_t resume_address;
+
+	// (_OUT_) Total size of the returned runs, in pages.
+	uint64_t mapped_pages;
+} LINPMEM_PROCESS_RUNS, *PLINPMEM_PROCESS_RUNS;
+
+/* IOCTL_LINPMEM_QUERY_DIRTY_RUNS is IOCTL_LINPMEM_QUERY_PROCESS_RUNS, but
+ * only for the pages written since the last clear: the soft-dirty bit of
+ * the page tables, as in /proc/pid/pagemap (the kernel needs
+ * CONFIG_MEM_SOFT_DIRTY, otherwise EOPNOTSUPP). Unlike the process runs, the
+ * driver walks the mappings of the process with the page table locks held,
+ * like the kernel does for clear_refs, so 5-level paging works, too.
+ * Mappings of raw page frames (VM_PFNMAP) are skipped.
+ *
+ * With LINPMEM_DIRTY_CLEAR, the pages returned are clean afterwards, each
+ * in one atomic step: a write is either in this result, or in the next one.
+ * Repeated process dumps then only read what changed in between. A dump
+ * cycle is: full dump, then dirty runs with LINPMEM_DIRTY_CLEAR, reading the
+ * pages, and so on. The first call with clear of a new process reports all
+ * its pages (new pages start out soft-dirty).
+ *
+ * Pages the driver can not clear (might be pinned for DMA, hugetlb, 1 GiB
+ * pages, a large page cut by the range) are just reported again. So are
+ * all pages of a mapping the kernel marks soft-dirty as a whole (a new or
+ * merged one), until a clear covers the whole mapping. Compare
+ * the phys_address of the runs with the last dump, too: a page that was
+ * swapped or migrated meanwhile has a new frame, not necessarily dirty.
+ */
+
+// Flags of LINPMEM_DIRTY_RUNS.
+// Clear the soft-dirty bits of the pages returned.
+#define LINPMEM_DIRTY_CLEAR (1 << 0)
+
+/* LINPMEM_DIRTY_RUNS: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_QUERY_DIRTY_RUNS" to the driver.
+ */
+typedef struct _LINPMEM_DIRTY_RUNS {
+	// (_INOUT_) As in LINPMEM_PROCESS_RUNS, with mapped_pages counting
+	// dirty pages only. If your run buffer is too small, the pages from
+	// resume_address on are not cleared.
+	LINPMEM_PROCESS_RUNS runs;
+
+	// (_IN_) LINPMEM_DIRTY_* flags, or zero.
+	uint32_t flags;
+
+	uint32_t reserved;
+} LINPMEM_DIRTY_RUNS, *PLINPMEM_DIRTY_RUNS;
+
+// ############################################################################
+// # Process enumeration						      #
+// ############################################################################
+
+/* IOCTL_LINPMEM_QUERY_PROCESSES returns all processes with their CR3 in one
+ * call, taken from one walk over the task list. Sweeping every process with
+ * IOCTL_LINPMEM_QUERY_CR3 instead costs one call per pid, and fails for
+ * processes that exit in between.
+ *
+ * If your buffer is too small, you get the first max_processes entries, and
+ * total_count tells you how many there were.
+ */
+
+// The maximum size of the buffer, in entries.
+#define LINPMEM_MAX_PROCESSES (262144)
+
+#define LINPMEM_COMM_SIZE (16)
+
+// Flags for LINPMEM_PROCESSES.
+// Return every thread, not only one entry per process (thread group).
+#define LINPMEM_PROCESSES_THREADS (1 << 0)
+
+// Flags of LINPMEM_PROCESS_INFO.
+// A kernel thread. It has no address space of its own.
+#define LINPMEM_PROCESS_KERNEL_THREAD (1 << 0)
+// The process is exiting.
+#define LINPMEM_PROCESS_EXITING (1 << 1)
+
+/* LINPMEM_PROCESS_INFO: one process (or thread) in your buffer. */
+typedef struct _LINPMEM_PROCESS_INFO {
+	// Pids as seen from your pid namespace.
+	uint32_t pid;
+	uint32_t tgid;
+	uint32_t ppid;
+
+	// LINPMEM_PROCESS_* flags.
+	uint32_t flags;
+
+	// Name of the executable (may be truncated).
+	char comm[LINPMEM_COMM_SIZE];
+
+	// Physical address of the top-level page table, as returned by
+	// IOCTL_LINPMEM_QUERY_CR3. Zero if the task has no address space.
+	uint64_t cr3;
+
+	// Identity of the address space (kernel address of its mm_struct).
+	// Threads of one process have the same mm_id.
+	uint64_t mm_id;
+} LINPMEM_PROCESS_INFO, *PLINPMEM_PROCESS_INFO;
+
+/* LINPMEM_PROCESSES: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_QUERY_PROCESSES" to the driver.
+ */
+typedef struct _LINPMEM_PROCESSES {
+	// (_INOUT_) Your buffer for max_processes entries.
+	LINPMEM_PROCESS_INFO *processes;
+
+	// (_IN_) 1 to LINPMEM_MAX_PROCESSES.
+	uint32_t max_processes;
+
+	// (_IN_) LINPMEM_PROCESSES_* flags, or zero.
+	uint32_t flags;
+
+	// (_OUT_) Number of entries in your buffer.
+	uint32_t process_count;
+
+	// (_OUT_) Number of processes (or threads) there were.
+	uint32_t total_count;
+} LINPMEM_PROCESSES, *PLINPMEM_PROCESSES;
+
+// ############################################################################
+// # System-wide process maps						      #
+// ############################################################################
+
+/* IOCTL_LINPMEM_QUERY_PROCESS_MAPS is IOCTL_LINPMEM_QUERY_PROCESS_RUNS for
+ * all processes in one call. Kernel workers walk the page tables in
+ * parallel, one process each at a time, so the VA -> PA map of the whole
+ * system is built at the speed of memory, not of ioctls.
+ *
+ * The result is one compact buffer, in pid order: a LINPMEM_PROCESS_MAP,
+ * directly followed by its run_count LINPMEM_VIRT_RUNs, then the next
+ * process. Walk it with LINPMEM_PROCESS_MAP_RUNS and LINPMEM_NEXT_PROCESS_MAP.
+ *
+ * Processes are the thread groups with an address space (no kernel
+ * threads) that are visible in your pid namespace, as of the call. If your
+ * buffer is too small, call again with start_pid = resume_pid. A buffer of
+ * LINPMEM_PROCESS_MAP_MAX_SIZE bytes holds any process: processes with more
+ * than LINPMEM_MAX_VIRT_RUNS runs are truncated, continue those with
+ * IOCTL_LINPMEM_QUERY_PROCESS_RUNS.
+ */
+
+// The maximum number of workers.
+#define LINPMEM_MAX_PROCESS_MAP_WORKERS (64)
+
+// Flags of LINPMEM_PROCESS_MAP.
+// There is more than LINPMEM_MAX_VIRT_RUNS runs, see resume_address.
+#define LINPMEM_PROCESS_MAP_TRUNCATED (1 << 0)
+// The walk failed, there are no runs.
+#define LINPMEM_PROCESS_MAP_FAILED (1 << 1)
+
+/* LINPMEM_PROCESS_MAP: one process in your buffer. */
+typedef struct _LINPMEM_PROCESS_MAP {
+	// The process (thread group id), as seen from your pid namespace.
+	uint32_t pid;
+
+	// LINPMEM_PROCESS_MAP_* flags.
+	uint32_t flags;
+
+	// As in LINPMEM_PROCESS_INFO.
+	uint64_t cr3;
+	uint64_t mm_id;
+
+	// Total size of the runs, in pages.
+	uint64_t mapped_pages;
+
+	// LINPMEM_PROCESS_MAP_TRUNCATED only: where the runs stop.
+	uint64_t resume_address;
+
+	// Number of runs following this struct.
+	uint32_t run_count;
+
+	uint32_t reserved;
+} LINPMEM_PROCESS_MAP, *PLINPMEM_PROCESS_MAP;
+
+#define LINPMEM_PROCESS_MAP_RUNS(map) ((PLINPMEM_VIRT_RUN)((map) + 1))
+
+#define LINPMEM_NEXT_PROCESS_MAP(map) \
+	((PLINPMEM_PROCESS_MAP)(LINPMEM_PROCESS_MAP_RUNS(map) + (map)->run_count))
+
+// Size of the largest process in the buffer.
+#define LINPMEM_PROCESS_MAP_MAX_SIZE \
+	(sizeof(LINPMEM_PROCESS_MAP) + \
+	 LINPMEM_MAX_VIRT_RUNS * sizeof(LINPMEM_VIRT_RUN))
+
+/* LINPMEM_PROCESS_MAPS: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_QUERY_PROCESS_MAPS" to the driver.
+ */
+typedef struct _LINPMEM_PROCESS_MAPS {
+	// (_IN_) Your buffer.
+	void *buffer;
+
+	// (_IN_) Its size in bytes, at least LINPMEM_PROCESS_MAP_MAX_SIZE.
+	uint64_t buffer_size;
+
+	// (_IN_) The first pid you want.
+	uint32_t start_pid;
+
+	// (_IN_) Number of workers. Zero for one per online CPU. At most
+	// LINPMEM_MAX_PROCESS_MAP_WORKERS.
+	uint32_t max_workers;
+
+	// (_OUT_) Bytes used in your buffer.
+	uint64_t used_size;
+
+	// (_OUT_) Number of processes in your buffer.
+	uint32_t process_count;
+
+	// (_OUT_) Zero if all processes are in your buffer, otherwise the
+	// next pid to ask for.
+	uint32_t resume_pid;
+
+	// (_OUT_) Number of workers used.
+	uint32_t workers;
+
+	uint32_t reserved;
+} LINPMEM_PROCESS_MAPS, *PLINPMEM_PROCESS_MAPS;
+
+// ############################################################################
+// # Kernel layout							      #
+// ############################################################################
+
+/* Analysis of a memory image starts with finding the kernel: where the
+ * direct mapping, vmalloc and vmemmap areas are (KASLR randomizes them),
+ * where the kernel image is, and where its symbol tables are. The driver
+ * simply knows, so ask it with IOCTL_LINPMEM_QUERY_KERNEL_LAYOUT instead of
+ * scanning memory for it.
+ *
+ * The kernel image and symbol fields need kallsyms_lookup_name, which the
+ * driver finds through kprobes. Without kprobes, LINPMEM_LAYOUT_SYMBOLS is
+ * not set and these fields are zero.
+ */
+
+// Flags of LINPMEM_KERNEL_LAYOUT.
+// The kernel image, kernel_cr3 and kallsyms fields are valid.
+#define LINPMEM_LAYOUT_SYMBOLS (1 << 0)
+
+// Indices into LINPMEM_KERNEL_LAYOUT.kallsyms. Which tables exist depends on
+// the kernel version and configuration (e.g., addresses or offsets).
+typedef enum _LINPMEM_KALLSYMS_TABLE {
+	LINPMEM_KALLSYMS_ADDRESSES = 0,
+	LINPMEM_KALLSYMS_OFFSETS,
+	LINPMEM_KALLSYMS_RELATIVE_BASE,
+	LINPMEM_KALLSYMS_NUM_SYMS,
+	LINPMEM_KALLSYMS_NAMES,
+	LINPMEM_KALLSYMS_MARKERS,
+	LINPMEM_KALLSYMS_TOKEN_TABLE,
+	LINPMEM_KALLSYMS_TOKEN_INDEX,
+	LINPMEM_KALLSYMS_TABLE_COUNT
+} LINPMEM_KALLSYMS_TABLE;
+
+#define LINPMEM_UTS_SIZE (65)
+
+/* LINPMEM_KERNEL_LAYOUT: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_QUERY_KERNEL_LAYOUT" to the driver. All fields are _OUT_.
+ * Addresses are virtual, unless the name ends with _phys or cr3.
+ */
+typedef struct _LINPMEM_KERNEL_LAYOUT {
+	// 4 or 5.
+	uint32_t paging_levels;
+
+	// LINPMEM_LAYOUT_* flags.
+	uint32_t flags;
+
+	// Start of the direct mapping of all physical memory (PAGE_OFFSET),
+	// of the vmalloc area, and of the struct page array.
+	uint64_t page_offset_base;
+	uint64_t vmalloc_base;
+	uint64_t vmemmap_base;
+
+	// Physical load offset of the kernel image (phys_base).
+	uint64_t phys_base;
+
+	// The kernel image: _text, _etext and _end.
+	uint64_t text_start;
+	uint64_t text_end;
+	uint64_t image_end;
+	uint64_t text_start_phys;
+
+	// KASLR displacement of the kernel image.
+	uint64_t kaslr_offset;
+
+	// Kernel page tables (swapper_pg_dir).
+	uint64_t kernel_cr3;
+
+	// kallsyms tables, zero if not found. See LINPMEM_KALLSYMS_TABLE.
+	uint64_t kallsyms[LINPMEM_KALLSYMS_TABLE_COUNT];
+
+	// uname -r and uname -v.
+	char uts_release[LINPMEM_UTS_SIZE];
+	char uts_version[LINPMEM_UTS_SIZE];
+
+	// Unused.
+	uint8_t reserved[6];
+} LINPMEM_KERNEL_LAYOUT, *PLINPMEM_KERNEL_LAYOUT;
+
+// ############################################################################
+// # Page owners (reverse mapping)					      #
+// ############################################################################
+
+/* Found something at a physical address? IOCTL_LINPMEM_QUERY_PAGE_OWNERS
+ * tells you who owns the page, for a whole batch of page frames at once:
+ * free, slab, page table, page cache (which file, at which offset), or
+ * anonymous memory; and for pages mapped into processes, one process that
+ * maps it and the virtual address there.
+ *
+ * Finding the process means sweeping the page tables of all processes, once
+ * per call. That is the slow part, so batch your page frames, or skip it with
+ * LINPMEM_PAGE_OWNERS_NO_PROCESSES.
+ *
+ * Of course, the answer can be outdated by the time you get it.
+ */
+
+#define LINPMEM_MAX_PAGE_OWNERS (16384)
+#define LINPMEM_OWNER_PATH_SIZE (128)
+
+typedef enum _LINPMEM_OWNER_TYPE {
+	// Could not tell, e.g., because the page changed while looking.
+	LINPMEM_OWNER_UNKNOWN = 0,
+	// No struct page: not RAM, or a memory hole.
+	LINPMEM_OWNER_INVALID = 1,
+	// Reserved: kernel image, firmware, ...
+	LINPMEM_OWNER_RESERVED = 2,
+	// Not allocated.
+	LINPMEM_OWNER_FREE = 3,
+	LINPMEM_OWNER_SLAB = 4,
+	LINPMEM_OWNER_PAGE_TABLE = 5,
+	// Anonymous memory of processes.
+	LINPMEM_OWNER_ANON = 6,
+	// Page cache.
+	LINPMEM_OWNER_FILE = 7,
+	// Other kernel allocations (vmalloc, page allocator, ...).
+	LINPMEM_OWNER_KERNEL = 8
+} LINPMEM_OWNER_TYPE;
+
+// Flags of LINPMEM_PAGE_OWNER.
+// pid, comm and virt_address are valid.
+#define LINPMEM_OWNER_PROCESS_FOUND (1 << 0)
+// Part of a huge page (or other compound page).
+#define LINPMEM_OWNER_COMPOUND (1 << 1)
+// Anonymous memory that is in the swap cache.
+#define LINPMEM_OWNER_SWAPCACHE (1 << 2)
+// The page is dirty.
+#define LINPMEM_OWNER_DIRTY (1 << 3)
+
+/* LINPMEM_PAGE_OWNER: one page frame you ask about. */
+typedef struct _LINPMEM_PAGE_OWNER {
+	// (_IN_) The page frame (physical address >> 12).
+	uint64_t pfn;
+
+	// (_OUT_) See LINPMEM_OWNER_TYPE.
+	uint32_t type;
+
+	// (_OUT_) LINPMEM_OWNER_* flags.
+	uint32_t flags;
+
+	// (_OUT_) Number of page table entries that map the page.
+	uint32_t map_count;
+
+	// (_OUT_) One process that maps the page, and where
+	// (LINPMEM_OWNER_PROCESS_FOUND). The pid is zero if the process is not
+	// visible in your pid namespace.
+	uint32_t pid;
+	char comm[LINPMEM_COMM_SIZE];
+	uint64_t virt_address;
+
+	// (_OUT_) Page cache: the file (inode number on device), and the
+	// offset of the page in the file. path is relative to the root of the
+	// file system, and empty if unknown.
+	uint64_t inode;
+	uint64_t file_offset;
+	uint32_t device;
+	uint32_t reserved;
+	char path[LINPMEM_OWNER_PATH_SIZE];
+} LINPMEM_PAGE_OWNER, *PLINPMEM_PAGE_OWNER;
+
+// Flags for LINPMEM_PAGE_OWNERS.
+// Do not sweep the processes (fast, but no pid and virt_address).
+#define LINPMEM_PAGE_OWNERS_NO_PROCESSES (1 << 0)
+
+/* LINPMEM_PAGE_OWNERS: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_QUERY_PAGE_OWNERS" to the driver.
+ */
+typedef struct _LINPMEM_PAGE_OWNERS {
+	// (_INOUT_) Your array of count entries, with pfn set.
+	LINPMEM_PAGE_OWNER *owners;
+
+	// (_IN_) 1 to LINPMEM_MAX_PAGE_OWNERS.
+	uint32_t count;
+
+	// (_IN_) LINPMEM_PAGE_OWNERS_* flags, or zero.
+	uint32_t flags;
+} LINPMEM_PAGE_OWNERS, *PLINPMEM_PAGE_OWNERS;
+
+// ############################################################################
+// # Registered buffers							      #
+// ############################################################################
+
+/* If you read a lot, register your buffer once with
+ * IOCTL_LINPMEM_REGISTER_BUFFER. The driver pins its pages for good, and
+ * IOCTL_LINPMEM_READ_REGISTERED reads into it by handle and offset, with no
+ * more checks and faults on your pointer per read. Like io_uring's fixed
+ * buffers.
+ *
+ * The buffer stays pinned until you unregister it or close the file
+ * descriptor. Do not free or unmap it before!
+ */
+
+#define LINPMEM_MAX_REGISTERED_BUFFERS (16)
+#define LINPMEM_MAX_REGISTERED_SIZE (0x40000000)
+
+/* LINPMEM_REGISTER_BUFFER: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_REGISTER_BUFFER" or "IOCTL_LINPMEM_UNREGISTER_BUFFER" to
+ * the driver.
+ */
+typedef struct _LINPMEM_REGISTER_BUFFER {
+	// (_IN_) Your buffer, register only. Need not be page aligned.
+	void *buffer;
+
+	// (_IN_) Its size, 1 to LINPMEM_MAX_REGISTERED_SIZE. Register only.
+	uint64_t size;
+
+	// (_INOUT_) The handle, nonzero. Returned by register, given to
+	// unregister.
+	uint32_t handle;
+
+	uint32_t reserved;
+} LINPMEM_REGISTER_BUFFER, *PLINPMEM_REGISTER_BUFFER;
+
+/* LINPMEM_READ_REGISTERED: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_READ_REGISTERED" to the driver.
+ * Reads physically contiguous memory, crossing page boundaries (like
+ * LINPMEM_TRANSFER_IGNORE_PAGE_BOUNDARY).
+ */
+typedef struct _LINPMEM_READ_REGISTERED {
+	// (_IN_) The physical address you want to read from.
+	uint64_t phys_address;
+
+	// (_IN_) Number of bytes. buffer_offset + size must fit in the buffer.
+	uint64_t size;
+
+	// (_IN_) Where in your buffer the data goes.
+	uint64_t buffer_offset;
+
+	// (_IN_) The handle from IOCTL_LINPMEM_REGISTER_BUFFER.
+	uint32_t handle;
+
+	uint32_t reserved;
+
+	// (_OUT_) Number of bytes read, less than size if the read ran into
+	// a page that is not readable.
+	uint64_t bytes_read;
+} LINPMEM_READ_REGISTERED, *PLINPMEM_READ_REGISTERED;
+
+// ############################################################################
+// # PFN map								      #
+// ############################################################################
+
+/* Which physical pages can be read at all? The driver keeps a map with the
+ * type of every page frame, 2 bits each, built at load time and again when
+ * memory is hot(un)plugged. Get it (or parts of it) with
+ * IOCTL_LINPMEM_QUERY_PFN_MAP, and skip what is not readable without asking
+ * the driver for every page.
+ *
+ * Page frames at or above total_pfns are not RAM. (MMIO up there, e.g., of
+ * 64-bit PCI BARs, is not in the map.)
+ */
+
+// Nothing we know of.
+#define LINPMEM_PFN_TYPE_HOLE (0)
+// Usable RAM. Readable.
+#define LINPMEM_PFN_TYPE_RAM (1)
+// Managed by the kernel, but not usable RAM: firmware, ACPI, reserved by
+// the kernel, or offline. Readable.
+#define LINPMEM_PFN_TYPE_RESERVED (2)
+// Device memory, or firmware ranges the kernel does not manage.
+// Not readable.
+#define LINPMEM_PFN_TYPE_MMIO (3)
+
+// Type of page frame `index` in a map, counted from start_pfn.
+#define LINPMEM_PFN_TYPE(map, index) \
+	(((map)[(index) / 4] >> (((index) % 4) * 2)) & 3)
+
+#define LINPMEM_PFN_READABLE(type) \
+	((type) == LINPMEM_PFN_TYPE_RAM || (type) == LINPMEM_PFN_TYPE_RESERVED)
+
+/* LINPMEM_PFN_MAP: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_QUERY_PFN_MAP" to the driver.
+ */
+typedef struct _LINPMEM_PFN_MAP {
+	// (_IN_) Your buffer for pfn_count / 4 (rounded up) bytes. Read it
+	// with LINPMEM_PFN_TYPE.
+	uint8_t *buffer;
+
+	// (_IN_) The first page frame you want, a multiple of 4.
+	uint64_t start_pfn;
+
+	// (_INOUT_) How many page frames fit into your buffer. On return,
+	// how many you got. Trailing bits in the last byte are undefined.
+	uint64_t pfn_count;
+
+	// (_OUT_) Number of page frames in the whole map.
+	uint64_t total_pfns;
+
+	// (_OUT_) Changes with every rebuild (memory hotplug). If it changes
+	// between two of your calls, start over.
+	uint64_t generation;
+} LINPMEM_PFN_MAP, *PLINPMEM_PFN_MAP;
+
+// ############################################################################
+// # Reading memory that is not RAM					      #
+// ############################################################################
+
+/* IOCTL_LINPMEM_READ_PHYSADDR also reads page frames without a struct page
+ * (LINPMEM_PFN_TYPE_MMIO and _HOLE in the PFN map): firmware memory and
+ * device memory. The driver ioremaps them, write-back for ACPI tables and
+ * NVS, uncached for everything else, and keeps a few of these windows
+ * mapped for the next reads. Byte, word, dword and qword reads are single
+ * accesses of that width. Careful: reading device registers can have side
+ * effects!
+ *
+ * IOCTL_LINPMEM_QUERY_IOWIN_STATS tells how well the window cache works.
+ */
+
+/* LINPMEM_IOWIN_STATS: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_QUERY_IOWIN_STATS" to the driver. All (_OUT_), counting
+ * since the driver was loaded.
+ */
+typedef struct _LINPMEM_IOWIN_STATS {
+	// Reads served by a mapped window.
+	uint64_t hits;
+	// Reads that needed a new window.
+	uint64_t misses;
+	// Windows unmapped to make room.
+	uint64_t evictions;
+	// Reads that failed because the kernel refused the mapping.
+	uint64_t failures;
+	// What is mapped right now.
+	uint64_t windows_mapped;
+	uint64_t bytes_mapped;
+} LINPMEM_IOWIN_STATS, *PLINPMEM_IOWIN_STATS;
+
+// ############################################################################
+// # ELF core view							      #
+// ############################################################################
+
+/* Minor 1 of the Linpmem device is physical memory as an ELF64 core file,
+ * made up on the fly:
+ *	mknod /dev/linpmem_core c 42 1
+ * Point crash, volatility & co. at it, and they analyze the live system
+ * with plain (p)reads, without a dump on disk first.
+ *
+ * There is a PT_LOAD for every System RAM range (as of open time), with
+ * p_paddr the physical and p_vaddr the direct mapping address. Pages that
+ * can not be read are zeros. The PT_NOTE has a LINPMEM_KERNEL_LAYOUT note
+ * (name LINPMEM_NOTE_NAME, type LINPMEM_NOTE_KERNEL_LAYOUT), with the
+ * kernel page tables in kernel_cr3, and the kernel's VMCOREINFO note if we
+ * can find it.
+ *
+ * Use lseek(fd, 0, SEEK_END) for the size, the device has none in stat.
+ */
+
+#define LINPMEM_MINOR_CORE (1)
+#define LINPMEM_NOTE_NAME "LINPMEM"
+#define LINPMEM_NOTE_KERNEL_LAYOUT (1)
+
+// ############################################################################
+// # Sessions								      #
+// ############################################################################
+
+/* A file descriptor can be bound to one address space, once, with
+ * IOCTL_LINPMEM_SESSION_BIND: a process (resolved once, the driver holds on
+ * to its address space until unbind or close, even if the process exits),
+ * or a raw CR3. Then:
+ *	- IOCTL_LINPMEM_VTOP_TRANSLATION_SERVICE with associated_cr3 zero
+ *	  translates in the bound address space, through a small translation
+ *	  cache (process bindings only; the driver drops entries when the
+ *	  process' page tables change).
+ *	- IOCTL_LINPMEM_READ_PHYSADDR with access_type zero uses the default
+ *	  access type of the session.
+ * Without a binding, both behave as before.
+ *
+ * IOCTL_LINPMEM_SESSION_QUERY returns the binding and what it was used for.
+ */
+
+// Bind to the raw CR3 in cr3, not a process.
+#define LINPMEM_SESSION_BIND_CR3 (1 << 0)
+// Drop the binding (the fields other than flags are ignored).
+#define LINPMEM_SESSION_UNBIND (1 << 1)
+
+/* LINPMEM_SESSION_BIND: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_SESSION_BIND" to the driver. Replaces an earlier binding.
+ */
+typedef struct _LINPMEM_SESSION_BIND {
+	// (_IN_) The process to bind to, zero for the caller.
+	uint64_t target_process;
+
+	// (_INOUT_) With LINPMEM_SESSION_BIND_CR3, the CR3 to bind to.
+	// On return, the CR3 of the binding.
+	uint64_t cr3;
+
+	// (_IN_) LINPMEM_SESSION_* flags, or zero.
+	uint32_t flags;
+
+	// (_IN_) The PHYS_ACCESS_MODE for reads with access_type zero, or
+	// zero for none.
+	uint8_t default_access_type;
+
+	// Unused, must be zero.
+	uint8_t reserved[3];
+} LINPMEM_SESSION_BIND, *PLINPMEM_SESSION_BIND;
+
+// Flags of LINPMEM_SESSION_INFO.
+#define LINPMEM_SESSION_BOUND (1 << 0)
+#define LINPMEM_SESSION_PROCESS (1 << 1)
+
+/* LINPMEM_SESSION_INFO: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_SESSION_QUERY" to the driver. All (_OUT_), counting since
+ * open.
+ */
+typedef struct _LINPMEM_SESSION_INFO {
+	// The bound process, if LINPMEM_SESSION_PROCESS.
+	uint64_t pid;
+	// LINPMEM_SESSION_* flags.
+	uint32_t flags;
+	uint8_t default_access_type;
+	uint8_t reserved[3];
+	// The bound CR3, if LINPMEM_SESSION_BOUND.
+	uint64_t cr3;
+
+	// Translations in the bound address space, and how many of them the
+	// cache answered. Invalidations are entries dropped because the
+	// page tables changed.
+	uint64_t vtop_count;
+	uint64_t tlb_hits;
+	uint64_t tlb_misses;
+	uint64_t tlb_invalidations;
+
+	// IOCTL_LINPMEM_READ_PHYSADDR calls, and bytes read by them.
+	uint64_t reads;
+	uint64_t bytes_read;
+} LINPMEM_SESSION_INFO, *PLINPMEM_SESSION_INFO;
+
+// ############################################################################
+// # Watching physical memory						      #
+// ############################################################################
+
+/* Instead of polling pages in a loop, register them once with
+ * IOCTL_LINPMEM_WATCH_SETUP: a kernel worker reads all ranges every
+ * period_ms, hashes them (xxh64), and signals your eventfd once for every
+ * sample in which any range changed. Then IOCTL_LINPMEM_WATCH_QUERY tells
+ * which ranges changed (LINPMEM_WATCH_CHANGED, cleared by the query), and
+ * returns their contents as of the change, so a change is not lost if it is
+ * undone before you get to read the memory.
+ *
+ * One watch set per file descriptor; a new setup replaces the old one,
+ * range_count zero just removes it. Closing the file descriptor does, too.
+ */
+
+#define LINPMEM_MAX_WATCH_RANGES (1024)
+// Largest sum of all range sizes.
+#define LINPMEM_MAX_WATCH_SIZE (0x400000)
+#define LINPMEM_MIN_WATCH_PERIOD_MS (10)
+
+// Flags of LINPMEM_WATCH_RANGE.
+// Changed since the last query.
+#define LINPMEM_WATCH_CHANGED (1 << 0)
+// Could not be read at the last sample.
+#define LINPMEM_WATCH_UNREADABLE (1 << 1)
+
+typedef struct _LINPMEM_WATCH_RANGE {
+	// (_IN_) The range. Can cross pages, must be RAM to be readable.
+	uint64_t phys_address;
+	uint64_t size;
+
+	// (_OUT_) Filled in by IOCTL_LINPMEM_WATCH_QUERY.
+	// xxh64 of the contents at the last sample, zero if unreadable.
+	uint64_t hash;
+	// Number of samples in which the range had changed.
+	uint64_t change_count;
+	// When the last change was seen (CLOCK_REALTIME, in ns).
+	uint64_t last_change;
+	// LINPMEM_WATCH_* flags.
+	uint32_t flags;
+
+	uint32_t reserved;
+} LINPMEM_WATCH_RANGE, *PLINPMEM_WATCH_RANGE;
+
+/* LINPMEM_WATCH_SETUP: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_WATCH_SETUP" to the driver.
+ */
+typedef struct _LINPMEM_WATCH_SETUP {
+	// (_IN_) The ranges, range_count of them. Only phys_address and size
+	// are used.
+	PLINPMEM_WATCH_RANGE ranges;
+	uint32_t range_count;
+
+	// (_IN_) How often to sample, at least LINPMEM_MIN_WATCH_PERIOD_MS.
+	uint32_t period_ms;
+
+	// (_IN_) The eventfd to signal, see eventfd(2).
+	int32_t eventfd;
+
+	uint32_t reserved;
+} LINPMEM_WATCH_SETUP, *PLINPMEM_WATCH_SETUP;
+
+/* LINPMEM_WATCH_QUERY: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_WATCH_QUERY" to the driver.
+ */
+typedef struct _LINPMEM_WATCH_QUERY {
+	// (_OUT_) The ranges, in setup order. Room for range_count.
+	PLINPMEM_WATCH_RANGE ranges;
+
+	// (_OUT_OPT_) The contents of all ranges as of their last change (or
+	// setup), one after the other in setup order. NULL if not wanted.
+	void *data;
+
+	// (_INOUT_) Size of data. On return, the size of all contents.
+	uint64_t data_size;
+
+	// (_INOUT_) Size of ranges. On return, the number of ranges watched.
+	uint32_t range_count;
+
+	// (_OUT_) Number of ranges with LINPMEM_WATCH_CHANGED.
+	uint32_t changed_count;
+
+	// (_OUT_) Number of samples taken.
+	uint64_t samples;
+} LINPMEM_WATCH_QUERY, *PLINPMEM_WATCH_QUERY;
+
+// ############################################################################
+// # Free pages								      #
+// ############################################################################
+
+/* Which RAM is free right now? The buddy allocator knows: the first page of
+ * every free block is marked, with the order of the block. Query the free
+ * runs of a pfn range with IOCTL_LINPMEM_QUERY_FREE_RUNS, and an acquisition
+ * can skip them (or just mark them) instead of reading gigabytes nobody
+ * uses.
+ *
+ * This is a snapshot: pages are allocated and freed all the time, a page
+ * reported free might be in use by the time you would read it, and the
+ * other way round. A free block that starts before start_pfn is not found,
+ * its pages in the range count as in use.
+ */
+
+typedef struct _LINPMEM_FREE_RUN {
+	// (_OUT_) The first free page frame.
+	uint64_t start_pfn;
+
+	// (_OUT_) Number of free page frames from there on.
+	uint64_t pfn_count;
+} LINPMEM_FREE_RUN, *PLINPMEM_FREE_RUN;
+
+// Upper bound of max_runs.
+#define LINPMEM_MAX_FREE_RUNS (65536)
+
+/* LINPMEM_FREE_RUNS: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_QUERY_FREE_RUNS" to the driver.
+ */
+typedef struct _LINPMEM_FREE_RUNS {
+	// (_IN_) The page frames [start_pfn, end_pfn) to look at.
+	uint64_t start_pfn;
+	uint64_t end_pfn;
+
+	// (_IN_) Your buffer for max_runs runs, ascending and not adjacent.
+	PLINPMEM_FREE_RUN runs;
+
+	// (_IN_) Size of runs, 1 to LINPMEM_MAX_FREE_RUNS.
+	uint32_t max_runs;
+
+	// (_OUT_) Number of runs returned.
+	uint32_t run_count;
+
+	// (_OUT_) end_pfn if the whole range was looked at. Otherwise, runs
+	// was full: call again with start_pfn = resume_pfn.
+	uint64_t resume_pfn;
+
+	// (_OUT_) Number of free page frames in the runs returned.
+	uint64_t free_pages;
+} LINPMEM_FREE_RUNS, *PLINPMEM_FREE_RUNS;
+
+// ############################################################################
+// # Kernel list walks							      #
+// ############################################################################
+
+/* Following a linked list through VTOP and READ_PHYSADDR costs a
+ * translation and a read per hop, and more if you want several fields of
+ * each element. IOCTL_LINPMEM_WALK_LIST follows the chain inside the driver
+ * and returns the elements ("records") in one buffer.
+ *
+ * Each record starts at a virtual address of the address space of
+ * associated_cr3. Its next pointer is the uint64_t at next_offset; the next
+ * record starts at that pointer minus next_bias. For a struct list_head
+ * embedded in the record, next_bias is the offset of the list_head. The
+ * walk ends at a NULL next pointer, at end_address (for a circular list,
+ * the address of its head), when it comes back to a record it returned
+ * (LINPMEM_LIST_STOP_LOOP), or at a record it can not read.
+ *
+ * Your buffer receives one entry per record: its virtual address
+ * (uint64_t), followed by the fields, in the order given, without padding.
+ * No fields means the whole record. An entry is 8 bytes plus record_size,
+ * or plus the sizes of the fields.
+ *
+ * The driver reads the page tables like VTOP does: nothing keeps a process
+ * from changing them meanwhile, and the list is not locked either. A list
+ * that changes while it is walked might end early or in the wrong place.
+ */
+
+// The most fields per record.
+#define LINPMEM_MAX_LIST_FIELDS (16)
+
+// Upper bound of record_size, and of the size of an entry's fields.
+#define LINPMEM_MAX_LIST_RECORD_SIZE (65536)
+
+// Upper bound of max_count.
+#define LINPMEM_MAX_LIST_COUNT (1 << 20)
+
+// Why the walk stopped (LINPMEM_LIST_WALK.stop_reason).
+// A NULL next pointer, or end_address.
+#define LINPMEM_LIST_STOP_END (0)
+// The list came back to a record already returned.
+#define LINPMEM_LIST_STOP_LOOP (1)
+// max_count records returned.
+#define LINPMEM_LIST_STOP_MAX_COUNT (2)
+// Your buffer is full.
+#define LINPMEM_LIST_STOP_BUFFER_FULL (3)
+// The record at resume_address is not mapped, or not RAM.
+#define LINPMEM_LIST_STOP_UNREADABLE (4)
+
+typedef struct _LINPMEM_LIST_FIELD {
+	// (_IN_) Where the field is in the record, and its size in bytes.
+	uint32_t offset;
+	uint32_t size;
+} LINPMEM_LIST_FIELD, *PLINPMEM_LIST_FIELD;
+
+/* LINPMEM_LIST_WALK: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_WALK_LIST" to the driver.
+ */
+typedef struct _LINPMEM_LIST_WALK {
+	// (_IN_) Virtual address of the first record.
+	uint64_t start_address;
+
+	// (_IN_) As in LINPMEM_VTOP_INFO: the CR3 to translate with, or zero
+	// for your own (which maps the kernel as well).
+	uint64_t associated_cr3;
+
+	// (_IN_) Subtracted from a next pointer to get the next record.
+	uint64_t next_bias;
+
+	// (_IN_OPT_) A next pointer that ends the walk, zero for none.
+	uint64_t end_address;
+
+	// (_IN_) Size of a record, 8 to LINPMEM_MAX_LIST_RECORD_SIZE. The
+	// next pointer (8 bytes) and the fields must be within it.
+	uint32_t record_size;
+
+	// (_IN_) Where the next pointer is in the record.
+	uint32_t next_offset;
+
+	// (_IN_) The most records to return, 1 to LINPMEM_MAX_LIST_COUNT.
+	uint32_t max_count;
+
+	// (_IN_) Number of fields, zero for the whole record.
+	uint32_t field_count;
+
+	// (_IN_) The fields to return of each record.
+	LINPMEM_LIST_FIELD fields[LINPMEM_MAX_LIST_FIELDS];
+
+	// (_IN_) Your buffer.
+	void *buffer;
+
+	// (_IN_) Its size in bytes.
+	uint64_t buffer_size;
+
+	// (_OUT_) Bytes used in your buffer.
+	uint64_t used_size;
+
+	// (_OUT_) With LINPMEM_LIST_STOP_MAX_COUNT, _BUFFER_FULL and
+	// _UNREADABLE: the record that was not returned. Call again with
+	// start_address = resume_address to continue. Zero otherwise.
+	uint64_t resume_address;
+
+	// (_OUT_) Number of records in your buffer.
+	uint32_t record_count;
+
+	// (_OUT_) LINPMEM_LIST_STOP_*.
+	uint32_t stop_reason;
+} LINPMEM_LIST_WALK, *PLINPMEM_LIST_WALK;
+
+// ############################################################################
+// # Digests of physical memory						      #
+// ############################################################################
+
+/* Does an image still match live memory, did a firmware region change?
+ * IOCTL_LINPMEM_DIGEST hashes physical memory inside the driver, in chunks,
+ * and only the digests come back: 8 bytes per chunk instead of its pages.
+ * With LINPMEM_DIGEST_COMPARE, you pass the digests you expect, and only the
+ * chunks that do not match come back.
+ *
+ * A chunk digest is computed like linpmem_dump does for its .digests file:
+ * the xxh64 (seed 0) over the xxh64s (seed 0) of the chunk's pages, where
+ * an unreadable page counts as 0. LINPMEM_CHUNK_DIGEST has the layout of
+ * LPMD_CHUNK_DIGEST, so such a file can be passed as it is.
+ */
+
+// Flags of LINPMEM_DIGEST.
+// Compare with the digests in chunks, results are the mismatches only.
+#define LINPMEM_DIGEST_COMPARE (1 << 0)
+
+// Flags of LINPMEM_CHUNK_DIGEST, in results.
+// The digest differs from the expected one.
+#define LINPMEM_DIGEST_MISMATCH (1 << 0)
+// At least one page of the chunk could not be read.
+#define LINPMEM_DIGEST_UNREADABLE (1 << 1)
+
+// Upper bound of chunk_count.
+#define LINPMEM_MAX_DIGEST_CHUNKS (1 << 20)
+
+// Upper bound of the page_count of a chunk. linpmem_dump reads a chunk
+// through the page ring in one go, so its chunks are never larger.
+#define LINPMEM_MAX_DIGEST_CHUNK_PAGES LINPMEM_RING_MAX_SLOTS
+
+typedef struct _LINPMEM_CHUNK_DIGEST {
+	// The chunk: its page aligned physical address, and size in pages
+	// (1 to LINPMEM_MAX_DIGEST_CHUNK_PAGES).
+	uint64_t phys_address;
+	uint32_t page_count;
+
+	// LINPMEM_DIGEST_MISMATCH etc., in results. Ignored in chunks.
+	uint32_t flags;
+
+	// In chunks: the expected digest (LINPMEM_DIGEST_COMPARE only). In
+	// results: the digest of live memory.
+	uint64_t digest;
+} LINPMEM_CHUNK_DIGEST, *PLINPMEM_CHUNK_DIGEST;
+
+/* LINPMEM_DIGEST: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_DIGEST" to the driver.
+ */
+typedef struct _LINPMEM_DIGEST {
+	// (_IN_) The chunks to hash.
+	PLINPMEM_CHUNK_DIGEST chunks;
+
+	// (_OUT_) Your buffer for max_results results, in the order of
+	// chunks. One per chunk, or with LINPMEM_DIGEST_COMPARE, one per
+	// chunk that does not match.
+	PLINPMEM_CHUNK_DIGEST results;
+
+	// (_IN_) Number of chunks, 1 to LINPMEM_MAX_DIGEST_CHUNKS.
+	uint32_t chunk_count;
+
+	// (_IN_) Size of results, at least 1.
+	uint32_t max_results;
+
+	// (_IN_) LINPMEM_DIGEST_* flags.
+	uint32_t flags;
+
+	// (_OUT_) Number of results.
+	uint32_t result_count;
+
+	// (_OUT_) chunk_count if all chunks were hashed. Otherwise, results
+	// was full or a signal came: call again from chunks + resume_index.
+	uint32_t resume_index;
+
+	uint32_t reserved;
+
+	// (_OUT_) Number of pages hashed, and of those unreadable.
+	uint64_t pages_hashed;
+	uint64_t pages_unreadable;
+} LINPMEM_DIGEST, *PLINPMEM_DIGEST;
+
+// ############################################################################
+// # Compressed reads							      #
+// ############################################################################
+
+/* If your reader forwards memory to a slow sink (e.g., a pipe to a remote
+ * collector), raw pages waste its bandwidth. IOCTL_LINPMEM_READ_COMPRESSED
+ * reads a physical range, compresses it in chunks with the kernel's LZ4,
+ * and fills your buffer with the chunks: a LINPMEM_COMPRESSED_CHUNK, then
+ * its data, padded to 8 bytes. The chunks can be forwarded as they are,
+ * and decompressed anywhere with LZ4_decompress_safe.
+ *
+ * A chunk covers chunk_size bytes, or less: it ends before a page that can
+ * not be read (or is not RAM), and such pages get chunks of their own, with
+ * LINPMEM_CHUNK_UNREADABLE and no data. Chunks LZ4 can not make smaller are
+ * stored as they are, with LINPMEM_CHUNK_STORED.
+ *
+ * The driver needs the kernel's LZ4 compressor (CONFIG_LZ4_COMPRESS).
+ */
+
+// Upper bound, and the default, of chunk_size.
+#define LINPMEM_MAX_COMPRESSED_CHUNK_SIZE (1024 * 1024)
+#define LINPMEM_DEFAULT_COMPRESSED_CHUNK_SIZE (64 * 1024)
+
+// Flags of LINPMEM_COMPRESSED_CHUNK.
+// The data is not compressed, compressed_size == raw_size.
+#define LINPMEM_CHUNK_STORED (1 << 0)
+// The pages could not be read, there is no data.
+#define LINPMEM_CHUNK_UNREADABLE (1 << 1)
+
+typedef struct _LINPMEM_COMPRESSED_CHUNK {
+	// Where the chunk is, and its size in memory.
+	uint64_t phys_address;
+	uint32_t raw_size;
+
+	// Size of the data following this struct.
+	uint32_t compressed_size;
+
+	// LINPMEM_CHUNK_* flags.
+	uint32_t flags;
+
+	uint32_t reserved;
+} LINPMEM_COMPRESSED_CHUNK, *PLINPMEM_COMPRESSED_CHUNK;
+
+#define LINPMEM_COMPRESSED_CHUNK_DATA(chunk) ((uint8_t *)((chunk) + 1))
+
+#define LINPMEM_NEXT_COMPRESSED_CHUNK(chunk) \
+	((PLINPMEM_COMPRESSED_CHUNK)(LINPMEM_COMPRESSED_CHUNK_DATA(chunk) + \
+				     (((chunk)->compressed_size + 7) & ~7U)))
+
+/* LINPMEM_COMPRESSED_READ: Use this struct for an ioctl invocation of type
+ * "IOCTL_LINPMEM_READ_COMPRESSED" to the driver.
+ */
+typedef struct _LINPMEM_COMPRESSED_READ {
+	// (_IN_) The range to read, page aligned.
+	uint64_t phys_address;
+	uint64_t size;
+
+	// (_IN_) Your buffer. It must have room for at least one chunk that
+	// is stored: sizeof(LINPMEM_COMPRESSED_CHUNK) + chunk_size.
+	void *buffer;
+	uint64_t buffer_size;
+
+	// (_IN_) A multiple of the page size, at most
+	// LINPMEM_MAX_COMPRESSED_CHUNK_SIZE. Zero for the default. Chunks
+	// are aligned to it.
+	uint32_t chunk_size;
+
+	// (_OUT_) Number of chunks in your buffer.
+	uint32_t chunk_count;
+
+	// (_OUT_) Bytes used in your buffer.
+	uint64_t used_size;
+
+	// (_OUT_) phys_address + size if the whole range was read. Otherwise,
+	// your buffer was full (or a signal came): continue from here.
+	uint64_t resume_address;
+
+	// (_OUT_) Bytes of the range that were read, before compression.
+	uint64_t raw_bytes;
+} LINPMEM_COMPRESSED_READ, *PLINPMEM_COMPRESSED_READ;
+
 // ############################################################################
 // # Possible Linpmem invocations					      #
 // ############################################################################
@@ -175,4 +1553,66 @@ typedef struct _LINPMEM_CR3_INFO {
 // A service to return the CR3 of a foreign process (e.g., for use in vtop). 
 #define IOCTL_LINPMEM_QUERY_CR3 _IOWR('a', 'c', LINPMEM_CR3_INFO)
 
+// Creates the page ring of this file descriptor (for mmap).
+#define IOCTL_LINPMEM_RING_SETUP _IOWR('a', 'd', LINPMEM_RING_SETUP)
+
+// Hands all submitted ring slots to the kernel workers.
+#define IOCTL_LINPMEM_RING_SUBMIT _IOW('a', 'e', LINPMEM_RING_SUBMIT)
+
+// Per NUMA node throughput of the ring workers.
+#define IOCTL_LINPMEM_QUERY_NUMA_STATS _IOR('a', 'f', LINPMEM_NUMA_STATS)
+
+// Searches physical memory for a set of byte patterns, inside the driver.
+#define IOCTL_LINPMEM_SCAN _IOWR('a', 'g', LINPMEM_SCAN)
+
+// All present pages of a process, as VA -> PA runs.
+#define IOCTL_LINPMEM_QUERY_PROCESS_RUNS _IOWR('a', 'h', LINPMEM_PROCESS_RUNS)
+
+// All processes with their CR3, in one call.
+#define IOCTL_LINPMEM_QUERY_PROCESSES _IOWR('a', 'i', LINPMEM_PROCESSES)
+
+// Where the kernel and its memory areas are.
+#define IOCTL_LINPMEM_QUERY_KERNEL_LAYOUT _IOR('a', 'j', LINPMEM_KERNEL_LAYOUT)
+
+// Who owns a batch of page frames.
+#define IOCTL_LINPMEM_QUERY_PAGE_OWNERS _IOW('a', 'k', LINPMEM_PAGE_OWNERS)
+
+// Registered buffers.
+#define IOCTL_LINPMEM_REGISTER_BUFFER _IOWR('a', 'l', LINPMEM_REGISTER_BUFFER)
+#define IOCTL_LINPMEM_UNREGISTER_BUFFER _IOW('a', 'm', LINPMEM_REGISTER_BUFFER)
+#define IOCTL_LINPMEM_READ_REGISTERED _IOWR('a', 'n', LINPMEM_READ_REGISTERED)
+
+// The type of all page frames.
+#define IOCTL_LINPMEM_QUERY_PFN_MAP _IOWR('a', 'o', LINPMEM_PFN_MAP)
+
+// Statistics of the ioremap windows for reading memory that is not RAM.
+#define IOCTL_LINPMEM_QUERY_IOWIN_STATS _IOR('a', 'p', LINPMEM_IOWIN_STATS)
+
+// Binds the file descriptor to an address space, and what came of it.
+#define IOCTL_LINPMEM_SESSION_BIND _IOWR('a', 'q', LINPMEM_SESSION_BIND)
+#define IOCTL_LINPMEM_SESSION_QUERY _IOR('a', 'r', LINPMEM_SESSION_INFO)
+
+// Watches physical ranges for changes, signalling an eventfd.
+#define IOCTL_LINPMEM_WATCH_SETUP _IOW('a', 's', LINPMEM_WATCH_SETUP)
+#define IOCTL_LINPMEM_WATCH_QUERY _IOWR('a', 't', LINPMEM_WATCH_QUERY)
+
+// The pages of a process written since the last clear, as VA -> PA runs.
+#define IOCTL_LINPMEM_QUERY_DIRTY_RUNS _IOWR('a', 'u', LINPMEM_DIRTY_RUNS)
+
+// The free page frames of a range, as the buddy allocator sees them.
+#define IOCTL_LINPMEM_QUERY_FREE_RUNS _IOWR('a', 'v', LINPMEM_FREE_RUNS)
+
+// The VA -> PA runs of all processes, walked in parallel.
+#define IOCTL_LINPMEM_QUERY_PROCESS_MAPS _IOWR('a', 'w', LINPMEM_PROCESS_MAPS)
+
+// Follows a linked list, returning the fields of its elements.
+#define IOCTL_LINPMEM_WALK_LIST _IOWR('a', 'x', LINPMEM_LIST_WALK)
+
+// Digests of physical memory, optionally compared with the expected ones.
+#define IOCTL_LINPMEM_DIGEST _IOWR('a', 'y', LINPMEM_DIGEST)
+
+// Reads a physical range, compressed with LZ4 in chunks.
+#define IOCTL_LINPMEM_READ_COMPRESSED \
+	_IOWR('a', 'z', LINPMEM_COMPRESSED_READ)
+
 #endif